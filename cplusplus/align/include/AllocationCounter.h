@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+
+namespace NimApp {
+
+	//
+	// AllocationCounter
+	//
+	//  When the tool is built with make COUNT_ALLOCATIONS=1, the global operator
+	//  new counts the heap allocations and the bytes requested, to measure the
+	//  allocations of a run. Otherwise both counts remain 0.
+	//
+	class AllocationCounter {
+	public:
+		/**
+		 Whether the allocations are counted in this build
+		 **/
+		static bool enabled() ;
+
+		/**
+		 The number of allocations and the number of bytes allocated so far
+		 **/
+		static size_t allocations() ;
+
+		static size_t bytes() ;
+	} ;
+
+}
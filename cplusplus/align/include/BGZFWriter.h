@@ -0,0 +1,78 @@
+#pragma once
+
+#include "nimbusheader.h"
+#include <deque>
+#include <condition_variable>
+#include "BGZF.h"
+
+namespace NimApp {
+
+	/**
+	 Writes a BGZF compressed stream
+
+	 The data is cut in blocks, which are compressed by a pool of threads
+	 and written in their original order. With no compression threads
+	 the blocks are compressed by the thread that writes.
+	 **/
+	class BGZFWriter {
+
+		struct _Block {
+			std::string data ;
+			std::string compressed ;
+			bool done ;
+		} ;
+
+		std::ostream* _out ;
+		int _level ;
+
+		// the data not yet in a block
+		std::string _pending ;
+
+		// the blocks in output order, only used by the writing thread
+		std::deque<_Block*> _blocks ;
+		size_t _maxblocks ;
+
+		// the compression threads
+		int _nthreads ;
+		threadutils::RingBuffer<_Block*>* _jobs ;
+		std::vector<std::thread> _threads ;
+		Nimbus::IO::BGZFCompressor* _compressor ;
+		std::mutex _m ;
+		std::condition_variable _done ;
+
+	public:
+		BGZFWriter( std::ostream* o, int threads ) ;
+
+		BGZFWriter( std::ostream* o, int threads, int level ) ;
+
+		~BGZFWriter() ;
+
+		/**
+		 Adds data to the stream
+		 **/
+		void write( const char* data, size_t n ) ;
+
+		void write( const std::string& data ) ;
+
+		/**
+		 Writes all the data and the end of file block, and stops the threads
+		 **/
+		void close() ;
+
+	private:
+		void _init( std::ostream* o, int threads, int level ) ;
+
+		/* hands the pending data to the compression */
+		void _submit() ;
+
+		/* writes the compressed blocks at the front; waits until at most keep blocks are left */
+		void _collect( size_t keep ) ;
+
+		/* the compression thread */
+		void _run() ;
+
+		BGZFWriter( const BGZFWriter& other ) ;
+		BGZFWriter& operator=( const BGZFWriter& other ) ;
+	} ;
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "nimbusheader.h"
+
+namespace NimApp {
+
+	/**
+	 A pool of the batches passed between the threads
+
+	 The thread that fills a batch takes it from the pool, and the thread
+	 that is done with it hands it back. The batches, and the reads and 
+	 buffers they hold, are thereby allocated once and reused for the 
+	 whole run: their memory is grown by the thread that fills them and 
+	 not freed by the thread that empties them.
+
+	 The pool keeps at most capacity batches, the others are deleted.
+	 **/
+	template<class T>
+	class BatchPool {
+
+		threadutils::RingBuffer<T*> _free ;
+
+	public:
+		BatchPool( size_t capacity ) : _free( capacity ) {
+		}
+
+		~BatchPool() {
+			T* x = NULL ;
+			while( _free.tryShift( x ) ) delete x ;
+		}
+
+		/*
+		 takes a batch from the pool, or a new batch if the pool is empty;
+		 the batch still holds its previous content
+		 */
+		T* get() {
+			T* rval = NULL ;
+			if( ! _free.tryShift( rval ) ) rval = new T() ;
+			return rval ;
+		}
+
+		/*
+		 hands a batch back to the pool
+		 */
+		void put( T* x ) {
+			if( ! _free.tryPush( x ) ) delete x ;
+		}
+
+	private:
+		BatchPool( const BatchPool& ) ;
+		BatchPool& operator=( const BatchPool& ) ;
+	} ;
+
+}
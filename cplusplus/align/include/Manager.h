@@ -4,15 +4,40 @@
 #include "Reader.h"
 #include "Worker.h"
 #include "Writer.h"
+#include "BGZFWriter.h"
+#include "BAM.h"
+#include "RecordSorter.h"
+#include "BatchPool.h"
 
 namespace NimApp {
 	
 	
 	class Manager {
 		
-		std::ifstream* _pfa ; 
-		std::ifstream* _pfb ;
-		std::ofstream* _pfo ;
+		// the input, output and format of a sample
+		struct _Sample {
+			// the FastQ files, opened by the reader when it reaches the sample
+			std::string fna ;
+			std::string fnb ;
+			std::ofstream* pfo ;
+
+			// the output format: BAM output collects the header before compressing
+			bool bam ;
+			int cthreads ;
+			std::string header ;
+			std::string readgroup ;
+			Nimbus::alignment::BAMEncoder* encoder ;
+			BGZFWriter* bgzf ;
+
+			// sorts the output by coordinate, NULL for unsorted output
+			RecordSorter* sorter ;
+
+			// the number of read pairs, set when the input has been read
+			threadutils::Signal<long>* total ;
+		} ;
+
+		// the samples, set up one after the other
+		std::vector<_Sample> _samples ;
 
 		//
 		Reader* _in ;
@@ -21,7 +46,14 @@ namespace NimApp {
 
 		//
 		threadutils::Signal<bool>* _stop ;
-		threadutils::TQueue< Nimbus::AlignmentBuilder*>* _oqueue ;
+		threadutils::RingBuffer<OutputBatch*>* _oqueue ;
+
+		// the batches recycled between the threads
+		BatchPool<ReadBatch>* _rpool ;
+		BatchPool<OutputBatch>* _opool ;
+
+		// the number of read pairs per queue item
+		unsigned int _batchsize ;
 		
 	public:
 		/*
@@ -29,10 +61,20 @@ namespace NimApp {
 		 */
 		Manager( ) ;
 
+		Manager( unsigned int batchsize ) ;
+
 		// Manager( std::string fnout, std::string fna, std::string fnb ) ;
 
 		// Manager( std::string fnout, std::string fna, std::string fnb, int n_workers ) ;
 
+		/*
+		 * starts the next sample: the input, output, read group, sort 
+		 * order and header set afterwards apply to this sample. The 
+		 * samples are read one after the other, aligned by the same 
+		 * workers and each written to its own output
+		 */
+		void addSample( ) ;
+
 		/*
 		 * add the input files
 		 */
@@ -49,6 +91,24 @@ namespace NimApp {
 		 */ 
 		void addOutput( std::string fn ) ;
 
+		/*
+		 * opens the output file, in BAM format compressed by
+		 * threads compression threads if bam is set
+		 */ 
+		void addOutput( std::string fn, bool bam, int threads ) ;
+
+		/*
+		 * sets the read group ID added to each record
+		 */
+		void setReadGroup( std::string id ) ;
+
+		/*
+		 * writes the records sorted by coordinate, collected in a bucket
+		 * per amplicon; records beyond budget bytes are kept in temporary 
+		 * files. Should be called before finalizeStreams
+		 */
+		void sortOutput( const std::vector<Nimbus::basic::Amplicon*>& amplicons, const std::vector<std::string>& references, size_t budget ) ;
+
 		/*
 		 * worker builder
 		 */
@@ -71,6 +131,9 @@ namespace NimApp {
 		 */ 
 		void run( ) ;
 
+	private:
+		void _init( unsigned int batchsize ) ;
+
 	} ;
 	
 }
\ No newline at end of file
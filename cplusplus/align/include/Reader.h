@@ -2,6 +2,9 @@
 
 
 #include "nimbusheader.h"
+#include "BatchPool.h"
+#include "FastQParser.h"
+#include "GzipInput.h"
 
 namespace NimApp {
 
@@ -10,15 +13,34 @@ namespace NimApp {
 		//
 		threadutils::Signal<bool>* _stop ; 
 		threadutils::Signal<long>* _sigcnt ; 
-		threadutils::TQueue<std::pair<Nimbus::basic::Read*,Nimbus::basic::Read*>>*    _queue ;
+		threadutils::WorkStealingQueue<ReadBatch*>*    _queue ;
 
 		unsigned int _limit ;
 
+		// the number of read pairs per queue item
+		unsigned int _batchsize ;
+
 		// the input streams for the first 
 		// and second data reads
 		std::istream* _ha ;
 		std::istream* _hb ;
 
+		// the parsers of the input streams while running
+		Nimbus::IO::FastQParser* _pa ;
+		Nimbus::IO::FastQParser* _pb ;
+
+		// the batches are taken from the pool if not NULL
+		BatchPool<ReadBatch>* _pool ;
+
+		// the input files of a sample, opened when the samples
+		// before it have been read
+		struct _Input {
+			std::string fna ;
+			std::string fnb ;
+			threadutils::Signal<long>* total ;
+		} ;
+		std::vector<_Input> _inputs ;
+
 	public:
 
 		//
@@ -31,9 +53,11 @@ namespace NimApp {
 	
 		Reader( std::istream* xa, std::istream* xb, unsigned int l ) ;
 	
-		Reader( std::istream* xa, std::istream* xb, unsigned int l, threadutils::TQueue<std::pair<Nimbus::basic::Read*,Nimbus::basic::Read*>>* q, threadutils::Signal<long>* s ) ;
+		Reader( std::istream* xa, std::istream* xb, unsigned int l, unsigned int bs ) ;
+	
+		Reader( std::istream* xa, std::istream* xb, unsigned int l, threadutils::WorkStealingQueue<ReadBatch*>* q, threadutils::Signal<long>* s ) ;
 	
-		Reader( std::istream* xa, std::istream* xb, unsigned int l, threadutils::TQueue<std::pair<Nimbus::basic::Read*,Nimbus::basic::Read*>>* q, threadutils::Signal<long>* s, threadutils::Signal<bool>* b ) ;
+		Reader( std::istream* xa, std::istream* xb, unsigned int l, threadutils::WorkStealingQueue<ReadBatch*>* q, threadutils::Signal<long>* s, threadutils::Signal<bool>* b ) ;
 	
 		~Reader() ;
 
@@ -41,7 +65,7 @@ namespace NimApp {
 		// accessors
 		//
 
-		threadutils::TQueue< std::pair<Nimbus::basic::Read*,Nimbus::basic::Read*> >* getQueue( ) {
+		threadutils::WorkStealingQueue<ReadBatch*>* getQueue( ) {
 			return _queue ;
 		}
 
@@ -53,16 +77,54 @@ namespace NimApp {
 			return _stop ;
 		}
 
+		/*
+		 takes the batches from pool instead of allocating them
+		 */
+		void setPool( BatchPool<ReadBatch>* pool ) {
+			_pool = pool ;
+		}
+
+		/*
+		 adds the input files of the next sample; the streams of the
+		 constructor are the first sample if not NULL. The samples are
+		 read one after the other, their batches are marked with the
+		 number of the sample. total is set to the number of read pairs
+		 of the sample once it has been read, if not NULL
+		 */
+		void addInput( std::string fna, std::string fnb, threadutils::Signal<long>* total ) ;
+
 		//
 		// the processing function
 		//
 		std::pair<Nimbus::basic::Read*,Nimbus::basic::Read*> process( bool& proceed ) ;
 
+		/*
+		 reads the next pair into the reads of p, which are allocated if 
+		 NULL; returns false at the end of the input
+		 */
+		bool process( std::pair<Nimbus::basic::Read*,Nimbus::basic::Read*>& p ) ;
+
+		/*
+		 fills batch with the next read pairs of the streams; returns
+		 false at the end of the input, the batch may then still hold
+		 the last read pairs
+		 */
+		bool fill( ReadBatch* batch ) ;
+
 		//
 		// The processing loop
 		//
 		void run() ;
 
+		/*
+		 opens fn, decompressing it if it is gzip compressed; f and gz
+		 are set to the objects to delete, gz first
+		 */
+		static std::istream* open( const std::string& fn, std::ifstream*& f, Nimbus::IO::GzipInput*& gz ) ;
+
+	private:
+		/* reads the open streams as sample, returns false if stopped */
+		bool _read( unsigned int sample, threadutils::Signal<long>* total ) ;
 
 	} ;
 
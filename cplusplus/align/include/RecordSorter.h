@@ -0,0 +1,136 @@
+#pragma once
+
+#include "nimbusheader.h"
+#include <map>
+#include <sys/types.h>
+
+namespace NimApp {
+
+	/**
+	 Sorts the formatted records by coordinate
+
+	 Every aligned record belongs to an amplicon, so the records are
+	 collected in a bucket per amplicon and only the records within a
+	 bucket have to be sorted. The buckets are written per reference,
+	 in the order of the SAM header, and by position; buckets that
+	 overlap are merged. The records at the same position are ordered
+	 by flag and read name, so the output does not depend on the order
+	 in which the workers delivered them. The unmapped records are
+	 written last, ordered by read name and flag.
+
+	 When the buckets hold more than the memory budget, their records
+	 are moved to a temporary file. The keys stay in memory. The
+	 unmapped records are sorted before they are moved, and the sorted
+	 runs are merged when they are written.
+
+	 The workers only call bucket(); add() and next() are called by
+	 the writing thread.
+	 **/
+	class RecordSorter {
+
+		// the position and size of a record in its bucket
+		struct _Entry {
+			int pos ;
+			unsigned int length ;
+			unsigned short flag ;
+			unsigned char nameoffset ;
+			unsigned char namelength ;
+		} ;
+
+		struct _Bucket {
+			int refid ;
+			int minpos ;
+			int maxpos ;
+
+			// the records in memory, after the records in the temporary file
+			std::string data ;
+			std::vector< std::pair<off_t,size_t> > chunks ;
+			std::vector<_Entry> entries ;
+		} ;
+
+		std::map<const Nimbus::basic::Amplicon*, unsigned int> _amplicons ;
+		std::map<std::string, unsigned int> _references ;
+		std::vector<_Bucket> _buckets ;
+		unsigned int _unmapped ;
+
+		// the records in memory and the temporary file
+		size_t _memory ;
+		size_t _budget ;
+		int _fd ;
+		off_t _spilled ;
+
+		// a sorted run of unmapped records: its entries, and its records
+		// in the temporary file or in memory, read while they are merged
+		struct _Run {
+			size_t entry ;
+			size_t last ;
+			off_t offset ;
+			off_t end ;
+			std::string buffer ;
+			size_t at ;
+		} ;
+
+		// the buckets in output order, and the next one to write
+		std::vector<unsigned int> _order ;
+		size_t _next ;
+		bool _finished ;
+
+		// the runs of unmapped records, and the first entry not in a run
+		std::vector<_Run> _runs ;
+		size_t _unsorted ;
+
+	public:
+		/*
+		 creates a bucket for each amplicon, the references are in
+		 the order of the SAM header; budget is in bytes
+		 */
+		RecordSorter( const std::vector<Nimbus::basic::Amplicon*>& amplicons, const std::vector<std::string>& references, size_t budget ) ;
+
+		~RecordSorter() ;
+
+		/*
+		 the bucket of record r aligned to amplicon a, or of the
+		 unmapped records if a is NULL
+		 */
+		unsigned int bucket( const Nimbus::basic::Amplicon* a, const Nimbus::alignment::SAMRecord& r ) const ;
+
+		/*
+		 adds the records of a batch
+		 */
+		void add( const OutputBatch* b ) ;
+
+		/*
+		 gets the next part of the sorted records in out, returns
+		 false when all records have been returned; no records can
+		 be added after the first call
+		 */
+		bool next( std::string& out ) ;
+
+		/*
+		 the number of bytes moved to the temporary file
+		 */
+		size_t spilled() const ;
+
+	private:
+		/* moves the records in memory to the temporary file */
+		void _spill() ;
+
+		/* determines the output order of the buckets */
+		void _finish() ;
+
+		/* sorts the unmapped records in memory and adds them as a run */
+		void _addRun( off_t offset ) ;
+
+		/* reads the current record of run r in its buffer */
+		void _fill( _Run& r ) ;
+
+		/* appends the records of bucket b to out */
+		void _load( const _Bucket& b, std::string& out ) ;
+
+		void _read( off_t offset, size_t n, std::string& out ) ;
+
+		RecordSorter( const RecordSorter& other ) ;
+		RecordSorter& operator=( const RecordSorter& other ) ;
+	} ;
+
+}
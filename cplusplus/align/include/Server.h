@@ -0,0 +1,152 @@
+#pragma once
+
+#include "nimbusheader.h"
+#include "Reader.h"
+#include "Worker.h"
+#include "Writer.h"
+#include "BGZFWriter.h"
+#include "BAM.h"
+#include "RecordSorter.h"
+#include "BatchPool.h"
+#include "IndexFile.h"
+#include <map>
+#include <atomic>
+#include <condition_variable>
+
+namespace NimApp {
+
+	/**
+	 Aligns the jobs submitted over a UNIX domain socket
+
+	 The server maps the index files of its designs once, and aligns the
+	 read pairs of all jobs with one pool of workers. Each job has its own
+	 alignment parameters and output, and reads its FastQ files in a
+	 thread of its own.
+
+	 A connection sends one request: a line with the command, for a job
+	 followed by lines with the tab separated long option name of align
+	 and its value, and an empty line. The paths are used as given, so
+	 the client should send absolute paths.
+
+	   align
+	   design	panel
+	   forward	/data/s1_R1.fastq.gz
+	   reverse	/data/s1_R2.fastq.gz
+	   sam	/data/s1.bam
+	   bam	true
+
+	 The server answers a job with "job <id>", a "progress <read> <written>"
+	 line every second with the read pairs read and written, and at the
+	 end "done <read pairs>", "cancelled" or "error <message>". A job is
+	 cancelled when its connection is closed or by "cancel <id>"; the
+	 output of a job that did not finish is removed. "status" lists the
+	 running jobs as "job <id> running <design> <read> <written> <output>".
+	 **/
+	class Server {
+
+		// the read pairs and output of a job
+		struct _Job {
+			unsigned int id ;
+			std::string design ;
+			std::string fna ;
+			std::string fnb ;
+			std::string output ;
+
+			// the alignment with the parameters of the job
+			Nimbus::alignment::AlignmentScore* scores ;
+			Nimbus::AmpliconAlignment* aa ;
+			Nimbus::AlignmentCache* cache ;
+
+			// the output, the worker formats the records
+			std::ofstream* pfo ;
+			Nimbus::alignment::BAMEncoder* encoder ;
+			BGZFWriter* bgzf ;
+			RecordSorter* sorter ;
+			Worker* worker ;
+			Writer* writer ;
+			threadutils::RingBuffer<OutputBatch*>* oqueue ;
+			BatchPool<ReadBatch>* rpool ;
+			BatchPool<OutputBatch>* opool ;
+
+			threadutils::Signal<bool>* cancel ;
+			threadutils::Signal<bool>* written ;
+
+			// the batches read and aligned; the output queue is closed when
+			// all batches have been read and aligned
+			std::mutex m ;
+			long batches ;
+			long aligned ;
+			bool read ;
+			std::atomic<long> pairs ;
+		} ;
+
+		// a batch of read pairs of a job
+		struct _Task {
+			_Job* job ;
+			ReadBatch* batch ;
+		} ;
+
+		std::map<std::string, Nimbus::IO::IndexFile*> _designs ;
+
+		// the workers shared by the jobs
+		int _nworkers ;
+		unsigned int _batchsize ;
+		threadutils::RingBuffer<_Task>* _queue ;
+		std::vector<std::thread> _workers ;
+
+		// the running jobs and the open connections
+		std::mutex _m ;
+		std::condition_variable _closed ;
+		std::map<unsigned int, _Job*> _jobs ;
+		unsigned int _next ;
+		int _connections ;
+
+	public:
+		Server( int workers, unsigned int batchsize ) ;
+
+		~Server() ;
+
+		/*
+		 maps the index file fname as design name
+		 */
+		void addDesign( std::string name, std::string fname ) ;
+
+		/*
+		 serves the jobs on the socket at path until SIGINT or SIGTERM,
+		 which cancel the running jobs
+		 */
+		void run( std::string path ) ;
+
+	private:
+		/* the worker thread */
+		void _work() ;
+
+		/* handles the request of a connection, and closes it */
+		void _connection( int fd ) ;
+
+		/* runs a job and reports its progress to the connection */
+		void _align( int fd, const std::map<std::string,std::string>& options ) ;
+
+		/* sets up a job, or returns NULL and sets error */
+		_Job* _create( const std::map<std::string,std::string>& options, std::string& error ) ;
+
+		/* the thread reading the read pairs of a job */
+		void _read( _Job* job ) ;
+
+		/* the thread writing the output of a job */
+		void _write( _Job* job ) ;
+
+		/* the job has one more batch read or aligned; closes the output queue after the last */
+		void _count( _Job* job, bool aligned ) ;
+
+		void _delete( _Job* job ) ;
+
+		void _status( int fd ) ;
+
+		void _cancel( int fd, const std::string& id ) ;
+
+		Server( const Server& other ) ;
+		Server& operator=( const Server& other ) ;
+	} ;
+
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "nimbusheader.h"
+#include "BAM.h"
+#include "RecordSorter.h"
+#include "BatchPool.h"
 
 namespace NimApp {
 
@@ -8,31 +11,87 @@ namespace NimApp {
 			// the stop signal
 			threadutils::Signal<bool>* _stop ;
 
-			// the input Queue
-			threadutils::TQueue< std::pair<Nimbus::basic::Read*, Nimbus::basic::Read*> >* _in ;
+			// the input Queue, and the number of this worker in it
+			threadutils::WorkStealingQueue<ReadBatch*>* _in ;
+			unsigned int _id ;
 
 			// the output Queue
-			threadutils::TQueue< Nimbus::AlignmentBuilder* >* _out ;
+			threadutils::RingBuffer<OutputBatch*>* _out ;
 
-			unsigned int _limit ;
+			// the fewest read pairs left in a batch for it to be split
+			size_t _minsplit ;
 
 			Nimbus::AmpliconAlignment* _aa ;
 
-		public:
-			Worker( Nimbus::AmpliconAlignment* a, threadutils::Signal<bool>* s, threadutils::TQueue< std::pair<Nimbus::basic::Read*, Nimbus::basic::Read*> >* i, threadutils::TQueue< Nimbus::AlignmentBuilder* >* o, unsigned int l )  ;
+			// the format of the records of a sample
+			struct _Format {
+				// the BAM encoding of the records, NULL for SAM output
+				Nimbus::alignment::BAMEncoder* bam ;
+
+				// the read group added to each record, if not empty
+				std::string readgroup ;
+
+				// the sort keys of the records are added if not NULL
+				RecordSorter* sorter ;
+			} ;
+			std::vector<_Format> _formats ;
 
-			Worker( Nimbus::AmpliconAlignment* a, threadutils::Signal<bool>* s, threadutils::TQueue< std::pair<Nimbus::basic::Read*, Nimbus::basic::Read*> >* i, threadutils::TQueue< Nimbus::AlignmentBuilder* >* o ) ;
+			// the processed read batches are handed back to the reader, and 
+			// the output batches are taken from the writer, if not NULL
+			BatchPool<ReadBatch>* _rpool ;
+			BatchPool<OutputBatch>* _opool ;
 
-			Worker( Nimbus::AmpliconAlignment* a, threadutils::TQueue< std::pair<Nimbus::basic::Read*, Nimbus::basic::Read*> >* i, threadutils::TQueue< Nimbus::AlignmentBuilder* >* o ) ;
+		public:
+			Worker( Nimbus::AmpliconAlignment* a, threadutils::Signal<bool>* s, threadutils::WorkStealingQueue<ReadBatch*>* i, threadutils::RingBuffer<OutputBatch*>* o ) ;
+
+			Worker( Nimbus::AmpliconAlignment* a, threadutils::WorkStealingQueue<ReadBatch*>* i, threadutils::RingBuffer<OutputBatch*>* o ) ;
 
 			~Worker(void) ;
 
 			threadutils::Signal<bool>* getStopSignal() ;
 
 			/*
-		 	 process the alignments in a paired end manner
-			 */ 
-			Nimbus::AlignmentBuilder* process( std::pair<Nimbus::basic::Read*,Nimbus::basic::Read*> p ) ;
+			 sets the format of the records: BAM if bam is not NULL, 
+			 and the read group added to each record 
+			 */
+			void setOutputFormat( Nimbus::alignment::BAMEncoder* bam, std::string readgroup ) ;
+
+			void setOutputFormat( unsigned int sample, Nimbus::alignment::BAMEncoder* bam, std::string readgroup ) ;
+
+			/*
+			 adds the sort keys of sorter to the records
+			 */
+			void setSorter( RecordSorter* sorter ) ;
+
+			void setSorter( unsigned int sample, RecordSorter* sorter ) ;
+
+			/*
+			 recycles the read batches in rpool and the output batches from opool
+			 */
+			void setPools( BatchPool<ReadBatch>* rpool, BatchPool<OutputBatch>* opool ) ;
+
+			/*
+			 the number of read pairs in the batches of the reader, a batch
+			 is only split while an eighth of it is left
+			 */
+			void setBatchSize( size_t batchsize ) ;
+
+			/*
+			 process a batch of read pairs into formatted SAM records;
+			 several threads may process batches with the same worker.
+			 If b has taken SPLITTIME milliseconds and other workers wait
+			 for input, half of the read pairs not yet aligned are split
+			 off to them, so the output batch may hold fewer read pairs 
+			 than b
+			 */
+			OutputBatch* process( ReadBatch* b, Nimbus::alignment::AlignmentWorkspace* ws ) ;
+
+			/*
+			 append the SAM records of an alignment to batch; the
+			 alignments are deleted afterwards, the reads belong 
+			 to their batch
+			 */
+			void serialize( Nimbus::AlignmentBuilder& value, OutputBatch& batch ) ;
 
 
 			/**
@@ -40,6 +99,17 @@ namespace NimApp {
 			 **/
 			void run() ;
 
+		private:
+			void _init( Nimbus::AmpliconAlignment* a, threadutils::Signal<bool>* s, threadutils::WorkStealingQueue<ReadBatch*>* i, threadutils::RingBuffer<OutputBatch*>* o ) ;
+
+			/* the format of sample, which is added if needed */
+			_Format& _format( unsigned int sample ) ;
+
+			void _append( const Nimbus::alignment::SAMRecord& record, const Nimbus::basic::Amplicon* amplicon, OutputBatch& batch ) ;
+
+			/* moves the read pairs of b from the first onwards to a new batch for the other workers */
+			void _split( ReadBatch* b, size_t first ) ;
+
 		};
 
 	
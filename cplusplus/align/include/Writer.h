@@ -1,6 +1,9 @@
 #pragma once
 
 #include "nimbusheader.h"
+#include "BGZFWriter.h"
+#include "RecordSorter.h"
+#include "BatchPool.h"
 
 namespace NimApp {
 
@@ -8,14 +11,38 @@ namespace NimApp {
 	//template< class T> 
 	class Writer {
 	protected:
-		threadutils::TQueue<Nimbus::AlignmentBuilder*>* _in ;
+		threadutils::RingBuffer<OutputBatch*>* _in ;
 
 		// control signals
 		threadutils::Signal<bool>* _stop ;
 		threadutils::Signal<long>* _sigcnt ;
 
-		// the output stream
-		std::ostream* _out ;
+		// the output of a sample
+		struct _Output {
+			// the output stream
+			std::ostream* out ;
+
+			// the BGZF compression of the output stream, NULL for SAM output
+			BGZFWriter* bgzf ;
+
+			// collects the records to write them sorted, NULL for unsorted output
+			RecordSorter* sorter ;
+
+			// the number of read pairs of the sample once known, -1 before;
+			// the output is completed when they have all been written
+			threadutils::Signal<long>* total ;
+			long written ;
+
+			bool good ;
+			bool done ;
+		} ;
+		std::vector<_Output> _outputs ;
+
+		// the outputs before this one have been completed
+		size_t _first ;
+
+		// the written batches are handed back to the workers if not NULL
+		BatchPool<OutputBatch>* _pool ;
 		
 	public:
 
@@ -26,9 +53,14 @@ namespace NimApp {
 
 		Writer( std::ostream* o ) ; 
 
-		Writer( std::ostream* o, threadutils::TQueue<Nimbus::AlignmentBuilder*>* q, threadutils::Signal<bool>* b ) ; 
+		Writer( std::ostream* o, threadutils::RingBuffer<OutputBatch*>* q, threadutils::Signal<bool>* b ) ; 
+
+		Writer( std::ostream* o, threadutils::RingBuffer<OutputBatch*>* q, threadutils::Signal<long>* s, threadutils::Signal<bool>* b ) ; 
 
-		Writer( std::ostream* o, threadutils::TQueue<Nimbus::AlignmentBuilder*>* q, threadutils::Signal<long>* s, threadutils::Signal<bool>* b ) ; 
+		Writer( std::ostream* o, BGZFWriter* z, threadutils::RingBuffer<OutputBatch*>* q, threadutils::Signal<bool>* b ) ; 
+
+		// the outputs of the samples are set with setOutput
+		Writer( threadutils::RingBuffer<OutputBatch*>* q, threadutils::Signal<bool>* b ) ; 
 
 		//
 		// destructor
@@ -40,14 +72,49 @@ namespace NimApp {
 
 		threadutils::Signal<long>* getCounter() ;
 
+		/*
+		 writes the records sorted by sorter after the queue has been drained
+		 */
+		void setSorter( RecordSorter* sorter ) ;
+
+		void setSorter( unsigned int sample, RecordSorter* sorter ) ;
+
+		/*
+		 writes the records of sample to o, compressed by z if not NULL
+		 */
+		void setOutput( unsigned int sample, std::ostream* o, BGZFWriter* z ) ;
+
+		/*
+		 completes the output of sample as soon as total has been set
+		 and that number of read pairs has been written, instead of
+		 after the queue has been drained
+		 */
+		void setTotal( unsigned int sample, threadutils::Signal<long>* total ) ;
+
+		/*
+		 hands the written batches back to pool
+		 */
+		void setPool( BatchPool<OutputBatch>* pool ) ;
+
 		//
 		// processors
 		//
 
-		bool process( Nimbus::AlignmentBuilder* value ) ;
+		bool process( OutputBatch* value ) ;
 
 		// run the processor
 		void run( ) ;
+
+	private:
+		void _init( std::ostream* o, BGZFWriter* z, threadutils::RingBuffer<OutputBatch*>* q, threadutils::Signal<long>* s, threadutils::Signal<bool>* b ) ;
+
+		/* the output of sample, which is added if needed */
+		_Output& _output( unsigned int sample ) ;
+
+		/* writes the sorted records and the end of the output */
+		void _complete( _Output& o ) ;
+
+		bool _write( _Output& o, const std::string& records ) ;
 	} ;		
 	
 
@@ -1,3 +1,22 @@
 #pragma once
 
+#include <string>
+
 int nimbus_main( int argc, char* argv[] ) ;
+
+int index_main( int argc, char* argv[] ) ;
+
+int serve_main( int argc, char* argv[] ) ;
+
+int submit_main( int argc, char* argv[] ) ;
+
+/**
+ * The ID field of a read group header line
+ **/
+std::string ReadGroupID( std::string readgroup ) ;
+
+/**
+ * The read group header line with escaped tabs, as given on the command 
+ * line, without @RG
+ **/
+std::string ReadGroupLine( std::string readgroup ) ;
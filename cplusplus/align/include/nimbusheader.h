@@ -18,6 +18,8 @@
 // headers from the threadingutils library
 #include "Signal.h"
 #include "TQueue.h"
+#include "RingBuffer.h"
+#include "WorkStealingQueue.h"
 
 // headers from the libnimbus library
 #include "Read.h"
@@ -33,4 +35,57 @@
 #endif
 
 #define LIMIT 5000
-#define THREADSLEEPTIME 1 
+#define BATCHSIZE 1024
+#define MINSPLIT 16		// the fewest read pairs split off a batch
+#define SPLITTIME 10	// the milliseconds a batch takes before it is split
+
+namespace NimApp {
+
+	// the units of work passed between the threads, see BatchPool.h
+	//
+	// the read pairs of a batch; the batch owns the reads, which are
+	// overwritten when the batch is filled again
+	struct ReadBatch {
+		std::vector< std::pair<Nimbus::basic::Read*,Nimbus::basic::Read*> > pairs ;
+		size_t n ;				// the number of pairs in use
+		unsigned int sample ;	// the sample of the read pairs
+
+		ReadBatch(): n(0), sample(0) { }
+
+		~ReadBatch() {
+			for( size_t i=0; i<pairs.size(); i++ ) {
+				if( pairs[i].first != NULL ) delete pairs[i].first ;
+				if( pairs[i].second != NULL ) delete pairs[i].second ;
+			}
+		}
+
+	private:
+		ReadBatch( const ReadBatch& other ) ;
+		ReadBatch& operator=( const ReadBatch& other ) ;
+	} ;
+
+	// the sort key of a formatted record: its bucket, position and size
+	struct RecordKey {
+		unsigned int bucket ;
+		int pos ;
+		unsigned int length ;
+
+		// the records at the same position are ordered by flag and read
+		// name, the name is at nameoffset in the formatted record
+		unsigned short flag ;
+		unsigned char nameoffset ;
+		unsigned char namelength ;
+	} ;
+
+	// the formatted SAM records of a batch of read pairs, with
+	// a key per record if the output is sorted
+	struct OutputBatch {
+		std::string records ;
+		size_t n ;
+		unsigned int sample ;
+		std::vector<RecordKey> keys ;
+
+		OutputBatch(): n(0), sample(0) { }
+	} ;
+
+}
@@ -0,0 +1,139 @@
+// amplicon_index_bench.cpp : times the amplicon index on a synthetic design
+//
+// Usage: amplicon_index_bench [amplicons] [read pairs] [key size] [prefix]
+//
+// Generates a design of amplicons (default 20000) on a random genome, with
+// a quarter of the amplicons sharing their start with another amplicon as
+// in restriction enzyme based designs. Times building the AmpliconIndex
+// and looking up the candidate amplicons of read pairs (default 1000000)
+// with getAmplicons. One in five read pairs is random and matches no
+// amplicon. The number of candidates is printed as a check, which is the
+// same for every build of the index on the same arguments.
+//
+// If prefix is given, the design is also written to prefix.bed and
+// prefix.fa and the first read pairs to prefix_R1.fastq and prefix_R2.fastq,
+// so nimbus align can be timed on the same design.
+
+#include "stdafx.h"
+#include "AmpliconIndex.h"
+#include "Utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+
+using namespace std ;
+using namespace Nimbus ;
+using namespace Nimbus::basic ;
+using namespace Nimbus::seed ;
+
+static const char* BASES = "ACGT" ;
+
+// the read length and the number of read pairs written to the FastQ files
+static const size_t READLENGTH = 100 ;
+static const size_t WRITTEN    = 100000 ;
+
+static string random_sequence( mt19937& rng, size_t n ) {
+	string rval( n, 'A' ) ;
+	for( size_t i=0; i<n; i++ ) rval[i] = BASES[ rng() & 3 ] ;
+	return rval ;
+}
+
+static string reverse_complement( const string& s ) {
+	string rval( s.size(), 'N' ) ;
+	for( size_t i=0; i<s.size(); i++ ) rval[ s.size() - 1 - i ] = utils::complement_base( s[i] ) ;
+	return rval ;
+}
+
+static double seconds( chrono::steady_clock::time_point start ) {
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start ;
+	return elapsed.count() ;
+}
+
+int main( int argc, char* argv[] ) {
+	size_t n_amplicons = argc > 1 ? (size_t) atol( argv[1] ) : 20000 ;
+	size_t n_pairs     = argc > 2 ? (size_t) atol( argv[2] ) : 1000000 ;
+	int keysize        = argc > 3 ? atoi( argv[3] ) : 7 ;
+	string prefix      = argc > 4 ? argv[4] : "" ;
+	if( n_amplicons < 1 || keysize < 1 ) {
+		fprintf( stderr, "Usage: %s [amplicons] [read pairs] [key size] [prefix]\n", argv[0] ) ;
+		exit( EXIT_FAILURE ) ;
+	}
+
+	// the genome holds on average an amplicon every 250 bases
+	mt19937 rng( 20180101 ) ;
+	string genome = random_sequence( rng, n_amplicons * 250 + 1000 ) ;
+
+	vector<Amplicon*> amplicons ;
+	for( size_t i=0; i<n_amplicons; i++ ) {
+		size_t start = i > 0 && rng() % 4 == 0 ? amplicons[ rng() % i ]->start() : rng() % ( genome.size() - 600 ) ;
+		size_t end   = start + 100 + rng() % 400 ;
+		stringstream name ;
+		name << "amp" << i ;
+		amplicons.push_back( new Amplicon( "chrS", (int) start, (int) end, rng() % 2 == 0, genome.substr( start, end - start ), name.str() ) ) ;
+	}
+
+	// the read pairs of the amplicons, or random sequences
+	vector< pair<string,string> > pairs ;
+	for( size_t i=0; i<n_pairs; i++ ) {
+		if( rng() % 5 == 0 ) {
+			pairs.push_back( pair<string,string>( random_sequence( rng, READLENGTH ), random_sequence( rng, READLENGTH ) ) ) ;
+			continue ;
+		}
+		const Amplicon* a = amplicons[ rng() % n_amplicons ] ;
+		const string& seq = a->sequence() ;
+		size_t length     = min( READLENGTH, seq.size() ) ;
+		string first      = seq.substr( 0, length ) ;
+		string last       = reverse_complement( seq.substr( seq.size() - length ) ) ;
+		pairs.push_back( a->forward() ? pair<string,string>( first, last ) : pair<string,string>( last, first ) ) ;
+	}
+
+	// build the index
+	chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+	AmpliconIndex index ;
+	for( size_t i=0; i<amplicons.size(); i++ ) index.add( amplicons[i] ) ;
+	index.build( keysize ) ;
+	double build = seconds( start ) ;
+
+	// look up the read pairs
+	size_t candidates = 0 ;
+	start = chrono::steady_clock::now() ;
+	for( size_t i=0; i<pairs.size(); i++ ) {
+		candidates += index.getAmplicons( pairs[i].first, pairs[i].second ).size() ;
+	}
+	double lookup = seconds( start ) ;
+
+	printf( "amplicons\t%zu\n", n_amplicons ) ;
+	printf( "key size\t%d\n", keysize ) ;
+	printf( "build (s)\t%.3f\n", build ) ;
+	printf( "read pairs\t%zu\n", pairs.size() ) ;
+	printf( "lookup (s)\t%.3f\n", lookup ) ;
+	printf( "lookup per pair (ns)\t%.0f\n", pairs.empty() ? 0.0 : lookup * 1e9 / pairs.size() ) ;
+	printf( "candidates\t%zu\n", candidates ) ;
+
+	// the design and reads for nimbus align
+	if( prefix != "" ) {
+		ofstream fa( ( prefix + ".fa" ).c_str() ) ;
+		fa << ">chrS\n" ;
+		for( size_t i=0; i<genome.size(); i+=60 ) fa << genome.substr( i, 60 ) << '\n' ;
+
+		ofstream bed( ( prefix + ".bed" ).c_str() ) ;
+		for( size_t i=0; i<amplicons.size(); i++ ) {
+			const Amplicon* a = amplicons[i] ;
+			bed << "chrS\t" << a->start() << '\t' << a->end() << '\t' << a->name() << "\t0\t" << ( a->forward() ? '+' : '-' ) << '\n' ;
+		}
+
+		ofstream r1( ( prefix + "_R1.fastq" ).c_str() ) ;
+		ofstream r2( ( prefix + "_R2.fastq" ).c_str() ) ;
+		for( size_t i=0; i<pairs.size() && i<WRITTEN; i++ ) {
+			r1 << "@pair" << i << " 1:N:0\n" << pairs[i].first << "\n+\n" << string( pairs[i].first.size(), 'I' ) << '\n' ;
+			r2 << "@pair" << i << " 2:N:0\n" << pairs[i].second << "\n+\n" << string( pairs[i].second.size(), 'I' ) << '\n' ;
+		}
+		printf( "written\t%s.bed %s.fa %s_R1.fastq %s_R2.fastq\n", prefix.c_str(), prefix.c_str(), prefix.c_str(), prefix.c_str() ) ;
+	}
+
+	for( size_t i=0; i<amplicons.size(); i++ ) delete amplicons[i] ;
+	return 0 ;
+}
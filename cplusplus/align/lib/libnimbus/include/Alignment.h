@@ -1,5 +1,8 @@
 #pragma once
 
+#include "AlignmentKernel.h"
+#include "AlignmentWorkspace.h"
+
 namespace Nimbus {
 
 	namespace alignment {
@@ -18,8 +21,17 @@ namespace Nimbus {
 			int _mismatch ;	// mismatch
 			int _gap ;		// gap
 			int _maxamp ;   // maximum number of amplicons
+			kernel_t _kernel ; // the kernel to fill the Smith-Waterman matrices
+			int _band ;        // the band width around the seed diagonal, 0 for the full matrix
+			int _ungapped ;    // the mismatches allowed to align a read without gaps on the seed diagonal, -1 to always use Smith-Waterman
 		public:
-			AlignmentScore( int m, int mm, int g, int maxamp): _match(m), _mismatch(mm), _gap(g), _maxamp(maxamp) {}
+			AlignmentScore( int m, int mm, int g, int maxamp): _match(m), _mismatch(mm), _gap(g), _maxamp(maxamp), _kernel(k_SCALAR), _band(0), _ungapped(-1) {}
+
+			AlignmentScore( int m, int mm, int g, int maxamp, kernel_t k): _match(m), _mismatch(mm), _gap(g), _maxamp(maxamp), _kernel(resolveKernel(k)), _band(0), _ungapped(-1) {}
+
+			AlignmentScore( int m, int mm, int g, int maxamp, kernel_t k, int band): _match(m), _mismatch(mm), _gap(g), _maxamp(maxamp), _kernel(resolveKernel(k)), _band(band), _ungapped(-1) {}
+
+			AlignmentScore( int m, int mm, int g, int maxamp, kernel_t k, int band, int ungapped): _match(m), _mismatch(mm), _gap(g), _maxamp(maxamp), _kernel(resolveKernel(k)), _band(band), _ungapped(ungapped) {}
 			~AlignmentScore( ) {}
 
 			/** 
@@ -27,6 +39,13 @@ namespace Nimbus {
 			 **/
 			int score( char r, char q ) const ;
 
+			/**
+			 Get the band of diagonals lo <= i - j <= hi to fill around diagonal d
+			 of a matrix with n_subj subject and n_qry query bases. Without a band
+			 width, the band covers the full matrix.
+			 **/
+			void band( int d, int n_subj, int n_qry, int& lo, int& hi ) const ;
+
 			std::string str() const ;
 		} ;
 
@@ -66,6 +85,10 @@ namespace Nimbus {
 			//	- 3, subject base, query - 			
 			int** directions ;
 
+			// the blocks holding the cells of the matrices, the rows point into them
+			int* _scells ;
+			int* _dcells ;
+
 			// the subject and query functions
 			std::string subject ;
 			std::string query ;
@@ -76,17 +99,39 @@ namespace Nimbus {
 			
 			AlignmentScore* scorecalc ;
 
+			// the workspace the matrices are borrowed from, or NULL to allocate them
+			AlignmentWorkspace* workspace ;
+
 		public:		
 			Alignment( AlignmentScore* as ) : scorecalc(as) {
 				subject    = "" ;
 				query      = "" ;
 				scores     = NULL ;
 				directions = NULL ;				
+				_scells    = NULL ;
+				_dcells    = NULL ;
+				_max       = 0 ;
+				_coord     = std::pair<int,int>( 0, 0 ) ;
+				workspace  = NULL ;
+			}
+
+			/**
+			 The matrices are taken from the workspace ws and remain valid until
+			 the workspace is reset
+			 **/
+			Alignment( AlignmentScore* as, AlignmentWorkspace* ws ) : scorecalc(as) {
+				subject    = "" ;
+				query      = "" ;
+				scores     = NULL ;
+				directions = NULL ;				
+				_scells    = NULL ;
+				_dcells    = NULL ;
 				_max       = 0 ;
 				_coord     = std::pair<int,int>( 0, 0 ) ;
+				workspace  = ws ;
 			}
 
-			~Alignment(void) ; 
+			virtual ~Alignment(void) ; 
 
 			/**
 			 Get the path through the matrix for the best alignment
@@ -124,6 +169,14 @@ namespace Nimbus {
 		
 			std::vector<char> QCIGAR( std::vector< std::pair<int,int> > path ) const ;
 
+			/**
+			 Get the number of differences between the query and the reference along 
+			 the path, the mismatches and inserted and deleted bases as in the NM tag, 
+			 and set md to the MD string of the aligned bases. Returns -1 if the 
+			 directions were not defined
+			 **/
+			int QEditDistance( const std::vector< std::pair<int,int> >& path, std::string& md ) const ;
+
 			/**
 			 This method is specific foreach alignment method
 			 **/
@@ -139,27 +192,145 @@ namespace Nimbus {
 
 			
 		protected:
+			/**
+			 Whether the alignment was filled, and the score and direction of the
+			 cell in row i and column j; the trace back only uses these
+			 **/
+			virtual bool _filled( ) const ;
+			virtual int _score( int i, int j ) const ;
+			virtual int _direction( int i, int j ) const ;
+
 			void _clean_matrix( ) ; 
+
+			/**
+			 Allocates the score and direction matrices for the subject and query,
+			 with the rows stored contiguously
+			 **/
+			void _alloc_matrix( ) ;
 		} ;
 
 
 		class SmithWaterman: public Alignment {
 			int _gapopen ;
 
+			// the stored cells: the rows and columns up to the end coordinate,
+			// and in each row the band lo <= i - j <= hi with a cell on either 
+			// side; the other cells are boundaries
+			int _rows ;
+			int _cols ;
+			int _lo ;
+			int _hi ;
+
 		public:
-			SmithWaterman( AlignmentScore* as, int go ): Alignment(as), _gapopen(go) {}
+			SmithWaterman( AlignmentScore* as, int go ): Alignment(as), _gapopen(go), _rows(0), _cols(0), _lo(0), _hi(0) {}
+
+			SmithWaterman( AlignmentScore* as, int go, AlignmentWorkspace* ws ): Alignment(as, ws), _gapopen(go), _rows(0), _cols(0), _lo(0), _hi(0) {}
 
-			SmithWaterman( AlignmentScore* as, int go, std::string s, std::string q ): Alignment(as), _gapopen(go) {
+			SmithWaterman( AlignmentScore* as, int go, std::string s, std::string q ): Alignment(as), _gapopen(go), _rows(0), _cols(0), _lo(0), _hi(0) {
 				fillMatrix( s, q ) ;
 			}
 
+			SmithWaterman( AlignmentScore* as, int go, std::string s, std::string q, std::pair<int,int> end ): Alignment(as), _gapopen(go), _rows(0), _cols(0), _lo(0), _hi(0) {
+				fillMatrix( s, q, end ) ;
+			}
+
+			SmithWaterman( AlignmentScore* as, int go, std::string s, std::string q, std::pair<int,int> end, int diagonal ): Alignment(as), _gapopen(go), _rows(0), _cols(0), _lo(0), _hi(0) {
+				fillMatrix( s, q, end, diagonal ) ;
+			}
+
 			/*~SmithWaterman() {
 				_clean_matrix() ;
 			}*/
 
 			void fillMatrix( std::string ref, std::string q ) ;
 
+			/**
+			 Only fills the part of the matrix up to the end coordinate of the best 
+			 alignment, as determined by a score only pass. The trace back from the 
+			 end coordinate never leaves this part of the matrix.
+			 **/
+			void fillMatrix( std::string ref, std::string q, std::pair<int,int> end ) ;
+
+			/**
+			 Only fills the cells in the band around the diagonal i - j = diagonal, 
+			 if a band width was set in the alignment score. Reads found by their
+			 first bases start on diagonal 0 of the amplicon, reverse complemented
+			 reads end on diagonal ref.size() - q.size(). Only the band is stored,
+			 so the matrices take memory in proportion to the read length times
+			 the band width.
+			 **/
+			void fillMatrix( std::string ref, std::string q, std::pair<int,int> end, int diagonal ) ;
+
 			void _init_matrix( ) ;
+
+			/**
+			 Allocates and initializes the cells of the first rows rows and cols
+			 columns in the band lo <= i - j <= hi and the cell on either side 
+			 of it, the rows point into a block of these cells
+			 **/
+			void _init_band( int rows, int cols, int lo, int hi ) ;
+
+			/**
+			 Determines the maximum score and its coordinate without filling the 
+			 matrices, so only linear memory is used
+			 **/
+			static int score( AlignmentScore* as, int go, const std::string& s, const std::string& q, std::pair<int,int>& end ) ;
+
+			static int score( AlignmentScore* as, int go, const std::string& s, const std::string& q, int diagonal, std::pair<int,int>& end ) ;
+
+			static int score( AlignmentScore* as, int go, const std::string& s, const std::string& q, int diagonal, std::pair<int,int>& end, AlignmentWorkspace* ws ) ;
+
+			/**
+			 Determines the maximum score and its coordinate of q against each of the 
+			 subjects, around their diagonal, at once
+			 **/
+			static void score( AlignmentScore* as, int go, const std::vector<const std::string*>& s, const std::string& q, const std::vector<int>& diagonals, 
+								std::vector<int>& scores, std::vector< std::pair<int,int> >& ends, AlignmentWorkspace* ws ) ;
+
+		protected:
+			void _fill_rows( int n_subj, int n_qry, int lo, int hi ) ;
+
+			int _score( int i, int j ) const ;
+			int _direction( int i, int j ) const ;
+
+		private:
+			bool _stored( int i, int j ) const {
+				return i >= 0 && i < _rows && j >= 0 && j < _cols && i - j >= _lo - 1 && i - j <= _hi + 1 ;
+			}
+		} ;
+
+		class UngappedAlignment: public Alignment {
+			/*
+			 Aligns the query without gaps on a single diagonal of the matrix. On 
+			 this diagonal the scores and directions are the ones Smith-Waterman
+			 would find if no gap improves the alignment, so the trace back gives
+			 the same soft clipped alignment. Only the cells of the diagonal are 
+			 kept, the other cells are boundaries with score 0.
+			 */
+			int _diagonal ;
+			std::vector<int> _scores ;		// the scores on the diagonal by query position
+			std::vector<int> _directions ;
+
+		public:
+			UngappedAlignment( AlignmentScore* as ): Alignment(as), _diagonal(0) {}
+
+			/**
+			 Aligns q to ref on the diagonal i - j = diagonal, if q fits on the 
+			 diagonal, has at most mismatches mismatches there and its alignment
+			 starts at its first base. Returns whether the alignment was filled.
+			 **/
+			bool fillDiagonal( const std::string& ref, const std::string& q, int diagonal, int mismatches ) ;
+
+			/**
+			 The number of mismatches of q on the diagonal of ref, counting up to 
+			 limit + 1; -1 if q does not fit on the diagonal
+			 **/
+			static int mismatches( const std::string& ref, const std::string& q, int diagonal, int limit ) ;
+
+		protected:
+			bool _filled( ) const ;
+			int _score( int i, int j ) const ;
+			int _direction( int i, int j ) const ;
 		} ;
 
 		class NeedlemanWunsch: public Alignment {
@@ -190,6 +361,10 @@ namespace Nimbus {
 				fillMatrix( ref, q ) ;
 			}
 
+			Levenshtein( std::string ref, std::string q, AlignmentWorkspace* ws ): Alignment(new AlignmentScore( 0, 1, 1, 1), ws) {
+				fillMatrix( ref, q ) ;
+			}
+
 			Levenshtein( const Levenshtein& other ): Alignment(new AlignmentScore( 0, 1, 1, 1))  {
 				fillMatrix( other.subject, other.query ) ;
 			}
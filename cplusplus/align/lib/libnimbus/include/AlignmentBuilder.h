@@ -19,9 +19,23 @@ namespace Nimbus {
 		alignment::SAMRecord* f_record ;
 		alignment::SAMRecord* r_record ;
 
+		// the results of the score only pass
+		int f_score ;
+		int r_score ;
+		std::pair<int,int> f_end ;
+		std::pair<int,int> r_end ;
+
+		// whether the reads were aligned without gaps
+		bool f_ungapped ;
+		bool r_ungapped ;
+
+		// the workspace for the alignment matrices, or NULL
+		alignment::AlignmentWorkspace* workspace ;
+
 	public:
 		AlnSet() ;
 		AlnSet( basic::Amplicon* a ) ;
+		AlnSet( basic::Amplicon* a, alignment::AlignmentWorkspace* ws ) ;
 
 		~AlnSet() ;
 
@@ -31,6 +45,22 @@ namespace Nimbus {
 
 		void align( alignment::AlignmentScore* scores, int gapopen, basic::Read* f, basic::Read* r ) ;
 
+		/*
+		 Determines the alignment scores and end coordinates without 
+		 keeping the alignment matrices
+		 */
+		void score( alignment::AlignmentScore* scores, int gapopen, basic::Read* f, basic::Read* r ) ;
+
+		/*
+		 Whether the set was aligned or scored
+		 */
+		bool scored() const ;
+
+		/*
+		 The combined score of the alignments or the score only pass
+		 */
+		int combinedScore() const ;
+
 		void SAMrecord( basic::Read* f, basic::Read* r ) ;
 
 		void SAMrecord_f( basic::Read* f ) ;
@@ -45,6 +75,7 @@ namespace Nimbus {
 		basic::Read* forward ;
 		basic::Read* reverse ;
 		std::vector<AlnSet> entries ;
+		alignment::AlignmentWorkspace* workspace ;
 
 	public:
 		AlignmentBuilder( ) ;
@@ -52,6 +83,11 @@ namespace Nimbus {
 		AlignmentBuilder( basic::Read* f ) ;
 
 		AlignmentBuilder( basic::Read* f, basic::Read* r ) ;
+
+		/*
+		 the alignments of the reads borrow their matrices from workspace ws
+		 */
+		AlignmentBuilder( basic::Read* f, basic::Read* r, alignment::AlignmentWorkspace* ws ) ;
 		
 		~AlignmentBuilder(void);
 
@@ -67,6 +103,17 @@ namespace Nimbus {
 		 */
 		void align( alignment::AlignmentScore* scores, int gapopen ) ;
 
+		/*
+		 Determines the scores of the reads on the amplicons in the resultset
+		 without keeping the alignment matrices 
+		 */
+		void score( alignment::AlignmentScore* scores, int gapopen ) ;
+
+		/*
+		 Scores the forward (first) or reverse read against all amplicons at once 
+		 */
+		void score( alignment::AlignmentScore* scores, int gapopen, basic::Read* read, bool first ) ;
+
 		/*
 		 gets the alignment with the best combined score
 		 */
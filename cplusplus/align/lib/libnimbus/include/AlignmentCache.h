@@ -0,0 +1,84 @@
+#pragma once
+
+#include "stdafx.h"
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "Amplicon.h"
+#include "SAMrecord.h"
+
+namespace Nimbus {
+
+	//
+	// AlignmentCache
+	//
+	//  Keeps the outcome of the alignment of a read pair by the sequences
+	//  of its reads: the amplicon and the SAM records without their name
+	//  and quality. Read pairs with the same sequences get the same records.
+	//
+	//  - the cache holds at most capacity read pairs; the least recently
+	//    used pair is dropped first
+	//  - the pairs are spread over shards with a lock each, so the workers
+	//    rarely wait for each other
+	//
+	class AlignmentCache {
+
+		struct _Entry {
+			std::string key ;
+			basic::Amplicon* amplicon ;
+			alignment::SAMRecord* f_record ;
+			alignment::SAMRecord* r_record ;
+		} ;
+
+		struct _Shard {
+			std::mutex m ;
+			std::list<_Entry> entries ;		// the most recently used first
+			std::unordered_map< std::string, std::list<_Entry>::iterator > index ;
+		} ;
+
+		std::vector<_Shard*> _shards ;
+		size_t _capacity ;		// the capacity of a shard
+		std::atomic<size_t> _lookups ;
+		std::atomic<size_t> _hits ;
+
+	public:
+		static const size_t SHARDS = 64 ;
+
+	public:
+		AlignmentCache( size_t capacity ) ;
+
+		~AlignmentCache() ;
+
+		/**
+		 Gets the outcome for the sequences f and r: the amplicon and copies
+		 of the records, which are NULL if the read was not aligned
+		 **/
+		bool get( const std::string& f, const std::string& r, basic::Amplicon*& amplicon, alignment::SAMRecord*& f_record, alignment::SAMRecord*& r_record ) ;
+
+		/**
+		 Adds the outcome for the sequences f and r; the records are copied
+		 **/
+		void put( const std::string& f, const std::string& r, basic::Amplicon* amplicon, const alignment::SAMRecord* f_record, const alignment::SAMRecord* r_record ) ;
+
+		/**
+		 The number of lookups and the number of them that were found
+		 **/
+		size_t lookups() const ;
+
+		size_t hits() const ;
+
+	private:
+		static std::string _key( const std::string& f, const std::string& r ) ;
+
+		_Shard* _shard( const std::string& key ) const ;
+
+		static alignment::SAMRecord* _copy( const alignment::SAMRecord* r ) ;
+
+		static void _clear( _Entry& e ) ;
+
+		AlignmentCache( const AlignmentCache& other ) ;
+		AlignmentCache& operator=( const AlignmentCache& other ) ;
+	} ;
+
+}
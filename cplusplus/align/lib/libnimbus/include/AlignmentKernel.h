@@ -0,0 +1,89 @@
+#pragma once
+
+#include "stdafx.h"
+#include "AlignmentWorkspace.h"
+
+namespace Nimbus {
+
+	namespace alignment {
+
+		//
+		// The implementations available to fill the Smith-Waterman matrices
+		//
+		//  - k_AUTO: pick the fastest kernel supported by the CPU
+		//  - k_SCALAR: the row by row reference implementation
+		//  - k_SSE41: anti-diagonal kernel with 4 32-bit lanes
+		//  - k_AVX2: anti-diagonal kernel with 8 32-bit lanes
+		//
+		enum kernel_t { k_AUTO, k_SCALAR, k_SSE41, k_AVX2 } ;
+
+		/**
+		 Determines whether kernel k can run on this CPU
+		 **/
+		bool kernelSupported( kernel_t k ) ;
+
+		/**
+		 Replaces k_AUTO and unsupported kernels by the best supported kernel
+		 **/
+		kernel_t resolveKernel( kernel_t k ) ;
+
+		/**
+		 Converts a kernel from and to its name on the commandline. Returns
+		 false if the name is not recognized.
+		 **/
+		bool kernelFromString( std::string name, kernel_t& k ) ;
+
+		std::string kernelName( kernel_t k ) ;
+
+		/**
+		 Fills the Smith-Waterman score and direction matrices along the anti-diagonals
+		 with the vectorized kernel k. The cells on an anti-diagonal only depend on the
+		 two previous anti-diagonals, so the results are identical to those of the
+		 row by row implementation, including the direction dependent gap open penalty
+		 and the position of the maximum score.
+
+		 The matrices should have been initialized with 0's and d_BOUND. The maximum
+		 score and its coordinate are only updated when a higher score is found.
+		 **/
+		void fillDiagonals( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::string& subject, const std::string& query,
+							int** scores, int** directions,
+							int& max, std::pair<int,int>& coord ) ;
+
+		/**
+		 Only fills the cells (i,j) in the band of diagonals lo <= i - j <= hi. The
+		 cells outside of the band are treated like the boundary of the matrix. The
+		 buffers for the anti-diagonals are taken from the workspace ws if provided.
+		 **/
+		void fillDiagonals( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::string& subject, const std::string& query,
+							int lo, int hi, int** scores, int** directions,
+							int& max, std::pair<int,int>& coord, AlignmentWorkspace* ws ) ;
+
+		/**
+		 Determines the maximum Smith-Waterman score and its coordinate without
+		 keeping the matrices. Only two rows (scalar) or three anti-diagonals 
+		 (vectorized) are kept in memory.
+		 **/
+		void scoreMatrix( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::string& subject, const std::string& query,
+							int& max, std::pair<int,int>& coord ) ;
+
+		void scoreMatrix( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::string& subject, const std::string& query,
+							int lo, int hi, int& max, std::pair<int,int>& coord, AlignmentWorkspace* ws ) ;
+
+		/**
+		 Determines the maximum Smith-Waterman score and its coordinate of the query
+		 against each of the subjects, in the band lo[s] <= i - j <= hi[s] of subject s.
+		 The vectorized kernels score 8 (SSE4.1) or 16 (AVX2) subjects at once, with 
+		 a subject per 16-bit lane; the subjects of which the score saturates a lane 
+		 are scored again with 32-bit scores. The results are identical to those of
+		 scoreMatrix for each subject.
+		 **/
+		void scoreSubjects( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::vector<const std::string*>& subjects, const std::string& query,
+							const std::vector<int>& lo, const std::vector<int>& hi,
+							std::vector<int>& max, std::vector< std::pair<int,int> >& coord, AlignmentWorkspace* ws ) ;
+	}
+}
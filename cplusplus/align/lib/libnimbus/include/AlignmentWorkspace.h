@@ -0,0 +1,84 @@
+#pragma once
+
+#include "stdafx.h"
+
+namespace Nimbus {
+
+	namespace alignment {
+
+		//
+		// A grow-only memory arena for the alignment matrices of one thread
+		//
+		//  - allocations are aligned to a cache line and are never freed on
+		//    their own; the whole arena is reset at once, usually per read pair
+		//  - memory obtained after mark() can be handed back with release()
+		//  - when an arena needed more than one block, reset() replaces the
+		//    blocks by a single block, so it stops allocating once it has seen
+		//    the largest read pair
+		//
+		class AlignmentWorkspace {
+
+			struct _Block {
+				char* raw ;		// the allocated memory
+				char* data ;	// the aligned start of the block
+				size_t size ;	// the usable size of the block
+				size_t offset ;	// the arena offset of the start of the block
+			} ;
+
+			std::vector<_Block> _blocks ;
+			size_t _used ;		// the arena offset of the next allocation
+			size_t _peak ;		// the largest arena offset since the construction
+
+		public:
+			static const size_t CACHELINE = 64 ;
+			static const size_t MINBLOCK  = 1 << 16 ;
+
+		public:
+			AlignmentWorkspace() ;
+
+			AlignmentWorkspace( size_t size ) ;
+
+			~AlignmentWorkspace() ;
+
+			/**
+			 Allocates bytes of memory aligned to a cache line
+			 **/
+			void* allocate( size_t bytes ) ;
+
+			template<typename T>
+			T* allocate( size_t n ) {
+				return (T*) allocate( n * sizeof(T) ) ;
+			}
+
+			/**
+			 Makes sure the next bytes can be allocated from a single block
+			 **/
+			void reserve( size_t bytes ) ;
+
+			/**
+			 The current position in the arena, and returns all memory
+			 allocated after the position m
+			 **/
+			size_t mark() const ;
+			void release( size_t m ) ;
+
+			/**
+			 Invalidates all the allocated memory
+			 **/
+			void reset() ;
+
+			/**
+			 The number of bytes available without a new allocation
+			 **/
+			size_t capacity() const ;
+
+		private:
+			void _add_block( size_t size ) ;
+			void _clear() ;
+
+			// a workspace belongs to one thread and should not be copied
+			AlignmentWorkspace( const AlignmentWorkspace& other ) ;
+			AlignmentWorkspace& operator=( const AlignmentWorkspace& other ) ;
+		} ;
+	}
+}
@@ -35,11 +35,11 @@ namespace Nimbus {
 
 
 			// constant getters
-			std::string chromosome() const ;
+			const std::string& chromosome() const ;
 			int start() const ;
 			int end() const ; 
 			bool forward() const ;
-			std::string name() const ;
+			const std::string& name() const ;
 			int width() const ;
 			std::string str() const ;
 			std::string str( bool nm ) const ;
@@ -68,14 +68,14 @@ namespace Nimbus {
 			Amplicon( GenomicRegion g, std::string sequence ) : GenomicRegion(g), _sequence(sequence) { }
 
 			// copy constructor
-			Amplicon( const Amplicon& other ): GenomicRegion( (GenomicRegion)other ), _sequence(other.sequence() ){
+			Amplicon( const Amplicon& other ): GenomicRegion( other ), _sequence(other.sequence() ){
 			}
 		
 			// standard destroyer
 			~Amplicon(void);
 
 			// constant getters
-			std::string sequence() const ;
+			const std::string& sequence() const ;
 			
 			
 			std::string str( ) const ;
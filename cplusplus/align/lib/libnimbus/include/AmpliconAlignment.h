@@ -1,10 +1,12 @@
 #pragma once
 
 #include "stdafx.h"
+#include <atomic>
 #include "Read.h"
 #include "AmpliconIndex.h"
 #include "Alignment.h"
 #include "AlignmentBuilder.h"
+#include "AlignmentCache.h"
 
 namespace Nimbus {
 
@@ -52,6 +54,13 @@ namespace Nimbus {
 		bool _reportsecondary ;
 		MappingQuality* _mapqual ;
 
+		// the outcomes of read pairs aligned before, or NULL
+		AlignmentCache* _cache ;
+
+		// the number of reads aligned, and aligned without gaps
+		mutable std::atomic<size_t> _aligned ;
+		mutable std::atomic<size_t> _ungapped ;
+
 	public:
 	
 		AmpliconAlignment( seed::AmpliconIndex* ai, alignment::AlignmentScore* scores, int seedpos, int go ) ;
@@ -65,8 +74,38 @@ namespace Nimbus {
 		 **/
 		AlignmentBuilder align( std::pair<basic::Read*,basic::Read*> p ) const ;
 
+		/**
+		 Aligns the reads with the matrices taken from workspace ws. The workspace
+		 is reset first, so the matrices of the previous read pair become invalid.
+		 **/
+		AlignmentBuilder align( std::pair<basic::Read*,basic::Read*> p, alignment::AlignmentWorkspace* ws ) const ;
+
+		/**
+		 Reuses the outcome of read pairs with the same sequences from cache c, 
+		 unless secondary alignments are reported. The cache is not owned.
+		 **/
+		void setCache( AlignmentCache* c ) ;
+
+		/**
+		 The number of reads aligned to an amplicon, and the number of them
+		 that were aligned without gaps on their seed diagonal
+		 **/
+		size_t aligned() const ;
+
+		size_t ungapped() const ;
 
 	protected:
+		/* gets the outcome of a read pair with the same sequences as p */
+		bool _lookup( std::pair<basic::Read*,basic::Read*> p, AlignmentBuilder& rval ) const ;
+
+		/* keeps the outcome of the read pair for the next pair with the same sequences */
+		void _store( std::pair<basic::Read*,basic::Read*> p, AlignmentBuilder& rval ) const ;
+
+		/* counts the reads aligned to the amplicons */
+		void _count( const AlignmentBuilder& rval ) const ;
+
+		AmpliconAlignment( const AmpliconAlignment& other ) ;
+		AmpliconAlignment& operator=( const AmpliconAlignment& other ) ;
 
 	} ;
 
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "Amplicon.h"
-#include "_DNANode.h"
+#include "KmerIndex.h"
 #include "Read.h"
 
 namespace Nimbus {
@@ -16,11 +16,20 @@ namespace Nimbus {
 
 		class AmpliconIndex	{
 
-			//
-			_DNANode<basic::Amplicon*>* _idx_f_a ;
-			_DNANode<basic::Amplicon*>* _idx_r_a ;
-			_DNANode<basic::Amplicon*>* _idx_f_b ;
-			_DNANode<basic::Amplicon*>* _idx_r_b ;
+			// the indexes on the forward and reverse keys, which hold the 
+			// position of the amplicons in the sorted amplicon vector
+			KmerIndex<unsigned int>* _idx_f_a ;
+			KmerIndex<unsigned int>* _idx_r_a ;
+			KmerIndex<unsigned int>* _idx_f_b ;
+			KmerIndex<unsigned int>* _idx_r_b ;
+
+			// the indexes on the combined forward and reverse keys (a or b), which
+			// hold the position of the amplicons in the sorted amplicon vector
+			KmerIndex<unsigned int>* _idx_aa ;
+			KmerIndex<unsigned int>* _idx_ab ;
+			KmerIndex<unsigned int>* _idx_ba ;
+			KmerIndex<unsigned int>* _idx_bb ;
+
 			std::vector< basic::Amplicon* > _amplicons ;
 			int _keysize ;
 
@@ -50,14 +59,35 @@ namespace Nimbus {
 			 **/
 			unsigned int build( int keysize ) ;
 
+			/**
+			 * Writes the tables of the built index
+			 **/
+			void write( std::ostream& out ) const ;
+
+			/**
+			 * Uses the tables written by write() at data instead of building 
+			 * the index; the amplicons should have been added in the order of 
+			 * amplicons() of the written index, and data should stay mapped 
+			 * while the index is used. Returns the end of the tables, or NULL 
+			 * if the data does not hold valid tables before end.
+			 **/
+			const char* map( int keysize, const char* data, const char* end ) ;
+
+			int keysize() const ;
+
+			/**
+			 * The amplicons of the index, sorted once the index is built
+			 **/
+			const std::vector<basic::Amplicon*>& amplicons() const ;
+
 			/** 
 			 * Gets the amplicons corresponding to f and r
 			 **/
-			std::vector<basic::Amplicon*> getAmplicons( std::string f, std::string r ) const ; 
+			std::vector<basic::Amplicon*> getAmplicons( const std::string& f, const std::string& r ) const ; 
 
-			std::vector<basic::Amplicon*> getAmpliconsF( std::string f ) const ;
+			std::vector<basic::Amplicon*> getAmpliconsF( const std::string& f ) const ;
 
-			std::vector<basic::Amplicon*> getAmpliconsR( std::string r ) const ;
+			std::vector<basic::Amplicon*> getAmpliconsR( const std::string& r ) const ;
 
 			/** 
 			 * Gets the amplicons corresponding to f and r
@@ -67,6 +97,17 @@ namespace Nimbus {
 			std::vector<basic::Amplicon*> getAmplicons( std::pair<basic::Read*, basic::Read*> p ) const ; 
 
 		protected:
+			void _create() ;
+
+			std::vector<unsigned int> _getUnion( const KmerIndex<unsigned int>* a, const KmerIndex<unsigned int>* b, const std::string& s ) const ;
+
+			std::vector<basic::Amplicon*> _get( const std::vector<unsigned int>& ids ) const ;
+
+			/*
+			 * Adds the amplicon positions at the combined key of f at offset fo
+			 * and r at offset ro to ids
+			 */
+			void _getPairIds( const KmerIndex<unsigned int>* idx, const std::string& f, int fo, const std::string& r, int ro, std::vector<unsigned int>& ids ) const ;
 
 		} ;
 
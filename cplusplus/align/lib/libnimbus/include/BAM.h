@@ -0,0 +1,46 @@
+#pragma once
+
+#include "stdafx.h"
+#include <map>
+#include "SAMrecord.h"
+
+namespace Nimbus {
+
+	namespace alignment { 
+
+		/**
+		 Encodes SAM records in the BAM format
+
+		 The reference indexes are taken from the @SQ lines of the SAM
+		 header text, in the order in which they appear. 
+		 **/
+		class BAMEncoder {
+
+			std::string _text ;
+			std::vector<std::string> _names ;
+			std::vector<int> _lengths ;
+			std::map<std::string,int> _index ;
+
+		public:
+			BAMEncoder( const std::string& text ) ;
+
+			/**
+			 Appends the binary BAM header to out
+			 **/
+			void header( std::string& out ) const ;
+
+			/**
+			 The index of reference name, -1 if not in the header
+			 **/
+			int reference( const std::string& name ) const ;
+
+			/**
+			 Appends the record to out
+			 **/
+			void append( const SAMRecord& r, std::string& out ) const ;
+
+			void append( const SAMRecord& r, const std::string& readgroup, std::string& out ) const ;
+		} ;
+
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "stdafx.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+namespace Nimbus {
+
+	namespace IO {
+
+		//
+		// BGZF compression
+		//
+		//  BGZF files are series of gzip members of at most 64 kB each, with
+		//  the compressed size in a header field, so a reader can seek to the
+		//  start of each block. A file ends with an empty block. 
+		//
+		//  A compressor reuses its zlib stream for each block, so each thread 
+		//  compressing blocks should have its own compressor.
+		//
+		class BGZFCompressor {
+			z_stream _z ;
+			int _level ;
+
+		public:
+			// the largest number of bytes compressed in one block
+			static const size_t BLOCKSIZE = 0xff00 ;
+
+			// the largest size of a compressed block
+			static const size_t MAXBLOCKSIZE = 0x10000 ;
+
+		public:
+			BGZFCompressor( ) ;
+
+			BGZFCompressor( int level ) ;
+
+			~BGZFCompressor( ) ;
+
+			/**
+			 Appends data, at most BLOCKSIZE bytes, as one BGZF block to out
+			 **/
+			void compress( const char* data, size_t n, std::string& out ) ;
+
+			/**
+			 Appends the empty block that marks the end of a BGZF file
+			 **/
+			static void eof( std::string& out ) ;
+
+		private:
+			void _init( int level ) ;
+
+			// the zlib stream should not be copied
+			BGZFCompressor( const BGZFCompressor& other ) ;
+			BGZFCompressor& operator=( const BGZFCompressor& other ) ;
+		} ;
+	}
+}
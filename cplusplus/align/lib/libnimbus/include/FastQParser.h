@@ -0,0 +1,67 @@
+#pragma once
+
+#include "stdafx.h"
+#include "Read.h"
+
+namespace Nimbus {
+
+	namespace IO {
+
+		//
+		// FastQParser
+		//
+		//  Reads a FastQ stream in large blocks and splits the entries in 
+		//  the block with memchr, instead of reading it line by line. 
+		//
+		//  - an entry that does not fit in the rest of the block is moved 
+		//    to the front of the buffer before the next block is read; the
+		//    buffer grows if a single entry is larger than a block
+		//  - lines may end with CRLF, the CR is not part of the line
+		//  - as in FastQReader, lines are skipped until four lines look like
+		//    a FastQ entry, and parsing stops at an entry of which the 
+		//    sequence and quality differ in length
+		//
+		//  The parser reads ahead, so the stream should not be read otherwise.
+		//
+		class FastQParser {
+			std::istream& _in ;
+			std::vector<char> _buffer ;
+			size_t _pos ;			// the start of the data not parsed yet
+			size_t _end ;			// the end of the data in the buffer
+			size_t _blocksize ;
+			bool _eof ;
+
+		public:
+			// the default number of bytes read at once
+			static const size_t BLOCKSIZE = 1 << 20 ;
+
+		public:
+			FastQParser( std::istream& in ) ;
+
+			FastQParser( std::istream& in, size_t blocksize ) ;
+
+			~FastQParser() ;
+
+			/**
+			 Reads the next entry into r, reusing the memory of r; returns 
+			 false if there is no entry left
+			 **/
+			bool next( basic::Read& r ) ;
+
+		private:
+			void _init( size_t blocksize ) ;
+
+			/* 
+			 finds the next line, its start and length are set in start[n] and
+			 length[n]; the pending lines start[0..n-1] are kept in the buffer
+			 */
+			bool _line( size_t* start, size_t* length, int n ) ;
+
+			/* moves the data from offset keep to the front and reads a block */
+			void _fill( size_t keep ) ;
+
+			FastQParser( const FastQParser& other ) ;
+			FastQParser& operator=( const FastQParser& other ) ;
+		} ;
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "stdafx.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <zlib.h>
+
+namespace Nimbus {
+
+	namespace IO {
+
+		//
+		// GzipInput
+		//
+		//  An input stream with the decompressed data of a gzip stream, which
+		//  may consist of several gzip members.
+		//
+		//  - BGZF input, recognized by the BC field in the header of the first
+		//    member, consists of independent blocks of at most 64 kB; a pool
+		//    of decoder threads inflates these blocks in parallel
+		//  - other gzip input is inflated by a single thread, which reads
+		//    ahead of the consumer
+		//
+		//  A thread reads the compressed stream, which should not be read
+		//  otherwise while the GzipInput exists. Corrupt or truncated input
+		//  is fatal.
+		//
+		class GzipInput: public std::istream {
+
+			// a block of compressed and decompressed data
+			struct _Block {
+				std::string in ;
+				std::string out ;
+				bool done ;
+			} ;
+
+			class _Buffer: public std::streambuf {
+				std::istream& _in ;
+				int _threads ;
+				bool _bgzf ;
+				bool _detected ;		// whether _bgzf is known
+
+				// the blocks in the order of the stream, those waiting for a
+				// decoder, and the blocks that can be reused
+				std::deque<_Block*> _order ;
+				std::deque<_Block*> _todo ;
+				std::vector<_Block*> _spare ;
+				size_t _readahead ;
+
+				// the block read by the consumer
+				_Block* _current ;
+
+				std::mutex _m ;
+				std::condition_variable _space ;
+				std::condition_variable _work ;
+				std::condition_variable _ready ;
+				bool _eof ;
+				bool _stop ;
+
+				std::thread _reader ;
+				std::vector<std::thread> _decoders ;
+
+			public:
+				_Buffer( std::istream& in, int threads ) ;
+
+				~_Buffer() ;
+
+				bool bgzf() ;
+
+			protected:
+				int_type underflow() ;
+
+			private:
+				// the thread reading the compressed stream
+				void _read() ;
+
+				void _readBGZF( std::string& header, int bsize ) ;
+
+				void _readGzip( const std::string& start ) ;
+
+				// the decoder threads of BGZF blocks
+				void _decode() ;
+
+				static void _inflate( z_stream& z, _Block* b ) ;
+
+				// waits for room in the read ahead, returns NULL when stopping
+				_Block* _block() ;
+
+				void _push( _Block* b, bool decode ) ;
+
+				size_t _get( char* buffer, size_t n ) ;
+
+				static int _bsize( const std::string& extra ) ;
+
+				_Buffer( const _Buffer& other ) ;
+				_Buffer& operator=( const _Buffer& other ) ;
+			} ;
+
+			_Buffer* _buffer ;
+
+		public:
+			// the default number of threads decoding BGZF blocks
+			static const int THREADS = 2 ;
+
+			// the number of decompressed bytes per block of gzip input
+			static const size_t CHUNKSIZE = 1 << 20 ;
+
+		public:
+			GzipInput( std::istream& in ) ;
+
+			GzipInput( std::istream& in, int threads ) ;
+
+			~GzipInput() ;
+
+			/**
+			 Whether the stream is BGZF compressed; waits for the first block
+			 **/
+			bool bgzf() ;
+
+			/**
+			 Whether the stream starts like gzip data; nothing is consumed
+			 **/
+			static bool gzipped( std::istream& in ) ;
+
+		private:
+			GzipInput( const GzipInput& other ) ;
+			GzipInput& operator=( const GzipInput& other ) ;
+		} ;
+	}
+}
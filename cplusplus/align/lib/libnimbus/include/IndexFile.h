@@ -0,0 +1,78 @@
+#pragma once
+
+#include "stdafx.h"
+#include <stdint.h>
+#include "Amplicon.h"
+#include "AmpliconIndex.h"
+#include "SAMrecord.h"
+
+namespace Nimbus {
+
+	namespace IO {
+
+		//
+		// IndexFile
+		//
+		//  A prebuilt amplicon index, written once per design and genome by
+		//  write() and mapped read-only by the constructor. The file holds:
+		//
+		//  - a versioned header with the key size of the index
+		//  - the reference sequences of the SAM header
+		//  - the table of the sorted distinct amplicons, with their names and
+		//    sequences concatenated
+		//  - the k-mer tables of the AmpliconIndex
+		//
+		//  The k-mer tables are used in place from the mapping, so processes
+		//  using the same index file share its pages. The integers are
+		//  stored in the byte order of the machine that wrote the file.
+		//
+		class IndexFile {
+			std::string _fname ;
+			const char* _data ;
+			size_t _size ;
+
+			alignment::SAMHeader _header ;
+			std::vector<basic::Amplicon*> _amplicons ;
+			seed::AmpliconIndex* _index ;
+
+		public:
+			// the version of the file format
+			static const uint32_t VERSION = 1 ;
+
+		public:
+			/**
+			 Maps the index file; an invalid file is fatal
+			 **/
+			IndexFile( const std::string& fname ) ;
+
+			~IndexFile() ;
+
+			/**
+			 The index, which is valid while the IndexFile exists
+			 **/
+			seed::AmpliconIndex* index() const ;
+
+			/**
+			 The sorted distinct amplicons of the index
+			 **/
+			const std::vector<basic::Amplicon*>& amplicons() const ;
+
+			const alignment::SAMHeader& header() const ;
+
+			int keysize() const ;
+
+			/**
+			 Writes the built index and the references in the header to fname;
+			 the file is replaced at once, so running alignments keep the
+			 index they mapped
+			 **/
+			static void write( const std::string& fname, const seed::AmpliconIndex& index, const alignment::SAMHeader& header ) ;
+
+		private:
+			void _fail( const std::string& message ) const ;
+
+			IndexFile( const IndexFile& other ) ;
+			IndexFile& operator=( const IndexFile& other ) ;
+		} ;
+	}
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <map>
+#include <stdint.h>
+
+namespace Nimbus {
+
+	namespace seed {
+
+		//
+		// Span: a view on a contiguous range of values owned by an index
+		//
+		template <class T>
+		class Span {
+			const T* _begin ;
+			const T* _end ;
+
+		public:
+			Span(): _begin(NULL), _end(NULL) {}
+
+			Span( const T* b, const T* e ): _begin(b), _end(e) {}
+
+			const T* begin() const { return _begin ; }
+			const T* end() const { return _end ; }
+			size_t size() const { return (size_t) ( _end - _begin ) ; }
+			bool empty() const { return _begin == _end ; }
+			const T& operator[]( size_t i ) const { return _begin[i] ; }
+		} ;
+
+		//
+		// KmerIndex
+		//
+		//  Maps keys of keysize bases to values. Keys of A, C, G and T are 2-bit
+		//  encoded and their values are stored in one contiguous array, grouped
+		//  per key (CSR layout):
+		//
+		//   - for short keys the offsets array is indexed by the key directly
+		//   - for long keys the offsets belong to an array of the keys, which
+		//     is found through an open addressing hash table
+		//
+		//  Keys with an N, which the trie kept in a separate branch, are stored
+		//  in a map. Keys with any other character are not indexed and are never
+		//  found. The values of a key keep the order in which they were added.
+		//
+		//  A built index of plain values can be written to a stream and used
+		//  in place from a memory mapped copy of that stream.
+		//
+		template <class T>
+		class KmerIndex {
+			int _keysize ;
+			bool _direct ;
+			std::vector<uint32_t> _offsets ;
+			std::vector<uint64_t> _keys ;
+			std::vector<uint32_t> _slots ;
+			int _shift ;
+			std::vector<T> _values ;
+			std::map< std::string, std::vector<T> > _nkeys ;
+			std::vector< std::pair<uint64_t, T> > _added ;
+
+			// the arrays used for the lookups: the vectors above or a mapped index
+			Span<uint32_t> _offsets_v ;
+			Span<uint64_t> _keys_v ;
+			Span<uint32_t> _slots_v ;
+			Span<T> _values_v ;
+
+		public:
+			// the largest key size indexed directly: 4^10 offsets
+			static const int MAXDIRECT = 10 ;
+
+			// the largest key size that can be encoded
+			static const int MAXKEYSIZE = 32 ;
+
+			// encoding results
+			enum code_t { c_OK, c_N, c_INVALID } ;
+
+		public:
+			KmerIndex( int keysize ) {
+				_keysize = keysize ;
+				_direct  = keysize <= MAXDIRECT ;
+				_shift   = 64 ;
+			}
+
+			int keysize() const { return _keysize ; }
+
+			/*
+			 2-bit encodes the first keysize bases of key
+			 */
+			code_t encode( const char* key, uint64_t& code ) const {
+				code_t rval = c_OK ;
+				code = 0 ;
+				for( int i=0; i<_keysize; i++ ) {
+					code <<= 2 ;
+					switch( key[i] ) {
+					case 'A':
+						break ;
+					case 'C':
+						code |= 1 ;
+						break ;
+					case 'G':
+						code |= 2 ;
+						break ;
+					case 'T':
+						code |= 3 ;
+						break ;
+					case 'N':
+						rval = c_N ;
+						break ;
+					default:
+						return c_INVALID ;
+					}
+				}
+				return rval ;
+			}
+
+			/*
+			 Adds a value at key; the value is available after build()
+			 */
+			void add( const std::string& key, T value ) {
+				if( (int) key.size() != _keysize || _keysize > MAXKEYSIZE ) return ;
+
+				uint64_t code ;
+				code_t c = encode( key.c_str(), code ) ;
+				if( c == c_OK ) {
+					_added.push_back( std::pair<uint64_t,T>( code, value ) ) ;
+				} else if( c == c_N ) {
+					_nkeys[key].push_back( value ) ;
+				}
+			}
+
+			/*
+			 Builds the offsets and value arrays from the added values
+			 */
+			void build() {
+
+				// group the values per key, keeping the order in which they were added
+				std::stable_sort( _added.begin(), _added.end(), _cmp_key ) ;
+
+				_values.clear() ;
+				_keys.clear() ;
+				_slots.clear() ;
+				_offsets.clear() ;
+				_values.reserve( _added.size() ) ;
+
+				if( _direct ) {
+					_offsets = std::vector<uint32_t>( ( (size_t) 1 << ( 2 * _keysize ) ) + 1, 0 ) ;
+					for( size_t i=0; i<_added.size(); i++ ) {
+						_offsets[ _added[i].first + 1 ]++ ;
+						_values.push_back( _added[i].second ) ;
+					}
+					for( size_t i=1; i<_offsets.size(); i++ ) _offsets[i] += _offsets[i-1] ;
+				} else {
+					for( size_t i=0; i<_added.size(); i++ ) {
+						if( _keys.empty() || _keys.back() != _added[i].first ) {
+							_keys.push_back( _added[i].first ) ;
+							_offsets.push_back( (uint32_t) i ) ;
+						}
+						_values.push_back( _added[i].second ) ;
+					}
+					_offsets.push_back( (uint32_t) _values.size() ) ;
+
+					// hash the keys in a table that is at most half full
+					int bits = 1 ;
+					while( ( (size_t) 1 << bits ) < 2 * _keys.size() ) bits++ ;
+					_shift = 64 - bits ;
+					_slots = std::vector<uint32_t>( (size_t) 1 << bits, 0 ) ;
+					for( size_t i=0; i<_keys.size(); i++ ) {
+						size_t h = _hash( _keys[i] ) ;
+						while( _slots[h] != 0 ) h = ( h + 1 ) & ( _slots.size() - 1 ) ;
+						_slots[h] = (uint32_t) i + 1 ;
+					}
+				}
+
+				// release the staging area
+				std::vector< std::pair<uint64_t, T> >().swap( _added ) ;
+
+				_offsets_v = _view( _offsets ) ;
+				_keys_v    = _view( _keys ) ;
+				_slots_v   = _view( _slots ) ;
+				_values_v  = _view( _values ) ;
+			}
+
+			/*
+			 Writes the built index; all sections are padded to 8 bytes
+			 */
+			void write( std::ostream& out ) const {
+				uint64_t head[8] = { (uint64_t) _keysize, (uint64_t) _direct, (uint64_t) _shift, 
+					_offsets_v.size(), _keys_v.size(), _slots_v.size(), _values_v.size(), _nkeys.size() } ;
+				_write( out, head, sizeof( head ) ) ;
+				_write( out, _offsets_v.begin(), _offsets_v.size() * sizeof( uint32_t ) ) ;
+				_write( out, _keys_v.begin(), _keys_v.size() * sizeof( uint64_t ) ) ;
+				_write( out, _slots_v.begin(), _slots_v.size() * sizeof( uint32_t ) ) ;
+				_write( out, _values_v.begin(), _values_v.size() * sizeof( T ) ) ;
+				for( typename std::map< std::string, std::vector<T> >::const_iterator it=_nkeys.begin(); it!=_nkeys.end(); ++it ) {
+					uint64_t n = it->second.size() ;
+					_write( out, &n, sizeof( n ) ) ;
+					_write( out, it->first.data(), it->first.size() ) ;
+					_write( out, it->second.data(), n * sizeof( T ) ) ;
+				}
+			}
+
+			/*
+			 Uses the index written by write() at data, which should stay mapped 
+			 while the index is used. Returns the end of the index, or NULL if 
+			 the data does not hold an index of this key size before end.
+			 */
+			const char* map( const char* data, const char* end ) {
+				const uint64_t* head = (const uint64_t*) data ;
+				if( data == NULL || (size_t) ( end - data ) < 8 * sizeof( uint64_t ) ) return NULL ;
+				if( head[0] != (uint64_t) _keysize || head[1] != (uint64_t) _direct || head[2] > 64 ) return NULL ;
+				_shift = (int) head[2] ;
+				const char* p = data + 8 * sizeof( uint64_t ) ;
+				p = _map( p, end, head[3], _offsets_v ) ;
+				p = _map( p, end, head[4], _keys_v ) ;
+				p = _map( p, end, head[5], _slots_v ) ;
+				p = _map( p, end, head[6], _values_v ) ;
+
+				// the lookups only stay within the arrays if these are consistent
+				if( p != NULL && _direct && _offsets_v.size() != ( (size_t) 1 << ( 2 * _keysize ) ) + 1 ) p = NULL ;
+				if( p != NULL && ! _direct && ( _offsets_v.size() != _keys_v.size() + 1 || ( _slots_v.size() & ( _slots_v.size() - 1 ) ) != 0 ) ) p = NULL ;
+				if( p != NULL && ! _direct && ( _shift < 1 || _slots_v.size() != (size_t) 1 << ( 64 - _shift ) ) ) p = NULL ;
+				if( p != NULL && ! _offsets_v.empty() && ( _offsets_v[0] != 0 || _offsets_v[ _offsets_v.size() - 1 ] != _values_v.size() ) ) p = NULL ;
+				for( size_t i=1; p != NULL && i<_offsets_v.size(); i++ ) {
+					if( _offsets_v[i] < _offsets_v[i - 1] ) p = NULL ;
+				}
+				size_t filled = 0 ;
+				for( size_t i=0; p != NULL && i<_slots_v.size(); i++ ) {
+					if( _slots_v[i] > _keys_v.size() ) p = NULL ;
+					if( _slots_v[i] != 0 ) filled++ ;
+				}
+				if( p != NULL && ! _direct && ( filled != _keys_v.size() || filled == _slots_v.size() ) ) p = NULL ;
+
+				// the keys with an N are few, so these are copied
+				_nkeys.clear() ;
+				for( uint64_t i=0; p != NULL && i<head[7]; i++ ) {
+					Span<uint64_t> n ;
+					Span<char> key ;
+					Span<T> values ;
+					p = _map( p, end, 1, n ) ;
+					if( p != NULL ) p = _map( p, end, _keysize, key ) ;
+					if( p != NULL ) p = _map( p, end, n[0], values ) ;
+					if( p != NULL ) _nkeys[ std::string( key.begin(), key.end() ) ] = std::vector<T>( values.begin(), values.end() ) ;
+				}
+				return p ;
+			}
+
+			/*
+			 Gets the values at the first keysize bases of key, without copying
+			 */
+			Span<T> get( const char* key ) const {
+				Span<T> rval = Span<T>() ;
+				uint64_t code ;
+				code_t c = encode( key, code ) ;
+
+				if( c == c_OK && _direct && ! _offsets_v.empty() ) {
+					rval = _span( _offsets_v[code], _offsets_v[code + 1] ) ;
+				} else if( c == c_OK && ! _slots_v.empty() ) {
+					size_t h = _hash( code ) ;
+					while( _slots_v[h] != 0 ) {
+						size_t idx = _slots_v[h] - 1 ;
+						if( _keys_v[idx] == code ) {
+							rval = _span( _offsets_v[idx], _offsets_v[idx + 1] ) ;
+							break ;
+						}
+						h = ( h + 1 ) & ( _slots_v.size() - 1 ) ;
+					}
+				} else if( c == c_N ) {
+					typename std::map< std::string, std::vector<T> >::const_iterator it = _nkeys.find( std::string( key, _keysize ) ) ;
+					if( it != _nkeys.end() ) {
+						rval = Span<T>( &it->second[0], &it->second[0] + it->second.size() ) ;
+					}
+				}
+				return rval ;
+			}
+
+			Span<T> get( const std::string& key ) const {
+				if( (int) key.size() < _keysize ) return Span<T>() ;
+				return get( key.c_str() ) ;
+			}
+
+			/*
+			 The number of values in the index
+			 */
+			size_t size() const {
+				size_t rval = _values_v.size() ;
+				for( typename std::map< std::string, std::vector<T> >::const_iterator it=_nkeys.begin(); it!=_nkeys.end(); ++it ) {
+					rval += it->second.size() ;
+				}
+				return rval ;
+			}
+
+			/*
+			 Whether all values in the index are less than n
+			 */
+			bool below( T n ) const {
+				for( const T* it=_values_v.begin(); it!=_values_v.end(); ++it ) {
+					if( !( *it < n ) ) return false ;
+				}
+				for( typename std::map< std::string, std::vector<T> >::const_iterator it=_nkeys.begin(); it!=_nkeys.end(); ++it ) {
+					for( size_t i=0; i<it->second.size(); i++ ) {
+						if( !( it->second[i] < n ) ) return false ;
+					}
+				}
+				return true ;
+			}
+
+		private:
+			/* multiplicative hashing: the top bits of the product */
+			size_t _hash( uint64_t code ) const {
+				return (size_t) ( ( code * 0x9E3779B97F4A7C15ULL ) >> _shift ) ;
+			}
+
+			Span<T> _span( uint32_t b, uint32_t e ) const {
+				if( b == e ) return Span<T>() ;
+				return Span<T>( _values_v.begin() + b, _values_v.begin() + e ) ;
+			}
+
+			template <class V>
+			static Span<V> _view( const std::vector<V>& v ) {
+				return Span<V>( v.data(), v.data() + v.size() ) ;
+			}
+
+			static void _write( std::ostream& out, const void* data, size_t n ) {
+				static const char padding[8] = { 0 } ;
+				if( n > 0 ) out.write( (const char*) data, n ) ;
+				out.write( padding, ( 8 - n % 8 ) % 8 ) ;
+			}
+
+			/* sets v to n values at p, returns the next 8 byte aligned position */
+			template <class V>
+			static const char* _map( const char* p, const char* end, uint64_t n, Span<V>& v ) {
+				if( p == NULL || n > (uint64_t) ( end - p ) / sizeof( V ) ) return NULL ;
+				size_t bytes = (size_t) n * sizeof( V ) ;
+				v = Span<V>( (const V*) p, (const V*) ( p + bytes ) ) ;
+				bytes += ( 8 - bytes % 8 ) % 8 ;
+				return bytes <= (size_t) ( end - p ) ? p + bytes : NULL ;
+			}
+
+			static bool _cmp_key( const std::pair<uint64_t,T>& a, const std::pair<uint64_t,T>& b ) {
+				return a.first < b.first ;
+			}
+		} ;
+
+	}
+}
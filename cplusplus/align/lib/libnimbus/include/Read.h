@@ -14,7 +14,7 @@ namespace Nimbus {
 			std::string _r_qual ;
 
 		public:
-			Read( std::string name, std::string sequence, std::string qualiy ) ;
+			Read( const std::string& name, const std::string& sequence, const std::string& qualiy ) ;
 			
 			Read() ;
 
@@ -22,20 +22,25 @@ namespace Nimbus {
 
 			~Read(void);
 			
+			//
+			// the getters return references to the members of the read,
+			// which are valid until the read is changed or destroyed
+			//
+
 			/* get the reverse complement of the sequence */
-			std::string rc_sequence() ;
+			const std::string& rc_sequence() ;
 
 			/* get the reverse complement of the quality */
-			std::string r_quality() ;
+			const std::string& r_quality() ;
 
-			/* get the reverse complement for this read */
-			std::string name() const ;
+			/* get the name of the read */
+			const std::string& name() const ;
 
 			/* get the sequence of the read */
-			std::string sequence() const ;
+			const std::string& sequence() const ;
 
 			/* get the quality string of the read */
-			std::string quality() const ;
+			const std::string& quality() const ;
 
 			/* return the read in FastQ format */
 			std::string fastq() const ;
@@ -43,6 +48,11 @@ namespace Nimbus {
 			unsigned int size() const ;
 
 			std::string str( ) const ;
+
+			/* replace the name, sequence and quality, reusing the memory of the read */
+			void assign( const std::string& name, const std::string& sequence, const std::string& quality ) ;
+
+			void assign( const char* name, size_t nl, const char* sequence, size_t sl, const char* quality, size_t ql ) ;
 			
 
 		protected:
@@ -51,6 +61,9 @@ namespace Nimbus {
 
 			/* set the quality string of the read */
 			void quality( std::string q ) ;
+
+			/* replace the sequence and quality by their reverse complement */
+			void reverse() ;
 			
 		};
 
@@ -131,10 +131,10 @@ namespace Nimbus {
 
 			SAMCore() ;
 
-			SAMCore(std::string rn, int p, int m, std::string _cig ): _rname(rn), _pos(p), _mapq(m), 
+			SAMCore( const std::string& rn, int p, int m, const std::string& _cig ): _rname(rn), _pos(p), _mapq(m), 
 				_cigar(_cig.begin(), _cig.end() ), _rlen(-1), _qlen(-1) { } 
 
-			SAMCore(std::string rn, int p, int m, std::vector<char> _cig ): _rname(rn), _pos(p), _mapq(m), 
+			SAMCore( const std::string& rn, int p, int m, const std::vector<char>& _cig ): _rname(rn), _pos(p), _mapq(m), 
 				_cigar(_cig.begin(), _cig.end() ), _rlen(-1), _qlen(-1) { } 
 			
 			~SAMCore() {}
@@ -142,9 +142,9 @@ namespace Nimbus {
 			/**
 			 get and set reference name
 			 **/
-			std::string rname() const ;
+			const std::string& rname() const ;
 
-			void rname(std::string rn ) ;
+			void rname( const std::string& rn ) ;
 
 			/**
 			 get and set position
@@ -172,6 +172,11 @@ namespace Nimbus {
 
 			void cigar( std::vector<char> c )  ;
 
+			/**
+			 append the CIGAR string to s
+			 **/
+			void append_cigar( std::string& s ) const ;
+
 			/**
 			 the length of the record on the reference
 			 **/ 
@@ -198,13 +203,13 @@ namespace Nimbus {
 		public:
 
 			// constructors
-			SAMRecord( basic::Read r ): Read(r), SAMFlag(), SAMCore("*", 0, 0, "") {
+			SAMRecord( const basic::Read& r ): Read(r), SAMFlag(), SAMCore("*", 0, 0, "") {
 				setUnmapped() ;
 				set_to_defaults() ;
 			}
 
 
-			SAMRecord( basic::Read r, bool unmapped, std::string rname, int pos, bool forward ): Read(r), SAMFlag(), SAMCore(rname, pos, 0, "") {
+			SAMRecord( const basic::Read& r, bool unmapped, const std::string& rname, int pos, bool forward ): Read(r), SAMFlag(), SAMCore(rname, pos, 0, "") {
 
 				// if the record represents an unmapped read
 				if( unmapped  ) setUnmapped() ;
@@ -218,7 +223,7 @@ namespace Nimbus {
 
 			}
 
-			SAMRecord( basic::Read r, bool unmapped, std::string rname, int pos, bool forward, std::string cig ): Read(r), SAMFlag(), SAMCore(rname, pos, 0, cig) {
+			SAMRecord( const basic::Read& r, bool unmapped, const std::string& rname, int pos, bool forward, const std::string& cig ): Read(r), SAMFlag(), SAMCore(rname, pos, 0, cig) {
 
 				// if the record represents an unmapped read
 				if( unmapped  ) setUnmapped() ;
@@ -231,7 +236,7 @@ namespace Nimbus {
 				set_to_defaults() ;
 			}
 
-			SAMRecord( basic::Read r, bool unmapped, std ::string rname, int pos, bool forward, int mq, std::string cig ): Read(r), SAMFlag(), SAMCore(rname, pos, mq, cig) {
+			SAMRecord( const basic::Read& r, bool unmapped, const std::string& rname, int pos, bool forward, int mq, const std::string& cig ): Read(r), SAMFlag(), SAMCore(rname, pos, mq, cig) {
 
 				// if the record represents an unmapped read
 				if( unmapped  ) setUnmapped() ;
@@ -264,11 +269,30 @@ namespace Nimbus {
 
 			std::string str() const ;
 
+			/**
+			 Appends the formatted record to buffer, without a line end
+			 **/
+			void append( std::string& buffer ) const ;
+
+			/**
+			 Appends the record in BAM format to buffer, with the reference 
+			 indexes of the reference and the mate reference. A non empty
+			 readgroup is added as RG tag.
+			 **/
+			void append_bam( std::string& buffer, int refid, int nextrefid, const std::string& readgroup ) const ;
+
 			/*
 			 Sets the read unmapped and resets the fields
 			 */
 			void Unmap() ;
 
+			/*
+			 Takes the name and quality of read r, which has the same sequence
+			 as the read of this record; the quality is reversed if the record
+			 was created on the reverse strand
+			 */
+			void setRead( const basic::Read& r, bool reversed ) ;
+
 			/** 
 			 add any value as a tag
 			 **/
@@ -292,8 +316,7 @@ namespace Nimbus {
 
 			void set_to_reverse_strand() {
 				setReverseComplemented() ;
-				sequence( rc_sequence() ) ;
-				quality( r_quality() ) ;
+				reverse() ;
 			}
 
 		} ;
@@ -302,6 +325,7 @@ namespace Nimbus {
 		
 			std::vector<std::string> _names ;
 			std::vector<int> _lengths ;
+			bool _sorted ;
 
 		public:
 			SAMHeader() ;
@@ -316,6 +340,13 @@ namespace Nimbus {
 			std::vector<std::string> names() const ;
 
 			std::vector<int> lengths() const ;
+
+			/*
+			 get and set whether the records are sorted by coordinate
+			 */
+			bool sorted() const ;
+
+			void sorted( bool s ) ;
 		} ;
 		
 		
@@ -17,6 +17,11 @@ namespace Nimbus {
 		 **/
 		std::vector<std::string> split_string( std::string x, std::string d )  ;
 
+		/**
+		 * Appends the decimal representation of x to s, without a stringstream
+		 **/
+		void appendInt( std::string& s, long x ) ;
+
 		/** 
 		 Determines where the query of the path actually starts  (second > 0)
 		 **/
@@ -15,6 +15,12 @@ namespace Nimbus {
 		 */
 		basic::Read* FastQReader( std::istream& input ) ;  
 
+		/*
+		 * Reads the next FastQ entry into r, reusing the memory of r; returns 
+		 * false if there is no entry left
+		 */
+		bool FastQReader( std::istream& input, basic::Read& r ) ;
+
 		/*
 		 * Same as the basicv FastQ file reader, but this one also trims the adapter 
 		 * sequences from the read
@@ -26,6 +32,23 @@ namespace Nimbus {
 		 */
 		std::pair< std::string, std::string* >* FastAReader( std::istream& input ) ;
 
+		/*
+		 * An entry of a samtools faidx index (.fai)
+		 */
+		struct FastAIndexEntry {
+			std::string name ;
+			size_t length ;
+			size_t offset ;		// the position of the first base
+			size_t linebases ;
+			size_t linewidth ;	// the bytes of a line including the line end
+		} ;
+
+		/*
+		 * Reads the entries of a FastA index file; returns false if the file does 
+		 * not exist, is not a valid index or has no entries
+		 */
+		bool FastAIndexReader( std::vector<FastAIndexEntry>& entries, std::string fname ) ;
+
 		/*
 		 * A basic BED file reader that returns a single GenomicRegion instance from an input stream
 		 */
@@ -37,7 +60,9 @@ namespace Nimbus {
 		std::vector<basic::GenomicRegion*> BEDReader( std::string fname ) ;
 
 		/* 
-		 * Reads the amplicons from the bed and fasta file
+		 * Reads the amplicons from the bed and fasta file. If the fasta file has a
+		 * samtools faidx index (fasta.fai), only the bases of the amplicons are read
+		 * and the header is built from the index; otherwise the whole fasta is read.
 		 */
 		void AmpliconReader( std::vector<basic::Amplicon*>& amplicons, alignment::SAMHeader& header, std::string fname_bed, std::string fname_fasta ) ;
 
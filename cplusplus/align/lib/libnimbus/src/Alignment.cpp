@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "Alignment.h"
+#include "Utils.h"
 
 
 namespace Nimbus {
@@ -33,6 +34,16 @@ namespace Nimbus {
 			return rval ;
 		}		
 
+		void AlignmentScore::band( int d, int n_subj, int n_qry, int& lo, int& hi ) const {
+			if( _band > 0 ) {
+				lo = d - _band ;
+				hi = d + _band ;
+			} else {
+				lo = -n_qry ;
+				hi = n_subj ;
+			}
+		}
+
 		std::string AlignmentScore::str() const { 
 			
 			std::stringstream ss ;
@@ -63,8 +74,8 @@ namespace Nimbus {
 		 */
 		int Alignment::getAlignmentScore( int x, int y) const {
 			int rval = -1 ;
-			if( scores != NULL && x < (int)subject.size() + 1 && y < (int)query.size() + 1 ) {
-				rval = scores[x][y] ;
+			if( _filled() && x < (int)subject.size() + 1 && y < (int)query.size() + 1 ) {
+				rval = _score( x, y ) ;
 			}
 			return rval ;
 		}
@@ -83,19 +94,19 @@ namespace Nimbus {
 			std::vector< std::pair<int,int> >* rval = new std::vector< std::pair<int,int> >() ;
 
 			// if we have scores and directions
-			if( scores != NULL && directions != NULL ) {
+			if( _filled() ) {
 
 				// get the x and y coordinates 
 				int cur_i = x ;
 				int cur_j = y ;
 
 				// while we did not hit a bound
-				while( directions[cur_i][cur_j] != d_BOUND ) {
+				while( _direction( cur_i, cur_j ) != d_BOUND ) {
 					// add the coordinates to the vector
 					rval->push_back( std::pair<int,int>( cur_i, cur_j ) ) ;
 
 					// get the directions
-					switch( directions[cur_i][cur_j] ) {
+					switch( _direction( cur_i, cur_j ) ) {
 					case d_DIAG:
 						cur_i-- ;
 						cur_j-- ;						
@@ -135,7 +146,7 @@ namespace Nimbus {
 			std::vector<char> rval = std::vector<char>() ; 
 			
 			// return an empty cigar if the directions were not defined
-			if( directions == NULL ) {
+			if( ! _filled() ) {
 				return rval ;
 			}
 
@@ -165,11 +176,12 @@ namespace Nimbus {
 				}
 				
 				// add the CIGAR characters for match, insertion and deletion
-				if( directions[cur_i][cur_j] == d_DIAG ) {
+				int d = _direction( cur_i, cur_j ) ;
+				if( d == d_DIAG ) {
 					rval.push_back( 'M' ) ; 
-				} else if( directions[cur_i][cur_j] == d_HORIZONTAL ) {					
+				} else if( d == d_HORIZONTAL ) {					
 					rval.push_back( 'D' ) ;
-				} else if( directions[cur_i][cur_j] == d_VERTICAL ) {
+				} else if( d == d_VERTICAL ) {
 					rval.push_back( 'I' ) ;
 				}
 
@@ -192,31 +204,136 @@ namespace Nimbus {
 			return rval ;
 		}
 
+		/*
+		 Count the differences in a single walk over the path 
+		 */
+		int Alignment::QEditDistance( const std::vector< std::pair<int,int> >& path, std::string& md ) const {
+			md.clear() ;
+			if( ! _filled() ) return -1 ;
+			if( path.empty() ) return 0 ;
+
+			// the soft clipped bases are not differences, like in the MD string
+			int rval     = 0 ;
+			int matches  = 0 ;
+			bool deleted = false ;
+
+			for( unsigned int i=0; i<path.size(); i++ ) {
+				int cur_i = path[i].first ;
+				int cur_j = path[i].second ;
+				char r    = subject[cur_i - 1] ;
+				int d     = _direction( cur_i, cur_j ) ;
+
+				if( d == d_DIAG ) {
+					// unknown bases are not counted as differences
+					char q = query[cur_j - 1] ;
+					if( r == q || r == 'N' || q == 'N' ) {
+						matches++ ;
+					} else {
+						utils::appendInt( md, matches ) ;
+						md += r ;
+						matches = 0 ;
+						rval++ ;
+					}
+					deleted = false ;
+				} else if( d == d_HORIZONTAL ) {
+					if( ! deleted ) {
+						utils::appendInt( md, matches ) ;
+						md += '^' ;
+						matches = 0 ;
+					}
+					md += r ;
+					deleted = true ;
+					rval++ ;
+				} else if( d == d_VERTICAL ) {
+					deleted = false ;
+					rval++ ;
+				}
+			}
+			utils::appendInt( md, matches ) ;
+			return rval ;
+		}
+
+		bool Alignment::_filled() const {
+			return scores != NULL && directions != NULL ;
+		}
+
+		int Alignment::_score( int i, int j ) const {
+			return scores[i][j] ;
+		}
+
+		int Alignment::_direction( int i, int j ) const {
+			return directions[i][j] ;
+		}
+
 		/**
 		 * clean the matrix
 		 *
 		 **/
 		void Alignment::_clean_matrix() {
 
-			// clear the scores
-			if( scores != NULL ) {
-				for( unsigned int i=0; i<subject.size()+1; i++ ) {
-					delete[] scores[i] ;
+			// matrices borrowed from a workspace are returned by resetting the workspace
+			if( workspace == NULL ) {
+
+				// clear the scores
+				if( scores != NULL ) {
+					delete[] _scells ;
+					delete[] scores ;
 				}
-				delete[] scores ;
-				scores = NULL ;
-			}
 
-			// clear the directions matrix
-			if( directions != NULL ) {
-				for( unsigned int i=0; i<subject.size()+1; i++ ) {
-					delete[] directions[i] ;
+				// clear the directions matrix
+				if( directions != NULL ) {
+					delete[] _dcells ;
+					delete[] directions ;
 				}
-				delete[] directions ;
-				directions = NULL ;
 			}
-			subject = "" ;
-			query   = "" ;
+			scores     = NULL ;
+			directions = NULL ;
+			_scells    = NULL ;
+			_dcells    = NULL ;
+			subject    = "" ;
+			query      = "" ;
+		}
+
+		/**
+		 * allocate the matrices
+		 *
+		 **/
+		void Alignment::_alloc_matrix() {
+
+			// get the number of rows and columns in the matrix
+			int n_subj = (int) subject.size() + 1 ;
+			int n_qry  = (int) query.size() + 1 ;
+
+			// clean the matrix if required, without losing the sequences
+			if( scores != NULL || directions != NULL ) {
+				std::string s = subject ;
+				std::string q = query ;
+				_clean_matrix() ;
+				subject = s ;
+				query   = q ;
+			}
+
+			// the row pointers and one contiguous block of cells per matrix
+			int* s_cells ;
+			int* d_cells ;
+			if( workspace != NULL ) {
+				scores     = workspace->allocate<int*>( n_subj ) ;
+				directions = workspace->allocate<int*>( n_subj ) ;
+				s_cells    = workspace->allocate<int>( n_subj * n_qry ) ;
+				d_cells    = workspace->allocate<int>( n_subj * n_qry ) ;
+			} else {
+				scores     = new int*[n_subj] ;
+				directions = new int*[n_subj] ;
+				s_cells    = new int[n_subj * n_qry] ;
+				d_cells    = new int[n_subj * n_qry] ;
+			}
+
+			for( int i=0; i<n_subj; i++ ) {
+				scores[i]     = s_cells + i * n_qry ;
+				directions[i] = d_cells + i * n_qry ;
+			}
+			_scells = s_cells ;
+			_dcells = d_cells ;
 		}
 
 		std::string Alignment::formatScoreMatrix( ) {
@@ -244,7 +361,7 @@ namespace Nimbus {
 					}
 					//
 					for( int j=0; j<n_qry; j++ ) {
-						 ss << '\t' << scores[i][j] ;
+						 ss << '\t' << _score( i, j ) ;
 					}
 					ss << '\n' ;
 				}
@@ -280,7 +397,7 @@ namespace Nimbus {
 					}
 					//
 					for( int j=0; j<n_qry; j++ ) {
-						 ss << '\t' << directions[i][j] ;
+						 ss << '\t' << _direction( i, j ) ;
 					}
 					ss << '\n' ;
 				}
@@ -316,7 +433,7 @@ namespace Nimbus {
 							}
 						}
 						// print the score and direction at coordinate i,j
-						rval << " " << scores[i][j] << "(" << directions[i][j] << ")" ;						
+						rval << " " << _score( i, j ) << "(" << _direction( i, j ) << ")" ;						
 					}
 
 					// end the line
@@ -341,21 +458,81 @@ namespace Nimbus {
 		 * 
 		 */
 		void SmithWaterman::fillMatrix( std::string s, std::string q ) {
+			fillMatrix( s, q, std::pair<int,int>( (int) s.size(), (int) q.size() ) ) ;
+		}
+
+		void SmithWaterman::fillMatrix( std::string s, std::string q, std::pair<int,int> end ) {
+			fillMatrix( s, q, end, 0 ) ;
+		}
+
+		void SmithWaterman::fillMatrix( std::string s, std::string q, std::pair<int,int> end, int diagonal ) {
 			// set the class parameters
 			subject = s ;
 			query   = q ;
 			_max    = 0 ;
-						
-			// initialize the matrix
-			_init_matrix() ;
 
-			// set the counters
-			int n_subj = (int) subject.size() + 1 ;
-			int n_qry  = (int) query.size() + 1 ;
+			// the band of diagonals to fill
+			int lo, hi ;
+			scorecalc->band( diagonal, (int) subject.size(), (int) query.size(), lo, hi ) ;
+
+			// initialize the matrix, with a band width only the band up to 
+			// the end coordinate is kept
+			if( scorecalc->_band > 0 ) {
+				_init_band( end.first + 1, end.second + 1, lo, hi ) ;
+			} else {
+				_init_matrix() ;
+			}
+
+			// let a vectorized kernel fill the matrix if one was selected
+			if( scorecalc->_kernel != k_SCALAR ) {
+				fillDiagonals( scorecalc->_kernel, scorecalc->_match, scorecalc->_mismatch, scorecalc->_gap, _gapopen,
+								subject.substr( 0, end.first ), query.substr( 0, end.second ), 
+								lo, hi, scores, directions, _max, _coord, workspace ) ;
+			} else {
+				_fill_rows( end.first + 1, end.second + 1, lo, hi ) ;
+			}
+			// return void
+		}
+
+		int SmithWaterman::score( AlignmentScore* as, int go, const std::string& s, const std::string& q, std::pair<int,int>& end ) {
+			return score( as, go, s, q, 0, end ) ;
+		}
+
+		int SmithWaterman::score( AlignmentScore* as, int go, const std::string& s, const std::string& q, int diagonal, std::pair<int,int>& end ) {
+			return score( as, go, s, q, diagonal, end, NULL ) ;
+		}
+
+		int SmithWaterman::score( AlignmentScore* as, int go, const std::string& s, const std::string& q, int diagonal, std::pair<int,int>& end, AlignmentWorkspace* ws ) {
+			int rval = 0 ;
+			int lo, hi ;
+			end      = std::pair<int,int>( 0, 0 ) ;
+			as->band( diagonal, (int) s.size(), (int) q.size(), lo, hi ) ;
+			scoreMatrix( as->_kernel, as->_match, as->_mismatch, as->_gap, go, s, q, lo, hi, rval, end, ws ) ;
+			return rval ;
+		}
+
+		void SmithWaterman::score( AlignmentScore* as, int go, const std::vector<const std::string*>& s, const std::string& q, const std::vector<int>& diagonals, 
+									std::vector<int>& scores, std::vector< std::pair<int,int> >& ends, AlignmentWorkspace* ws ) {
+			std::vector<int> lo( s.size() ) ;
+			std::vector<int> hi( s.size() ) ;
+			for( size_t i=0; i<s.size(); i++ ) {
+				as->band( diagonals[i], (int) s[i]->size(), (int) q.size(), lo[i], hi[i] ) ;
+			}
+			scoreSubjects( as->_kernel, as->_match, as->_mismatch, as->_gap, go, s, q, lo, hi, scores, ends, ws ) ;
+		}
+
+		/*
+		 * fills the first n_subj rows and n_qry columns of the matrix row by row; 
+		 * this is the reference implementation for the vectorized kernels. Only the
+		 * cells in the band lo <= i - j <= hi are filled, the others remain 0.
+		 */
+		void SmithWaterman::_fill_rows( int n_subj, int n_qry, int lo, int hi ) {
 
 			// traverse the subject than the query
 			for( int i=1; i<n_subj; i++ ) {
-				for( int j=1; j<n_qry; j++ ) {
+				int j_first = i - hi > 1 ? i - hi : 1 ;
+				int j_last  = i - lo < n_qry - 1 ? i - lo : n_qry - 1 ;
+				for( int j=j_first; j<=j_last; j++ ) {
 					
 					//
 					//                   |   scores[i-1, j ] + scorecalc->score( '-', query[j-1]) + if( directions[i-1,j] != d_HORIZONTAL, _gapopen, 0 ) |
@@ -426,26 +603,162 @@ namespace Nimbus {
 			int n_subj = (int) subject.size() + 1 ;
 			int n_qry  = (int) query.size() + 1 ;
 
-			// clean the matrix if required
-			if( scores != NULL || directions != NULL ) _clean_matrix() ;
-
 			//initialize the matrix
-			scores     = new int*[n_subj] ;
-			directions = new int*[n_subj] ;
+			_alloc_matrix() ;
+			_rows = n_subj ;
+			_cols = n_qry ;
+			_lo   = 1 - n_qry ;
+			_hi   = n_subj - 1 ;
+
+			// fill the matrix with 0's
+			for( int x=0; x<n_subj*n_qry; x++ ) {
+				scores[0][x]     = 0 ;
+				directions[0][x] = d_BOUND ;
+			}
+		}
 
-			// fill the matrix
-			for( int i=0; i<n_subj; i++ ) {
+		/*
+		 * Initialize the cells of the band with 0's
+		 */
+		void SmithWaterman::_init_band( int rows, int cols, int lo, int hi ) {
+
+			// clean the matrix if required, without losing the sequences
+			if( scores != NULL || directions != NULL ) {
+				std::string s = subject ;
+				std::string q = query ;
+				_clean_matrix() ;
+				subject = s ;
+				query   = q ;
+			}
+			_rows = rows ;
+			_cols = cols ;
+			_lo   = lo ;
+			_hi   = hi ;
+
+			// the cells of a row follow those of the previous row; the block
+			// starts with room for the rows that start in a later column than 
+			// their offset, so the row pointers stay in the block
+			int n   = 0 ;
+			int pad = 0 ;
+			for( int i=0; i<rows; i++ ) {
+				int first = std::max( 0, i - hi - 1 ) ;
+				int last  = std::min( cols - 1, i - lo + 1 ) ;
+				if( last < first ) continue ;
+				if( first - n > pad ) pad = first - n ;
+				n += last - first + 1 ;
+			}
 
-				// add a new row
-				scores[i]     = new int[n_qry] ;
-				directions[i] = new int[n_qry] ;
+			int size = std::max( 1, pad + n ) ;
+			if( workspace != NULL ) {
+				scores     = workspace->allocate<int*>( rows ) ;
+				directions = workspace->allocate<int*>( rows ) ;
+				_scells    = workspace->allocate<int>( size ) ;
+				_dcells    = workspace->allocate<int>( size ) ;
+			} else {
+				scores     = new int*[rows] ;
+				directions = new int*[rows] ;
+				_scells    = new int[size] ;
+				_dcells    = new int[size] ;
+			}
 
-				// fill the rows with 0's
-				for( int j=0; j<n_qry; j++ ) {
-					scores[i][j]     = 0 ;
-					directions[i][j] = d_BOUND ;
+			int offset = pad ;
+			for( int i=0; i<rows; i++ ) {
+				int first = std::max( 0, i - hi - 1 ) ;
+				int last  = std::min( cols - 1, i - lo + 1 ) ;
+				if( last < first ) {
+					scores[i]     = _scells + offset ;
+					directions[i] = _dcells + offset ;
+					continue ;
+				}
+				scores[i]     = _scells + offset - first ;
+				directions[i] = _dcells + offset - first ;
+				offset += last - first + 1 ;
+			}
+
+			// fill the band with 0's
+			std::fill( _scells + pad, _scells + pad + n, 0 ) ;
+			std::fill( _dcells + pad, _dcells + pad + n, (int) d_BOUND ) ;
+		}
+
+		int SmithWaterman::_score( int i, int j ) const {
+			return _stored( i, j ) ? scores[i][j] : 0 ;
+		}
+
+		int SmithWaterman::_direction( int i, int j ) const {
+			return _stored( i, j ) ? directions[i][j] : (int) d_BOUND ;
+		}
+
+		//
+		//
+		// Specific alignments: ungapped
+		//
+		//
+
+		int UngappedAlignment::mismatches( const std::string& s, const std::string& q, int diagonal, int limit ) {
+			int n = (int) q.size() ;
+			if( diagonal < 0 || diagonal + n > (int) s.size() ) return -1 ;
+
+			// unknown bases are matches, like in the alignment score
+			int rval = 0 ;
+			const char* r = s.data() + diagonal ;
+			for( int j=0; j<n && rval<=limit; j++ ) {
+				if( r[j] != q[j] && r[j] != 'N' && q[j] != 'N' ) rval++ ;
+			}
+			return rval ;
+		}
+
+		bool UngappedAlignment::fillDiagonal( const std::string& s, const std::string& q, int diagonal, int mismatches ) {
+			int mm = UngappedAlignment::mismatches( s, q, diagonal, mismatches ) ;
+			if( mm < 0 || mm > mismatches ) return false ;
+
+			subject   = s ;
+			query     = q ;
+			_diagonal = diagonal ;
+			_max      = 0 ;
+			_coord    = std::pair<int,int>( 0, 0 ) ;
+
+			// the first cell is on the boundary of the matrix
+			int n = (int) query.size() ;
+			_scores.assign( n + 1, 0 ) ;
+			_directions.assign( n + 1, d_BOUND ) ;
+
+			// the Smith-Waterman recurrence without the gaps: a diagonal step 
+			// is preferred as long as the score does not drop below 0
+			for( int j=1; j<=n; j++ ) {
+				int i = j + diagonal ;
+				int s_diagonal = _scores[j-1] + scorecalc->score( subject[i-1], query[j-1] ) ;
+				if( s_diagonal >= 0 ) {
+					_scores[j]     = s_diagonal ;
+					_directions[j] = d_DIAG ;
+				}
+
+				// record the first top position
+				if( _scores[j] > _max ) {
+					_max   = _scores[j] ;
+					_coord = std::pair<int,int>( i, j ) ;
 				}
 			}
+
+			// a soft clipped start is traced back through cells with score 0,
+			// where Smith-Waterman may continue with a gap instead
+			bool rval = _max > 0 ;
+			for( int j=1; j<=_coord.second && rval; j++ ) {
+				if( _directions[j] != d_DIAG ) rval = false ;
+			}
+			if( ! rval ) _directions.clear() ;
+			return rval ;
+		}
+
+		bool UngappedAlignment::_filled() const {
+			return ! _directions.empty() ;
+		}
+
+		int UngappedAlignment::_score( int i, int j ) const {
+			return i - j == _diagonal && j >= 0 && j < (int) _scores.size() ? _scores[j] : 0 ;
+		}
+
+		int UngappedAlignment::_direction( int i, int j ) const {
+			return i - j == _diagonal && j >= 0 && j < (int) _directions.size() ? _directions[j] : (int) d_BOUND ;
 		}
 
 		//
@@ -523,25 +836,13 @@ namespace Nimbus {
 			int n_subj = (int) subject.size() + 1 ;
 			int n_qry  = (int) query.size() + 1 ;
 
-			// clean the matrix if required
-			if( scores != NULL || directions != NULL ) _clean_matrix() ;
-
 			//initialize the matrix
-			scores     = new int*[n_subj] ;
-			directions = new int*[n_subj] ;
-
-			// fill the matrix
-			for( int i=0; i<n_subj; i++ ) {
-
-				// add a new row
-				scores[i]     = new int[n_qry] ;
-				directions[i] = new int[n_qry] ;
+			_alloc_matrix() ;
 
-				// fill the rows with 0's
-				for( int j=0; j<n_qry; j++ ) {
-					scores[i][j]     = 0 ;
-					directions[i][j] = d_BOUND ;
-				}
+			// fill the matrix with 0's
+			for( int x=0; x<n_subj*n_qry; x++ ) {
+				scores[0][x]     = 0 ;
+				directions[0][x] = d_BOUND ;
 			}
 
 			// set the important 0 row and 0 column bounds
@@ -631,25 +932,13 @@ namespace Nimbus {
 			int n_subj = (int) subject.size() + 1 ;
 			int n_qry  = (int) query.size() + 1 ;
 
-			// clean the matrix if required
-			if( scores != NULL || directions != NULL ) _clean_matrix() ;
-
 			//initialize the matrix
-			scores     = new int*[n_subj] ;
-			directions = new int*[n_subj] ;
-
-			// fill the matrix
-			for( int i=0; i<n_subj; i++ ) {
-
-				// add a new row
-				scores[i]     = new int[n_qry] ;
-				directions[i] = new int[n_qry] ;
+			_alloc_matrix() ;
 
-				// fill the rows with 0's
-				for( int j=0; j<n_qry; j++ ) {
-					scores[i][j]     = 0 ;
-					directions[i][j] = d_BOUND ;
-				}
+			// fill the matrix with 0's
+			for( int x=0; x<n_subj*n_qry; x++ ) {
+				scores[0][x]     = 0 ;
+				directions[0][x] = d_BOUND ;
 			}
 
 			// set the important 0 row and 0 column bounds
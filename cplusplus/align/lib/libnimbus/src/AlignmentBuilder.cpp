@@ -12,6 +12,42 @@ namespace Nimbus {
 	// alignment set
 	//
 
+	/*
+	 The number of mismatches on the diagonal below which no alignment with a gap
+	 can score higher than the alignment without gaps: a gap costs more than the 
+	 mismatches lose compared to matches.
+	 */
+	static int ungappedLimit( AlignmentScore* scores, int gapopen ) {
+		int gap  = -( scores->_gap + gapopen ) ;
+		int loss = scores->_match - scores->_mismatch ;
+		int rval = gap > 0 && loss > 0 ? ( gap - 1 ) / loss : -1 ;
+		return rval < scores->_ungapped ? rval : scores->_ungapped ;
+	}
+
+	/*
+	 Aligns q to the amplicon sequence a on the diagonal where it is expected. A
+	 read with few mismatches on the diagonal is aligned without gaps, unless the
+	 score only pass found a different alignment; other reads are aligned with 
+	 Smith-Waterman up to the end coordinate.
+	 */
+	static Alignment* alignRead( AlignmentScore* scores, int gapopen, AlignmentWorkspace* ws, const string& a, const string& q, int diagonal, int score, pair<int,int> end, bool& ungapped ) {
+		ungapped = false ;
+		int limit = ungappedLimit( scores, gapopen ) ;
+		if( limit >= 0 ) {
+			UngappedAlignment* ua = new UngappedAlignment( scores ) ;
+			if( ua->fillDiagonal( a, q, diagonal, limit ) && 
+				( score == -1 || ( ua->getAlignmentScore() == score && ua->bestAlignment() == end ) ) ) {
+				ungapped = true ;
+				return ua ;
+			}
+			delete ua ;
+		}
+
+		SmithWaterman* sw = new SmithWaterman( scores, gapopen, ws ) ;
+		sw->fillMatrix( a, q, end, diagonal ) ;
+		return sw ;
+	}
+
 	AlnSet::AlnSet() {
 		amplicon    = NULL ;
 		f_alignment = NULL ;
@@ -20,6 +56,13 @@ namespace Nimbus {
 		r_path      = NULL ;
 		f_record    = NULL ;
 		r_record    = NULL ;
+		f_score     = -1 ;
+		r_score     = -1 ;
+		f_end       = pair<int,int>( 0, 0 ) ;
+		r_end       = pair<int,int>( 0, 0 ) ;
+		f_ungapped  = false ;
+		r_ungapped  = false ;
+		workspace   = NULL ;
 	}
 
 	AlnSet::AlnSet( Amplicon* a ) {
@@ -30,6 +73,30 @@ namespace Nimbus {
 		r_path      = NULL ;
 		f_record    = NULL ;
 		r_record    = NULL ;
+		f_score     = -1 ;
+		r_score     = -1 ;
+		f_end       = pair<int,int>( 0, 0 ) ;
+		r_end       = pair<int,int>( 0, 0 ) ;
+		f_ungapped  = false ;
+		r_ungapped  = false ;
+		workspace   = NULL ;
+	}
+
+	AlnSet::AlnSet( Amplicon* a, AlignmentWorkspace* ws ) {
+		amplicon    = a ;
+		f_alignment = NULL ;
+		r_alignment = NULL ;
+		f_path      = NULL ;
+		r_path      = NULL ;
+		f_record    = NULL ;
+		r_record    = NULL ;
+		f_score     = -1 ;
+		r_score     = -1 ;
+		f_end       = pair<int,int>( 0, 0 ) ;
+		r_end       = pair<int,int>( 0, 0 ) ;
+		f_ungapped  = false ;
+		r_ungapped  = false ;
+		workspace   = ws ;
 	}
 
 	AlnSet::~AlnSet() {		
@@ -47,10 +114,17 @@ namespace Nimbus {
 
 	void AlnSet::align( AlignmentScore* scores, int gapopen, Read* f ) {
 		if( amplicon != NULL ) {
+
+			// if the read was scored before, we only need the matrix up to the end of the alignment
+			pair<int,int> end = f_score != -1 ? f_end : pair<int,int>( (int) amplicon->sequence().size(), (int) f->size() ) ;
+
+			// the seeded read starts at the start of the amplicon, its reverse complement ends at the end
+			const string& aseq = amplicon->sequence() ;
 			if( amplicon->forward() ) {
-				f_alignment = new SmithWaterman( scores, gapopen, amplicon->sequence(), f->sequence() ) ;
+				f_alignment = alignRead( scores, gapopen, workspace, aseq, f->sequence(), 0, f_score, end, f_ungapped ) ;
 			} else {
-				f_alignment = new SmithWaterman( scores, gapopen, amplicon->sequence(), f->rc_sequence() ) ;
+				int diagonal = (int) aseq.size() - (int) f->size() ;
+				f_alignment = alignRead( scores, gapopen, workspace, aseq, f->rc_sequence(), diagonal, f_score, end, f_ungapped ) ;
 			}
 		}
 	}
@@ -60,14 +134,55 @@ namespace Nimbus {
 			align( scores, gapopen, f ) ;
 
 			// align the second read
+			if( r != NULL ) {
+				pair<int,int> end = r_score != -1 ? r_end : pair<int,int>( (int) amplicon->sequence().size(), (int) r->size() ) ;
+				const string& aseq = amplicon->sequence() ;
+				if( amplicon->forward() ) {
+					int diagonal = (int) aseq.size() - (int) r->size() ;
+					r_alignment = alignRead( scores, gapopen, workspace, aseq, r->rc_sequence(), diagonal, r_score, end, r_ungapped ) ;
+				} else {
+					r_alignment = alignRead( scores, gapopen, workspace, aseq, r->sequence(), 0, r_score, end, r_ungapped ) ;
+				}
+			}
+		}
+	}
+
+	void AlnSet::score( AlignmentScore* scores, int gapopen, Read* f, Read* r ) {
+		if( amplicon != NULL ) {
+			const string& aseq = amplicon->sequence() ;
+
+			// score the first read
+			if( amplicon->forward() ) {
+				f_score = SmithWaterman::score( scores, gapopen, aseq, f->sequence(), 0, f_end, workspace ) ;
+			} else {
+				f_score = SmithWaterman::score( scores, gapopen, aseq, f->rc_sequence(), (int) aseq.size() - (int) f->size(), f_end, workspace ) ;
+			}
+
+			// score the second read
 			if( r != NULL && amplicon->forward() ) {
-				r_alignment = new SmithWaterman( scores, gapopen, amplicon->sequence(), r->rc_sequence() ) ;
+				r_score = SmithWaterman::score( scores, gapopen, aseq, r->rc_sequence(), (int) aseq.size() - (int) r->size(), r_end, workspace ) ;
 			} else if( r != NULL && !amplicon->forward() ) {
-				r_alignment = new SmithWaterman( scores, gapopen, amplicon->sequence(), r->sequence() ) ;
+				r_score = SmithWaterman::score( scores, gapopen, aseq, r->sequence(), 0, r_end, workspace ) ;
 			}
 		}
 	}
 
+	bool AlnSet::scored() const {
+		return f_alignment != NULL || f_score != -1 ;
+	}
+
+	int AlnSet::combinedScore() const {
+		int rval = 0 ;
+		if( f_alignment != NULL ) {
+			rval = f_alignment->getAlignmentScore() ;
+			if( r_alignment != NULL ) rval += r_alignment->getAlignmentScore() ;
+		} else if( f_score != -1 ) {
+			rval = f_score ;
+			if( r_score != -1 ) rval += r_score ;
+		}
+		return rval ;
+	}
+
 	void AlnSet::SAMrecord( Read* f, Read* r ) {	
 		if( amplicon != NULL && f_alignment != NULL && r_alignment != NULL ) {
 			SAMrecord_f( f ) ;
@@ -87,22 +202,17 @@ namespace Nimbus {
 
 			// set the SAM records
 			f_record = new SAMRecord( *f, false, amplicon->chromosome(), pos, amplicon->forward() ) ;
-			f_record->cigar( f_alignment->QCIGAR() ) ;
+			f_record->cigar( f_alignment->QCIGAR( *f_path ) ) ;
 			f_record->mapq( 150 ) ;
 			f_record->add_tag( "am", 'Z', amplicon->format() ) ;
 			f_record->add_tag( "AS", 'i', f_alignment->getAlignmentScore() ) ;
 			f_record->setProperlyAligned() ;
 			f_record->setFirstSegmentInTemplate() ;
 
-			// add the nr tag using the Levenshtein distance
-			int start     = f_path->at(idx).first - 1 ;
-			int len       = f_path->at( utils::QueryEnd(*f_path) ).first  - start + 1 ;
-			string rseq   = amplicon->sequence().substr( start, len ) ;
-			Levenshtein l = Levenshtein( rseq, f_record->sequence() ) ;
-			f_record->add_tag( "NM", 'i', l.distance() ) ;
-
-			// add the reference sequence tag (rs)
-			// f_record->add_tag( "rs", 'Z', rseq ) ;
+			// add the NM and MD tags from the differences along the path
+			string md ;
+			f_record->add_tag( "NM", 'i', f_alignment->QEditDistance( *f_path, md ) ) ;
+			f_record->add_tag( "MD", 'Z', md ) ;
 		}
 	}
 
@@ -122,15 +232,10 @@ namespace Nimbus {
 			r_record->setProperlyAligned() ;
 			r_record->setLastSegmentInTemplate() ;
 
-			// add the nr tag using the Levenshtein distance	
-			int start     = r_path->at(idx).first - 1 ;
-			int len       = r_path->at( utils::QueryEnd(*r_path) ).first - start + 1  ;
-			string rseq   = amplicon->sequence().substr( start, len ) ;				
-			Levenshtein l = Levenshtein( rseq, r_record->sequence() ) ;
-			r_record->add_tag( "NM", 'i', l.distance() ) ;
-
-			// add the reference sequence tag (rs)
-			// r_record->add_tag( "rs", 'Z', rseq ) ;
+			// add the NM and MD tags from the differences along the path
+			string md ;
+			r_record->add_tag( "NM", 'i', r_alignment->QEditDistance( *r_path, md ) ) ;
+			r_record->add_tag( "MD", 'Z', md ) ;
 		}
 	}
 
@@ -139,21 +244,31 @@ namespace Nimbus {
 	//
 	
 	AlignmentBuilder::AlignmentBuilder() {
-		forward = NULL ;
-		reverse = NULL ;
-		entries = vector<AlnSet>() ;
+		forward   = NULL ;
+		reverse   = NULL ;
+		entries   = vector<AlnSet>() ;
+		workspace = NULL ;
 	}
 
 	AlignmentBuilder::AlignmentBuilder( Read* f ) {
-		forward = f ;
-		reverse = NULL ;
-		entries = vector<AlnSet>() ;
+		forward   = f ;
+		reverse   = NULL ;
+		entries   = vector<AlnSet>() ;
+		workspace = NULL ;
 	}
 	
 	AlignmentBuilder::AlignmentBuilder( Read* f, Read* r ) {
-		forward = f ;
-		reverse = r ;
-		entries = vector<AlnSet>() ;
+		forward   = f ;
+		reverse   = r ;
+		entries   = vector<AlnSet>() ;
+		workspace = NULL ;
+	}
+
+	AlignmentBuilder::AlignmentBuilder( Read* f, Read* r, AlignmentWorkspace* ws ) {
+		forward   = f ;
+		reverse   = r ;
+		entries   = vector<AlnSet>() ;
+		workspace = ws ;
 	}
 	
 	AlignmentBuilder::~AlignmentBuilder(void) {
@@ -165,7 +280,7 @@ namespace Nimbus {
 	}
 
 	void AlignmentBuilder::add( Amplicon* a ) {
-		entries.push_back( AlnSet(a) ) ;
+		entries.push_back( AlnSet(a, workspace) ) ;
 	}
 
 	void AlignmentBuilder::align( AlignmentScore* scores, int gapopen ) {
@@ -174,6 +289,53 @@ namespace Nimbus {
 		}
 	}
 
+	void AlignmentBuilder::score( AlignmentScore* scores, int gapopen ) {
+		if( entries.size() > 1 && scores->_kernel != k_SCALAR ) {
+			// score each read against all amplicons at once
+			score( scores, gapopen, forward, true ) ;
+			score( scores, gapopen, reverse, false ) ;
+		} else {
+			for( vector<AlnSet>::iterator it=entries.begin(); it!=entries.end(); ++it ) {
+				it->score( scores, gapopen, forward, reverse ) ;
+			}
+		}
+	}
+
+	void AlignmentBuilder::score( AlignmentScore* scores, int gapopen, Read* read, bool first ) {
+		if( read == NULL ) return ;
+
+		// the read is aligned as is to the amplicons on its own strand, and reverse 
+		// complemented to the others: first on the start, the reverse complement on the end
+		for( int strand=0; strand<2; strand++ ) {
+			bool own = ( strand == 0 ) ;
+			const string& q = own ? read->sequence() : read->rc_sequence() ;
+
+			vector<AlnSet*> sets ;
+			vector<const string*> subjects ;
+			vector<int> diagonals ;
+			for( vector<AlnSet>::iterator it=entries.begin(); it!=entries.end(); ++it ) {
+				if( it->amplicon == NULL || ( it->amplicon->forward() == first ) != own ) continue ;
+				sets.push_back( &(*it) ) ;
+				subjects.push_back( &it->amplicon->sequence() ) ;
+				diagonals.push_back( own ? 0 : (int) subjects.back()->size() - (int) q.size() ) ;
+			}
+			if( sets.empty() ) continue ;
+
+			vector<int> s ;
+			vector< pair<int,int> > e ;
+			SmithWaterman::score( scores, gapopen, subjects, q, diagonals, s, e, workspace ) ;
+			for( size_t i=0; i<sets.size(); i++ ) {
+				if( first ) {
+					sets[i]->f_score = s[i] ;
+					sets[i]->f_end   = e[i] ;
+				} else {
+					sets[i]->r_score = s[i] ;
+					sets[i]->r_end   = e[i] ;
+				}
+			}
+		}
+	}
+
 
 	int AlignmentBuilder::best() {
 		int rval = -1 ;
@@ -182,17 +344,13 @@ namespace Nimbus {
 		for( unsigned int i=0; i<entries.size(); i++ ) {
 
 			// only consider initialized alignments
-			if( entries[i].f_alignment != NULL )  {
+			if( entries[i].scored() )  {
 
 				// set rval to the first initialized entry, if not defined 
 				if( rval == -1 ) rval = i ; 
 
 				// record the scores
-				if(entries[i].r_alignment != NULL)  {
-					scores[i] = entries[i].r_alignment->getAlignmentScore() + entries[i].f_alignment->getAlignmentScore() ;
-				} else {
-					scores[i] = entries[i].f_alignment->getAlignmentScore() ;
-				}
+				scores[i] = entries[i].combinedScore() ;
 
 				if( scores[i] > scores[rval] ) rval = (int) i ;
 			}
@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include "AlignmentCache.h"
+
+namespace Nimbus {
+
+	using namespace std ;
+	using namespace basic ;
+	using namespace alignment ;
+
+	AlignmentCache::AlignmentCache( size_t capacity ) {
+		_capacity = ( capacity + SHARDS - 1 ) / SHARDS ;
+		_lookups.store( 0 ) ;
+		_hits.store( 0 ) ;
+		for( size_t i=0; i<SHARDS; i++ ) _shards.push_back( new _Shard() ) ;
+	}
+
+	AlignmentCache::~AlignmentCache() {
+		for( vector<_Shard*>::iterator it=_shards.begin(); it!=_shards.end(); ++it ) {
+			for( list<_Entry>::iterator e=(*it)->entries.begin(); e!=(*it)->entries.end(); ++e ) {
+				_clear( *e ) ;
+			}
+			delete *it ;
+		}
+	}
+
+	bool AlignmentCache::get( const string& f, const string& r, Amplicon*& amplicon, SAMRecord*& f_record, SAMRecord*& r_record ) {
+		bool rval  = false ;
+		string key = _key( f, r ) ;
+		_Shard* s  = _shard( key ) ;
+		_lookups.fetch_add( 1, memory_order_relaxed ) ;
+		{
+			lock_guard<mutex> guard( s->m ) ;
+			unordered_map< string, list<_Entry>::iterator >::iterator it = s->index.find( key ) ;
+			if( it != s->index.end() ) {
+				s->entries.splice( s->entries.begin(), s->entries, it->second ) ;
+				amplicon = it->second->amplicon ;
+				f_record = _copy( it->second->f_record ) ;
+				r_record = _copy( it->second->r_record ) ;
+				rval     = true ;
+			}
+		}
+		if( rval ) _hits.fetch_add( 1, memory_order_relaxed ) ;
+		return rval ;
+	}
+
+	void AlignmentCache::put( const string& f, const string& r, Amplicon* amplicon, const SAMRecord* f_record, const SAMRecord* r_record ) {
+		if( _capacity == 0 ) return ;
+
+		// copy the records without the read names and qualities
+		_Entry e ;
+		e.key      = _key( f, r ) ;
+		e.amplicon = amplicon ;
+		e.f_record = _copy( f_record ) ;
+		e.r_record = _copy( r_record ) ;
+		if( e.f_record != NULL ) e.f_record->setRead( Read(), false ) ;
+		if( e.r_record != NULL ) e.r_record->setRead( Read(), false ) ;
+
+		_Shard* s = _shard( e.key ) ;
+		lock_guard<mutex> guard( s->m ) ;
+
+		// another thread may have added the pair meanwhile
+		if( s->index.count( e.key ) > 0 ) {
+			_clear( e ) ;
+			return ;
+		}
+
+		s->entries.push_front( e ) ;
+		s->index[ e.key ] = s->entries.begin() ;
+		if( s->entries.size() > _capacity ) {
+			s->index.erase( s->entries.back().key ) ;
+			_clear( s->entries.back() ) ;
+			s->entries.pop_back() ;
+		}
+	}
+
+	size_t AlignmentCache::lookups() const {
+		return _lookups.load() ;
+	}
+
+	size_t AlignmentCache::hits() const {
+		return _hits.load() ;
+	}
+
+	string AlignmentCache::_key( const string& f, const string& r ) {
+		string rval ;
+		rval.reserve( f.size() + r.size() + 1 ) ;
+		rval += f ;
+		rval += '\t' ;
+		rval += r ;
+		return rval ;
+	}
+
+	AlignmentCache::_Shard* AlignmentCache::_shard( const string& key ) const {
+		return _shards[ hash<string>()( key ) % SHARDS ] ;
+	}
+
+	SAMRecord* AlignmentCache::_copy( const SAMRecord* r ) {
+		return r != NULL ? new SAMRecord( *r ) : NULL ;
+	}
+
+	void AlignmentCache::_clear( _Entry& e ) {
+		if( e.f_record != NULL ) delete e.f_record ;
+		if( e.r_record != NULL ) delete e.r_record ;
+		e.f_record = NULL ;
+		e.r_record = NULL ;
+	}
+
+}
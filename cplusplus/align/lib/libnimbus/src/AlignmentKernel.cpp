@@ -0,0 +1,932 @@
+#include "stdafx.h"
+#include "Alignment.h"
+#include "AlignmentKernel.h"
+
+#include <string.h>
+#include <climits>
+#include <cstdlib>
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define NIMBUS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace Nimbus {
+
+	namespace alignment {
+
+		//
+		//
+		// Kernel selection
+		//
+		//
+
+		bool kernelSupported( kernel_t k ) {
+			bool rval = false ;
+			switch( k ) {
+			case k_AUTO:
+			case k_SCALAR:
+				rval = true ;
+				break ;
+#ifdef NIMBUS_X86_KERNELS
+			case k_SSE41:
+				rval = __builtin_cpu_supports( "sse4.1" ) ;
+				break ;
+			case k_AVX2:
+				rval = __builtin_cpu_supports( "avx2" ) ;
+				break ;
+#endif
+			default:
+				break ;
+			}
+			return rval ;
+		}
+
+		kernel_t resolveKernel( kernel_t k ) {
+			kernel_t rval = k ;
+
+			// fall back to the next best kernel if the requested one is not available
+			if( rval == k_AUTO || ! kernelSupported(rval) ) {
+				if( kernelSupported( k_AVX2 ) ) {
+					rval = k_AVX2 ;
+				} else if( kernelSupported( k_SSE41 ) ) {
+					rval = k_SSE41 ;
+				} else {
+					rval = k_SCALAR ;
+				}
+			}
+			return rval ;
+		}
+
+		bool kernelFromString( std::string name, kernel_t& k ) {
+			bool rval = true ;
+			if( name == "auto" ) {
+				k = k_AUTO ;
+			} else if( name == "scalar" ) {
+				k = k_SCALAR ;
+			} else if( name == "sse41" ) {
+				k = k_SSE41 ;
+			} else if( name == "avx2" ) {
+				k = k_AVX2 ;
+			} else {
+				rval = false ;
+			}
+			return rval ;
+		}
+
+		std::string kernelName( kernel_t k ) {
+			std::string rval = "auto" ;
+			switch( k ) {
+			case k_SCALAR:
+				rval = "scalar" ;
+				break ;
+			case k_SSE41:
+				rval = "sse41" ;
+				break ;
+			case k_AVX2:
+				rval = "avx2" ;
+				break ;
+			default:
+				break ;
+			}
+			return rval ;
+		}
+
+		//
+		//
+		// Anti-diagonal buffers
+		//
+		//
+
+		/*
+		 The anti-diagonal d holds the cells (i, d-i). The cells on diagonal d are stored
+		 at index i in a buffer, so cell (i-1,j) and (i,j-1) are found at index i-1 and i
+		 of diagonal d-1 and cell (i-1,j-1) at index i-1 of diagonal d-2.
+
+		 The query is stored reversed, so that the query bases of consecutive cells on a
+		 diagonal are consecutive in memory as well. All buffers are padded with the
+		 width of a vector so the last vector on a diagonal can be loaded and stored
+		 without checks.
+
+		 With a band, only the cells with band_lo <= i - j <= band_hi are filled. As
+		 the band moves at most one cell per diagonal, the cells just outside of the
+		 band are reset like the boundary of the matrix.
+
+		 The buffers are taken from a workspace and handed back when done.
+		 */
+		class _Diagonals {
+		public:
+			int n_subj ;
+			int n_qry ;
+			int band_lo ;
+			int band_hi ;
+			int* h[3] ;
+			int* d[3] ;
+			unsigned char* subj ;
+			unsigned char* qrev ;
+
+		private:
+			AlignmentWorkspace _own ;
+			AlignmentWorkspace* _ws ;
+			size_t _mark ;
+
+			/* the size of the buffers, including the alignment of each buffer */
+			static size_t _bytes( size_t n_subj, size_t n_qry, int width ) {
+				const size_t cl = AlignmentWorkspace::CACHELINE ;
+				return 6 * ( ( n_subj + 2 + 2 * width ) * sizeof(int) + cl ) + ( n_subj + 2 * width + cl ) + ( n_qry + 2 * width + cl ) ;
+			}
+
+		public:
+			_Diagonals( const std::string& s, const std::string& q, int lo, int hi, int width, AlignmentWorkspace* ws ) :
+				_own( ws != NULL ? 0 : _bytes( s.size(), q.size(), width ) ) {
+				n_subj  = (int) s.size() ;
+				n_qry   = (int) q.size() ;
+				band_lo = lo > 1 - n_qry ? lo : 1 - n_qry ;
+				band_hi = hi < n_subj - 1 ? hi : n_subj - 1 ;
+
+				// take the buffers from the workspace
+				_ws   = ws != NULL ? ws : &_own ;
+				_mark = _ws->mark() ;
+				int n = n_subj + 2 + 2 * width ;
+				for( int k=0; k<3; k++ ) {
+					h[k] = _ws->allocate<int>( n ) ;
+					d[k] = _ws->allocate<int>( n ) ;
+					std::fill( h[k], h[k] + n, 0 ) ;
+					std::fill( d[k], d[k] + n, (int) d_BOUND ) ;
+				}
+				subj = _ws->allocate<unsigned char>( n_subj + 2 * width ) ;
+				qrev = _ws->allocate<unsigned char>( n_qry + 2 * width ) ;
+				std::fill( subj, subj + n_subj + 2 * width, 0 ) ;
+				std::fill( qrev, qrev + n_qry + 2 * width, 0 ) ;
+				for( int i=0; i<n_subj; i++ ) subj[i] = (unsigned char) s[i] ;
+				for( int j=0; j<n_qry; j++ ) qrev[j] = (unsigned char) q[n_qry - 1 - j] ;
+			}
+
+			~_Diagonals() {
+				_ws->release( _mark ) ;
+			}
+
+			/* the first and the last subject position on diagonal k */
+			int first( int k ) const { 
+				int rval = k - n_qry > 1 ? k - n_qry : 1 ;
+				if( k + band_lo > 2 && (k + band_lo + 1) / 2 > rval ) rval = (k + band_lo + 1) / 2 ;
+				return rval ;
+			}
+
+			int last( int k ) const { 
+				int rval = k - 1 < n_subj ? k - 1 : n_subj ; 
+				if( (k + band_hi) / 2 < rval ) rval = (k + band_hi) / 2 ;
+				return rval ;
+			}
+
+			/* the first and the last diagonal that cross the band */
+			int firstDiagonal() const { 
+				int rval = 2 ;
+				if( band_lo > 0 ) rval += band_lo ;
+				if( band_hi < 0 ) rval -= band_hi ;
+				return rval ;
+			}
+
+			int lastDiagonal() const { 
+				int rval = n_subj + n_qry ;
+				if( band_hi < n_subj - n_qry ) rval -= n_subj - n_qry - band_hi ;
+				if( band_lo > n_subj - n_qry ) rval -= band_lo - n_subj + n_qry ;
+				return rval ;
+			}
+
+			/*
+			 resets the cells just outside diagonal k, which are either the
+			 boundary of the matrix or the band, or were overwritten by the 
+			 vector padding
+			 */
+			void bound( int k ) {
+				int b = k % 3 ;
+				if( first(k) - 1 <= n_subj + 1 ) {
+					h[b][first(k) - 1] = 0 ;
+					d[b][first(k) - 1] = d_BOUND ;
+				}
+				if( last(k) + 1 >= 0 ) {
+					h[b][last(k) + 1]  = 0 ;
+					d[b][last(k) + 1]  = d_BOUND ;
+				}
+			}
+
+			/*
+			 records the maximum of diagonal k if it exceeds max, or if it is equal
+			 to max but located in an earlier row, like the row by row implementation
+			 */
+			void record( int k, int dmax, int& max, std::pair<int,int>& coord ) const {
+				if( dmax > 0 && dmax >= max ) {
+					const int* hk = &h[k % 3][0] ;
+					int i = first(k) ;
+					while( hk[i] != dmax ) i++ ;
+					if( dmax > max || i < coord.first ) {
+						max   = dmax ;
+						coord = std::pair<int,int>( i, k - i ) ;
+					}
+				}
+			}
+
+			/* copies diagonal k to the score and direction matrices */
+			void store( int k, int** scores, int** directions ) const {
+				if( scores != NULL && directions != NULL ) {
+					const int* hk = &h[k % 3][0] ;
+					const int* dk = &d[k % 3][0] ;
+					for( int i=first(k); i<=last(k); i++ ) {
+						scores[i][k-i]     = hk[i] ;
+						directions[i][k-i] = dk[i] ;
+					}
+				}
+			}
+		} ;
+
+#ifdef NIMBUS_X86_KERNELS
+
+		//
+		//
+		// SSE4.1 kernel
+		//
+		//
+
+		__attribute__((target("sse4.1")))
+		static void fillDiagonalsSSE41( int match, int mismatch, int gap, int gapopen,
+										_Diagonals& m, int** scores, int** directions,
+										int& max, std::pair<int,int>& coord ) {
+
+			// the constants
+			const __m128i v_match    = _mm_set1_epi32( match ) ;
+			const __m128i v_mismatch = _mm_set1_epi32( mismatch ) ;
+			const __m128i v_gap      = _mm_set1_epi32( gap ) ;
+			const __m128i v_gapopen  = _mm_set1_epi32( gapopen ) ;
+			const __m128i v_zero     = _mm_setzero_si128() ;
+			const __m128i v_diag     = _mm_set1_epi32( d_DIAG ) ;
+			const __m128i v_vert     = _mm_set1_epi32( d_VERTICAL ) ;
+			const __m128i v_horz     = _mm_set1_epi32( d_HORIZONTAL ) ;
+			const __m128i v_base_n   = _mm_set1_epi32( 'N' ) ;
+			const __m128i v_base_gap = _mm_set1_epi32( '-' ) ;
+			const __m128i v_lanes    = _mm_setr_epi32( 0, 1, 2, 3 ) ;
+
+			// traverse the anti-diagonals
+			for( int k=m.firstDiagonal(); k<=m.lastDiagonal(); k++ ) {
+
+				int* hc = &m.h[k % 3][0] ;
+				int* dc = &m.d[k % 3][0] ;
+				const int* h1 = &m.h[(k-1) % 3][0] ;
+				const int* d1 = &m.d[(k-1) % 3][0] ;
+				const int* h2 = &m.h[(k-2) % 3][0] ;
+
+				int lo = m.first(k) ;
+				int hi = m.last(k) ;
+				__m128i v_max  = v_zero ;
+				__m128i v_last = _mm_set1_epi32( hi ) ;
+
+				for( int i=lo; i<=hi; i+=4 ) {
+
+					// the subject and query bases
+					int rb, qb ;
+					memcpy( &rb, &m.subj[i-1], sizeof(int) ) ;
+					memcpy( &qb, &m.qrev[m.n_qry - k + i], sizeof(int) ) ;
+					__m128i r = _mm_cvtepu8_epi32( _mm_cvtsi32_si128( rb ) ) ;
+					__m128i q = _mm_cvtepu8_epi32( _mm_cvtsi32_si128( qb ) ) ;
+
+					// the per base score
+					__m128i eq = _mm_or_si128( _mm_cmpeq_epi32( r, q ),
+								 _mm_or_si128( _mm_cmpeq_epi32( r, v_base_n ), _mm_cmpeq_epi32( q, v_base_n ) ) ) ;
+					__m128i gp = _mm_or_si128( _mm_cmpeq_epi32( r, v_base_gap ), _mm_cmpeq_epi32( q, v_base_gap ) ) ;
+					__m128i sc = _mm_blendv_epi8( v_mismatch, v_match, eq ) ;
+					sc = _mm_blendv_epi8( sc, v_gap, gp ) ;
+
+					// the neighbouring cells
+					__m128i h_up   = _mm_loadu_si128( (const __m128i*) (h1 + i - 1) ) ;
+					__m128i d_up   = _mm_loadu_si128( (const __m128i*) (d1 + i - 1) ) ;
+					__m128i h_left = _mm_loadu_si128( (const __m128i*) (h1 + i) ) ;
+					__m128i d_left = _mm_loadu_si128( (const __m128i*) (d1 + i) ) ;
+					__m128i h_diag = _mm_loadu_si128( (const __m128i*) (h2 + i - 1) ) ;
+
+					// horizontal, vertical and diagonal scores
+					__m128i s_h = _mm_add_epi32( _mm_add_epi32( h_up, v_gap ), _mm_andnot_si128( _mm_cmpeq_epi32( d_up, v_horz ), v_gapopen ) ) ;
+					__m128i s_v = _mm_add_epi32( _mm_add_epi32( h_left, v_gap ), _mm_andnot_si128( _mm_cmpeq_epi32( d_left, v_vert ), v_gapopen ) ) ;
+					__m128i s_d = _mm_add_epi32( h_diag, sc ) ;
+
+					// the maximum and its direction: diagonal first, then vertical and horizontal
+					__m128i lmax = _mm_max_epi32( _mm_max_epi32( s_d, s_h ), _mm_max_epi32( s_v, v_zero ) ) ;
+					__m128i dir  = _mm_setzero_si128() ;
+					dir = _mm_blendv_epi8( dir, v_horz, _mm_cmpeq_epi32( s_h, lmax ) ) ;
+					dir = _mm_blendv_epi8( dir, v_vert, _mm_cmpeq_epi32( s_v, lmax ) ) ;
+					dir = _mm_blendv_epi8( dir, v_diag, _mm_cmpeq_epi32( s_d, lmax ) ) ;
+
+					_mm_storeu_si128( (__m128i*) (hc + i), lmax ) ;
+					_mm_storeu_si128( (__m128i*) (dc + i), dir ) ;
+
+					// only consider the lanes on the diagonal for the maximum
+					__m128i valid = _mm_cmpgt_epi32( _mm_add_epi32( v_last, _mm_set1_epi32(1) ), _mm_add_epi32( v_lanes, _mm_set1_epi32(i) ) ) ;
+					v_max = _mm_max_epi32( v_max, _mm_and_si128( lmax, valid ) ) ;
+				}
+
+				// reduce the maximum of this diagonal
+				v_max = _mm_max_epi32( v_max, _mm_shuffle_epi32( v_max, _MM_SHUFFLE(1,0,3,2) ) ) ;
+				v_max = _mm_max_epi32( v_max, _mm_shuffle_epi32( v_max, _MM_SHUFFLE(2,3,0,1) ) ) ;
+				int dmax = _mm_cvtsi128_si32( v_max ) ;
+
+				// finish the diagonal
+				m.bound( k ) ;
+				m.record( k, dmax, max, coord ) ;
+				m.store( k, scores, directions ) ;
+			}
+		}
+
+		//
+		//
+		// AVX2 kernel
+		//
+		//
+
+		__attribute__((target("avx2")))
+		static void fillDiagonalsAVX2( int match, int mismatch, int gap, int gapopen,
+									   _Diagonals& m, int** scores, int** directions,
+									   int& max, std::pair<int,int>& coord ) {
+
+			// the constants
+			const __m256i v_match    = _mm256_set1_epi32( match ) ;
+			const __m256i v_mismatch = _mm256_set1_epi32( mismatch ) ;
+			const __m256i v_gap      = _mm256_set1_epi32( gap ) ;
+			const __m256i v_gapopen  = _mm256_set1_epi32( gapopen ) ;
+			const __m256i v_zero     = _mm256_setzero_si256() ;
+			const __m256i v_diag     = _mm256_set1_epi32( d_DIAG ) ;
+			const __m256i v_vert     = _mm256_set1_epi32( d_VERTICAL ) ;
+			const __m256i v_horz     = _mm256_set1_epi32( d_HORIZONTAL ) ;
+			const __m256i v_base_n   = _mm256_set1_epi32( 'N' ) ;
+			const __m256i v_base_gap = _mm256_set1_epi32( '-' ) ;
+			const __m256i v_lanes    = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ) ;
+
+			// traverse the anti-diagonals
+			for( int k=m.firstDiagonal(); k<=m.lastDiagonal(); k++ ) {
+
+				int* hc = &m.h[k % 3][0] ;
+				int* dc = &m.d[k % 3][0] ;
+				const int* h1 = &m.h[(k-1) % 3][0] ;
+				const int* d1 = &m.d[(k-1) % 3][0] ;
+				const int* h2 = &m.h[(k-2) % 3][0] ;
+
+				int lo = m.first(k) ;
+				int hi = m.last(k) ;
+				__m256i v_max  = v_zero ;
+				__m256i v_last = _mm256_set1_epi32( hi + 1 ) ;
+
+				for( int i=lo; i<=hi; i+=8 ) {
+
+					// the subject and query bases
+					__m256i r = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*) &m.subj[i-1] ) ) ;
+					__m256i q = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*) &m.qrev[m.n_qry - k + i] ) ) ;
+
+					// the per base score
+					__m256i eq = _mm256_or_si256( _mm256_cmpeq_epi32( r, q ),
+								 _mm256_or_si256( _mm256_cmpeq_epi32( r, v_base_n ), _mm256_cmpeq_epi32( q, v_base_n ) ) ) ;
+					__m256i gp = _mm256_or_si256( _mm256_cmpeq_epi32( r, v_base_gap ), _mm256_cmpeq_epi32( q, v_base_gap ) ) ;
+					__m256i sc = _mm256_blendv_epi8( v_mismatch, v_match, eq ) ;
+					sc = _mm256_blendv_epi8( sc, v_gap, gp ) ;
+
+					// the neighbouring cells
+					__m256i h_up   = _mm256_loadu_si256( (const __m256i*) (h1 + i - 1) ) ;
+					__m256i d_up   = _mm256_loadu_si256( (const __m256i*) (d1 + i - 1) ) ;
+					__m256i h_left = _mm256_loadu_si256( (const __m256i*) (h1 + i) ) ;
+					__m256i d_left = _mm256_loadu_si256( (const __m256i*) (d1 + i) ) ;
+					__m256i h_diag = _mm256_loadu_si256( (const __m256i*) (h2 + i - 1) ) ;
+
+					// horizontal, vertical and diagonal scores
+					__m256i s_h = _mm256_add_epi32( _mm256_add_epi32( h_up, v_gap ), _mm256_andnot_si256( _mm256_cmpeq_epi32( d_up, v_horz ), v_gapopen ) ) ;
+					__m256i s_v = _mm256_add_epi32( _mm256_add_epi32( h_left, v_gap ), _mm256_andnot_si256( _mm256_cmpeq_epi32( d_left, v_vert ), v_gapopen ) ) ;
+					__m256i s_d = _mm256_add_epi32( h_diag, sc ) ;
+
+					// the maximum and its direction: diagonal first, then vertical and horizontal
+					__m256i lmax = _mm256_max_epi32( _mm256_max_epi32( s_d, s_h ), _mm256_max_epi32( s_v, v_zero ) ) ;
+					__m256i dir  = _mm256_setzero_si256() ;
+					dir = _mm256_blendv_epi8( dir, v_horz, _mm256_cmpeq_epi32( s_h, lmax ) ) ;
+					dir = _mm256_blendv_epi8( dir, v_vert, _mm256_cmpeq_epi32( s_v, lmax ) ) ;
+					dir = _mm256_blendv_epi8( dir, v_diag, _mm256_cmpeq_epi32( s_d, lmax ) ) ;
+
+					_mm256_storeu_si256( (__m256i*) (hc + i), lmax ) ;
+					_mm256_storeu_si256( (__m256i*) (dc + i), dir ) ;
+
+					// only consider the lanes on the diagonal for the maximum
+					__m256i valid = _mm256_cmpgt_epi32( v_last, _mm256_add_epi32( v_lanes, _mm256_set1_epi32(i) ) ) ;
+					v_max = _mm256_max_epi32( v_max, _mm256_and_si256( lmax, valid ) ) ;
+				}
+
+				// reduce the maximum of this diagonal
+				__m128i x_max = _mm_max_epi32( _mm256_castsi256_si128( v_max ), _mm256_extracti128_si256( v_max, 1 ) ) ;
+				x_max = _mm_max_epi32( x_max, _mm_shuffle_epi32( x_max, _MM_SHUFFLE(1,0,3,2) ) ) ;
+				x_max = _mm_max_epi32( x_max, _mm_shuffle_epi32( x_max, _MM_SHUFFLE(2,3,0,1) ) ) ;
+				int dmax = _mm_cvtsi128_si32( x_max ) ;
+
+				// finish the diagonal
+				m.bound( k ) ;
+				m.record( k, dmax, max, coord ) ;
+				m.store( k, scores, directions ) ;
+			}
+		}
+
+		//
+		//
+		// Inter-sequence buffers
+		//
+		//
+
+		/*
+		 The subjects scored at once, with a subject per 16-bit lane. The rows of the
+		 matrices are filled for all lanes at once: row i holds base i of the subject 
+		 in each lane, and the query is the same in all lanes. The cells of a lane that
+		 are outside of its band or past the end of its subject are treated like the 
+		 boundary of the matrix, so the lanes do not depend on each other.
+
+		 Only the previous and the current row are kept, with the lanes of a cell next
+		 to each other. The buffers are taken from a workspace and handed back when done.
+		 */
+		class _Lanes {
+		public:
+			int width ;
+			int n_rows ;	// the length of the longest subject
+			int n_qry ;
+			short* subj ;	// the bases of row i are found at (i-1) * width
+			short* lo ;
+			short* hi ;
+			short* len ;
+			short* h[2] ;
+			short* d[2] ;
+
+			// the maximum score and its coordinate in each lane
+			short* max ;
+			short* max_i ;
+			short* max_j ;
+
+		private:
+			AlignmentWorkspace _own ;
+			AlignmentWorkspace* _ws ;
+			size_t _mark ;
+
+			static size_t _bytes( size_t n_rows, size_t n_qry, int width ) {
+				const size_t cl = AlignmentWorkspace::CACHELINE ;
+				return 11 * cl + ( n_rows + 4 * ( n_qry + 1 ) + 6 ) * width * sizeof(short) ;
+			}
+
+		public:
+			_Lanes( const std::vector<const std::string*>& subjects, const std::vector<size_t>& lanes, const std::string& q, 
+					const std::vector<int>& l, const std::vector<int>& hv, int w, AlignmentWorkspace* ws ) :
+				_own( ws != NULL ? 0 : _bytes( _rows( subjects, lanes ), q.size(), w ) ) {
+				width  = w ;
+				n_rows = _rows( subjects, lanes ) ;
+				n_qry  = (int) q.size() ;
+
+				// take the buffers from the workspace
+				_ws   = ws != NULL ? ws : &_own ;
+				_mark = _ws->mark() ;
+				subj  = _ws->allocate<short>( n_rows * width ) ;
+				lo    = _ws->allocate<short>( width ) ;
+				hi    = _ws->allocate<short>( width ) ;
+				len   = _ws->allocate<short>( width ) ;
+				for( int k=0; k<2; k++ ) {
+					h[k] = _ws->allocate<short>( ( n_qry + 1 ) * width ) ;
+					d[k] = _ws->allocate<short>( ( n_qry + 1 ) * width ) ;
+					std::fill( h[k], h[k] + ( n_qry + 1 ) * width, 0 ) ;
+					std::fill( d[k], d[k] + ( n_qry + 1 ) * width, (short) d_BOUND ) ;
+				}
+				max   = _ws->allocate<short>( width ) ;
+				max_i = _ws->allocate<short>( width ) ;
+				max_j = _ws->allocate<short>( width ) ;
+
+				// the lanes without a subject have no cells to fill
+				std::fill( subj, subj + n_rows * width, 0 ) ;
+				for( int x=0; x<width; x++ ) {
+					lo[x]  = 1 ;
+					hi[x]  = 0 ;
+					len[x] = 0 ;
+					if( x < (int) lanes.size() ) {
+						const std::string& s = *subjects[ lanes[x] ] ;
+						int n  = (int) s.size() ;
+						len[x] = (short) n ;
+						lo[x]  = (short) ( l[ lanes[x] ] > -n_qry ? l[ lanes[x] ] : -n_qry ) ;
+						hi[x]  = (short) ( hv[ lanes[x] ] < n ? hv[ lanes[x] ] : n ) ;
+						for( int i=0; i<n; i++ ) subj[ i * width + x ] = (short) (unsigned char) s[i] ;
+					}
+				}
+			}
+
+			~_Lanes() {
+				_ws->release( _mark ) ;
+			}
+
+		private:
+			static int _rows( const std::vector<const std::string*>& subjects, const std::vector<size_t>& lanes ) {
+				size_t rval = 0 ;
+				for( size_t x=0; x<lanes.size(); x++ ) {
+					if( subjects[ lanes[x] ]->size() > rval ) rval = subjects[ lanes[x] ]->size() ;
+				}
+				return (int) rval ;
+			}
+		} ;
+
+		//
+		//
+		// SSE4.1 inter-sequence kernel
+		//
+		//
+
+		__attribute__((target("sse4.1")))
+		static void scoreLanesSSE41( int match, int mismatch, int gap, int gapopen, const std::string& query, _Lanes& m ) {
+
+			// the constants
+			const __m128i v_match    = _mm_set1_epi16( (short) match ) ;
+			const __m128i v_mismatch = _mm_set1_epi16( (short) mismatch ) ;
+			const __m128i v_gap      = _mm_set1_epi16( (short) gap ) ;
+			const __m128i v_gapopen  = _mm_set1_epi16( (short) gapopen ) ;
+			const __m128i v_zero     = _mm_setzero_si128() ;
+			const __m128i v_diag     = _mm_set1_epi16( d_DIAG ) ;
+			const __m128i v_vert     = _mm_set1_epi16( d_VERTICAL ) ;
+			const __m128i v_horz     = _mm_set1_epi16( d_HORIZONTAL ) ;
+			const __m128i v_base_n   = _mm_set1_epi16( 'N' ) ;
+			const __m128i v_base_gap = _mm_set1_epi16( '-' ) ;
+			const __m128i v_lo       = _mm_loadu_si128( (const __m128i*) m.lo ) ;
+			const __m128i v_hi       = _mm_loadu_si128( (const __m128i*) m.hi ) ;
+			const __m128i v_len      = _mm_loadu_si128( (const __m128i*) m.len ) ;
+
+			__m128i v_max = v_zero ;
+			__m128i v_mi  = v_zero ;
+			__m128i v_mj  = v_zero ;
+
+			for( int i=1; i<=m.n_rows; i++ ) {
+				const short* hp = m.h[(i-1) & 1] ;
+				const short* dp = m.d[(i-1) & 1] ;
+				short* hc = m.h[i & 1] ;
+				short* dc = m.d[i & 1] ;
+
+				// the subject bases of the row, and the lanes of which the subject ended
+				__m128i r      = _mm_loadu_si128( (const __m128i*) (m.subj + (i-1) * 8) ) ;
+				__m128i r_n    = _mm_cmpeq_epi16( r, v_base_n ) ;
+				__m128i r_gap  = _mm_cmpeq_epi16( r, v_base_gap ) ;
+				__m128i v_i    = _mm_set1_epi16( (short) i ) ;
+				__m128i ended  = _mm_cmpgt_epi16( v_i, v_len ) ;
+
+				// the first column is the boundary
+				__m128i h_left = v_zero ;
+				__m128i d_left = v_zero ;
+
+				for( int j=1; j<=m.n_qry; j++ ) {
+					char qb = query[j-1] ;
+
+					// the per base score
+					__m128i eq = _mm_or_si128( _mm_cmpeq_epi16( r, _mm_set1_epi16( (short) (unsigned char) qb ) ), r_n ) ;
+					eq = _mm_or_si128( eq, _mm_set1_epi16( qb == 'N' ? -1 : 0 ) ) ;
+					__m128i gp = _mm_or_si128( r_gap, _mm_set1_epi16( qb == '-' ? -1 : 0 ) ) ;
+					__m128i sc = _mm_blendv_epi8( v_mismatch, v_match, eq ) ;
+					sc = _mm_blendv_epi8( sc, v_gap, gp ) ;
+
+					// the neighbouring cells
+					__m128i h_up   = _mm_loadu_si128( (const __m128i*) (hp + j * 8) ) ;
+					__m128i d_up   = _mm_loadu_si128( (const __m128i*) (dp + j * 8) ) ;
+					__m128i h_diag = _mm_loadu_si128( (const __m128i*) (hp + (j-1) * 8) ) ;
+
+					// horizontal, vertical and diagonal scores, which saturate instead of overflowing
+					__m128i s_h = _mm_adds_epi16( _mm_adds_epi16( h_up, v_gap ), _mm_andnot_si128( _mm_cmpeq_epi16( d_up, v_horz ), v_gapopen ) ) ;
+					__m128i s_v = _mm_adds_epi16( _mm_adds_epi16( h_left, v_gap ), _mm_andnot_si128( _mm_cmpeq_epi16( d_left, v_vert ), v_gapopen ) ) ;
+					__m128i s_d = _mm_adds_epi16( h_diag, sc ) ;
+
+					// the maximum and its direction: diagonal first, then vertical and horizontal
+					__m128i lmax = _mm_max_epi16( _mm_max_epi16( s_d, s_h ), _mm_max_epi16( s_v, v_zero ) ) ;
+					__m128i dir  = _mm_setzero_si128() ;
+					dir = _mm_blendv_epi8( dir, v_horz, _mm_cmpeq_epi16( s_h, lmax ) ) ;
+					dir = _mm_blendv_epi8( dir, v_vert, _mm_cmpeq_epi16( s_v, lmax ) ) ;
+					dir = _mm_blendv_epi8( dir, v_diag, _mm_cmpeq_epi16( s_d, lmax ) ) ;
+
+					// the cells outside of the band are boundaries
+					__m128i v_ij    = _mm_set1_epi16( (short) (i - j) ) ;
+					__m128i outside = _mm_or_si128( ended, _mm_or_si128( _mm_cmpgt_epi16( v_lo, v_ij ), _mm_cmpgt_epi16( v_ij, v_hi ) ) ) ;
+					lmax = _mm_andnot_si128( outside, lmax ) ;
+					dir  = _mm_andnot_si128( outside, dir ) ;
+
+					_mm_storeu_si128( (__m128i*) (hc + j * 8), lmax ) ;
+					_mm_storeu_si128( (__m128i*) (dc + j * 8), dir ) ;
+					h_left = lmax ;
+					d_left = dir ;
+
+					// record the first top position of each lane
+					__m128i gt = _mm_cmpgt_epi16( lmax, v_max ) ;
+					v_max = _mm_blendv_epi8( v_max, lmax, gt ) ;
+					v_mi  = _mm_blendv_epi8( v_mi, v_i, gt ) ;
+					v_mj  = _mm_blendv_epi8( v_mj, _mm_set1_epi16( (short) j ), gt ) ;
+				}
+			}
+			_mm_storeu_si128( (__m128i*) m.max, v_max ) ;
+			_mm_storeu_si128( (__m128i*) m.max_i, v_mi ) ;
+			_mm_storeu_si128( (__m128i*) m.max_j, v_mj ) ;
+		}
+
+		//
+		//
+		// AVX2 inter-sequence kernel
+		//
+		//
+
+		__attribute__((target("avx2")))
+		static void scoreLanesAVX2( int match, int mismatch, int gap, int gapopen, const std::string& query, _Lanes& m ) {
+
+			// the constants
+			const __m256i v_match    = _mm256_set1_epi16( (short) match ) ;
+			const __m256i v_mismatch = _mm256_set1_epi16( (short) mismatch ) ;
+			const __m256i v_gap      = _mm256_set1_epi16( (short) gap ) ;
+			const __m256i v_gapopen  = _mm256_set1_epi16( (short) gapopen ) ;
+			const __m256i v_zero     = _mm256_setzero_si256() ;
+			const __m256i v_diag     = _mm256_set1_epi16( d_DIAG ) ;
+			const __m256i v_vert     = _mm256_set1_epi16( d_VERTICAL ) ;
+			const __m256i v_horz     = _mm256_set1_epi16( d_HORIZONTAL ) ;
+			const __m256i v_base_n   = _mm256_set1_epi16( 'N' ) ;
+			const __m256i v_base_gap = _mm256_set1_epi16( '-' ) ;
+			const __m256i v_lo       = _mm256_loadu_si256( (const __m256i*) m.lo ) ;
+			const __m256i v_hi       = _mm256_loadu_si256( (const __m256i*) m.hi ) ;
+			const __m256i v_len      = _mm256_loadu_si256( (const __m256i*) m.len ) ;
+
+			__m256i v_max = v_zero ;
+			__m256i v_mi  = v_zero ;
+			__m256i v_mj  = v_zero ;
+
+			for( int i=1; i<=m.n_rows; i++ ) {
+				const short* hp = m.h[(i-1) & 1] ;
+				const short* dp = m.d[(i-1) & 1] ;
+				short* hc = m.h[i & 1] ;
+				short* dc = m.d[i & 1] ;
+
+				// the subject bases of the row, and the lanes of which the subject ended
+				__m256i r      = _mm256_loadu_si256( (const __m256i*) (m.subj + (i-1) * 16) ) ;
+				__m256i r_n    = _mm256_cmpeq_epi16( r, v_base_n ) ;
+				__m256i r_gap  = _mm256_cmpeq_epi16( r, v_base_gap ) ;
+				__m256i v_i    = _mm256_set1_epi16( (short) i ) ;
+				__m256i ended  = _mm256_cmpgt_epi16( v_i, v_len ) ;
+
+				// the first column is the boundary
+				__m256i h_left = v_zero ;
+				__m256i d_left = v_zero ;
+
+				for( int j=1; j<=m.n_qry; j++ ) {
+					char qb = query[j-1] ;
+
+					// the per base score
+					__m256i eq = _mm256_or_si256( _mm256_cmpeq_epi16( r, _mm256_set1_epi16( (short) (unsigned char) qb ) ), r_n ) ;
+					eq = _mm256_or_si256( eq, _mm256_set1_epi16( qb == 'N' ? -1 : 0 ) ) ;
+					__m256i gp = _mm256_or_si256( r_gap, _mm256_set1_epi16( qb == '-' ? -1 : 0 ) ) ;
+					__m256i sc = _mm256_blendv_epi8( v_mismatch, v_match, eq ) ;
+					sc = _mm256_blendv_epi8( sc, v_gap, gp ) ;
+
+					// the neighbouring cells
+					__m256i h_up   = _mm256_loadu_si256( (const __m256i*) (hp + j * 16) ) ;
+					__m256i d_up   = _mm256_loadu_si256( (const __m256i*) (dp + j * 16) ) ;
+					__m256i h_diag = _mm256_loadu_si256( (const __m256i*) (hp + (j-1) * 16) ) ;
+
+					// horizontal, vertical and diagonal scores, which saturate instead of overflowing
+					__m256i s_h = _mm256_adds_epi16( _mm256_adds_epi16( h_up, v_gap ), _mm256_andnot_si256( _mm256_cmpeq_epi16( d_up, v_horz ), v_gapopen ) ) ;
+					__m256i s_v = _mm256_adds_epi16( _mm256_adds_epi16( h_left, v_gap ), _mm256_andnot_si256( _mm256_cmpeq_epi16( d_left, v_vert ), v_gapopen ) ) ;
+					__m256i s_d = _mm256_adds_epi16( h_diag, sc ) ;
+
+					// the maximum and its direction: diagonal first, then vertical and horizontal
+					__m256i lmax = _mm256_max_epi16( _mm256_max_epi16( s_d, s_h ), _mm256_max_epi16( s_v, v_zero ) ) ;
+					__m256i dir  = _mm256_setzero_si256() ;
+					dir = _mm256_blendv_epi8( dir, v_horz, _mm256_cmpeq_epi16( s_h, lmax ) ) ;
+					dir = _mm256_blendv_epi8( dir, v_vert, _mm256_cmpeq_epi16( s_v, lmax ) ) ;
+					dir = _mm256_blendv_epi8( dir, v_diag, _mm256_cmpeq_epi16( s_d, lmax ) ) ;
+
+					// the cells outside of the band are boundaries
+					__m256i v_ij    = _mm256_set1_epi16( (short) (i - j) ) ;
+					__m256i outside = _mm256_or_si256( ended, _mm256_or_si256( _mm256_cmpgt_epi16( v_lo, v_ij ), _mm256_cmpgt_epi16( v_ij, v_hi ) ) ) ;
+					lmax = _mm256_andnot_si256( outside, lmax ) ;
+					dir  = _mm256_andnot_si256( outside, dir ) ;
+
+					_mm256_storeu_si256( (__m256i*) (hc + j * 16), lmax ) ;
+					_mm256_storeu_si256( (__m256i*) (dc + j * 16), dir ) ;
+					h_left = lmax ;
+					d_left = dir ;
+
+					// record the first top position of each lane
+					__m256i gt = _mm256_cmpgt_epi16( lmax, v_max ) ;
+					v_max = _mm256_blendv_epi8( v_max, lmax, gt ) ;
+					v_mi  = _mm256_blendv_epi8( v_mi, v_i, gt ) ;
+					v_mj  = _mm256_blendv_epi8( v_mj, _mm256_set1_epi16( (short) j ), gt ) ;
+				}
+			}
+			_mm256_storeu_si256( (__m256i*) m.max, v_max ) ;
+			_mm256_storeu_si256( (__m256i*) m.max_i, v_mi ) ;
+			_mm256_storeu_si256( (__m256i*) m.max_j, v_mj ) ;
+		}
+
+#endif
+
+		//
+		//
+		// Scalar score only kernel
+		//
+		//
+
+		/*
+		 the per base score, as in AlignmentScore::score()
+		 */
+		static inline int baseScore( int match, int mismatch, int gap, char r, char q ) {
+			int rval = mismatch ;
+			if( r == '-' || q == '-' ) {
+				rval = gap ;
+			} else if( r == 'N' || q == 'N' || r == q ) {
+				rval = match ;
+			}
+			return rval ;
+		}
+
+		/*
+		 the row by row recurrence of SmithWaterman::fillMatrix with only the 
+		 previous and current row in memory. Only the columns j in the band 
+		 lo <= i - j <= hi are filled; the cells just outside of the band are 
+		 reset, as the buffers are reused for every other row.
+		 */
+		static void scoreRows( int match, int mismatch, int gap, int gapopen,
+							   const std::string& subject, const std::string& query,
+							   int lo, int hi, int& max, std::pair<int,int>& coord, AlignmentWorkspace* ws ) {
+
+			int n_subj = (int) subject.size() + 1 ;
+			int n_qry  = (int) query.size() + 1 ;
+			if( lo > hi ) return ;
+
+			// the rows that cross the band
+			int i_first = 1 + lo > 1 ? 1 + lo : 1 ;
+			int i_last  = n_qry - 1 + hi < n_subj - 1 ? n_qry - 1 + hi : n_subj - 1 ;
+
+			// take the rows from the workspace
+			AlignmentWorkspace own( ws != NULL ? 0 : 4 * (n_qry + 1) * sizeof(int) ) ;
+			AlignmentWorkspace* w = ws != NULL ? ws : &own ;
+			size_t mark = w->mark() ;
+			int* rows   = w->allocate<int>( 4 * (n_qry + 1) ) ;
+			std::fill( rows, rows + 4 * (n_qry + 1), 0 ) ;
+
+			int* h_prev = &rows[0] ;
+			int* d_prev = &rows[n_qry + 1] ;
+			int* h_cur  = &rows[2 * (n_qry + 1)] ;
+			int* d_cur  = &rows[3 * (n_qry + 1)] ;
+
+			// keep the maximum in local variables, so it is not reloaded for each cell
+			int lmaxall = max ;
+			std::pair<int,int> lcoord = coord ;
+
+			for( int i=i_first; i<=i_last; i++ ) {
+				char r = subject[i-1] ;
+
+				// the columns in the band
+				int j_first = i - hi > 1 ? i - hi : 1 ;
+				int j_last  = i - lo < n_qry - 1 ? i - lo : n_qry - 1 ;
+
+				h_cur[j_first - 1] = 0 ;
+				d_cur[j_first - 1] = d_BOUND ;
+				for( int j=j_first; j<=j_last; j++ ) {
+					int _s_horizontal = h_prev[j]   + gap + (d_prev[j] != d_HORIZONTAL ? gapopen : 0) ;
+					int _s_vertical   = h_cur[j-1]  + gap + (d_cur[j-1] != d_VERTICAL ? gapopen : 0) ;
+					int _s_diagonal   = h_prev[j-1] + baseScore( match, mismatch, gap, r, query[j-1] ) ;
+
+					int lmax = _s_diagonal ;
+					if( lmax < _s_horizontal ) lmax = _s_horizontal ;
+					if( lmax < _s_vertical ) lmax = _s_vertical ;
+					if( lmax < 0 ) lmax = 0 ;
+
+					h_cur[j] = lmax ;
+					if( _s_diagonal == lmax ) {
+						d_cur[j] = d_DIAG ;
+					} else if( _s_vertical == lmax ) {
+						d_cur[j] = d_VERTICAL ;
+					} else if( _s_horizontal == lmax ) {
+						d_cur[j] = d_HORIZONTAL ;
+					} else {
+						d_cur[j] = d_BOUND ;
+					}
+
+					// record the top positions
+					if( lmax > lmaxall ) {
+						lmaxall = lmax ;
+						lcoord  = std::pair<int,int>( i, j ) ;
+					}
+				}
+				h_cur[j_last + 1] = 0 ;
+				d_cur[j_last + 1] = d_BOUND ;
+
+				std::swap( h_prev, h_cur ) ;
+				std::swap( d_prev, d_cur ) ;
+			}
+			max   = lmaxall ;
+			coord = lcoord ;
+			w->release( mark ) ;
+		}
+
+		//
+		//
+		// Dispatch
+		//
+		//
+
+		void fillDiagonals( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::string& subject, const std::string& query,
+							int** scores, int** directions,
+							int& max, std::pair<int,int>& coord ) {
+			fillDiagonals( k, match, mismatch, gap, gapopen, subject, query, 
+							-(int) query.size(), (int) subject.size(), scores, directions, max, coord, NULL ) ;
+		}
+
+		void fillDiagonals( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::string& subject, const std::string& query,
+							int lo, int hi, int** scores, int** directions,
+							int& max, std::pair<int,int>& coord, AlignmentWorkspace* ws ) {
+
+			// nothing to align
+			if( subject.size() == 0 || query.size() == 0 || lo > hi ) return ;
+
+			k = resolveKernel( k ) ;
+#ifdef NIMBUS_X86_KERNELS
+			if( k == k_AVX2 ) {
+				_Diagonals m( subject, query, lo, hi, 8, ws ) ;
+				fillDiagonalsAVX2( match, mismatch, gap, gapopen, m, scores, directions, max, coord ) ;
+			} else if( k == k_SSE41 ) {
+				_Diagonals m( subject, query, lo, hi, 4, ws ) ;
+				fillDiagonalsSSE41( match, mismatch, gap, gapopen, m, scores, directions, max, coord ) ;
+			}
+#endif
+		}
+
+		void scoreMatrix( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::string& subject, const std::string& query,
+							int& max, std::pair<int,int>& coord ) {
+			scoreMatrix( k, match, mismatch, gap, gapopen, subject, query, 
+							-(int) query.size(), (int) subject.size(), max, coord, NULL ) ;
+		}
+
+		void scoreMatrix( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::string& subject, const std::string& query,
+							int lo, int hi, int& max, std::pair<int,int>& coord, AlignmentWorkspace* ws ) {
+			k = resolveKernel( k ) ;
+			if( k == k_SCALAR ) {
+				scoreRows( match, mismatch, gap, gapopen, subject, query, lo, hi, max, coord, ws ) ;
+			} else {
+				fillDiagonals( k, match, mismatch, gap, gapopen, subject, query, lo, hi, NULL, NULL, max, coord, ws ) ;
+			}
+		}
+
+		/*
+		 whether the scores fit in 16-bit lanes: the per base scores and gaps, and
+		 the coordinates of the cells
+		 */
+		static bool fitsLanes( int match, int mismatch, int gap, int gapopen, size_t n ) {
+			const int limit = SHRT_MAX / 4 ;
+			return abs( match ) < limit && abs( mismatch ) < limit && abs( gap ) < limit && abs( gapopen ) < limit && n < (size_t) SHRT_MAX ;
+		}
+
+		void scoreSubjects( kernel_t k, int match, int mismatch, int gap, int gapopen,
+							const std::vector<const std::string*>& subjects, const std::string& query,
+							const std::vector<int>& lo, const std::vector<int>& hi,
+							std::vector<int>& max, std::vector< std::pair<int,int> >& coord, AlignmentWorkspace* ws ) {
+			size_t n = subjects.size() ;
+			max.assign( n, 0 ) ;
+			coord.assign( n, std::pair<int,int>( 0, 0 ) ) ;
+			k = resolveKernel( k ) ;
+
+			// the subjects that still need a 32-bit score
+			std::vector<bool> rescore( n, true ) ;
+
+#ifdef NIMBUS_X86_KERNELS
+			int width = k == k_AVX2 ? 16 : ( k == k_SSE41 ? 8 : 0 ) ;
+			if( width > 0 && fitsLanes( match, mismatch, gap, gapopen, query.size() ) ) {
+
+				// subjects of a similar length share the lanes, so few cells are wasted
+				std::vector< std::pair<size_t,size_t> > order ;
+				for( size_t s=0; s<n; s++ ) {
+					if( subjects[s]->size() < (size_t) SHRT_MAX ) order.push_back( std::pair<size_t,size_t>( subjects[s]->size(), s ) ) ;
+				}
+				std::sort( order.begin(), order.end() ) ;
+
+				// a few subjects are scored faster along the anti-diagonals
+				for( size_t g=0; g + width / 2 <= order.size(); g+=width ) {
+					std::vector<size_t> lanes ;
+					for( size_t x=g; x<order.size() && x<g+width; x++ ) lanes.push_back( order[x].second ) ;
+
+					_Lanes m( subjects, lanes, query, lo, hi, width, ws ) ;
+					if( k == k_AVX2 ) {
+						scoreLanesAVX2( match, mismatch, gap, gapopen, query, m ) ;
+					} else {
+						scoreLanesSSE41( match, mismatch, gap, gapopen, query, m ) ;
+					}
+
+					// a saturated lane may have lost its maximum
+					for( size_t x=0; x<lanes.size(); x++ ) {
+						if( m.max[x] < SHRT_MAX ) {
+							max[ lanes[x] ]     = m.max[x] ;
+							coord[ lanes[x] ]   = std::pair<int,int>( m.max_i[x], m.max_j[x] ) ;
+							rescore[ lanes[x] ] = false ;
+						}
+					}
+				}
+			}
+#endif
+			for( size_t s=0; s<n; s++ ) {
+				if( rescore[s] ) scoreMatrix( k, match, mismatch, gap, gapopen, *subjects[s], query, lo[s], hi[s], max[s], coord[s], ws ) ;
+			}
+		}
+	}
+}
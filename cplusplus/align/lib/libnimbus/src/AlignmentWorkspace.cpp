@@ -0,0 +1,110 @@
+#include "stdafx.h"
+#include "AlignmentWorkspace.h"
+
+namespace Nimbus {
+
+	namespace alignment {
+
+		const size_t AlignmentWorkspace::CACHELINE ;
+		const size_t AlignmentWorkspace::MINBLOCK ;
+
+		//
+		//
+		// Implementation of the AlignmentWorkspace object
+		//
+		//
+
+		AlignmentWorkspace::AlignmentWorkspace() {
+			_blocks = std::vector<_Block>() ;
+			_used   = 0 ;
+			_peak   = 0 ;
+		}
+
+		AlignmentWorkspace::AlignmentWorkspace( size_t size ) {
+			_blocks = std::vector<_Block>() ;
+			_used   = 0 ;
+			_peak   = 0 ;
+			if( size > 0 ) _add_block( size ) ;
+		}
+
+		AlignmentWorkspace::~AlignmentWorkspace() {
+			_clear() ;
+		}
+
+		/*
+		 * adds a block starting at the current arena offset
+		 */
+		void AlignmentWorkspace::_add_block( size_t size ) {
+			size = ( size + CACHELINE - 1 ) & ~( CACHELINE - 1 ) ;
+
+			_Block b ;
+			b.raw    = new char[size + CACHELINE] ;
+			b.data   = (char*) ( ( (size_t) b.raw + CACHELINE - 1 ) & ~( CACHELINE - 1 ) ) ;
+			b.size   = size ;
+			b.offset = _used ;
+			_blocks.push_back( b ) ;
+		}
+
+		void AlignmentWorkspace::_clear() {
+			for( std::vector<_Block>::iterator it=_blocks.begin(); it!=_blocks.end(); ++it ) {
+				delete[] it->raw ;
+			}
+			_blocks.clear() ;
+		}
+
+		void AlignmentWorkspace::reserve( size_t bytes ) {
+			if( capacity() < bytes ) {
+
+				// grow geometrically, so a growing arena needs few blocks
+				size_t size = _blocks.empty() ? MINBLOCK : 2 * _blocks.back().size ;
+				if( size < bytes ) size = bytes ;
+				_add_block( size ) ;
+			}
+		}
+
+		void* AlignmentWorkspace::allocate( size_t bytes ) {
+			bytes = ( bytes + CACHELINE - 1 ) & ~( CACHELINE - 1 ) ;
+			reserve( bytes ) ;
+
+			// a new block starts at the current offset, so the
+			// unused end of the previous block is skipped
+			_Block& b  = _blocks.back() ;
+			void* rval = b.data + ( _used - b.offset ) ;
+			_used += bytes ;
+			if( _used > _peak ) _peak = _used ;
+			return rval ;
+		}
+
+		size_t AlignmentWorkspace::mark() const {
+			return _used ;
+		}
+
+		void AlignmentWorkspace::release( size_t m ) {
+			// blocks added after the mark are freed, the next
+			// reset will replace them by a single larger block
+			while( _blocks.size() > 1 && _blocks.back().offset > m ) {
+				delete[] _blocks.back().raw ;
+				_blocks.pop_back() ;
+			}
+			if( m < _used ) _used = m ;
+		}
+
+		void AlignmentWorkspace::reset() {
+			if( _blocks.size() > 1 ) {
+				_clear() ;
+				_used = 0 ;
+				_add_block( _peak ) ;
+			}
+			_used = 0 ;
+		}
+
+		size_t AlignmentWorkspace::capacity() const {
+			size_t rval = 0 ;
+			if( ! _blocks.empty() ) {
+				const _Block& b = _blocks.back() ;
+				rval = b.offset + b.size - _used ;
+			}
+			return rval ;
+		}
+	}
+}
@@ -11,7 +11,7 @@ namespace Nimbus {
 		//
 		//
 
-		std::string GenomicRegion::chromosome() const { return _chr ; }
+		const std::string& GenomicRegion::chromosome() const { return _chr ; }
 
 		/*
 		 Get the start coordinate of the amplicon
@@ -31,7 +31,7 @@ namespace Nimbus {
 		/*
 		 Get the name of the amplicon
 		 */ 
-		std::string GenomicRegion::name() const { return _name ; }
+		const std::string& GenomicRegion::name() const { return _name ; }
 
 		/*
 		 Gets the difference between the start and the end of the amplicon
@@ -125,7 +125,7 @@ namespace Nimbus {
 		/* 
 		 Get the sequence of the amplicon
 		 */
-		std::string Amplicon::sequence() const { return _sequence ; }
+		const std::string& Amplicon::sequence() const { return _sequence ; }
 
 		
 
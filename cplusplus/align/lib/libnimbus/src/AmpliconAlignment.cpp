@@ -106,6 +106,9 @@ namespace Nimbus {
 		_posd    = seedpos ;
 		_gapopen = go ;
 		_reportsecondary = false ;
+		_cache   = NULL ;
+		_aligned.store( 0 ) ;
+		_ungapped.store( 0 ) ;
 		// mapping quality score calculator
 		_mapqual = new MappingQuality( 
 					_ai->dbsize(), 
@@ -119,6 +122,9 @@ namespace Nimbus {
 		_posd    = seedpos ;
 		_gapopen = go ;
 		_reportsecondary = rs ;
+		_cache   = NULL ;
+		_aligned.store( 0 ) ;
+		_ungapped.store( 0 ) ;
 		// mapping quality score calculator
 		_mapqual = new MappingQuality( 
 					_ai->dbsize(), 
@@ -129,12 +135,34 @@ namespace Nimbus {
 	AmpliconAlignment::~AmpliconAlignment(void) {
 		delete _mapqual ;
 	}
+
+	void AmpliconAlignment::setCache( AlignmentCache* c ) {
+		_cache = c ;
+	}
+
+	size_t AmpliconAlignment::aligned() const {
+		return _aligned.load() ;
+	}
+
+	size_t AmpliconAlignment::ungapped() const {
+		return _ungapped.load() ;
+	}
 		
 
 	AlignmentBuilder AmpliconAlignment::align( std::pair<basic::Read*,basic::Read*> p ) const {
+		return align( p, NULL ) ;
+	}
+
+	AlignmentBuilder AmpliconAlignment::align( std::pair<basic::Read*,basic::Read*> p, alignment::AlignmentWorkspace* ws ) const {
+
+		// start with an empty workspace
+		if( ws != NULL ) ws->reset() ;
 
 		// declare the output variable
-		AlignmentBuilder rval = AlignmentBuilder( p.first, p.second ) ;
+		AlignmentBuilder rval = AlignmentBuilder( p.first, p.second, ws ) ;
+
+		// duplicate read pairs only need their names and qualities
+		if( _lookup( p, rval ) ) return rval ;
 
 		// get the amplicons
 		std::vector<basic::Amplicon*> ampset = _ai->getAmplicons( p ) ;
@@ -146,16 +174,23 @@ namespace Nimbus {
 			}
 		}
 
-		// align the reads to the amplicon
-		rval.align( _scores, _gapopen ) ; 
-
 		// create the relevant samrecords
 		if( _reportsecondary ) {			
+			// align the reads to the amplicon
+			rval.align( _scores, _gapopen ) ; 
 			rval.createRecords( ) ;
 		} else {
-			// only create a record for the best record
+			// with multiple candidates, score the reads against all amplicons 
+			// first and only align the reads to the best amplicon
+			if( rval.entries.size() > 1 ) {
+				rval.score( _scores, _gapopen ) ;
+			} else {
+				rval.align( _scores, _gapopen ) ;
+			}
 			int idx = rval.best() ;
 			if(idx != -1 ) {
+				if( rval.entries[idx].f_alignment == NULL ) 
+					rval.entries[idx].align( _scores, _gapopen, rval.forward, rval.reverse ) ;
 				rval.createRecord( rval.entries[idx] ) ;
 			} 
 		}
@@ -220,9 +255,58 @@ namespace Nimbus {
 			}
 		}
 
+		_count( rval ) ;
+		_store( p, rval ) ;
+
 		// returns the results from the alignment
 		return rval ;
 	}
 
+	bool AmpliconAlignment::_lookup( std::pair<basic::Read*,basic::Read*> p, AlignmentBuilder& rval ) const {
+		if( _cache == NULL || _reportsecondary || p.first == NULL || p.second == NULL ) return false ;
+
+		basic::Amplicon* a = NULL ;
+		alignment::SAMRecord* f = NULL ;
+		alignment::SAMRecord* r = NULL ;
+		if( ! _cache->get( p.first->sequence(), p.second->sequence(), a, f, r ) ) return false ;
+
+		// the forward read is reverse complemented on a reverse amplicon, the reverse read on a forward one
+		if( f != NULL || r != NULL ) {
+			AlnSet set = AlnSet( a, rval.workspace ) ;
+			if( f != NULL ) f->setRead( *p.first, ! a->forward() ) ;
+			if( r != NULL ) r->setRead( *p.second, a->forward() ) ;
+			set.f_record = f ;
+			set.r_record = r ;
+			rval.entries.push_back( set ) ;
+		}
+		return true ;
+	}
+
+	void AmpliconAlignment::_store( std::pair<basic::Read*,basic::Read*> p, AlignmentBuilder& rval ) const {
+		if( _cache == NULL || _reportsecondary || p.first == NULL || p.second == NULL ) return ;
+
+		// without secondary alignments only the best amplicon has records
+		for( std::vector<AlnSet>::iterator it=rval.entries.begin(); it!=rval.entries.end(); ++it ) {
+			if( it->f_record != NULL || it->r_record != NULL ) {
+				_cache->put( p.first->sequence(), p.second->sequence(), it->amplicon, it->f_record, it->r_record ) ;
+				return ;
+			}
+		}
+		_cache->put( p.first->sequence(), p.second->sequence(), NULL, NULL, NULL ) ;
+	}
+
+	void AmpliconAlignment::_count( const AlignmentBuilder& rval ) const {
+		size_t aligned  = 0 ;
+		size_t ungapped = 0 ;
+		for( std::vector<AlnSet>::const_iterator it=rval.entries.begin(); it!=rval.entries.end(); ++it ) {
+			if( it->f_alignment != NULL ) aligned++ ;
+			if( it->r_alignment != NULL ) aligned++ ;
+			if( it->f_alignment != NULL && it->f_ungapped ) ungapped++ ;
+			if( it->r_alignment != NULL && it->r_ungapped ) ungapped++ ;
+		}
+		if( aligned > 0 ) _aligned.fetch_add( aligned, std::memory_order_relaxed ) ;
+		if( ungapped > 0 ) _ungapped.fetch_add( ungapped, std::memory_order_relaxed ) ;
+	}
+
 
 }
\ No newline at end of file
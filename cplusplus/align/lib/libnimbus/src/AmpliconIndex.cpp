@@ -21,6 +21,10 @@ namespace Nimbus {
 			_idx_r_a = NULL ;
 			_idx_f_b = NULL ;
 			_idx_r_b = NULL ;
+			_idx_aa  = NULL ;
+			_idx_ab  = NULL ;
+			_idx_ba  = NULL ;
+			_idx_bb  = NULL ;
 			vector<Amplicon*> _amplicons = vector<Amplicon*>() ;
 		}
 
@@ -32,6 +36,10 @@ namespace Nimbus {
 			if( _idx_r_a != NULL ) delete _idx_r_a ;
 			if( _idx_f_b != NULL ) delete _idx_f_b ;
 			if( _idx_r_b != NULL ) delete _idx_r_b ;
+			if( _idx_aa  != NULL ) delete _idx_aa ;
+			if( _idx_ab  != NULL ) delete _idx_ab ;
+			if( _idx_ba  != NULL ) delete _idx_ba ;
+			if( _idx_bb  != NULL ) delete _idx_bb ;
 			//for( vector<Amplicon*>::iterator it=_amplicons.begin(); it!=_amplicons.end(); ++it ) {
 			//	if( *it != NULL ) delete *it ;
 			//}
@@ -77,14 +85,9 @@ namespace Nimbus {
 				return 0 ;
 			}
 
-			// set the keysize
+			// set the keysize and create the key indexes
 			_keysize = ks ;
-			
-			// build the roots of the index tree
-			_idx_f_a = new _DNANode<Amplicon*>( ) ;
-			_idx_r_a = new _DNANode<Amplicon*>( ) ;
-			_idx_f_b = new _DNANode<Amplicon*>( ) ;
-			_idx_r_b = new _DNANode<Amplicon*>( ) ;
+			_create() ;
 
 			// sort the amplicons prior to assignment 
 			sort( _amplicons.begin(), _amplicons.end(), cmp_lt_amplicon_p ) ;
@@ -92,8 +95,9 @@ namespace Nimbus {
 			// iterate over the amplicon pointer vector to add them to the various trees
 			for( vector< Amplicon* >::iterator it=_amplicons.begin(); it!=_amplicons.end(); ++it ) {
 				
-				// get the pointer to the current amplicon
-				Amplicon* a = *it ;
+				// get the pointer to the current amplicon and its position
+				Amplicon* a     = *it ;
+				unsigned int id = (unsigned int) ( it - _amplicons.begin() ) ;
 
 				//
 				// Key determination procedure
@@ -143,94 +147,210 @@ namespace Nimbus {
 				}
 
 				//
-				// Add the amplicon pointer to the trees
+				// Add the amplicon pointer to the indexes
 				//
 				// printf("Build keys are %s %s\n", k_f_a.c_str(), k_r_a.c_str() ) ;
 				// cout << a->str() << "\t" << k_f_a << "\t" << k_r_a << "\t" << k_f_b << "\t" << k_r_b << endl ;
 
-				// add the amplicon pointer to the various trees
-				if( (int)k_f_a.size() == _keysize ) addTreeData( _idx_f_a, k_f_a, a ) ;
-				if( (int)k_r_a.size() == _keysize ) addTreeData( _idx_r_a, k_r_a, a ) ;
-				if( (int)k_f_b.size() == _keysize ) addTreeData( _idx_f_b, k_f_b, a ) ;
-				if( (int)k_r_b.size() == _keysize ) addTreeData( _idx_r_b, k_r_b, a ) ;
+				// add the amplicon position to the various indexes
+				if( (int)k_f_a.size() == _keysize ) _idx_f_a->add( k_f_a, id ) ;
+				if( (int)k_r_a.size() == _keysize ) _idx_r_a->add( k_r_a, id ) ;
+				if( (int)k_f_b.size() == _keysize ) _idx_f_b->add( k_f_b, id ) ;
+				if( (int)k_r_b.size() == _keysize ) _idx_r_b->add( k_r_b, id ) ;
+
+				// add the position of the amplicon at the combined keys
+				if( _idx_aa != NULL ) {
+					_idx_aa->add( k_f_a + k_r_a, id ) ;
+					_idx_ab->add( k_f_a + k_r_b, id ) ;
+					_idx_ba->add( k_f_b + k_r_a, id ) ;
+					_idx_bb->add( k_f_b + k_r_b, id ) ;
+				}
+			}
+
+			// the amplicons were added in sorted order, so the 
+			// positions of each key remain sorted
+			_idx_f_a->build() ;
+			_idx_r_a->build() ;
+			_idx_f_b->build() ;
+			_idx_r_b->build() ;
+			if( _idx_aa != NULL ) {
+				_idx_aa->build() ;
+				_idx_ab->build() ;
+				_idx_ba->build() ;
+				_idx_bb->build() ;
 			}
 
 			// return the number of amplicons processed
 			return (unsigned int)_amplicons.size() ; 
 		}
 
+		/*
+		 * Creates the empty key indexes for the key size
+		 */
+		void AmpliconIndex::_create() {
+			_idx_f_a = new KmerIndex<unsigned int>( _keysize ) ;
+			_idx_r_a = new KmerIndex<unsigned int>( _keysize ) ;
+			_idx_f_b = new KmerIndex<unsigned int>( _keysize ) ;
+			_idx_r_b = new KmerIndex<unsigned int>( _keysize ) ;
+
+			// the combined keys can only be encoded for smaller key sizes
+			if( 2 * _keysize <= KmerIndex<unsigned int>::MAXKEYSIZE ) {
+				_idx_aa = new KmerIndex<unsigned int>( 2 * _keysize ) ;
+				_idx_ab = new KmerIndex<unsigned int>( 2 * _keysize ) ;
+				_idx_ba = new KmerIndex<unsigned int>( 2 * _keysize ) ;
+				_idx_bb = new KmerIndex<unsigned int>( 2 * _keysize ) ;
+			}
+		}
+
+		//
+		// Index files
+		//
+
+		/*
+		 * Writes the tables of the built index, in the order in which map reads them
+		 */
+		void AmpliconIndex::write( ostream& out ) const {
+			assert( _idx_f_a != NULL ) ;
+			_idx_f_a->write( out ) ;
+			_idx_r_a->write( out ) ;
+			_idx_f_b->write( out ) ;
+			_idx_r_b->write( out ) ;
+			if( _idx_aa != NULL ) {
+				_idx_aa->write( out ) ;
+				_idx_ab->write( out ) ;
+				_idx_ba->write( out ) ;
+				_idx_bb->write( out ) ;
+			}
+		}
+
+		/*
+		 * Uses the written tables at data
+		 */
+		const char* AmpliconIndex::map( int ks, const char* data, const char* end ) {
+
+			// don't do anything if the index has already been build
+			if( _idx_f_a != NULL || ks < 1 || ks > KmerIndex<unsigned int>::MAXKEYSIZE ) {
+				return NULL ;
+			}
+			_keysize = ks ;
+			_create() ;
+
+			const char* p = data ;
+			p = _idx_f_a->map( p, end ) ;
+			p = _idx_r_a->map( p, end ) ;
+			p = _idx_f_b->map( p, end ) ;
+			p = _idx_r_b->map( p, end ) ;
+			if( _idx_aa != NULL ) {
+				p = _idx_aa->map( p, end ) ;
+				p = _idx_ab->map( p, end ) ;
+				p = _idx_ba->map( p, end ) ;
+				p = _idx_bb->map( p, end ) ;
+			}
+
+			// the positions in the tables should refer to the amplicons
+			KmerIndex<unsigned int>* idx[8] = { _idx_f_a, _idx_r_a, _idx_f_b, _idx_r_b, _idx_aa, _idx_ab, _idx_ba, _idx_bb } ;
+			for( int i=0; p != NULL && i<8 && idx[i] != NULL; i++ ) {
+				if( ! idx[i]->below( (unsigned int) _amplicons.size() ) ) p = NULL ;
+			}
+			return p ;
+		}
+
+		int AmpliconIndex::keysize() const {
+			return _keysize ;
+		}
+
+		const vector<Amplicon*>& AmpliconIndex::amplicons() const {
+			return _amplicons ;
+		}
+
 		/*
 		 * Gets the amplicons corresponding to read sequences f and r
 		 */
-		vector<Amplicon*> AmpliconIndex::getAmplicons( string f, string r ) const {
+		vector<Amplicon*> AmpliconIndex::getAmplicons( const string& f, const string& r ) const {
+
+			// an amplicon matches if one of its forward keys and one of its reverse keys 
+			// match, so look up the four combinations of the a and b keys 
+			if( _idx_aa != NULL ) {
+				vector<unsigned int> ids = vector<unsigned int>() ;
+				_getPairIds( _idx_aa, f, 0, r, 0, ids ) ;
+				_getPairIds( _idx_ab, f, 0, r, _keysize, ids ) ;
+				_getPairIds( _idx_ba, f, _keysize, r, 0, ids ) ;
+				_getPairIds( _idx_bb, f, _keysize, r, _keysize, ids ) ;
+
+				// the positions follow the sort order of the amplicons
+				sort( ids.begin(), ids.end() ) ;
+				ids.erase( unique( ids.begin(), ids.end() ), ids.end() ) ;
+				return _get( ids ) ;
+			}
 
-			// declare the return value
-			vector<Amplicon*> rval = vector<Amplicon*>() ;
-			vector<Amplicon*> vf   = getAmpliconsF( f ) ;
-			vector<Amplicon*> vr   = getAmpliconsR( r ) ;			
+			// otherwise intersect the forward and reverse candidates
+			vector<unsigned int> vf = _getUnion( _idx_f_a, _idx_f_b, f ) ;
+			vector<unsigned int> vr = _getUnion( _idx_r_a, _idx_r_b, r ) ;
 						
 			// get the overlap between the 2 sets 
-			rval.resize( vf.size() + vr.size() ) ;
-			vector<Amplicon*>::iterator it = set_intersection( vf.begin(), vf.end(), 
-																vr.begin(), vr.end(), 
-																rval.begin(), cmp_lt_amplicon_p ) ;
-			rval.resize( it - rval.begin() ) ;
+			vector<unsigned int> ids = vector<unsigned int>( vf.size() + vr.size() ) ;
+			vector<unsigned int>::iterator it = set_intersection( vf.begin(), vf.end(), vr.begin(), vr.end(), ids.begin() ) ;
+			ids.resize( it - ids.begin() ) ;
 
-			// printf( "%d\t%d\t%d\n", vf.size(), vr.size(), rval.size() ) ;
 			// return the amplicons
-			return rval ;
+			return _get( ids ) ;
 		}
 
-		vector<Amplicon*> AmpliconIndex::getAmpliconsF( string f ) const {
+		vector<Amplicon*> AmpliconIndex::getAmpliconsF( const string& f ) const {
+			return _get( _getUnion( _idx_f_a, _idx_f_b, f ) ) ;
+		}
 
-			// declare the return value
+		vector<Amplicon*> AmpliconIndex::getAmpliconsR( const string& r ) const {
+			return _get( _getUnion( _idx_r_a, _idx_r_b, r ) ) ;
+		}
+
+		/*
+		 * The amplicons at the sorted positions ids
+		 */
+		vector<Amplicon*> AmpliconIndex::_get( const vector<unsigned int>& ids ) const {
 			vector<Amplicon*> rval = vector<Amplicon*>() ;
-			vector<Amplicon*> va   = vector<Amplicon*>() ;
-			vector<Amplicon*> vb   = vector<Amplicon*>() ;
-		
-				// process the first key
-			if( f.size() >= (unsigned int) _keysize ) {
-				string fk = f.substr( 0, _keysize ) ;				
-				va = getTreeData( _idx_f_a, fk ) ;	
+			rval.reserve( ids.size() ) ;
+			for( vector<unsigned int>::const_iterator it=ids.begin(); it!=ids.end(); ++it ) {
+				rval.push_back( _amplicons[*it] ) ;
 			}
-			if( f.size() >= (unsigned int) 2 * _keysize ) {
-				string fk = f.substr( _keysize, _keysize ) ;
-				vb = getTreeData( _idx_f_b, fk ) ;
-			}	
+			return rval ;
+		}
 
-			// get the union of both target lists
-			rval.resize( va.size() + vb.size() ) ;
-			vector<Amplicon*>::iterator it = set_union( va.begin(), va.end(), 
-														vb.begin(), vb.end(), 
-														rval.begin(), cmp_lt_amplicon_p ) ;
-			rval.resize( it - rval.begin() ) ;
+		void AmpliconIndex::_getPairIds( const KmerIndex<unsigned int>* idx, const string& f, int fo, const string& r, int ro, vector<unsigned int>& ids ) const {
+			if( (int) f.size() >= fo + _keysize && (int) r.size() >= ro + _keysize ) {
 
-			//
-			return rval ;
+				// the combined key
+				char key[2 * KmerIndex<unsigned int>::MAXKEYSIZE] ;
+				f.copy( key, _keysize, fo ) ;
+				r.copy( key + _keysize, _keysize, ro ) ;
+
+				Span<unsigned int> v = idx->get( key ) ;
+				ids.insert( ids.end(), v.begin(), v.end() ) ;
+			}
 		}
 
-		vector<Amplicon*> AmpliconIndex::getAmpliconsR( string r ) const {
+		/*
+		 * Gets the union of the amplicon positions at the first key of s in 
+		 * index a and at the second key of s in index b
+		 */
+		vector<unsigned int> AmpliconIndex::_getUnion( const KmerIndex<unsigned int>* a, const KmerIndex<unsigned int>* b, const string& s ) const {
 
 			// declare the return value
-			vector<Amplicon*> rval = vector<Amplicon*>() ;
-			vector<Amplicon*> va   = vector<Amplicon*>() ;
-			vector<Amplicon*> vb   = vector<Amplicon*>() ;
-		
-				// process the first key
-			if( r.size() >= (unsigned int) _keysize ) {
-				string rk = r.substr( 0, _keysize ) ;				
-				va = getTreeData( _idx_r_a, rk ) ;	
+			vector<unsigned int> rval = vector<unsigned int>() ;
+			Span<unsigned int> va     = Span<unsigned int>() ;
+			Span<unsigned int> vb     = Span<unsigned int>() ;
+
+			// process the first and second key
+			if( a != NULL && s.size() >= (unsigned int) _keysize ) {
+				va = a->get( s.c_str() ) ;
+			}
+			if( b != NULL && s.size() >= (unsigned int) 2 * _keysize ) {
+				vb = b->get( s.c_str() + _keysize ) ;
 			}
-			if( r.size() >= (unsigned int) 2 * _keysize ) {
-				string rk = r.substr( _keysize, _keysize ) ;	
-				vb = getTreeData( _idx_r_b, rk ) ;
-			}	
 
 			// get the union of both target lists
 			rval.resize( va.size() + vb.size() ) ;
-			vector<Amplicon*>::iterator it = set_union( va.begin(), va.end(), 
-														vb.begin(), vb.end(), 
-														rval.begin(), cmp_lt_amplicon_p ) ;
+			vector<unsigned int>::iterator it = set_union( va.begin(), va.end(), vb.begin(), vb.end(), rval.begin() ) ;
 			rval.resize( it - rval.begin() ) ;
 
 			// return the return value
@@ -0,0 +1,74 @@
+#include "stdafx.h"
+#include "BAM.h"
+
+namespace Nimbus {
+
+	namespace alignment { 
+
+		using namespace std ;
+
+		static void append_uint32( string& out, uint32_t v ) {
+			char b[4] = { (char) ( v & 0xff ), (char) ( ( v >> 8 ) & 0xff ), (char) ( ( v >> 16 ) & 0xff ), (char) ( ( v >> 24 ) & 0xff ) } ;
+			out.append( b, 4 ) ;
+		}
+
+		//
+		//
+		// Implementation of the BAMEncoder
+		//
+		//
+
+		BAMEncoder::BAMEncoder( const string& text ) {
+			_text = text ;
+
+			// collect the SN and LN fields of the @SQ lines
+			istringstream lines( text ) ;
+			string line ;
+			while( getline( lines, line ) ) {
+				if( line.compare( 0, 4, "@SQ\t" ) != 0 ) continue ;
+
+				string name = "" ;
+				int length  = 0 ;
+				istringstream fields( line ) ;
+				string field ;
+				while( getline( fields, field, '\t' ) ) {
+					if( field.compare( 0, 3, "SN:" ) == 0 ) name = field.substr( 3 ) ;
+					if( field.compare( 0, 3, "LN:" ) == 0 ) length = atoi( field.substr( 3 ).c_str() ) ;
+				}
+				if( name != "" && _index.find( name ) == _index.end() ) {
+					_index[name] = (int) _names.size() ;
+					_names.push_back( name ) ;
+					_lengths.push_back( length ) ;
+				}
+			}
+		}
+
+		void BAMEncoder::header( string& out ) const {
+			out.append( "BAM\1", 4 ) ;
+			append_uint32( out, (uint32_t) _text.size() ) ;
+			out += _text ;
+			append_uint32( out, (uint32_t) _names.size() ) ;
+			for( unsigned int i=0; i<_names.size(); i++ ) {
+				append_uint32( out, (uint32_t) _names[i].size() + 1 ) ;
+				out.append( _names[i].c_str(), _names[i].size() + 1 ) ;
+				append_uint32( out, (uint32_t) _lengths[i] ) ;
+			}
+		}
+
+		int BAMEncoder::reference( const string& name ) const {
+			map<string,int>::const_iterator it = _index.find( name ) ;
+			return it != _index.end() ? it->second : -1 ;
+		}
+
+		void BAMEncoder::append( const SAMRecord& r, string& out ) const {
+			append( r, string(), out ) ;
+		}
+
+		void BAMEncoder::append( const SAMRecord& r, const string& readgroup, string& out ) const {
+			int refid = reference( r.rname() ) ;
+			string rnext = r.rnext() ;
+			int nextrefid = rnext == "=" ? refid : reference( rnext ) ;
+			r.append_bam( out, refid, nextrefid, readgroup ) ;
+		}
+	}
+}
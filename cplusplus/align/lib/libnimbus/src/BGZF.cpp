@@ -0,0 +1,92 @@
+#include "stdafx.h"
+#include "BGZF.h"
+
+namespace Nimbus {
+
+	namespace IO {
+
+		const size_t BGZFCompressor::BLOCKSIZE ;
+		const size_t BGZFCompressor::MAXBLOCKSIZE ;
+
+		// the gzip header with the BC extra field, the block size is set per block
+		static const unsigned char BGZF_HEADER[18] = {
+			0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0
+		} ;
+
+		// the crc32 and size trailing the deflated data
+		static const size_t BGZF_FOOTER = 8 ;
+
+		static void put_uint32( std::string& out, size_t at, uint32_t v ) {
+			out[at]     = (char) ( v & 0xff ) ;
+			out[at + 1] = (char) ( ( v >> 8 ) & 0xff ) ;
+			out[at + 2] = (char) ( ( v >> 16 ) & 0xff ) ;
+			out[at + 3] = (char) ( ( v >> 24 ) & 0xff ) ;
+		}
+
+		//
+		//
+		// Implementation of the BGZFCompressor
+		//
+		//
+
+		BGZFCompressor::BGZFCompressor( ) {
+			_init( Z_DEFAULT_COMPRESSION ) ;
+		}
+
+		BGZFCompressor::BGZFCompressor( int level ) {
+			_init( level ) ;
+		}
+
+		BGZFCompressor::~BGZFCompressor( ) {
+			deflateEnd( &_z ) ;
+		}
+
+		void BGZFCompressor::_init( int level ) {
+			_level    = level ;
+			_z.zalloc = Z_NULL ;
+			_z.zfree  = Z_NULL ;
+			_z.opaque = Z_NULL ;
+
+			// raw deflate: the gzip header is written by compress
+			if( deflateInit2( &_z, _level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) {
+				std::cerr << "[BGZF] could not initialize the compression" << std::endl ;
+				exit( EXIT_FAILURE ) ;
+			}
+		}
+
+		void BGZFCompressor::compress( const char* data, size_t n, std::string& out ) {
+			assert( n <= BLOCKSIZE ) ;
+
+			size_t start = out.size() ;
+			out.append( (const char*) BGZF_HEADER, sizeof(BGZF_HEADER) ) ;
+			out.resize( start + MAXBLOCKSIZE ) ;
+
+			// deflate the data; deflate stores incompressible data in blocks of 
+			// 5 bytes overhead per 16k, so BLOCKSIZE bytes always fit in a block
+			deflateReset( &_z ) ;
+			_z.next_in   = (Bytef*) data ;
+			_z.avail_in  = (uInt) n ;
+			_z.next_out  = (Bytef*) &out[start + sizeof(BGZF_HEADER)] ;
+			_z.avail_out = (uInt) ( MAXBLOCKSIZE - sizeof(BGZF_HEADER) - BGZF_FOOTER ) ;
+			if( deflate( &_z, Z_FINISH ) != Z_STREAM_END ) {
+				std::cerr << "[BGZF] could not compress a block of " << n << " bytes" << std::endl ;
+				exit( EXIT_FAILURE ) ;
+			}
+			size_t size = sizeof(BGZF_HEADER) + _z.total_out + BGZF_FOOTER ;
+			out.resize( start + size ) ;
+
+			// the block size minus one in the header, the crc and input size in the footer
+			out[start + 16] = (char) ( ( size - 1 ) & 0xff ) ;
+			out[start + 17] = (char) ( ( size - 1 ) >> 8 ) ;
+			put_uint32( out, start + size - 8, crc32( crc32( 0L, Z_NULL, 0 ), (const Bytef*) data, (uInt) n ) ) ;
+			put_uint32( out, start + size - 4, (uint32_t) n ) ;
+		}
+
+		void BGZFCompressor::eof( std::string& out ) {
+			static const unsigned char BGZF_EOF[28] = {
+				0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+			} ;
+			out.append( (const char*) BGZF_EOF, sizeof(BGZF_EOF) ) ;
+		}
+	}
+}
@@ -0,0 +1,94 @@
+#include "stdafx.h"
+#include "FastQParser.h"
+#include <cstring>
+
+namespace Nimbus {
+
+	namespace IO {
+
+		using namespace std ;
+		using namespace basic ;
+
+		FastQParser::FastQParser( istream& in ): _in(in) {
+			_init( BLOCKSIZE ) ;
+		}
+
+		FastQParser::FastQParser( istream& in, size_t blocksize ): _in(in) {
+			_init( blocksize ) ;
+		}
+
+		FastQParser::~FastQParser() {
+		}
+
+		void FastQParser::_init( size_t blocksize ) {
+			_blocksize = blocksize > 0 ? blocksize : 1 ;
+			_buffer.resize( _blocksize ) ;
+			_pos = 0 ;
+			_end = 0 ;
+			_eof = false ;
+		}
+
+		bool FastQParser::next( Read& r ) {
+			size_t start[4] ;
+			size_t length[4] ;
+
+			// slide over the lines until four of them look like a FastQ entry
+			int n = 0 ;
+			while( n < 4 ) {
+				if( ! _line( start, length, n ) ) return false ;
+				n++ ;
+				if( n == 4 && ! ( length[0] > 0 && _buffer[ start[0] ] == '@' && length[2] > 0 && _buffer[ start[2] ] == '+' ) ) {
+					for( int i=0; i<3; i++ ) {
+						start[i]  = start[i+1] ;
+						length[i] = length[i+1] ;
+					}
+					n = 3 ;
+				}
+			}
+
+			// do some more checks
+			if( length[1] == 0 || length[1] != length[3] ) return false ;
+
+			const char* b = &_buffer[0] ;
+			r.assign( b + start[0] + 1, length[0] - 1, b + start[1], length[1], b + start[3], length[3] ) ;
+			return true ;
+		}
+
+		bool FastQParser::_line( size_t* start, size_t* length, int n ) {
+			for( ;; ) {
+				const char* p = NULL ;
+				if( _pos < _end ) p = (const char*) memchr( &_buffer[_pos], '\n', _end - _pos ) ;
+
+				// the last line of the stream may lack its line end
+				if( p != NULL || ( _eof && _pos < _end ) ) {
+					size_t e  = p != NULL ? (size_t) ( p - &_buffer[0] ) : _end ;
+					start[n]  = _pos ;
+					length[n] = e - _pos ;
+					if( length[n] > 0 && _buffer[ e - 1 ] == '\r' ) length[n]-- ;
+					_pos = p != NULL ? e + 1 : _end ;
+					return true ;
+				}
+				if( _eof ) return false ;
+
+				// the line continues in the next block
+				size_t keep = n > 0 ? start[0] : _pos ;
+				_fill( keep ) ;
+				for( int i=0; i<n; i++ ) start[i] -= keep ;
+			}
+		}
+
+		void FastQParser::_fill( size_t keep ) {
+			size_t n = _end - keep ;
+			if( keep > 0 && n > 0 ) memmove( &_buffer[0], &_buffer[keep], n ) ;
+			_pos -= keep ;
+			_end  = n ;
+
+			// make room for a full block
+			if( _buffer.size() < _end + _blocksize ) _buffer.resize( _end + _blocksize ) ;
+			_in.read( &_buffer[_end], (streamsize) _blocksize ) ;
+			size_t got = (size_t) _in.gcount() ;
+			_end += got ;
+			if( got < _blocksize ) _eof = true ;
+		}
+	}
+}
@@ -0,0 +1,393 @@
+#include "stdafx.h"
+#include "GzipInput.h"
+#include <cstring>
+#include <stdint.h>
+
+namespace Nimbus {
+
+	namespace IO {
+
+		using namespace std ;
+
+		const int GzipInput::THREADS ;
+		const size_t GzipInput::CHUNKSIZE ;
+
+		// the fixed part of a gzip member header
+		static const size_t GZIP_HEADER = 12 ;
+
+		// the crc32 and size trailing the deflated data
+		static const size_t GZIP_FOOTER = 8 ;
+
+		// the number of BGZF blocks read ahead per decoder thread
+		static const size_t BGZF_READAHEAD = 32 ;
+
+		// the number of chunks of gzip input read ahead
+		static const size_t GZIP_READAHEAD = 4 ;
+
+		static void fatal( const string& message ) {
+			cerr << "[GzipInput] " << message << endl ;
+			exit( EXIT_FAILURE ) ;
+		}
+
+		static size_t get_uint16( const string& s, size_t at ) {
+			return (size_t) (unsigned char) s[at] | ( (size_t) (unsigned char) s[at + 1] << 8 ) ;
+		}
+
+		static uint32_t get_uint32( const string& s, size_t at ) {
+			return (uint32_t) (unsigned char) s[at] | ( (uint32_t) (unsigned char) s[at + 1] << 8 ) |
+					( (uint32_t) (unsigned char) s[at + 2] << 16 ) | ( (uint32_t) (unsigned char) s[at + 3] << 24 ) ;
+		}
+
+		// whether the fixed header starts a gzip member with extra fields
+		static bool has_extra( const string& header ) {
+			return (unsigned char) header[0] == 0x1f && (unsigned char) header[1] == 0x8b && header[2] == 8 && ( header[3] & 4 ) != 0 ;
+		}
+
+		//
+		//
+		// GzipInput
+		//
+		//
+
+		GzipInput::GzipInput( istream& in ): istream( NULL ) {
+			_buffer = new _Buffer( in, THREADS ) ;
+			rdbuf( _buffer ) ;
+		}
+
+		GzipInput::GzipInput( istream& in, int threads ): istream( NULL ) {
+			_buffer = new _Buffer( in, threads > 0 ? threads : 1 ) ;
+			rdbuf( _buffer ) ;
+		}
+
+		GzipInput::~GzipInput() {
+			rdbuf( NULL ) ;
+			delete _buffer ;
+		}
+
+		bool GzipInput::bgzf() {
+			return _buffer->bgzf() ;
+		}
+
+		bool GzipInput::gzipped( istream& in ) {
+			return in.peek() == 0x1f ;
+		}
+
+		//
+		//
+		// The stream buffer
+		//
+		//
+
+		GzipInput::_Buffer::_Buffer( istream& in, int threads ): _in(in) {
+			_threads   = threads ;
+			_bgzf      = false ;
+			_detected  = false ;
+			_readahead = GZIP_READAHEAD ;
+			_current   = NULL ;
+			_eof       = false ;
+			_stop      = false ;
+			setg( NULL, NULL, NULL ) ;
+			_reader = thread( &_Buffer::_read, this ) ;
+		}
+
+		GzipInput::_Buffer::~_Buffer() {
+			{
+				lock_guard<mutex> guard( _m ) ;
+				_stop = true ;
+			}
+			_space.notify_all() ;
+			_work.notify_all() ;
+			_reader.join() ;
+			for( vector<thread>::iterator it=_decoders.begin(); it!=_decoders.end(); ++it ) it->join() ;
+
+			if( _current != NULL ) delete _current ;
+			for( deque<_Block*>::iterator it=_order.begin(); it!=_order.end(); ++it ) delete *it ;
+			for( vector<_Block*>::iterator it=_spare.begin(); it!=_spare.end(); ++it ) delete *it ;
+		}
+
+		bool GzipInput::_Buffer::bgzf() {
+			unique_lock<mutex> lock( _m ) ;
+			while( ! _detected && ! _eof ) _ready.wait( lock ) ;
+			return _bgzf ;
+		}
+
+		GzipInput::_Buffer::int_type GzipInput::_Buffer::underflow() {
+			if( gptr() < egptr() ) return traits_type::to_int_type( *gptr() ) ;
+
+			unique_lock<mutex> lock( _m ) ;
+			if( _current != NULL ) {
+				_spare.push_back( _current ) ;
+				_current = NULL ;
+			}
+
+			// take the next block in the order of the stream, skipping empty blocks
+			for( ;; ) {
+				while( ! ( ! _order.empty() && _order.front()->done ) && ! ( _order.empty() && _eof ) ) _ready.wait( lock ) ;
+				if( _order.empty() ) {
+					setg( NULL, NULL, NULL ) ;
+					return traits_type::eof() ;
+				}
+				_Block* b = _order.front() ;
+				_order.pop_front() ;
+				_space.notify_one() ;
+				if( ! b->out.empty() ) {
+					_current = b ;
+					break ;
+				}
+				_spare.push_back( b ) ;
+			}
+
+			char* p = &_current->out[0] ;
+			setg( p, p, p + _current->out.size() ) ;
+			return traits_type::to_int_type( *p ) ;
+		}
+
+		//
+		// the reader thread
+		//
+
+		void GzipInput::_Buffer::_read() {
+			string header( GZIP_HEADER, '\0' ) ;
+			header.resize( _get( &header[0], GZIP_HEADER ) ) ;
+
+			// BGZF blocks have the block size in the BC field of the header
+			int bsize = -1 ;
+			if( header.size() == GZIP_HEADER && has_extra( header ) ) {
+				string extra( get_uint16( header, 10 ), '\0' ) ;
+				if( _get( &extra[0], extra.size() ) != extra.size() ) fatal( "truncated gzip header" ) ;
+				bsize = _bsize( extra ) ;
+				header += extra ;
+			}
+
+			{
+				lock_guard<mutex> guard( _m ) ;
+				_bgzf     = bsize >= 0 ;
+				_detected = true ;
+			}
+			_ready.notify_all() ;
+
+			if( bsize >= 0 ) {
+				_readBGZF( header, bsize ) ;
+			} else {
+				_readGzip( header ) ;
+			}
+
+			{
+				lock_guard<mutex> guard( _m ) ;
+				_eof = true ;
+			}
+			_ready.notify_all() ;
+			_work.notify_all() ;
+		}
+
+		void GzipInput::_Buffer::_readBGZF( string& header, int bsize ) {
+			{
+				lock_guard<mutex> guard( _m ) ;
+				_readahead = BGZF_READAHEAD * _threads ;
+			}
+			for( int i=0; i<_threads; i++ ) _decoders.push_back( thread( &_Buffer::_decode, this ) ) ;
+
+			for( ;; ) {
+				_Block* b = _block() ;
+				if( b == NULL ) return ;
+
+				// the block is bsize + 1 bytes, including the header
+				size_t total = (size_t) bsize + 1 ;
+				if( total < header.size() + GZIP_FOOTER ) fatal( "invalid BGZF block size" ) ;
+				b->in = header ;
+				b->in.resize( total ) ;
+				size_t rest = total - header.size() ;
+				if( _get( &b->in[ header.size() ], rest ) != rest ) fatal( "truncated BGZF block" ) ;
+				_push( b, true ) ;
+
+				// the header of the next block
+				header.resize( GZIP_HEADER ) ;
+				size_t n = _get( &header[0], GZIP_HEADER ) ;
+				if( n == 0 ) return ;
+				if( n < GZIP_HEADER || ! has_extra( header ) ) fatal( "invalid BGZF block header" ) ;
+				string extra( get_uint16( header, 10 ), '\0' ) ;
+				if( _get( &extra[0], extra.size() ) != extra.size() ) fatal( "truncated BGZF block header" ) ;
+				bsize = _bsize( extra ) ;
+				if( bsize < 0 ) fatal( "BGZF block without a block size" ) ;
+				header += extra ;
+			}
+		}
+
+		void GzipInput::_Buffer::_readGzip( const string& start ) {
+			z_stream z ;
+			z.zalloc   = Z_NULL ;
+			z.zfree    = Z_NULL ;
+			z.opaque   = Z_NULL ;
+			z.next_in  = Z_NULL ;
+			z.avail_in = 0 ;
+			if( inflateInit2( &z, 15 + 16 ) != Z_OK ) fatal( "could not initialize the decompression" ) ;
+
+			// the bytes read to detect the format are inflated first
+			vector<char> input( CHUNKSIZE ) ;
+			memcpy( &input[0], start.data(), start.size() ) ;
+			z.next_in  = (Bytef*) &input[0] ;
+			z.avail_in = (uInt) start.size() ;
+
+			bool member  = true ;		// whether a member is being inflated
+			size_t members = 0 ;
+			_Block* b    = NULL ;
+			for( ;; ) {
+				if( z.avail_in == 0 ) {
+					size_t n = _get( &input[0], CHUNKSIZE ) ;
+					if( n == 0 ) break ;
+					z.next_in  = (Bytef*) &input[0] ;
+					z.avail_in = (uInt) n ;
+				}
+				if( b == NULL ) {
+					b = _block() ;
+					if( b == NULL ) break ;
+					b->out.resize( CHUNKSIZE ) ;
+					z.next_out  = (Bytef*) &b->out[0] ;
+					z.avail_out = (uInt) CHUNKSIZE ;
+				}
+
+				// the next member follows the end of the previous one
+				if( ! member ) {
+					inflateReset( &z ) ;
+					member = true ;
+				}
+
+				int ret = inflate( &z, Z_NO_FLUSH ) ;
+				if( ret == Z_STREAM_END ) {
+					member = false ;
+					members++ ;
+				} else if( ret == Z_DATA_ERROR && members > 0 && z.total_out == 0 ) {
+					// like gzip, ignore trailing garbage after a member
+					member = false ;
+					break ;
+				} else if( ret != Z_OK && ret != Z_BUF_ERROR ) {
+					fatal( "corrupt gzip data" ) ;
+				}
+
+				if( z.avail_out == 0 ) {
+					_push( b, false ) ;
+					b = NULL ;
+				}
+			}
+
+			if( b != NULL ) {
+				b->out.resize( CHUNKSIZE - z.avail_out ) ;
+				_push( b, false ) ;
+			}
+			inflateEnd( &z ) ;
+
+			bool stopped = false ;
+			{
+				lock_guard<mutex> guard( _m ) ;
+				stopped = _stop ;
+			}
+			if( member && ! stopped ) fatal( "truncated gzip data" ) ;
+		}
+
+		//
+		// the decoder threads
+		//
+
+		void GzipInput::_Buffer::_decode() {
+			z_stream z ;
+			z.zalloc   = Z_NULL ;
+			z.zfree    = Z_NULL ;
+			z.opaque   = Z_NULL ;
+			z.next_in  = Z_NULL ;
+			z.avail_in = 0 ;
+			if( inflateInit2( &z, -15 ) != Z_OK ) fatal( "could not initialize the decompression" ) ;
+
+			for( ;; ) {
+				_Block* b = NULL ;
+				{
+					unique_lock<mutex> lock( _m ) ;
+					while( _todo.empty() && ! _eof && ! _stop ) _work.wait( lock ) ;
+					if( _todo.empty() || _stop ) break ;
+					b = _todo.front() ;
+					_todo.pop_front() ;
+				}
+
+				_inflate( z, b ) ;
+
+				{
+					lock_guard<mutex> guard( _m ) ;
+					b->done = true ;
+				}
+				_ready.notify_all() ;
+			}
+			inflateEnd( &z ) ;
+		}
+
+		void GzipInput::_Buffer::_inflate( z_stream& z, _Block* b ) {
+			const string& in = b->in ;
+			size_t start     = GZIP_HEADER + get_uint16( in, 10 ) ;
+			size_t n         = in.size() - start - GZIP_FOOTER ;
+			uint32_t crc     = get_uint32( in, in.size() - 8 ) ;
+			uint32_t isize   = get_uint32( in, in.size() - 4 ) ;
+
+			b->out.resize( isize ) ;
+			if( isize == 0 ) return ;
+
+			inflateReset( &z ) ;
+			z.next_in   = (Bytef*) &in[start] ;
+			z.avail_in  = (uInt) n ;
+			z.next_out  = (Bytef*) &b->out[0] ;
+			z.avail_out = (uInt) isize ;
+			if( inflate( &z, Z_FINISH ) != Z_STREAM_END || z.avail_out != 0 ) fatal( "corrupt BGZF block" ) ;
+			if( crc32( 0, (const Bytef*) b->out.data(), isize ) != crc ) fatal( "BGZF block with a wrong checksum" ) ;
+		}
+
+		//
+		// the hand over between the threads
+		//
+
+		GzipInput::_Block* GzipInput::_Buffer::_block() {
+			unique_lock<mutex> lock( _m ) ;
+			while( _order.size() >= _readahead && ! _stop ) _space.wait( lock ) ;
+			if( _stop ) return NULL ;
+
+			_Block* rval = NULL ;
+			if( _spare.empty() ) {
+				rval = new _Block() ;
+			} else {
+				rval = _spare.back() ;
+				_spare.pop_back() ;
+			}
+			rval->done = false ;
+			return rval ;
+		}
+
+		void GzipInput::_Buffer::_push( _Block* b, bool decode ) {
+			{
+				lock_guard<mutex> guard( _m ) ;
+				b->done = ! decode ;
+				_order.push_back( b ) ;
+				if( decode ) _todo.push_back( b ) ;
+			}
+			if( decode ) {
+				_work.notify_one() ;
+			} else {
+				_ready.notify_all() ;
+			}
+		}
+
+		size_t GzipInput::_Buffer::_get( char* buffer, size_t n ) {
+			if( n == 0 ) return 0 ;
+			_in.read( buffer, (streamsize) n ) ;
+			return (size_t) _in.gcount() ;
+		}
+
+		// the block size minus one in the BC subfield of the extra field, -1 if absent
+		int GzipInput::_Buffer::_bsize( const string& extra ) {
+			size_t i = 0 ;
+			while( i + 4 <= extra.size() ) {
+				size_t len = get_uint16( extra, i + 2 ) ;
+				if( extra[i] == 'B' && extra[i + 1] == 'C' && len == 2 && i + 6 <= extra.size() ) {
+					return (int) get_uint16( extra, i + 4 ) ;
+				}
+				i += 4 + len ;
+			}
+			return -1 ;
+		}
+	}
+}
@@ -0,0 +1,256 @@
+#include "stdafx.h"
+#include "IndexFile.h"
+#include <map>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace Nimbus {
+
+	namespace IO {
+
+		using namespace std ;
+		using namespace basic ;
+		using namespace seed ;
+		using namespace alignment ;
+
+		const uint32_t IndexFile::VERSION ;
+
+		// the start of every index file
+		static const char MAGIC[8] = { 'N', 'I', 'M', 'B', 'U', 'S', 'I', 'X' } ;
+
+		// written in the byte order of the machine
+		static const uint32_t BYTEORDER = 0x01020304 ;
+
+		//
+		// the records of the file, which are all multiples of 8 bytes
+		//
+
+		struct FileHeader {
+			char magic[8] ;
+			uint32_t version ;
+			uint32_t byteorder ;
+			uint32_t keysize ;
+			uint32_t references ;
+			uint32_t amplicons ;
+			uint32_t reserved ;
+			uint64_t size ;			// the size of the file
+			uint64_t names ;		// the bytes of the concatenated names
+			uint64_t sequences ;	// the bytes of the concatenated sequences
+			uint64_t reserved2 ;
+		} ;
+
+		struct ReferenceRecord {
+			uint64_t length ;
+			uint64_t name ;
+			uint64_t namelength ;
+		} ;
+
+		struct AmpliconRecord {
+			uint32_t reference ;
+			int32_t start ;
+			int32_t end ;
+			uint32_t forward ;
+			uint64_t name ;
+			uint64_t sequence ;
+			uint32_t namelength ;
+			uint32_t sequencelength ;
+		} ;
+
+		static size_t padded( size_t n ) {
+			return ( n + 7 ) & ~ (size_t) 7 ;
+		}
+
+		static void write_padded( ostream& out, const void* data, size_t n ) {
+			static const char padding[8] = { 0 } ;
+			if( n > 0 ) out.write( (const char*) data, n ) ;
+			out.write( padding, padded( n ) - n ) ;
+		}
+
+		//
+		//
+		// IndexFile
+		//
+		//
+
+		IndexFile::IndexFile( const string& fname ): _fname(fname) {
+			_data  = NULL ;
+			_size  = 0 ;
+			_index = NULL ;
+
+			// map the whole file
+			int fd = open( fname.c_str(), O_RDONLY ) ;
+			if( fd < 0 ) _fail( "could not be opened" ) ;
+			struct stat st ;
+			if( fstat( fd, &st ) != 0 || st.st_size < (off_t) sizeof( FileHeader ) ) {
+				close( fd ) ;
+				_fail( "is not an index file" ) ;
+			}
+			_size = (size_t) st.st_size ;
+			void* data = mmap( NULL, _size, PROT_READ, MAP_SHARED, fd, 0 ) ;
+			close( fd ) ;
+			if( data == MAP_FAILED ) _fail( "could not be mapped" ) ;
+			_data = (const char*) data ;
+			const char* end = _data + _size ;
+
+			// check the header
+			const FileHeader* h = (const FileHeader*) _data ;
+			if( memcmp( h->magic, MAGIC, sizeof( MAGIC ) ) != 0 ) _fail( "is not an index file" ) ;
+			if( h->byteorder != BYTEORDER ) _fail( "was written on a machine with another byte order" ) ;
+			if( h->version != VERSION ) _fail( "has an unsupported version, rebuild it with nimbus index" ) ;
+			if( h->size != _size ) _fail( "is truncated" ) ;
+
+			// the sections should fit in the file
+			const char* p = _data + sizeof( FileHeader ) ;
+			size_t n_references = h->references ;
+			size_t n_amplicons  = h->amplicons ;
+			if( n_references > (size_t) ( end - p ) / sizeof( ReferenceRecord ) ) _fail( "is corrupt" ) ;
+			const ReferenceRecord* references = (const ReferenceRecord*) p ;
+			p += n_references * sizeof( ReferenceRecord ) ;
+			if( n_amplicons > (size_t) ( end - p ) / sizeof( AmpliconRecord ) ) _fail( "is corrupt" ) ;
+			const AmpliconRecord* amplicons = (const AmpliconRecord*) p ;
+			p += n_amplicons * sizeof( AmpliconRecord ) ;
+			if( h->names > (uint64_t) ( end - p ) || padded( h->names ) > (size_t) ( end - p ) ) _fail( "is corrupt" ) ;
+			const char* names = p ;
+			p += padded( h->names ) ;
+			if( h->sequences > (uint64_t) ( end - p ) || padded( h->sequences ) > (size_t) ( end - p ) ) _fail( "is corrupt" ) ;
+			const char* sequences = p ;
+			p += padded( h->sequences ) ;
+
+			// the references of the SAM header
+			vector<string> chromosomes = vector<string>() ;
+			for( size_t i=0; i<n_references; i++ ) {
+				const ReferenceRecord& r = references[i] ;
+				if( r.name > h->names || r.namelength > h->names - r.name ) _fail( "is corrupt" ) ;
+				chromosomes.push_back( string( names + r.name, r.namelength ) ) ;
+				_header.add( chromosomes.back(), (int) r.length ) ;
+			}
+
+			// the amplicons, in the order of the index
+			_amplicons.reserve( n_amplicons ) ;
+			for( size_t i=0; i<n_amplicons; i++ ) {
+				const AmpliconRecord& a = amplicons[i] ;
+				if( a.reference >= n_references ) _fail( "is corrupt" ) ;
+				if( a.name > h->names || a.namelength > h->names - a.name ) _fail( "is corrupt" ) ;
+				if( a.sequence > h->sequences || a.sequencelength > h->sequences - a.sequence ) _fail( "is corrupt" ) ;
+				_amplicons.push_back( new Amplicon( chromosomes[a.reference], a.start, a.end, a.forward != 0,
+					string( sequences + a.sequence, a.sequencelength ), string( names + a.name, a.namelength ) ) ) ;
+			}
+
+			// the k-mer tables are used in place
+			_index = new AmpliconIndex() ;
+			for( vector<Amplicon*>::iterator it=_amplicons.begin(); it!=_amplicons.end(); ++it ) {
+				_index->add( *it ) ;
+			}
+			if( _index->map( (int) h->keysize, p, end ) != end ) _fail( "is corrupt" ) ;
+		}
+
+		IndexFile::~IndexFile() {
+			if( _index != NULL ) delete _index ;
+			for( vector<Amplicon*>::iterator it=_amplicons.begin(); it!=_amplicons.end(); ++it ) delete *it ;
+			if( _data != NULL ) munmap( (void*) _data, _size ) ;
+		}
+
+		AmpliconIndex* IndexFile::index() const {
+			return _index ;
+		}
+
+		const vector<Amplicon*>& IndexFile::amplicons() const {
+			return _amplicons ;
+		}
+
+		const SAMHeader& IndexFile::header() const {
+			return _header ;
+		}
+
+		int IndexFile::keysize() const {
+			return _index->keysize() ;
+		}
+
+		void IndexFile::_fail( const string& message ) const {
+			cerr << "[IndexFile] " << _fname << " " << message << endl ;
+			exit( EXIT_FAILURE ) ;
+		}
+
+		//
+		// Writing
+		//
+
+		void IndexFile::write( const string& fname, const AmpliconIndex& index, const SAMHeader& header ) {
+			const vector<Amplicon*>& amplicons = index.amplicons() ;
+			vector<string> chromosomes = header.names() ;
+			vector<int> lengths        = header.lengths() ;
+
+			// concatenate the names and sequences
+			string names     = "" ;
+			string sequences = "" ;
+			map<string, uint32_t> ids = map<string, uint32_t>() ;
+			vector<ReferenceRecord> refrecords = vector<ReferenceRecord>( chromosomes.size() ) ;
+			for( size_t i=0; i<chromosomes.size(); i++ ) {
+				ids[ chromosomes[i] ]     = (uint32_t) i ;
+				refrecords[i].length     = (uint64_t) lengths[i] ;
+				refrecords[i].name       = names.size() ;
+				refrecords[i].namelength = chromosomes[i].size() ;
+				names += chromosomes[i] ;
+			}
+
+			vector<AmpliconRecord> amprecords = vector<AmpliconRecord>( amplicons.size() ) ;
+			for( size_t i=0; i<amplicons.size(); i++ ) {
+				const Amplicon* a = amplicons[i] ;
+				map<string, uint32_t>::iterator it = ids.find( a->chromosome() ) ;
+				if( it == ids.end() ) {
+					cerr << "[IndexFile] reference " << a->chromosome() << " of amplicon " << a->str() << " is not in the header" << endl ;
+					exit( EXIT_FAILURE ) ;
+				}
+				AmpliconRecord& r = amprecords[i] ;
+				r.reference      = it->second ;
+				r.start          = a->start() ;
+				r.end            = a->end() ;
+				r.forward        = a->forward() ? 1 : 0 ;
+				r.name           = names.size() ;
+				r.namelength     = (uint32_t) a->name().size() ;
+				r.sequence       = sequences.size() ;
+				r.sequencelength = (uint32_t) a->sequence().size() ;
+				names     += a->name() ;
+				sequences += a->sequence() ;
+			}
+
+			// the tables of the index follow the other sections
+			stringstream tables ;
+			index.write( tables ) ;
+			string tabledata = tables.str() ;
+
+			FileHeader h ;
+			memset( &h, 0, sizeof( h ) ) ;
+			memcpy( h.magic, MAGIC, sizeof( MAGIC ) ) ;
+			h.version    = VERSION ;
+			h.byteorder  = BYTEORDER ;
+			h.keysize    = (uint32_t) index.keysize() ;
+			h.references = (uint32_t) refrecords.size() ;
+			h.amplicons  = (uint32_t) amprecords.size() ;
+			h.names      = names.size() ;
+			h.sequences  = sequences.size() ;
+			h.size       = sizeof( FileHeader ) + refrecords.size() * sizeof( ReferenceRecord ) + amprecords.size() * sizeof( AmpliconRecord ) +
+							padded( names.size() ) + padded( sequences.size() ) + tabledata.size() ;
+
+			// write to a temporary file that replaces the index when complete
+			string tmpname = fname + ".tmp" ;
+			ofstream out( tmpname.c_str(), ios::out | ios::binary | ios::trunc ) ;
+			out.write( (const char*) &h, sizeof( h ) ) ;
+			write_padded( out, refrecords.data(), refrecords.size() * sizeof( ReferenceRecord ) ) ;
+			write_padded( out, amprecords.data(), amprecords.size() * sizeof( AmpliconRecord ) ) ;
+			write_padded( out, names.data(), names.size() ) ;
+			write_padded( out, sequences.data(), sequences.size() ) ;
+			out.write( tabledata.data(), tabledata.size() ) ;
+			out.close() ;
+			if( ! out || rename( tmpname.c_str(), fname.c_str() ) != 0 ) {
+				cerr << "[IndexFile] could not write " << fname << endl ;
+				remove( tmpname.c_str() ) ;
+				exit( EXIT_FAILURE ) ;
+			}
+		}
+	}
+}
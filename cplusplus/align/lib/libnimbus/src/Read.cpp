@@ -17,27 +17,14 @@ namespace Nimbus {
 		/* 
 		 Default constructor
 		 */
-		Read::Read( std::string name, std::string sequence, std::string quality ) {
-			_name = std::string(name)  ;
-			_seq  = std::string(sequence) ;
-			_qual = std::string(quality) ;
-
-			_r_qual = "" ;
-			_rc_seq = "" ;
+		Read::Read( const std::string& name, const std::string& sequence, const std::string& quality ): 
+			_name(name), _seq(sequence), _qual(quality) { 
 		}
 
 		Read::Read() {
-			_name = "" ;
-			_seq  = "" ;
-			_qual = "" ;
-			_r_qual = "" ;
-			_rc_seq = "" ;
 		}
 
-		Read::Read( const Read& other ) {
-			_name = other.name() ;
-			_seq  = other.sequence() ;
-			_qual = other.quality() ;
+		Read::Read( const Read& other ): _name(other._name), _seq(other._seq), _qual(other._qual) {
 		}
 
 		Read::~Read(void)
@@ -45,45 +32,39 @@ namespace Nimbus {
 		}
 
 		// get the reverse complement of the sequence
-		std::string Read::rc_sequence() {
-			std::string rval ;
+		const std::string& Read::rc_sequence() {
 
 			// set the reverse complement read on the first call of this function
-			if( _rc_seq.size() == 0 ) {
-
-				// complement the read via a stringstream
-				std::stringstream tmp ;
-				for( std::string::reverse_iterator it=_seq.rbegin(); it!=_seq.rend(); ++it ) {
-					tmp << utils::complement_base( *it ) ; 
+			if( _rc_seq.size() != _seq.size() ) {
+				_rc_seq.resize( _seq.size() ) ;
+				std::string::iterator out = _rc_seq.begin() ;
+				for( std::string::const_reverse_iterator it=_seq.rbegin(); it!=_seq.rend(); ++it, ++out ) {
+					*out = utils::complement_base( *it ) ; 
 				}
-				_rc_seq = tmp.str() ;
 			}
-			rval = _rc_seq ;
-			return rval ;
+			return _rc_seq ;
 		}
 
 		// get the reverse complement of the quality
-		std::string Read::r_quality() {
-			std::string rval ;
+		const std::string& Read::r_quality() {
 
 			// set the reverse complement read on the first call of this function
-			if( _r_qual.size() == 0 ) {
-				_r_qual = std::string( _qual.rbegin(), _qual.rend() ) ;
+			if( _r_qual.size() != _qual.size() ) {
+				_r_qual.assign( _qual.rbegin(), _qual.rend() ) ;
 			} 
-			rval = _r_qual ;
-			return rval ;
+			return _r_qual ;
 		}
 
-		// get the reverse complement for this read
-		std::string Read::name() const {
+		// get the name of the read
+		const std::string& Read::name() const {
 			return _name ;
 		}
 
-		std::string Read::sequence() const {
+		const std::string& Read::sequence() const {
 			return _seq ;
 		}
 
-		std::string Read::quality() const {
+		const std::string& Read::quality() const {
 			return _qual ;
 		}
 
@@ -106,18 +87,43 @@ namespace Nimbus {
 			return s.str() ;
 		}
 
+		void Read::assign( const std::string& name, const std::string& sequence, const std::string& quality ) {
+			_name.assign( name ) ;
+			_seq.assign( sequence ) ;
+			_qual.assign( quality ) ;
+			_rc_seq.clear() ;
+			_r_qual.clear() ;
+		}
+
+		void Read::assign( const char* name, size_t nl, const char* sequence, size_t sl, const char* quality, size_t ql ) {
+			_name.assign( name, nl ) ;
+			_seq.assign( sequence, sl ) ;
+			_qual.assign( quality, ql ) ;
+			_rc_seq.clear() ;
+			_r_qual.clear() ;
+		}
+
 		
 		//
 		// protected functions
 		//
 		void Read::sequence( std::string s ) {
-			_seq    = std::string(s) ;
-			_rc_seq = "" ;
+			_seq.swap( s ) ;
+			_rc_seq.clear() ;
 		}
 
 		void Read::quality( std::string q ) {
-			_qual   = std::string(q) ;
-			_r_qual = "" ;
+			_qual.swap( q ) ;
+			_r_qual.clear() ;
+		}
+
+		// the reverse complement of the reverse complement is the sequence
+		// itself, so swapping the strings keeps the cache valid
+		void Read::reverse() {
+			rc_sequence() ;
+			r_quality() ;
+			_seq.swap( _rc_seq ) ;
+			_qual.swap( _r_qual ) ;
 		}
 
 	}
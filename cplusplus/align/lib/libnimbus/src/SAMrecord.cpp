@@ -1,5 +1,7 @@
 #include "stdafx.h"
 #include "SAMrecord.h"
+#include <stdint.h>
+#include <cstring>
 
 namespace Nimbus {
 
@@ -94,11 +96,11 @@ namespace Nimbus {
 			_qlen  = -1 ;
 		}
 
-		void SAMCore::rname( string rn ) {
-			_rname = string(rn) ;
+		void SAMCore::rname( const string& rn ) {
+			_rname = rn ;
 		}
 
-		string SAMCore::rname() const {
+		const string& SAMCore::rname() const {
 			return _rname ;
 		}
 
@@ -118,6 +120,23 @@ namespace Nimbus {
 			}
 		}
 
+		void SAMCore::append_cigar( string& s ) const {
+			if( _cigar.size() > 0 ) {
+				size_t n = 1 ;
+				for( size_t i=1; i<=_cigar.size(); i++ ) {
+					if( i < _cigar.size() && _cigar[i] == _cigar[i-1] ) {
+						n++ ;
+					} else {
+						utils::appendInt( s, (long) n ) ;
+						s += _cigar[i-1] ;
+						n = 1 ;
+					}
+				}
+			} else {
+				s += '*' ;
+			}
+		}
+
 		void SAMCore::pos( int p ) {
 			_pos = int(p) ;
 		}
@@ -240,26 +259,170 @@ namespace Nimbus {
 
 		// 
 		string SAMRecord::str() const {
-			stringstream rval ;
-			rval << name() << "\t" 
-				<< flag() << "\t" 
-				<< rname() << "\t" 
-				<< pos() << "\t"
-				<< mapq() << "\t"
-				<< cigar() << "\t"
-				<< rnext() << "\t"
-				<< pnext() << "\t"
-				<< tlen() << "\t"
-				<< sequence() << "\t"
-				<< quality() ;
+			string rval ;
+			append( rval ) ;
+			return rval ;
+		}
+
+		void SAMRecord::append( string& rval ) const {
+			rval += _name ;
+			rval += '\t' ;
+			utils::appendInt( rval, flag() ) ;
+			rval += '\t' ;
+			rval += _rname ;
+			rval += '\t' ;
+			utils::appendInt( rval, _pos ) ;
+			rval += '\t' ;
+			utils::appendInt( rval, _mapq ) ;
+			rval += '\t' ;
+			append_cigar( rval ) ;
+			rval += '\t' ;
+			rval += _rnext ;
+			rval += '\t' ;
+			utils::appendInt( rval, _pnext ) ;
+			rval += '\t' ;
+			utils::appendInt( rval, _tlen ) ;
+			rval += '\t' ;
+			rval += _seq ;
+			rval += '\t' ;
+			rval += _qual ;
 
 			// add the tags to the format
-			for( vector<string>::const_iterator it=_tags.cbegin(); it!=_tags.cend(); ++it) { 
-				rval << "\t" << *it ;
+			for( vector<string>::const_iterator it=_tags.begin(); it!=_tags.end(); ++it) { 
+				rval += '\t' ;
+				rval += *it ;
+			}
+		}
+
+		//
+		// BAM encoding
+		//
+
+		static void append_bam_int( string& out, uint32_t v, int bytes ) {
+			for( int i=0; i<bytes; i++ ) out += (char) ( ( v >> ( 8 * i ) ) & 0xff ) ;
+		}
+
+		/* the BAM bin of the 0-based region beg-end, from the SAM specification */
+		static int reg2bin( int beg, int end ) {
+			--end ;
+			if( beg >> 14 == end >> 14 ) return ( ( 1 << 15 ) - 1 ) / 7 + ( beg >> 14 ) ;
+			if( beg >> 17 == end >> 17 ) return ( ( 1 << 12 ) - 1 ) / 7 + ( beg >> 17 ) ;
+			if( beg >> 20 == end >> 20 ) return ( ( 1 << 9 ) - 1 ) / 7 + ( beg >> 20 ) ;
+			if( beg >> 23 == end >> 23 ) return ( ( 1 << 6 ) - 1 ) / 7 + ( beg >> 23 ) ;
+			if( beg >> 26 == end >> 26 ) return ( ( 1 << 3 ) - 1 ) / 7 + ( beg >> 26 ) ;
+			return 0 ;
+		}
+
+		/* the 4-bit code of a base */
+		static unsigned char bam_base( char b ) {
+			static const string codes = "=ACMGRSVTWYHKDBN" ;
+			size_t i = codes.find( toupper( b ) ) ;
+			return i == string::npos ? 15 : (unsigned char) i ;
+		}
+
+		/* appends an integer tag value in the smallest type that holds it */
+		static void append_bam_int_tag( string& out, long v ) {
+			if( v < 0 ) {
+				if( v >= -128 ) { out += 'c' ; append_bam_int( out, (uint32_t) v, 1 ) ; }
+				else if( v >= -32768 ) { out += 's' ; append_bam_int( out, (uint32_t) v, 2 ) ; }
+				else { out += 'i' ; append_bam_int( out, (uint32_t) v, 4 ) ; }
+			} else {
+				if( v <= 255 ) { out += 'C' ; append_bam_int( out, (uint32_t) v, 1 ) ; }
+				else if( v <= 65535 ) { out += 'S' ; append_bam_int( out, (uint32_t) v, 2 ) ; }
+				else { out += 'I' ; append_bam_int( out, (uint32_t) v, 4 ) ; }
+			}
+		}
+
+		/* appends a tag in the SAM format TG:T:VALUE */
+		static void append_bam_tag( string& out, const string& tag ) {
+			if( tag.size() < 5 || tag[2] != ':' || tag[4] != ':' ) return ;
+
+			out.append( tag, 0, 2 ) ;
+			string value = tag.substr( 5 ) ;
+			float f ;
+			uint32_t u ;
+			switch( tag[3] ) {
+			case 'A':
+				out += 'A' ;
+				out += value.empty() ? ' ' : value[0] ;
+				break ;
+			case 'i':
+				append_bam_int_tag( out, atol( value.c_str() ) ) ;
+				break ;
+			case 'f':
+				out += 'f' ;
+				f = (float) atof( value.c_str() ) ;
+				memcpy( &u, &f, 4 ) ;
+				append_bam_int( out, u, 4 ) ;
+				break ;
+			case 'H':
+				out += 'H' ;
+				out.append( value.c_str(), value.size() + 1 ) ;
+				break ;
+			default:
+				out += 'Z' ;
+				out.append( value.c_str(), value.size() + 1 ) ;
+				break ;
+			}
+		}
+
+		void SAMRecord::append_bam( string& buffer, int refid, int nextrefid, const string& readgroup ) const {
+			static const string ops = "MIDNSHP=X" ;
+
+			// the run length encoded CIGAR and its length on the reference
+			vector<uint32_t> cigar ;
+			int rlen = 0 ;
+			for( size_t i=0, n=1; i<_cigar.size(); i++, n++ ) {
+				if( i + 1 == _cigar.size() || _cigar[i + 1] != _cigar[i] ) {
+					size_t op = ops.find( _cigar[i] ) ;
+					cigar.push_back( (uint32_t) ( n << 4 ) | (uint32_t) ( op == string::npos ? 0 : op ) ) ;
+					if( op == 0 || op == 2 || op == 3 || op == 7 || op == 8 ) rlen += (int) n ;
+					n = 0 ;
+				}
+			}
+
+			bool noseq = _seq == "*" ;
+			uint32_t l_seq = noseq ? 0 : (uint32_t) _seq.size() ;
+			int pos = _pos - 1 ;
+			int end = rlen > 0 ? pos + rlen : pos + 1 ;
+
+			// the fixed size fields; the block size is filled in at the end
+			size_t start = buffer.size() ;
+			append_bam_int( buffer, 0, 4 ) ;
+			append_bam_int( buffer, (uint32_t) refid, 4 ) ;
+			append_bam_int( buffer, (uint32_t) pos, 4 ) ;
+			append_bam_int( buffer, (uint32_t) _name.size() + 1, 1 ) ;
+			append_bam_int( buffer, (uint32_t) _mapq, 1 ) ;
+			append_bam_int( buffer, (uint32_t) reg2bin( pos, end ), 2 ) ;
+			append_bam_int( buffer, (uint32_t) cigar.size(), 2 ) ;
+			append_bam_int( buffer, flag(), 2 ) ;
+			append_bam_int( buffer, l_seq, 4 ) ;
+			append_bam_int( buffer, (uint32_t) nextrefid, 4 ) ;
+			append_bam_int( buffer, (uint32_t) ( _pnext - 1 ), 4 ) ;
+			append_bam_int( buffer, (uint32_t) _tlen, 4 ) ;
+
+			// the variable length fields
+			buffer.append( _name.c_str(), _name.size() + 1 ) ;
+			for( size_t i=0; i<cigar.size(); i++ ) append_bam_int( buffer, cigar[i], 4 ) ;
+			for( size_t i=0; i<l_seq; i+=2 ) {
+				unsigned char c = bam_base( _seq[i] ) << 4 ;
+				if( i + 1 < l_seq ) c |= bam_base( _seq[i + 1] ) ;
+				buffer += (char) c ;
+			}
+			for( size_t i=0; i<l_seq; i++ ) {
+				buffer += _qual == "*" || i >= _qual.size() ? (char) 0xff : (char) ( _qual[i] - 33 ) ;
+			}
+			for( vector<string>::const_iterator it=_tags.begin(); it!=_tags.end(); ++it ) {
+				append_bam_tag( buffer, *it ) ;
+			}
+			if( ! readgroup.empty() ) {
+				buffer += "RGZ" ;
+				buffer.append( readgroup.c_str(), readgroup.size() + 1 ) ;
 			}
 
-			// return the string with the format
-			return rval.str() ;
+			// the block size excludes the size field itself
+			uint32_t size = (uint32_t) ( buffer.size() - start - 4 ) ;
+			for( int i=0; i<4; i++ ) buffer[start + i] = (char) ( ( size >> ( 8 * i ) ) & 0xff ) ;
 		}
 
 		//
@@ -312,10 +475,7 @@ namespace Nimbus {
 			*/
 
 			// if the read was mapped to reverse strand, flip it again
-			if( isReverseComplemented() ) { 
-				sequence( rc_sequence() ) ;
-				quality( r_quality() ) ;				
-			}
+			if( isReverseComplemented() ) reverse() ;
 
 			set_to_defaults() ;
 			_cigar.clear() ;
@@ -324,6 +484,15 @@ namespace Nimbus {
 			rname("*") ;
 		}
 
+		void SAMRecord::setRead( const basic::Read& r, bool reversed ) {
+			_name = r.name() ;
+			if( reversed ) {
+				quality( string( r.quality().rbegin(), r.quality().rend() ) ) ;
+			} else {
+				quality( r.quality() ) ;
+			}
+		}
+
 
 		//
 		//
@@ -332,6 +501,7 @@ namespace Nimbus {
 		SAMHeader::SAMHeader() {
 			_names   = vector<string>() ;
 			_lengths = vector<int>() ;
+			_sorted  = false ;
 		}
 
 		void SAMHeader::add( string nm, int l ) {
@@ -348,11 +518,19 @@ namespace Nimbus {
 			return _lengths ;
 		}
 
+		bool SAMHeader::sorted() const {
+			return _sorted ;
+		}
+
+		void SAMHeader::sorted( bool s ) {
+			_sorted = s ;
+		}
+
 		string SAMHeader::str() const {
 			assert( _names.size() == _lengths.size() ) ;
 
 			stringstream s ;
-			s << "@HD\tVN:1.3\tSO:unsorted" << endl ;
+			s << "@HD\tVN:1.3\tSO:" << ( _sorted ? "coordinate" : "unsorted" ) << endl ;
 			for( unsigned int i=0; i<_names.size(); i++ ) {
 				s << "@SQ\tSN:" << _names[i] << "\tLN:" << _lengths[i] << endl ; 
  			}
@@ -63,6 +63,18 @@ namespace Nimbus {
 			return rval ;
 		}
 
+		void appendInt( std::string& s, long x ) {
+			char buf[24] ;
+			char* p = buf + sizeof(buf) ;
+			unsigned long u = x < 0 ? -(unsigned long) x : (unsigned long) x ;
+			do {
+				*--p = '0' + ( u % 10 ) ;
+				u /= 10 ;
+			} while( u > 0 ) ;
+			if( x < 0 ) *--p = '-' ;
+			s.append( p, buf + sizeof(buf) - p ) ;
+		}
+
 		int QueryStart( std::vector< std::pair<int,int> > path ) {
 
 			// declare the return value 
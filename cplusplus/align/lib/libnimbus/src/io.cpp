@@ -2,6 +2,7 @@
 #include "io.h"
 #include "Utils.h"
 #include "Amplicon.h"
+#include <unordered_map>
 
 namespace Nimbus {
 
@@ -14,24 +15,37 @@ namespace Nimbus {
 		Read* FastQReader( istream& input ) {
 
 			// declare the return value
-			Read* rval = NULL ;
+			Read* rval = new Read() ;
+			if( ! FastQReader( input, *rval ) ) {
+				delete rval ;
+				rval = NULL ;
+			}
+
+			// return the read pointer
+			return rval ;
+		}
+
+		bool FastQReader( istream& input, Read& r ) {
+
+			// declare the return value
+			bool rval = false ;
 			
 			string pname = "" ;
 			string seq   = "" ;
 			string sname = "" ;
 			string qual  = "" ;
+			string tmp   = "" ;
 
 			// we can read a ine
 			while( input.good() ) { 
-				string tmp ;
 				getline( input, tmp ) ;
 
 				// cycle through the variables until: 
 				// pname.size() > 0 and pname[0] == '@' && sname[0] == '+'  
-				pname = seq ;
-				seq   = sname ; 
-				sname = qual ;
-				qual  = tmp ;
+				pname.swap( seq ) ;
+				seq.swap( sname ) ;
+				sname.swap( qual ) ;
+				qual.swap( tmp ) ;
 
 				// break as soon as we have something that looks like a FastQ entry 
 				if( pname.size() > 0 && pname[0] == '@' && sname.size() > 0 && sname[0] == '+' ) {
@@ -42,10 +56,11 @@ namespace Nimbus {
 
 			// do some more checks
 			if( seq.size() > 0 && seq.size() == qual.size() ) {
-				rval = new Read( pname.substr(1), seq, qual ) ;
+				pname.erase( 0, 1 ) ;
+				r.assign( pname, seq, qual ) ;
+				rval = true ;
 			}
 
-			// return the read pointer
 			return rval ;
 		}
 
@@ -163,15 +178,141 @@ namespace Nimbus {
 		}
 
 
-		void AmpliconReader( vector<Amplicon*>& amplicons, SAMHeader& header, string fname_bed, string fname_fasta ) {
+		/*
+		 * Parses a non-negative number
+		 */
+		static bool parse_size( const string& s, size_t& value ) {
+			char* end = NULL ;
+			value = (size_t) strtoull( s.c_str(), &end, 10 ) ;
+			return s.size() > 0 && s[0] != '-' && *end == '\0' ;
+		}
 
-			// declare the result vector
-			amplicons = vector<Amplicon*>() ;
-			header    = SAMHeader() ; 
+		bool FastAIndexReader( vector<FastAIndexEntry>& entries, string fname ) {
+
+			// initialize the return value
+			entries = vector<FastAIndexEntry>() ;
+
+			ifstream handle( fname.c_str(), ios::in ) ;
+			if( ! handle.is_open() ) return false ;
+
+			// the fields are name, length, offset, bases per line and bytes per line
+			string line ;
+			while( getline( handle, line ) ) {
+				if( line.size() > 0 && line[ line.size() - 1 ] == '\r' ) line.erase( line.size() - 1 ) ;
+				if( line.size() == 0 ) continue ;
+
+				vector<string> fields = utils::split_string( line, "\t" ) ;
+				FastAIndexEntry e ;
+				if( fields.size() < 5 ) return false ;
+				e.name = fields[0] ;
+				if( ! parse_size( fields[1], e.length ) || ! parse_size( fields[2], e.offset ) ) return false ;
+				if( ! parse_size( fields[3], e.linebases ) || ! parse_size( fields[4], e.linewidth ) ) return false ;
+				if( e.length > 0 && ( e.linebases == 0 || e.linewidth <= e.linebases ) ) return false ;
+				entries.push_back( e ) ;
+			}
+
+			// an empty index, e.g. of an interrupted samtools faidx, is not used
+			return ! entries.empty() ;
+		}
+
+		/*
+		 * Whether the sequence of the index entry starts after a line end and 
+		 * ends before a line end or the end of the fasta
+		 */
+		static bool matches_index( istream& fasta, size_t fsize, const FastAIndexEntry& e ) {
+			size_t last = e.offset + ( ( e.length - 1 ) / e.linebases ) * e.linewidth + ( e.length - 1 ) % e.linebases ;
+			if( e.offset == 0 || last >= fsize ) return false ;
+
+			char before = 0 ;
+			char end[2] = { 0, '\n' } ;
+			fasta.seekg( (streamoff) e.offset - 1 ) ;
+			fasta.get( before ) ;
+			fasta.seekg( (streamoff) last ) ;
+			fasta.read( end, last + 1 < fsize ? 2 : 1 ) ;
+			bool rval = fasta && before == '\n' && end[0] != '\n' && end[0] != '\r' && ( end[1] == '\n' || end[1] == '\r' ) ;
+			fasta.clear() ;
+			return rval ;
+		}
+
+		/*
+		 * Reads the bases of the regions from the fasta at the positions in the
+		 * index; the header holds the sequences of the index
+		 */
+		static void AmpliconReaderIndexed( vector<Amplicon*>& amplicons, SAMHeader& header, const unordered_map< string, vector<GenomicRegion*> >& regions, 
+										   const string& fname_fasta, const vector<FastAIndexEntry>& fai ) {
+
+			ifstream fasta( fname_fasta.c_str(), ios::in | ios::binary ) ;
+			if( ! fasta.is_open() ) return ;
+			fasta.seekg( 0, ios::end ) ;
+			size_t fsize = (size_t) fasta.tellg() ;
+
+			string bytes = "" ;
+			for( vector<FastAIndexEntry>::const_iterator ft=fai.begin(); ft!=fai.end(); ++ft ) {
+				const FastAIndexEntry& e = *ft ;
+				if( e.length == 0 ) continue ;
+
+				// add the reference to the sam header
+				header.add( e.name, (int) e.length ) ;
+
+				unordered_map< string, vector<GenomicRegion*> >::const_iterator rt = regions.find( e.name ) ;
+				if( rt == regions.end() ) continue ;
+
+				if( ! matches_index( fasta, fsize, e ) ) {
+					cerr << "[AmpliconReader] " << fname_fasta << " does not match its index " << fname_fasta << ".fai" << endl ;
+					exit( EXIT_FAILURE ) ;
+				}
+
+				for( vector<GenomicRegion*>::const_iterator it=rt->second.begin(); it!=rt->second.end(); ++it ) {
+					GenomicRegion gr = *(*it) ;
+
+					// regions that start beyond the chromosome are skipped, and 
+					// like substr the amplicon ends at the end of the chromosome
+					if( gr.start() < 0 || (size_t) gr.start() > e.length ) continue ;
+					size_t b = (size_t) gr.start() ;
+					size_t n = gr.end() > gr.start() ? min( (size_t) gr.end(), e.length ) - b : 0 ;
+
+					string ampseq = "" ;
+					if( n > 0 ) {
+
+						// the bytes from the first to the last base, including the line ends
+						size_t first = e.offset + ( b / e.linebases ) * e.linewidth + b % e.linebases ;
+						size_t last  = e.offset + ( ( b + n - 1 ) / e.linebases ) * e.linewidth + ( b + n - 1 ) % e.linebases ;
+						if( last >= fsize ) {
+							cerr << "[AmpliconReader] " << fname_fasta << " does not match its index " << fname_fasta << ".fai" << endl ;
+							exit( EXIT_FAILURE ) ;
+						}
+						bytes.resize( last - first + 1 ) ;
+						fasta.seekg( (streamoff) first ) ;
+						fasta.read( &bytes[0], bytes.size() ) ;
+
+						// remove the line ends, which should be where the index puts them, and
+						// convert the sequence to uppercase
+						bool valid = (bool) fasta ;
+						size_t column = b % e.linebases ;
+						ampseq.reserve( n ) ;
+						for( string::iterator ct=bytes.begin(); ct!=bytes.end(); ++ct ) {
+							bool lineend = *ct == '\n' || *ct == '\r' ;
+							if( lineend != ( column >= e.linebases ) || *ct == '>' ) valid = false ;
+							if( ! lineend ) ampseq += (char) ::toupper( *ct ) ;
+							column = column + 1 < e.linewidth ? column + 1 : 0 ;
+						}
+						if( ! valid || ampseq.size() != n ) {
+							cerr << "[AmpliconReader] " << fname_fasta << " does not match its index " << fname_fasta << ".fai" << endl ;
+							exit( EXIT_FAILURE ) ;
+						}
+					}
+					amplicons.push_back( new Amplicon( gr, ampseq ) ) ; 
+				}
+			}
+			fasta.close() ;
+		}
+
+		/*
+		 * Reads the whole fasta to obtain the bases of the regions 
+		 */
+		static void AmpliconReaderStreamed( vector<Amplicon*>& amplicons, SAMHeader& header, const unordered_map< string, vector<GenomicRegion*> >& regions, 
+											const string& fname_fasta ) {
 
-			// load all the bed regions
-			vector<GenomicRegion*> bed = BEDReader( fname_bed ) ;
-			
 			// initialize the input handle with the currrent file
 			ifstream fasta( fname_fasta.c_str(), ios::in ) ;
 
@@ -184,22 +325,16 @@ namespace Nimbus {
 					// add the reference to the sam header
 					header.add( fseq->first, (int) fseq->second->size() ) ;
 
-					// get the genomic regions for the current chromosome
-					vector<GenomicRegion*> cur = vector<GenomicRegion*>( ) ;
-					for( vector<GenomicRegion*>::iterator it=bed.begin(); it!=bed.end(); ++it ) {
-						GenomicRegion* x = *it ;
-						if( x->chromosome() == fseq->first ) {
-							cur.push_back( *it ) ;
+					// Build the amplicon list of the current chromosome
+					unordered_map< string, vector<GenomicRegion*> >::const_iterator rt = regions.find( fseq->first ) ;
+					if( rt != regions.end() ) {
+						for( vector<GenomicRegion*>::const_iterator it=rt->second.begin(); it!=rt->second.end(); ++it ) {
+							GenomicRegion gr = *(*it) ;
+							string ampseq    = fseq->second->substr( gr.start(), gr.width() ) ;
+							amplicons.push_back( new Amplicon( gr, ampseq ) ) ; 
 						}
 					}
 
-					// Build the amplicon list
-					for( vector<GenomicRegion*>::iterator it=cur.begin(); it!=cur.end(); ++it ) {
-						GenomicRegion gr = *(*it) ;
-						string ampseq    = fseq->second->substr( gr.start(), gr.width() ) ;
-						amplicons.push_back( new Amplicon( gr, ampseq ) ) ; 
-					}
-
 					// clean the memory before we move on
 					delete fseq->second ;
 					delete fseq ;
@@ -209,6 +344,28 @@ namespace Nimbus {
 				}
 				fasta.close() ;
 			}
+		}
+
+		void AmpliconReader( vector<Amplicon*>& amplicons, SAMHeader& header, string fname_bed, string fname_fasta ) {
+
+			// declare the result vector
+			amplicons = vector<Amplicon*>() ;
+			header    = SAMHeader() ; 
+
+			// load all the bed regions, grouped per chromosome
+			vector<GenomicRegion*> bed = BEDReader( fname_bed ) ;
+			unordered_map< string, vector<GenomicRegion*> > regions ;
+			for( vector<GenomicRegion*>::iterator it=bed.begin(); it!=bed.end(); ++it ) {
+				regions[ (*it)->chromosome() ].push_back( *it ) ;
+			}
+
+			// only read the amplicons if the fasta is indexed
+			vector<FastAIndexEntry> fai ;
+			if( FastAIndexReader( fai, fname_fasta + ".fai" ) ) {
+				AmpliconReaderIndexed( amplicons, header, regions, fname_fasta, fai ) ;
+			} else {
+				AmpliconReaderStreamed( amplicons, header, regions, fname_fasta ) ;
+			}
 
 			// delete the genomic regions
 			for( vector<GenomicRegion*>::iterator it=bed.begin(); it!=bed.end(); ++it ) {				
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace threadutils {
+
+	/**
+	 A bounded multi-producer/multi-consumer queue for use in threads
+
+	 The values are kept in a ring of cells. Each cell carries a sequence
+	 number that tells whether it is free for the producer or filled for
+	 the consumer of the current lap, so producers and consumers only
+	 contend on their own ticket counter and never take a lock.
+
+	 The blocking push and shift only take a lock when they have to wait:
+	 a thread registers itself as waiting before it sleeps, and the other
+	 side only signals when it sees a registered waiter. After close() no
+	 values are accepted, and shift returns false once the queue is drained.
+	 close() marks the ticket counter of the producers, so a push racing
+	 with it has either claimed its cell before, and its value is still
+	 taken, or fails.
+
+	 The capacity is rounded up to a power of two.
+	 **/
+	template<class T>
+	class RingBuffer {
+
+	protected:
+		struct _Cell {
+			std::atomic<size_t> seq ;
+			T value ;
+		} ;
+
+		// keep the tickets of the producers and consumers on separate cache lines
+		static const size_t CACHELINE = 64 ;
+
+		// the bit of the ticket of the producers that is set by close()
+		static const size_t CLOSED = ~( ~ (size_t) 0 >> 1 ) ;
+
+		char _pad0[CACHELINE] ;
+		std::vector<_Cell> _cells ;
+		size_t _mask ;
+		char _pad1[CACHELINE] ;
+		std::atomic<size_t> _head ;
+		char _pad2[CACHELINE] ;
+		std::atomic<size_t> _tail ;
+		char _pad3[CACHELINE] ;
+
+		// the waiting threads
+		std::atomic<int> _pwaiting ;
+		std::atomic<int> _cwaiting ;
+		std::mutex _m ;
+		std::condition_variable _notfull ;
+		std::condition_variable _notempty ;
+
+		// the number of attempts before a thread waits
+		static const unsigned int SPIN = 64 ;
+
+	public:
+
+		RingBuffer( size_t capacity ) : _cells( _round( capacity ) ) {
+			_mask = _cells.size() - 1 ;
+			for( size_t i=0; i<_cells.size(); i++ ) {
+				_cells[i].seq.store( i, std::memory_order_relaxed ) ;
+			}
+			_head.store( 0, std::memory_order_relaxed ) ;
+			_tail.store( 0, std::memory_order_relaxed ) ;
+			_pwaiting.store( 0 ) ;
+			_cwaiting.store( 0 ) ;
+		}
+
+		~RingBuffer(void){ }
+
+	private:
+		RingBuffer( const RingBuffer& ) ;
+		RingBuffer& operator=( const RingBuffer& ) ;
+
+	public:
+		/*
+		 adds val to the queue, returns false if the queue is full or closed
+		 */
+		bool tryPush( const T& val ) {
+			bool rval = _push( val ) ;
+			if( rval ) _notify( _cwaiting, _notempty ) ;
+			return rval ;
+		}
+
+		/*
+		 takes the oldest value of the queue, returns false if the queue is empty
+		 */
+		bool tryShift( T& rval ) {
+			bool ok = _shift( rval ) ;
+			if( ok ) _notify( _pwaiting, _notfull ) ;
+			return ok ;
+		}
+
+		/*
+		 adds val to the queue, waits while the queue is full;
+		 returns false if the queue has been closed
+		 */
+		bool push( const T& val ) {
+			bool rval = false ;
+			for( unsigned int n=0; n<SPIN && ! rval; n++ ) {
+				if( closed() ) return false ;
+				rval = _push( val ) ;
+				if( ! rval ) _backoff( n ) ;
+			}
+
+			if( ! rval ) {
+				std::unique_lock<std::mutex> lock( _m ) ;
+				_pwaiting.fetch_add( 1 ) ;
+				std::atomic_thread_fence( std::memory_order_seq_cst ) ;
+				while( ! ( rval = _push( val ) ) && ! closed() ) {
+					_notfull.wait( lock ) ;
+				}
+				_pwaiting.fetch_sub( 1 ) ;
+			}
+
+			if( rval ) _notify( _cwaiting, _notempty ) ;
+			return rval ;
+		}
+
+		/*
+		 takes the oldest value of the queue, waits while the queue is
+		 empty; returns false if the queue has been closed and drained
+		 */
+		bool shift( T& rval ) {
+			bool ok = false ;
+			bool done = false ;
+			for( unsigned int n=0; n<SPIN && ! ok && ! done; n++ ) {
+				ok = _shift( rval ) ;
+				if( ! ok ) {
+					done = drained() ;
+					_backoff( n ) ;
+				}
+			}
+
+			if( ! ok && ! done ) {
+				std::unique_lock<std::mutex> lock( _m ) ;
+				_cwaiting.fetch_add( 1 ) ;
+				std::atomic_thread_fence( std::memory_order_seq_cst ) ;
+				while( ! ( ok = _shift( rval ) ) && ! drained() ) {
+					_notempty.wait( lock ) ;
+				}
+				_cwaiting.fetch_sub( 1 ) ;
+			}
+
+			if( ok ) _notify( _pwaiting, _notfull ) ;
+			return ok ;
+		}
+
+		/*
+		 stops accepting values and wakes all waiting threads
+		 */
+		void close() {
+			_tail.fetch_or( CLOSED ) ;
+			std::lock_guard<std::mutex> guard( _m ) ;
+			_notfull.notify_all() ;
+			_notempty.notify_all() ;
+		}
+
+		bool closed() const {
+			return ( _tail.load() & CLOSED ) != 0 ;
+		}
+
+		/*
+		 whether the queue has been closed and all its values have been taken
+		 */
+		bool drained() const {
+			size_t t = _tail.load() ;
+			return ( t & CLOSED ) != 0 && ( t & ~CLOSED ) == _head.load() ;
+		}
+
+		/*
+		 the number of values in the queue; only a snapshot when
+		 other threads are using the queue
+		 */
+		size_t size() const {
+			size_t h = _head.load( std::memory_order_acquire ) ;
+			size_t t = _tail.load( std::memory_order_acquire ) & ~CLOSED ;
+			return t > h ? t - h : 0 ;
+		}
+
+		bool empty() const {
+			return size() == 0 ;
+		}
+
+		size_t capacity() const {
+			return _cells.size() ;
+		}
+
+	private:
+		/* claims a free cell for val */
+		bool _push( const T& val ) {
+			size_t pos = _tail.load( std::memory_order_relaxed ) ;
+			for( ;; ) {
+				// the queue has been closed
+				if( pos & CLOSED ) return false ;
+
+				_Cell& c = _cells[pos & _mask] ;
+				size_t seq = c.seq.load( std::memory_order_acquire ) ;
+				long diff = (long) seq - (long) pos ;
+				if( diff == 0 ) {
+					// the cell is free in this lap: claim it
+					if( _tail.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+						c.value = val ;
+						c.seq.store( pos + 1, std::memory_order_release ) ;
+						return true ;
+					}
+				} else if( diff < 0 ) {
+					// the cell still holds the value of the previous lap
+					return false ;
+				} else {
+					pos = _tail.load( std::memory_order_relaxed ) ;
+				}
+			}
+		}
+
+		/* claims the oldest filled cell */
+		bool _shift( T& rval ) {
+			size_t pos = _head.load( std::memory_order_relaxed ) ;
+			for( ;; ) {
+				_Cell& c = _cells[pos & _mask] ;
+				size_t seq = c.seq.load( std::memory_order_acquire ) ;
+				long diff = (long) seq - (long) ( pos + 1 ) ;
+				if( diff == 0 ) {
+					// the cell is filled in this lap: claim it
+					if( _head.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+						rval = c.value ;
+						c.seq.store( pos + _mask + 1, std::memory_order_release ) ;
+						return true ;
+					}
+				} else if( diff < 0 ) {
+					// the producer of this cell has not finished
+					return false ;
+				} else {
+					pos = _head.load( std::memory_order_relaxed ) ;
+				}
+			}
+		}
+
+		static size_t _round( size_t n ) {
+			size_t rval = 2 ;
+			while( rval < n ) rval <<= 1 ;
+			return rval ;
+		}
+
+		/* wakes a thread registered as waiting on cv */
+		void _notify( std::atomic<int>& waiting, std::condition_variable& cv ) {
+			std::atomic_thread_fence( std::memory_order_seq_cst ) ;
+			if( waiting.load( std::memory_order_relaxed ) > 0 ) {
+				std::lock_guard<std::mutex> guard( _m ) ;
+				cv.notify_one() ;
+			}
+		}
+
+		/* spin shortly, then hand the processor to the other threads */
+		static void _backoff( unsigned int n ) {
+			if( n >= 16 ) std::this_thread::yield() ;
+		}
+	} ;
+
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "RingBuffer.h"
+
+namespace threadutils {
+
+	/**
+	 A task queue for a fixed set of workers that share out uneven tasks
+
+	 The producers push the tasks in a shared bounded queue. Each worker
+	 also has a deque of its own, holding the parts it split off the task
+	 it is working on: a worker whose task turns out to be expensive
+	 splits off the rest of it while other workers are idle, see hungry().
+	 A worker takes the newest part of its own deque, then steals the
+	 oldest part of the other deques, and only then takes a new task of
+	 the shared queue, so the tasks that were started are finished first.
+
+	 The split parts are few and large, so the deques are guarded by a
+	 lock of their own and only the shared queue is lock-free. The idle
+	 workers wait like the consumers of the RingBuffer: registered, so
+	 that the producers and splitting workers only signal when a worker
+	 waits.
+
+	 shift returns false once the queue is closed, all tasks have been
+	 taken and no worker is busy anymore, because a busy worker can still
+	 split its task. A worker that stops before that should leave().
+	 **/
+	template<class T>
+	class WorkStealingQueue {
+
+	protected:
+		// the parts split off by a worker
+		struct _Deque {
+			std::mutex m ;
+			std::deque<T> tasks ;
+		} ;
+
+		RingBuffer<T> _shared ;
+		std::vector<_Deque*> _deques ;
+
+		// the number of parts in the deques
+		std::atomic<long> _local ;
+		std::atomic<long> _splits ;
+
+		// the idle workers wait until a task is pushed or split, the busy
+		// workers are counted under the lock
+		std::atomic<int> _idle ;
+		int _busy ;
+		std::mutex _m ;
+		std::condition_variable _work ;
+
+	public:
+
+		WorkStealingQueue( size_t capacity ) : _shared( capacity ) {
+			_local.store( 0 ) ;
+			_splits.store( 0 ) ;
+			_idle.store( 0 ) ;
+			_busy = 0 ;
+		}
+
+		~WorkStealingQueue(void) {
+			for( size_t i=0; i<_deques.size(); i++ ) {
+				delete _deques[i] ;
+			}
+		}
+
+	private:
+		WorkStealingQueue( const WorkStealingQueue& ) ;
+		WorkStealingQueue& operator=( const WorkStealingQueue& ) ;
+
+	public:
+		/*
+		 adds a worker and returns its number; the workers are added
+		 before any of them takes a task
+		 */
+		unsigned int addWorker() {
+			std::lock_guard<std::mutex> guard( _m ) ;
+			_deques.push_back( new _Deque() ) ;
+			_busy++ ;
+			return (unsigned int) _deques.size() - 1 ;
+		}
+
+		/*
+		 adds val to the shared queue, waits while the queue is full;
+		 returns false if the queue has been closed
+		 */
+		bool push( const T& val ) {
+			bool rval = _shared.push( val ) ;
+			if( rval ) _notify() ;
+			return rval ;
+		}
+
+		/*
+		 adds val to the shared queue, returns false if the queue is full or closed
+		 */
+		bool tryPush( const T& val ) {
+			bool rval = _shared.tryPush( val ) ;
+			if( rval ) _notify() ;
+			return rval ;
+		}
+
+		/*
+		 adds val, split off the task of worker, to the deque of worker;
+		 the parts are also accepted after close()
+		 */
+		void split( unsigned int worker, const T& val ) {
+			_Deque& d = *_deques[ worker ] ;
+			{
+				std::lock_guard<std::mutex> guard( d.m ) ;
+				d.tasks.push_back( val ) ;
+				_local.fetch_add( 1 ) ;
+			}
+			_splits.fetch_add( 1, std::memory_order_relaxed ) ;
+			_notify() ;
+		}
+
+		/*
+		 whether workers are waiting for a task: a busy worker should then
+		 split the rest of its task if it is worth it
+		 */
+		bool hungry() const {
+			return _idle.load( std::memory_order_relaxed ) > 0 ;
+		}
+
+		/*
+		 takes a task for worker, waits while there is none; returns false
+		 if the queue has been closed, all tasks have been taken and no
+		 worker can split a task anymore
+		 */
+		bool shift( unsigned int worker, T& rval ) {
+			if( _take( worker, rval ) ) return true ;
+
+			std::unique_lock<std::mutex> lock( _m ) ;
+			_idle.fetch_add( 1 ) ;
+			_busy-- ;
+			std::atomic_thread_fence( std::memory_order_seq_cst ) ;
+			bool ok = false ;
+			for( ;; ) {
+				if( ( ok = _take( worker, rval ) ) ) break ;
+				if( _shared.drained() && _busy == 0 ) {
+					_work.notify_all() ;
+					break ;
+				}
+				_work.wait( lock ) ;
+			}
+			_idle.fetch_sub( 1 ) ;
+			if( ok ) _busy++ ;
+			return ok ;
+		}
+
+		/*
+		 the worker takes no tasks anymore
+		 */
+		void leave( unsigned int worker ) {
+			std::lock_guard<std::mutex> guard( _m ) ;
+			_busy-- ;
+			_work.notify_all() ;
+		}
+
+		/*
+		 stops accepting values in the shared queue and wakes all waiting threads
+		 */
+		void close() {
+			_shared.close() ;
+			std::lock_guard<std::mutex> guard( _m ) ;
+			_work.notify_all() ;
+		}
+
+		bool closed() const {
+			return _shared.closed() ;
+		}
+
+		/*
+		 the number of tasks and parts in the queue; only a snapshot when
+		 other threads are using the queue
+		 */
+		size_t size() const {
+			return _shared.size() + (size_t) _local.load() ;
+		}
+
+		bool empty() const {
+			return size() == 0 ;
+		}
+
+		/*
+		 the number of parts split off the tasks
+		 */
+		long splits() const {
+			return _splits.load() ;
+		}
+
+	private:
+		/* the own newest part, a stolen oldest part or a new task */
+		bool _take( unsigned int worker, T& rval ) {
+			if( _local.load() > 0 ) {
+				if( _pop( *_deques[ worker ], rval, true ) ) return true ;
+				for( size_t i=1; i<_deques.size(); i++ ) {
+					if( _pop( *_deques[ ( worker + i ) % _deques.size() ], rval, false ) ) return true ;
+				}
+			}
+			return _shared.tryShift( rval ) ;
+		}
+
+		bool _pop( _Deque& d, T& rval, bool newest ) {
+			std::lock_guard<std::mutex> guard( d.m ) ;
+			if( d.tasks.empty() ) return false ;
+			if( newest ) {
+				rval = d.tasks.back() ;
+				d.tasks.pop_back() ;
+			} else {
+				rval = d.tasks.front() ;
+				d.tasks.pop_front() ;
+			}
+			_local.fetch_sub( 1 ) ;
+			return true ;
+		}
+
+		/* wakes a worker waiting for a task */
+		void _notify() {
+			std::atomic_thread_fence( std::memory_order_seq_cst ) ;
+			if( _idle.load( std::memory_order_relaxed ) > 0 ) {
+				std::lock_guard<std::mutex> guard( _m ) ;
+				_work.notify_one() ;
+			}
+		}
+	} ;
+
+}
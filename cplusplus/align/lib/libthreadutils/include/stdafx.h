@@ -7,4 +7,6 @@
 
 // TODO: reference additional headers your program requires here
 #include <mutex>
-#include <queue>
\ No newline at end of file
+#include <queue>
+#include <atomic>
+#include <thread>
\ No newline at end of file
@@ -0,0 +1,6 @@
+#include "stdafx.h"
+#include "RingBuffer.h"
+
+namespace threadutils {
+
+}
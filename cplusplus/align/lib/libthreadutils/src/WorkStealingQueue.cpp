@@ -0,0 +1,6 @@
+#include "stdafx.h"
+#include "WorkStealingQueue.h"
+
+namespace threadutils {
+
+}
@@ -0,0 +1,109 @@
+// ringbuffer_bench.cpp : times a RingBuffer against a TQueue with 1 to 32 threads
+//
+// The same number of producers and consumers pass VALUES values through
+// a queue holding at most CAPACITY values. The TQueue does not wait, so
+// its producers poll its size while it is full and its consumers poll
+// shift while it is empty, yielding in between.
+
+#include "stdafx.h"
+#include "RingBuffer.h"
+#include "TQueue.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std ;
+using namespace threadutils ;
+
+static const size_t VALUES   = 2000000 ;
+static const size_t CAPACITY = 1024 ;
+
+static void ring_produce( RingBuffer<size_t>* q, size_t n ) {
+	for( size_t i=0; i<n; i++ ) q->push( i ) ;
+}
+
+static void ring_consume( RingBuffer<size_t>* q, size_t* sum ) {
+	size_t v = 0 ;
+	while( q->shift( v ) ) *sum += v ;
+}
+
+static void tqueue_produce( TQueue<size_t>* q, size_t n ) {
+	for( size_t i=0; i<n; i++ ) {
+		while( q->size() >= CAPACITY ) this_thread::yield() ;
+		q->push( i ) ;
+	}
+}
+
+static void tqueue_consume( TQueue<size_t>* q, atomic<bool>* done, size_t* sum ) {
+	size_t v = 0 ;
+	for( ;; ) {
+		if( q->shift( v ) ) {
+			*sum += v ;
+		} else if( done->load() ) {
+			// the last values may have been pushed before done was set
+			if( ! q->shift( v ) ) break ;
+			*sum += v ;
+		} else {
+			this_thread::yield() ;
+		}
+	}
+}
+
+/* the seconds taken by threads producers and consumers on a RingBuffer */
+static double time_ring( int threads, size_t& sum ) {
+	RingBuffer<size_t> q( CAPACITY ) ;
+	vector<size_t> sums( threads, 0 ) ;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+	vector<thread> producers, consumers ;
+	for( int t=0; t<threads; t++ ) consumers.push_back( thread( ring_consume, &q, &sums[t] ) ) ;
+	for( int t=0; t<threads; t++ ) producers.push_back( thread( ring_produce, &q, VALUES / threads ) ) ;
+	for( int t=0; t<threads; t++ ) producers[t].join() ;
+	q.close() ;
+	for( int t=0; t<threads; t++ ) consumers[t].join() ;
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start ;
+	sum = 0 ;
+	for( int t=0; t<threads; t++ ) sum += sums[t] ;
+	return elapsed.count() ;
+}
+
+/* the seconds taken by threads producers and consumers on a TQueue */
+static double time_tqueue( int threads, size_t& sum ) {
+	TQueue<size_t> q ;
+	atomic<bool> done ;
+	done.store( false ) ;
+	vector<size_t> sums( threads, 0 ) ;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+	vector<thread> producers, consumers ;
+	for( int t=0; t<threads; t++ ) consumers.push_back( thread( tqueue_consume, &q, &done, &sums[t] ) ) ;
+	for( int t=0; t<threads; t++ ) producers.push_back( thread( tqueue_produce, &q, VALUES / threads ) ) ;
+	for( int t=0; t<threads; t++ ) producers[t].join() ;
+	done.store( true ) ;
+	for( int t=0; t<threads; t++ ) consumers[t].join() ;
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start ;
+	sum = 0 ;
+	for( int t=0; t<threads; t++ ) sum += sums[t] ;
+	return elapsed.count() ;
+}
+
+int main( int argc, char* argv[] ) {
+	printf( "# %zu values, capacity %zu, %u hardware threads\n", VALUES, CAPACITY, thread::hardware_concurrency() ) ;
+	printf( "threads\tRingBuffer (s)\tTQueue (s)\tspeedup\n" ) ;
+	for( int threads=1; threads<=32; threads*=2 ) {
+		size_t expected = 0 ;
+		for( size_t i=0; i<VALUES / threads; i++ ) expected += i ;
+		expected *= threads ;
+
+		size_t rsum = 0 ;
+		size_t tsum = 0 ;
+		double r = time_ring( threads, rsum ) ;
+		double t = time_tqueue( threads, tsum ) ;
+		if( rsum != expected || tsum != expected ) {
+			fprintf( stderr, "[RingBuffer] values were lost with %d threads\n", threads ) ;
+			exit( EXIT_FAILURE ) ;
+		}
+		printf( "%d\t%.3f\t%.3f\t%.2f\n", threads, r, t, t / r ) ;
+	}
+	return 0 ;
+}
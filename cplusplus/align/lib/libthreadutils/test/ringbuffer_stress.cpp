@@ -0,0 +1,160 @@
+// ringbuffer_stress.cpp : checks that a RingBuffer delivers each value exactly once
+//
+// N producers and M consumers pass values through queues of several
+// capacities, also when the queue is closed while producers wait in
+// push and consumers wait in shift. Exits with EXIT_FAILURE on the first
+// failed check.
+
+#include "stdafx.h"
+#include "RingBuffer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std ;
+using namespace threadutils ;
+
+// the number of values per producer
+static const size_t VALUES = 20000 ;
+
+// the seconds after which a run is considered deadlocked
+static const int TIMEOUT = 120 ;
+
+static atomic<bool> running ;
+
+static void fail( const char* message, size_t capacity, int producers, int consumers ) {
+	fprintf( stderr, "[RingBuffer] FAILED: %s (capacity %zu, %d producers, %d consumers)\n", message, capacity, producers, consumers ) ;
+	exit( EXIT_FAILURE ) ;
+}
+
+/* aborts the test if it still runs after TIMEOUT seconds */
+static void watchdog() {
+	for( int i=0; i<TIMEOUT * 10 && running.load(); i++ ) {
+		this_thread::sleep_for( chrono::milliseconds( 100 ) ) ;
+	}
+	if( running.load() ) {
+		fprintf( stderr, "[RingBuffer] FAILED: no progress after %d seconds\n", TIMEOUT ) ;
+		_Exit( EXIT_FAILURE ) ;
+	}
+}
+
+/* pushes the values p * n up to ( p + 1 ) * n, or until the queue is closed; counts the accepted values */
+static void produce( RingBuffer<size_t>* q, size_t p, size_t n, size_t* accepted ) {
+	size_t i = 0 ;
+	while( i < n && q->push( p * n + i ) ) i++ ;
+	*accepted = i ;
+}
+
+/* shifts values until the queue is closed and drained */
+static void consume( RingBuffer<size_t>* q, vector<size_t>* values ) {
+	size_t v = 0 ;
+	while( q->shift( v ) ) values->push_back( v ) ;
+}
+
+/*
+ runs producers and consumers on a queue of capacity; if stop is not 0,
+ the queue is closed after stop milliseconds while the producers may still
+ push, otherwise after all producers are done. Checks that the consumers
+ received each accepted value exactly once, and the values of a producer
+ in the order they were pushed.
+ */
+static void run( size_t capacity, int producers, int consumers, size_t n, int stop ) {
+	RingBuffer<size_t> q( capacity ) ;
+	vector<size_t> accepted( producers, 0 ) ;
+	vector< vector<size_t> > received( consumers ) ;
+
+	vector<thread> cthreads ;
+	for( int c=0; c<consumers; c++ ) cthreads.push_back( thread( consume, &q, &received[c] ) ) ;
+	vector<thread> pthreads ;
+	for( int p=0; p<producers; p++ ) pthreads.push_back( thread( produce, &q, (size_t) p, n, &accepted[p] ) ) ;
+
+	if( stop > 0 ) {
+		this_thread::sleep_for( chrono::milliseconds( stop ) ) ;
+		q.close() ;
+	}
+	for( size_t i=0; i<pthreads.size(); i++ ) pthreads[i].join() ;
+	if( stop == 0 ) q.close() ;
+	for( size_t i=0; i<cthreads.size(); i++ ) cthreads[i].join() ;
+
+	// each accepted value once, the values of a producer in order
+	vector<unsigned char> seen( (size_t) producers * n, 0 ) ;
+	for( int c=0; c<consumers; c++ ) {
+		vector<size_t> last( producers, 0 ) ;
+		for( size_t i=0; i<received[c].size(); i++ ) {
+			size_t v = received[c][i] ;
+			size_t p = v / n ;
+			if( v >= seen.size() || v % n >= accepted[p] ) fail( "a value was received that was not accepted", capacity, producers, consumers ) ;
+			if( seen[v]++ ) fail( "a value was received twice", capacity, producers, consumers ) ;
+			if( v % n + 1 <= last[p] ) fail( "the values of a producer were received out of order", capacity, producers, consumers ) ;
+			last[p] = v % n + 1 ;
+		}
+	}
+	for( int p=0; p<producers; p++ ) {
+		if( stop == 0 && accepted[p] != n ) fail( "a value was refused before the close", capacity, producers, consumers ) ;
+		for( size_t i=0; i<accepted[p]; i++ ) {
+			if( ! seen[ p * n + i ] ) fail( "an accepted value was lost", capacity, producers, consumers ) ;
+		}
+	}
+
+	size_t v = 0 ;
+	if( ! q.closed() || q.tryPush( v ) || q.push( v ) || q.shift( v ) ) fail( "the closed queue accepted or returned a value", capacity, producers, consumers ) ;
+}
+
+/*
+ closes the queue while all producers wait in push on a full queue, and
+ then while all consumers wait in shift on an empty queue
+ */
+static void run_blocked( size_t capacity, int threads ) {
+	{
+		RingBuffer<size_t> q( capacity ) ;
+		vector<size_t> accepted( threads, 0 ) ;
+		vector<thread> pthreads ;
+		for( int p=0; p<threads; p++ ) pthreads.push_back( thread( produce, &q, (size_t) p, q.capacity() + 1, &accepted[p] ) ) ;
+		while( q.size() < q.capacity() ) this_thread::yield() ;
+		this_thread::sleep_for( chrono::milliseconds( 20 ) ) ;
+		q.close() ;
+		for( size_t i=0; i<pthreads.size(); i++ ) pthreads[i].join() ;
+
+		// the queue is drained after the close
+		vector<size_t> drained ;
+		consume( &q, &drained ) ;
+		size_t total = 0 ;
+		for( int p=0; p<threads; p++ ) total += accepted[p] ;
+		if( total != q.capacity() || drained.size() != total ) fail( "the producers waiting in push lost or added values at the close", capacity, threads, 0 ) ;
+	}
+	{
+		RingBuffer<size_t> q( capacity ) ;
+		vector< vector<size_t> > received( threads ) ;
+		vector<thread> cthreads ;
+		for( int c=0; c<threads; c++ ) cthreads.push_back( thread( consume, &q, &received[c] ) ) ;
+		this_thread::sleep_for( chrono::milliseconds( 20 ) ) ;
+		q.close() ;
+		for( size_t i=0; i<cthreads.size(); i++ ) cthreads[i].join() ;
+		for( int c=0; c<threads; c++ ) {
+			if( ! received[c].empty() ) fail( "a consumer waiting in shift received a value", capacity, 0, threads ) ;
+		}
+	}
+}
+
+int main( int argc, char* argv[] ) {
+	running.store( true ) ;
+	thread w( watchdog ) ;
+
+	size_t capacities[] = { 1, 2, 7, 64, 1024 } ;
+	int threads[][2] = { { 1, 1 }, { 1, 4 }, { 4, 1 }, { 4, 4 }, { 8, 3 } } ;
+	for( size_t c=0; c<sizeof( capacities ) / sizeof( capacities[0] ); c++ ) {
+		for( size_t t=0; t<sizeof( threads ) / sizeof( threads[0] ); t++ ) {
+			run( capacities[c], threads[t][0], threads[t][1], VALUES, 0 ) ;
+			run( capacities[c], threads[t][0], threads[t][1], VALUES, 5 ) ;
+		}
+		run_blocked( capacities[c], 4 ) ;
+		printf( "[RingBuffer] capacity %zu: passed\n", capacities[c] ) ;
+	}
+
+	running.store( false ) ;
+	w.join() ;
+	printf( "[RingBuffer] all checks passed\n" ) ;
+	return 0 ;
+}
@@ -0,0 +1,50 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace NimApp {
+
+	static std::atomic<size_t> n_allocations( 0 ) ;
+	static std::atomic<size_t> n_bytes( 0 ) ;
+
+#ifdef COUNT_ALLOCATIONS
+	bool AllocationCounter::enabled() {
+		return true ;
+	}
+#else
+	bool AllocationCounter::enabled() {
+		return false ;
+	}
+#endif
+
+	size_t AllocationCounter::allocations() {
+		return n_allocations.load() ;
+	}
+
+	size_t AllocationCounter::bytes() {
+		return n_bytes.load() ;
+	}
+
+}
+
+#ifdef COUNT_ALLOCATIONS
+
+//
+// the replacements of the global operator new and delete; the array and 
+// nothrow versions of the standard library call these
+//
+void* operator new( size_t size ) {
+	NimApp::n_allocations.fetch_add( 1, std::memory_order_relaxed ) ;
+	NimApp::n_bytes.fetch_add( size, std::memory_order_relaxed ) ;
+	void* rval = malloc( size > 0 ? size : 1 ) ;
+	if( rval == NULL ) throw std::bad_alloc() ;
+	return rval ;
+}
+
+void operator delete( void* p ) noexcept {
+	free( p ) ;
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include "nimbusheader.h"
+#include "BGZFWriter.h"
+
+namespace NimApp {
+
+	using namespace std ;
+	using namespace threadutils ;
+	using namespace Nimbus::IO ;
+
+	BGZFWriter::BGZFWriter( ostream* o, int threads ) {
+		_init( o, threads, Z_DEFAULT_COMPRESSION ) ;
+	}
+
+	BGZFWriter::BGZFWriter( ostream* o, int threads, int level ) {
+		_init( o, threads, level ) ;
+	}
+
+	void BGZFWriter::_init( ostream* o, int threads, int level ) {
+		_out   = o ;
+		_level = level ;
+		_pending.reserve( BGZFCompressor::BLOCKSIZE ) ;
+
+		// keep a few blocks per thread in flight; the threads are started
+		// with the first block, so idle outputs have no threads
+		_nthreads   = threads ;
+		_maxblocks  = threads > 0 ? 4 * threads : 0 ;
+		_jobs       = NULL ;
+		_compressor = NULL ;
+		if( threads > 0 ) {
+			_jobs = new RingBuffer<_Block*>( _maxblocks ) ;
+		} else {
+			_compressor = new BGZFCompressor( _level ) ;
+		}
+	}
+
+	BGZFWriter::~BGZFWriter() {
+		close() ;
+		if( _jobs != NULL ) delete _jobs ;
+		if( _compressor != NULL ) delete _compressor ;
+	}
+
+	void BGZFWriter::write( const char* data, size_t n ) {
+		while( n > 0 ) {
+			size_t k = min( n, BGZFCompressor::BLOCKSIZE - _pending.size() ) ;
+			_pending.append( data, k ) ;
+			data += k ;
+			n    -= k ;
+			if( _pending.size() == BGZFCompressor::BLOCKSIZE ) _submit() ;
+		}
+	}
+
+	void BGZFWriter::write( const string& data ) {
+		write( data.data(), data.size() ) ;
+	}
+
+	void BGZFWriter::close() {
+		if( _out == NULL ) return ;
+
+		if( ! _pending.empty() ) _submit() ;
+		_collect( 0 ) ;
+
+		// stop the compression threads
+		if( _jobs != NULL ) _jobs->close() ;
+		for( vector<thread>::iterator it=_threads.begin(); it!=_threads.end(); ++it ) {
+			it->join() ;
+		}
+		_threads.clear() ;
+
+		string eof ;
+		BGZFCompressor::eof( eof ) ;
+		_out->write( eof.data(), eof.size() ) ;
+		_out->flush() ;
+		_out = NULL ;
+	}
+
+	void BGZFWriter::_submit() {
+		_Block* b = new _Block() ;
+		b->data.swap( _pending ) ;
+		b->done = false ;
+		_pending.reserve( BGZFCompressor::BLOCKSIZE ) ;
+
+		_blocks.push_back( b ) ;
+		if( _jobs != NULL ) {
+			if( _threads.empty() ) {
+				for( int i=0; i<_nthreads; i++ ) {
+					_threads.push_back( thread( &BGZFWriter::_run, this ) ) ;
+				}
+			}
+			_jobs->push( b ) ;
+		} else {
+			_compressor->compress( b->data.data(), b->data.size(), b->compressed ) ;
+			b->done = true ;
+		}
+		_collect( _maxblocks ) ;
+	}
+
+	void BGZFWriter::_collect( size_t keep ) {
+		while( ! _blocks.empty() ) {
+			_Block* b = _blocks.front() ;
+			{
+				unique_lock<mutex> lock( _m ) ;
+				if( ! b->done && _blocks.size() <= keep ) break ;
+				while( ! b->done ) _done.wait( lock ) ;
+			}
+			_out->write( b->compressed.data(), b->compressed.size() ) ;
+			_blocks.pop_front() ;
+			delete b ;
+		}
+	}
+
+	void BGZFWriter::_run() {
+		BGZFCompressor compressor( _level ) ;
+		_Block* b = NULL ;
+		while( _jobs->shift( b ) ) {
+			compressor.compress( b->data.data(), b->data.size(), b->compressed ) ;
+			lock_guard<mutex> guard( _m ) ;
+			b->done = true ;
+			_done.notify_one() ;
+		}
+	}
+
+}
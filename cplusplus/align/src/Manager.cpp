@@ -28,20 +28,32 @@ namespace NimApp {
 	}
 
 	Manager::Manager( ) {
+		_init( BATCHSIZE ) ;
+	}
+
+	Manager::Manager( unsigned int batchsize ) {
+		_init( batchsize ) ;
+	}
+
+	void Manager::_init( unsigned int batchsize ) {
+
+		// the number of read pairs per queue item
+		_batchsize = batchsize > 0 ? batchsize : 1 ;
 
 		// prepare the kill switch
 		_stop   = new Signal<bool>(false) ; 
-		_oqueue = new TQueue< Nimbus::AlignmentBuilder* >() ;
-		
-		// set the input to NULL
-		_pfa = NULL ;
-		_pfb = NULL ;
+		_oqueue = new RingBuffer<OutputBatch*>( LIMIT / _batchsize + 1 ) ;
+
+		// the pools are created with the workers
+		_rpool  = NULL ;
+		_opool  = NULL ;
 
 		_in  = NULL ;
 		_out = NULL ;
 
-		// set the output to NULL
-		_pfo = NULL ;
+		// start with a single sample
+		_samples = vector<_Sample>() ;
+		addSample() ;
 
 		// make an empty worker vector
 		_workers = vector<Worker>() ;
@@ -49,41 +61,56 @@ namespace NimApp {
 
 	Manager::~Manager(void) {
 
-		// close the first FastQ file
-		if( _pfa != NULL ) {
-			if( _pfa->is_open() ) _pfa->close() ;
-			delete _pfa ;
-		}
+		for( vector<_Sample>::iterator it=_samples.begin(); it!=_samples.end(); ++it ) {
 
-		// close the second FastQ file
-		if( _pfb != NULL ) {
-			if( _pfb->is_open() ) _pfb->close() ;
-			delete _pfb ;
-		}
+			// the compression writes to the output stream
+			if( it->bgzf != NULL ) delete it->bgzf ;
+			if( it->encoder != NULL ) delete it->encoder ;
+			if( it->sorter != NULL ) delete it->sorter ;
 
-		// close the output stream
-		if( _pfo != NULL ) {
-			if( _pfo->is_open() ) _pfo->close() ;
-			delete _pfo ;
-		}	
+			// close the output stream
+			if( it->pfo != NULL ) {
+				if( it->pfo->is_open() ) it->pfo->close() ;
+				delete it->pfo ;
+			}
+			if( it->total != NULL ) delete it->total ;
+		}
 
 		// delete the signals
 		if( _stop != NULL ) delete _stop ;
 		if( _oqueue != NULL ) delete _oqueue ;
 		if( _in != NULL ) delete _in ;
 		if( _out != NULL ) delete _out ;
+		if( _rpool != NULL ) delete _rpool ;
+		if( _opool != NULL ) delete _opool ;
 	}
 
 	//
 	// 
 	//
 
+	void Manager::addSample( ) {
+		_Sample x ;
+		x.pfo = NULL ;
+
+		// write SAM unless BAM output is requested
+		x.bam      = false ;
+		x.cthreads = 0 ;
+		x.encoder  = NULL ;
+		x.bgzf     = NULL ;
+
+		// write the records in the order of the alignment
+		x.sorter   = NULL ;
+		x.total    = new Signal<long>( -1 ) ;
+		_samples.push_back( x ) ;
+	}
+
 	void Manager::addForwardInput( string fn ) {		
-		_pfa = new ifstream( fn.c_str(), fstream::in ) ;
+		_samples.back().fna = fn ;
 	}
 
 	void Manager::addReverseInput( string fn ) {		
-		_pfb = new ifstream( fn.c_str(), fstream::in ) ;
+		_samples.back().fnb = fn ;
 	}
 
 	void Manager::addInput( string fna, string fnb ) {
@@ -92,24 +119,75 @@ namespace NimApp {
 	}
 
 	void Manager::addOutput( string fn ) {
-		_pfo = new ofstream( fn.c_str(), fstream::out ) ;
+		_samples.back().pfo = new ofstream( fn.c_str(), fstream::out ) ;
+
+	}
+
+	void Manager::addOutput( string fn, bool bam, int threads ) {
+		_Sample& x = _samples.back() ;
+		x.pfo      = new ofstream( fn.c_str(), fstream::out | fstream::binary ) ;
+		x.bam      = bam ;
+		x.cthreads = threads ;
+	}
 
+	void Manager::setReadGroup( string id ) {
+		_samples.back().readgroup = id ;
+	}
+
+	void Manager::sortOutput( const vector<Nimbus::basic::Amplicon*>& amplicons, const vector<string>& references, size_t budget ) {
+		_samples.back().sorter = new RecordSorter( amplicons, references, budget ) ;
 	}
 	
 	void Manager::finalizeStreams( ) { 
-		_out = new Writer( _pfo, _oqueue, _stop ) ;
-		_in  = new Reader( _pfa, _pfb ) ;
+		_out = new Writer( _oqueue, _stop ) ;
+		_in  = new Reader( NULL, NULL, LIMIT, _batchsize ) ;
+		for( unsigned int i=0; i<_samples.size(); i++ ) {
+			_Sample& x = _samples[i] ;
+			if( x.bam && x.pfo != NULL ) {
+
+				// the header is written as the first BAM data
+				x.encoder = new Nimbus::alignment::BAMEncoder( x.header ) ;
+				x.bgzf    = new BGZFWriter( x.pfo, x.cthreads ) ;
+				string h ;
+				x.encoder->header( h ) ;
+				x.bgzf->write( h ) ;
+			}
+			_out->setOutput( i, x.pfo, x.bgzf ) ;
+			_out->setSorter( i, x.sorter ) ;
+			_out->setTotal( i, x.total ) ;
+			_in->addInput( x.fna, x.fnb, x.total ) ;
+		}
 	}
 
 	void Manager::writeToOutput( std::string s ) {
-		if( _pfo != NULL ) {
-			(*_pfo) <<  s ;
+		_Sample& x = _samples.back() ;
+		if( x.bam ) {
+			x.header += s ;
+		} else if( x.pfo != NULL ) {
+			(*x.pfo) <<  s ;
 		}
 	}
 
 	void Manager::addWorkers(  Nimbus::AmpliconAlignment* a, int n ) {
+
+		// the pools hold the batches in the queues and those being processed
+		if( _rpool == NULL ) {
+			size_t capacity = 2 * ( LIMIT / _batchsize + 1 ) + n + 2 ;
+			_rpool = new BatchPool<ReadBatch>( capacity ) ;
+			_opool = new BatchPool<OutputBatch>( capacity ) ;
+			_in->setPool( _rpool ) ;
+			_out->setPool( _opool ) ;
+		}
+
 		for( int i=0; i<n; i++ ){
-			_workers.push_back( Worker( a, _stop, _in->getQueue(), _oqueue ) ) ;
+			Worker w = Worker( a, _stop, _in->getQueue(), _oqueue ) ;
+			for( unsigned int j=0; j<_samples.size(); j++ ) {
+				w.setOutputFormat( j, _samples[j].encoder, _samples[j].readgroup ) ;
+				w.setSorter( j, _samples[j].sorter ) ;
+			}
+			w.setPools( _rpool, _opool ) ;
+			w.setBatchSize( _batchsize ) ;
+			_workers.push_back( w ) ;
 		}
 	}
 
@@ -132,26 +210,32 @@ namespace NimApp {
 		in.join() ;
 		cerr << "[Manager] Input has been processed" << endl ;
 		
-		// wait for the number of input reads to match the output
-		while( _in->getCounter()->get() != _out->getCounter()->get() ) {
-			// poll the counter every second
-#if __cplusplus >= 201103L				
-			this_thread::sleep_for( chrono::seconds(1) ) ;
-#elif _POSIX_VERSION >= 200112L
-			sleep( 1 ) ;
-#endif
-		}
-		cerr << "[Manager] All reads have been written to the output" << endl ;
-		cerr << "[Manager] Sending the stop signal to the workers" << endl ;
-		_stop->set( true ) ;
+		// the workers stop when the input queue is closed and drained
 		for( vector<thread>::iterator it=wthreads.begin(); it!=wthreads.end(); ++it ) {				
 			it->join() ;				
 		}
-		cerr << "[Manager] processed " << _in->getCounter()->get() << " elements in the input" << endl ;
-		cerr << "[Manager] processed " << _out->getCounter()->get() << " elements in the output" << endl ;
+		cerr << "[Manager] All reads have been aligned" << endl ;
 
-	 	// join the writer thread
+		// the writer stops when the output queue is drained
+		_oqueue->close() ;
 		out.join() ;
+		cerr << "[Manager] All reads have been written to the output" << endl ;
+		cerr << "[Manager] processed " << _in->getCounter()->get() << " elements in the input" << endl ;
+		cerr << "[Manager] processed " << _out->getCounter()->get() << " elements in the output" << endl ;
+		if( _in->getQueue()->splits() > 0 ) cerr << "[Manager] split " << _in->getQueue()->splits() << " batches to idle workers" << endl ;
+		if( _samples.size() > 1 ) {
+			for( unsigned int i=0; i<_samples.size(); i++ ) {
+				cerr << "[Manager] processed " << _samples[i].total->get() << " read pairs of sample " << i + 1 << endl ;
+			}
+		}
+		size_t spilled = 0 ;
+		bool sorted    = false ;
+		for( vector<_Sample>::iterator it=_samples.begin(); it!=_samples.end(); ++it ) {
+			if( it->sorter == NULL ) continue ;
+			spilled += it->sorter->spilled() ;
+			sorted   = true ;
+		}
+		if( sorted ) cerr << "[Manager] sorted the output with " << spilled << " bytes in temporary files" << endl ;
 		cerr << "[Manager] Joined all the threads" << endl ;
 
 		if( _in->getQueue() != NULL ) delete _in->getQueue() ;
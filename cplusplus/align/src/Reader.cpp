@@ -15,7 +15,11 @@ namespace NimApp {
 		_hb = NULL ;
 
 		_limit  = LIMIT ;  // keep a maximum of 10,000 read pairs in the queue
-		_queue  = new TQueue< pair<Read*,Read*> >() ;		
+		_batchsize = BATCHSIZE ;
+		_pool   = NULL ;
+		_pa     = NULL ;
+		_pb     = NULL ;
+		_queue  = new WorkStealingQueue<ReadBatch*>( _limit / _batchsize + 1 ) ;		
 		_sigcnt = new Signal<long>( 0 ) ;		
 		_stop   = new Signal<bool>( false ) ;
 	}
@@ -26,7 +30,11 @@ namespace NimApp {
 		_hb = xb ;
 
 		_limit  = LIMIT ;  // keep a maximum of 10,000 read pairs in the queue
-		_queue  = new TQueue< pair<Read*,Read*> >() ;
+		_batchsize = BATCHSIZE ;
+		_pool   = NULL ;
+		_pa     = NULL ;
+		_pb     = NULL ;
+		_queue  = new WorkStealingQueue<ReadBatch*>( _limit / _batchsize + 1 ) ;
 		_sigcnt = new Signal<long>( 0 ) ;
 		_stop   = new Signal<bool>( false ) ;
 	}
@@ -36,32 +44,60 @@ namespace NimApp {
 		_hb = xb ;
 
 		_limit  = l ;  // keep a maximum of 10,000 read pairs in the queue
-		_queue  = new TQueue< pair<Read*,Read*> >() ;
+		_batchsize = BATCHSIZE ;
+		_pool   = NULL ;
+		_pa     = NULL ;
+		_pb     = NULL ;
+		_queue  = new WorkStealingQueue<ReadBatch*>( _limit / _batchsize + 1 ) ;
 		_sigcnt = new Signal<long>( 0 ) ;
 		_stop   = new Signal<bool>( false ) ;
 	}
 
-	Reader::Reader( istream* xa, istream* xb, unsigned int l, TQueue<pair<Read*,Read*>>* q, Signal<long>* s ) {
+	Reader::Reader( istream* xa, istream* xb, unsigned int l, unsigned int bs ) {
 		_ha = xa ;
 		_hb = xb ;
 
 		_limit  = l ;  // keep a maximum of 10,000 read pairs in the queue
+		_batchsize = bs > 0 ? bs : 1 ;
+		_pool   = NULL ;
+		_pa     = NULL ;
+		_pb     = NULL ;
+		_queue  = new WorkStealingQueue<ReadBatch*>( _limit / _batchsize + 1 ) ;
+		_sigcnt = new Signal<long>( 0 ) ;
+		_stop   = new Signal<bool>( false ) ;
+	}
+
+	Reader::Reader( istream* xa, istream* xb, unsigned int l, WorkStealingQueue<ReadBatch*>* q, Signal<long>* s ) {
+		_ha = xa ;
+		_hb = xb ;
+
+		_limit  = l ;  // keep a maximum of 10,000 read pairs in the queue
+		_batchsize = BATCHSIZE ;
+		_pool   = NULL ;
+		_pa     = NULL ;
+		_pb     = NULL ;
 		_queue  = q ;
 		_sigcnt = s ;
 		_stop   = new Signal<bool>( false ) ;
 	}
 
-	Reader::Reader( istream* xa, istream* xb, unsigned int l, TQueue<pair<Read*,Read*>>* q, Signal<long>* s, Signal<bool>* b ) {
+	Reader::Reader( istream* xa, istream* xb, unsigned int l, WorkStealingQueue<ReadBatch*>* q, Signal<long>* s, Signal<bool>* b ) {
 		_ha = xa ;
 		_hb = xb ;
 
 		_limit  = l ;  // keep a maximum of 10,000 read pairs in the queue
+		_batchsize = BATCHSIZE ;
+		_pool   = NULL ;
+		_pa     = NULL ;
+		_pb     = NULL ;
 		_queue  = q ;
 		_sigcnt = s ;
 		_stop   = b ;
 	}
 
 	Reader::~Reader() {
+		if( _pa != NULL ) delete _pa ;
+		if( _pb != NULL ) delete _pb ;
 	}
 
 
@@ -90,51 +126,137 @@ namespace NimApp {
 		return rval ;
 	}
 
+	bool Reader::process( pair<Read*,Read*>& p ) {
+		bool rval = false ;
+
+		if( _ha != NULL ) {
+			if( p.first == NULL ) p.first = new Read() ;
+			rval = _pa != NULL ? _pa->next( *p.first ) : FastQReader( *_ha, *p.first ) ;
+		}
+
+		// the second read is missing if the second file ended first
+		if( rval && _hb != NULL ) {
+			if( p.second == NULL ) p.second = new Read() ;
+			if( ! ( _pb != NULL ? _pb->next( *p.second ) : FastQReader( *_hb, *p.second ) ) ) {
+				delete p.second ;
+				p.second = NULL ;
+			}
+		}
+		return rval ;
+	}
+
+	void Reader::addInput( string fna, string fnb, Signal<long>* total ) {
+		_Input i ;
+		i.fna   = fna ;
+		i.fnb   = fnb ;
+		i.total = total ;
+		_inputs.push_back( i ) ;
+	}
+
+	istream* Reader::open( const string& fn, ifstream*& f, GzipInput*& gz ) {
+		f  = NULL ;
+		gz = NULL ;
+		if( fn == "" ) return NULL ;
+		f = new ifstream( fn.c_str(), fstream::in ) ;
+		if( ! GzipInput::gzipped( *f ) ) return f ;
+		gz = new GzipInput( *f ) ;
+		cerr << "[Reader] Reading " << ( gz->bgzf() ? "BGZF" : "gzip" ) << " compressed input " << fn << endl ;
+		return gz ;
+	}
+
 	//
 	// The processing loop
 	//
 	void Reader::run() {
-		// while we are allowed		
 		bool proceed = true ;
+		unsigned int sample = 0 ;
 
-		//long inputcnt = 0 ;
+		// the streams of the constructor are the first sample
+		if( _ha != NULL ) proceed = _read( sample++, NULL ) ;
 
-		while( proceed ) {
-				
-			// give the other processes some breathing room if the queue is full		
-			while( _queue->size() >= _limit ) {
-#if __cplusplus >= 201103L				
-				this_thread::sleep_for( chrono::milliseconds(THREADSLEEPTIME) ) ;
-#elif _POSIX_VERSION >= 200112L
-				usleep( THREADSLEEPTIME * 1000 ) ;
-#endif		
-			}
-			
-			// push the results in the queue				
-			pair<Read*,Read*> x = process( proceed ) ;			
-			
-			if( proceed ) { 
+		// the files of the other samples are only opened when read, 
+		// the decompression is stopped before the files are closed
+		for( vector<_Input>::iterator it=_inputs.begin(); proceed && it!=_inputs.end(); ++it ) {
+			ifstream* fa  = NULL ;
+			ifstream* fb  = NULL ;
+			GzipInput* ga = NULL ;
+			GzipInput* gb = NULL ;
+			_ha = open( it->fna, fa, ga ) ;
+			_hb = open( it->fnb, fb, gb ) ;
+			if( _ha != NULL ) proceed = _read( sample, it->total ) ;
+			sample++ ;
+			if( ga != NULL ) delete ga ;
+			if( gb != NULL ) delete gb ;
+			if( fa != NULL ) delete fa ;
+			if( fb != NULL ) delete fb ;
+			_ha = NULL ;
+			_hb = NULL ;
+		}
 
-				// report the input count
-				//if( inputcnt % 1000000 == 0 )
-				//	cerr << "[InputReader] Processed " <<  inputcnt << " read (pairs)" << endl ;
+		// mark the end of the stream: the workers stop once the queue is drained
+		_queue->close() ;
+	}
+
+	bool Reader::fill( ReadBatch* batch ) {
+
+		// the streams are parsed in blocks
+		if( _pa == NULL && _ha != NULL ) _pa = new FastQParser( *_ha ) ;
+		if( _pb == NULL && _hb != NULL ) _pb = new FastQParser( *_hb ) ;
+
+		bool proceed = true ;
+		batch->n = 0 ;
+		while( proceed && batch->n < _batchsize ) {
+			if( batch->n == batch->pairs.size() ) batch->pairs.push_back( pair<Read*,Read*>( NULL, NULL ) ) ;
+			proceed = process( batch->pairs[ batch->n ] ) ;
+			if( proceed ) batch->n++ ;
+		}
+		return proceed ;
+	}
 
-				// add a read counter
-				//inputcnt += 1 ;
+	bool Reader::_read( unsigned int sample, Signal<long>* total ) {
+		// while we are allowed		
+		bool proceed = true ;
+		bool stopped = false ;
+		long n = 0 ;
 
-				// add a new input to the stream
-				_queue->push( x ) ;
+		while( proceed ) {
 				
+			// collect a batch of read pairs, in the reads of a reused batch
+			ReadBatch* batch = _pool != NULL ? _pool->get() : new ReadBatch() ;
+			batch->sample = sample ;
+			proceed = fill( batch ) ;
+			
+			if( batch->n > 0 ) { 
+
 				// update the counter signal
 				long c = _sigcnt->get() ;
-				c += 1 ;
+				c += batch->n ;
 				_sigcnt->set( c ) ;
+				n += batch->n ;
+
+				// add a new input to the stream, waits while the queue is full
+				_queue->push( batch ) ;
+			} else if( _pool != NULL ) {
+				_pool->put( batch ) ;
+			} else {
+				delete batch ;
 			}
 
 			// stop if the we get the signal
-			if( _stop->get() ) proceed = false ;
+			if( _stop->get() ) {
+				proceed = false ;
+				stopped = true ;
+			}
 		}
-	}
 
+		// the sample is complete once all its read pairs have been written
+		if( total != NULL && ! stopped ) total->set( n ) ;
+
+		if( _pa != NULL ) delete _pa ;
+		if( _pb != NULL ) delete _pb ;
+		_pa = NULL ;
+		_pb = NULL ;
+		return ! stopped ;
+	}
 
 }
\ No newline at end of file
@@ -0,0 +1,343 @@
+#include "nimbusheader.h"
+#include "RecordSorter.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace NimApp {
+
+	using namespace std ;
+	using namespace Nimbus::basic ;
+	using namespace Nimbus::alignment ;
+
+	// a record of the buckets being merged
+	struct _Record {
+		int pos ;
+		unsigned short flag ;
+		size_t name ;
+		unsigned char namelength ;
+		size_t offset ;
+		unsigned int length ;
+	} ;
+
+	// the bytes of the unmapped records read at once from a run
+	static const size_t RUNBUFFER = 1 << 16 ;
+
+	// the bytes of unmapped records returned at once by next()
+	static const size_t PART = 1 << 22 ;
+
+	static int _cmp_name( const char* a, unsigned char an, const char* b, unsigned char bn ) {
+		int c = memcmp( a, b, min( an, bn ) ) ;
+		return c != 0 ? c : (int) an - (int) bn ;
+	}
+
+	// orders the records by position, flag and read name
+	struct _RecordOrder {
+		const char* data ;
+
+		bool operator()( const _Record& a, const _Record& b ) const {
+			if( a.pos != b.pos ) return a.pos < b.pos ;
+			if( a.flag != b.flag ) return a.flag < b.flag ;
+			return _cmp_name( data + a.name, a.namelength, data + b.name, b.namelength ) < 0 ;
+		}
+	} ;
+
+	// orders the unmapped records by read name and flag
+	struct _UnmappedOrder {
+		const char* data ;
+
+		bool operator()( const _Record& a, const _Record& b ) const {
+			int c = _cmp_name( data + a.name, a.namelength, data + b.name, b.namelength ) ;
+			return c != 0 ? c < 0 : a.flag < b.flag ;
+		}
+	} ;
+
+	RecordSorter::RecordSorter( const vector<Amplicon*>& amplicons, const vector<string>& references, size_t budget ) {
+		_memory   = 0 ;
+		_budget   = budget ;
+		_fd       = -1 ;
+		_spilled  = 0 ;
+		_next     = 0 ;
+		_finished = false ;
+		_unsorted = 0 ;
+
+		_Bucket empty ;
+		empty.minpos = INT_MAX ;
+		empty.maxpos = INT_MIN ;
+
+		// the records of an amplicon on an unknown reference are unmapped
+		map<string,int> refids ;
+		for( unsigned int i=0; i<references.size(); i++ ) refids[ references[i] ] = (int) i ;
+
+		for( vector<Amplicon*>::const_iterator it=amplicons.begin(); it!=amplicons.end(); ++it ) {
+			map<string,int>::iterator ref = refids.find( (*it)->chromosome() ) ;
+			if( ref == refids.end() || _amplicons.count( *it ) > 0 ) continue ;
+			empty.refid = ref->second ;
+			_amplicons[ *it ] = (unsigned int) _buckets.size() ;
+			_buckets.push_back( empty ) ;
+		}
+
+		// a bucket per reference for the records of any other amplicon
+		for( unsigned int i=0; i<references.size(); i++ ) {
+			empty.refid = (int) i ;
+			_references[ references[i] ] = (unsigned int) _buckets.size() ;
+			_buckets.push_back( empty ) ;
+		}
+
+		empty.refid = INT_MAX ;
+		_unmapped   = (unsigned int) _buckets.size() ;
+		_buckets.push_back( empty ) ;
+	}
+
+	RecordSorter::~RecordSorter() {
+		if( _fd >= 0 ) close( _fd ) ;
+	}
+
+	unsigned int RecordSorter::bucket( const Amplicon* a, const SAMRecord& r ) const {
+		unsigned int rval = _unmapped ;
+		if( a != NULL && r.rname() != "*" ) {
+			map<const Amplicon*, unsigned int>::const_iterator it = _amplicons.find( a ) ;
+			if( it != _amplicons.end() ) {
+				rval = it->second ;
+			} else {
+				map<string, unsigned int>::const_iterator ref = _references.find( r.rname() ) ;
+				if( ref != _references.end() ) rval = ref->second ;
+			}
+		}
+		return rval ;
+	}
+
+	void RecordSorter::add( const OutputBatch* b ) {
+		size_t offset = 0 ;
+		for( vector<RecordKey>::const_iterator it=b->keys.begin(); it!=b->keys.end(); ++it ) {
+			_Bucket& bucket = _buckets[ it->bucket ] ;
+			bucket.data.append( b->records, offset, it->length ) ;
+			_Entry e ;
+			e.pos        = it->pos ;
+			e.length     = it->length ;
+			e.flag       = it->flag ;
+			e.nameoffset = it->nameoffset ;
+			e.namelength = it->namelength ;
+			bucket.entries.push_back( e ) ;
+			if( it->pos < bucket.minpos ) bucket.minpos = it->pos ;
+			if( it->pos > bucket.maxpos ) bucket.maxpos = it->pos ;
+			offset  += it->length ;
+			_memory += it->length ;
+		}
+		if( _memory > _budget ) _spill() ;
+	}
+
+	bool RecordSorter::next( string& out ) {
+		if( ! _finished ) _finish() ;
+		out.clear() ;
+
+		// merge the buckets while they overlap, and sort their records
+		if( _next < _order.size() ) {
+			string data ;
+			vector<_Record> records ;
+			size_t first  = _next ;
+			int refid     = _buckets[ _order[_next] ].refid ;
+			int maxpos    = _buckets[ _order[_next] ].maxpos ;
+			for( ; _next < _order.size(); _next++ ) {
+				_Bucket& b = _buckets[ _order[_next] ] ;
+				if( _next > first && ( b.refid != refid || b.minpos >= maxpos ) ) break ;
+				if( b.maxpos > maxpos ) maxpos = b.maxpos ;
+
+				size_t offset = data.size() ;
+				_load( b, data ) ;
+				for( vector<_Entry>::const_iterator it=b.entries.begin(); it!=b.entries.end(); ++it ) {
+					_Record r ;
+					r.pos        = it->pos ;
+					r.flag       = it->flag ;
+					r.name       = offset + it->nameoffset ;
+					r.namelength = it->namelength ;
+					r.offset     = offset ;
+					r.length     = it->length ;
+					records.push_back( r ) ;
+					offset += it->length ;
+				}
+
+				// the bucket is no longer needed
+				string().swap( b.data ) ;
+				vector<_Entry>().swap( b.entries ) ;
+			}
+
+			_RecordOrder order ;
+			order.data = data.data() ;
+			stable_sort( records.begin(), records.end(), order ) ;
+			out.reserve( data.size() ) ;
+			for( vector<_Record>::const_iterator it=records.begin(); it!=records.end(); ++it ) {
+				out.append( data, it->offset, it->length ) ;
+			}
+			return true ;
+		}
+
+		// the unmapped records, one part at a time merged from the runs
+		const _Bucket& u = _buckets[ _unmapped ] ;
+		while( out.size() < PART ) {
+			_Run* first = NULL ;
+			for( vector<_Run>::iterator it=_runs.begin(); it!=_runs.end(); ++it ) {
+				if( it->entry == it->last ) continue ;
+				_fill( *it ) ;
+				if( first != NULL ) {
+					const _Entry& a = u.entries[ it->entry ] ;
+					const _Entry& b = u.entries[ first->entry ] ;
+					int c = _cmp_name( it->buffer.data() + it->at + a.nameoffset, a.namelength, first->buffer.data() + first->at + b.nameoffset, b.namelength ) ;
+					if( c > 0 || ( c == 0 && a.flag >= b.flag ) ) continue ;
+				}
+				first = &(*it) ;
+			}
+			if( first == NULL ) break ;
+
+			unsigned int length = u.entries[ first->entry ].length ;
+			out.append( first->buffer, first->at, length ) ;
+			first->at += length ;
+			first->entry++ ;
+		}
+		return ! out.empty() ;
+	}
+
+	size_t RecordSorter::spilled() const {
+		return (size_t) _spilled ;
+	}
+
+	void RecordSorter::_spill() {
+
+		// the temporary file is removed as soon as it is closed
+		if( _fd < 0 ) {
+			const char* dir = getenv( "TMPDIR" ) ;
+			string fn = string( dir != NULL && *dir != '\0' ? dir : "/tmp" ) + "/nimbus_sort.XXXXXX" ;
+			vector<char> name( fn.begin(), fn.end() ) ;
+			name.push_back( '\0' ) ;
+			_fd = mkstemp( &name[0] ) ;
+			if( _fd < 0 ) {
+				cerr << "[RecordSorter] could not create a temporary file in " << fn << endl ;
+				exit( EXIT_FAILURE ) ;
+			}
+			unlink( &name[0] ) ;
+		}
+
+		for( vector<_Bucket>::iterator it=_buckets.begin(); it!=_buckets.end(); ++it ) {
+			if( it->data.empty() ) continue ;
+
+			// the unmapped records are written as a sorted run
+			if( it - _buckets.begin() == (ptrdiff_t) _unmapped ) _addRun( _spilled ) ;
+			const char* p = it->data.data() ;
+			size_t n = it->data.size() ;
+			while( n > 0 ) {
+				ssize_t w = write( _fd, p, n ) ;
+				if( w <= 0 ) {
+					cerr << "[RecordSorter] could not write the temporary file" << endl ;
+					exit( EXIT_FAILURE ) ;
+				}
+				p += w ;
+				n -= (size_t) w ;
+			}
+			it->chunks.push_back( pair<off_t,size_t>( _spilled, it->data.size() ) ) ;
+			_spilled += (off_t) it->data.size() ;
+			string().swap( it->data ) ;
+		}
+		_memory = 0 ;
+	}
+
+	void RecordSorter::_finish() {
+		_finished = true ;
+
+		// the unmapped records in memory are the last run
+		_Bucket& u = _buckets[ _unmapped ] ;
+		if( ! u.data.empty() ) {
+			_addRun( 0 ) ;
+			_runs.back().buffer.swap( u.data ) ;
+		}
+
+		// order the buckets by reference and their first record
+		vector< pair< pair<int,int>, unsigned int > > order ;
+		for( unsigned int i=0; i<_buckets.size(); i++ ) {
+			if( i == _unmapped || _buckets[i].entries.empty() ) continue ;
+			order.push_back( make_pair( make_pair( _buckets[i].refid, _buckets[i].minpos ), i ) ) ;
+		}
+		sort( order.begin(), order.end() ) ;
+		for( unsigned int i=0; i<order.size(); i++ ) _order.push_back( order[i].second ) ;
+	}
+
+	void RecordSorter::_addRun( off_t offset ) {
+		_Bucket& u = _buckets[ _unmapped ] ;
+		vector<_Record> records ;
+		size_t at = 0 ;
+		for( size_t i=_unsorted; i<u.entries.size(); i++ ) {
+			const _Entry& e = u.entries[i] ;
+			_Record r ;
+			r.pos        = e.pos ;
+			r.flag       = e.flag ;
+			r.name       = at + e.nameoffset ;
+			r.namelength = e.namelength ;
+			r.offset     = at ;
+			r.length     = e.length ;
+			records.push_back( r ) ;
+			at += e.length ;
+		}
+
+		_UnmappedOrder order ;
+		order.data = u.data.data() ;
+		stable_sort( records.begin(), records.end(), order ) ;
+
+		// rewrite the records and their entries in the sorted order
+		string data ;
+		data.reserve( u.data.size() ) ;
+		for( size_t i=0; i<records.size(); i++ ) {
+			_Entry& e     = u.entries[ _unsorted + i ] ;
+			e.pos         = records[i].pos ;
+			e.flag        = records[i].flag ;
+			e.nameoffset  = (unsigned char) ( records[i].name - records[i].offset ) ;
+			e.namelength  = records[i].namelength ;
+			e.length      = records[i].length ;
+			data.append( u.data, records[i].offset, records[i].length ) ;
+		}
+		u.data.swap( data ) ;
+
+		_Run r ;
+		r.entry  = _unsorted ;
+		r.last   = u.entries.size() ;
+		r.offset = offset ;
+		r.end    = offset + ( _finished ? 0 : (off_t) u.data.size() ) ;
+		r.at     = 0 ;
+		_runs.push_back( r ) ;
+		_unsorted = u.entries.size() ;
+	}
+
+	void RecordSorter::_fill( _Run& r ) {
+		unsigned int length = _buckets[ _unmapped ].entries[ r.entry ].length ;
+		if( r.at + length <= r.buffer.size() ) return ;
+
+		// drop the records that were written and read the next ones
+		r.buffer.erase( 0, r.at ) ;
+		r.at = 0 ;
+		size_t n = min( max( RUNBUFFER, (size_t) length ), (size_t) ( r.end - r.offset ) ) ;
+		_read( r.offset, n, r.buffer ) ;
+		r.offset += (off_t) n ;
+	}
+
+	void RecordSorter::_load( const _Bucket& b, string& out ) {
+		for( vector< pair<off_t,size_t> >::const_iterator it=b.chunks.begin(); it!=b.chunks.end(); ++it ) {
+			_read( it->first, it->second, out ) ;
+		}
+		out.append( b.data ) ;
+	}
+
+	void RecordSorter::_read( off_t offset, size_t n, string& out ) {
+		size_t start = out.size() ;
+		out.resize( start + n ) ;
+		size_t done = 0 ;
+		while( done < n ) {
+			ssize_t r = pread( _fd, &out[start + done], n - done, offset + (off_t) done ) ;
+			if( r <= 0 ) {
+				cerr << "[RecordSorter] could not read the temporary file" << endl ;
+				exit( EXIT_FAILURE ) ;
+			}
+			done += (size_t) r ;
+		}
+	}
+
+}
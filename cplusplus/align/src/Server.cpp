@@ -0,0 +1,563 @@
+#include "nimbusheader.h"
+#include "Server.h"
+#include "nimbus.h"
+#include "opt.h"
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/time.h>
+
+namespace NimApp {
+
+	using namespace std ;
+	using namespace threadutils ;
+	using namespace Nimbus ;
+	using namespace Nimbus::basic ;
+	using namespace Nimbus::alignment ;
+	using namespace Nimbus::IO ;
+
+	// set by SIGINT and SIGTERM
+	static volatile sig_atomic_t stopping = 0 ;
+
+	static void stop_serving( int ) {
+		stopping = 1 ;
+	}
+
+	// writes all of s to the connection, the connection may have been closed
+	static bool send_all( int fd, const string& s ) {
+		size_t done = 0 ;
+		while( done < s.size() ) {
+			ssize_t n = send( fd, s.data() + done, s.size() - done, MSG_NOSIGNAL ) ;
+			if( n < 0 && errno == EINTR ) continue ;
+			if( n <= 0 ) return false ;
+			done += (size_t) n ;
+		}
+		return true ;
+	}
+
+	// reads the next line of the connection into line, using buffer for the
+	// data read beyond it; returns false if the connection is closed first
+	static bool receive_line( int fd, string& buffer, string& line ) {
+		size_t end = buffer.find( '\n' ) ;
+		while( end == string::npos ) {
+			char data[4096] ;
+			ssize_t n = recv( fd, data, sizeof( data ), 0 ) ;
+			if( n < 0 && errno == EINTR ) continue ;
+			if( n <= 0 || buffer.size() > ( 1 << 20 ) ) return false ;
+			buffer.append( data, (size_t) n ) ;
+			end = buffer.find( '\n' ) ;
+		}
+		line = buffer.substr( 0, end ) ;
+		buffer.erase( 0, end + 1 ) ;
+		if( ! line.empty() && line[ line.size() - 1 ] == '\r' ) line.erase( line.size() - 1 ) ;
+		return true ;
+	}
+
+	// the integer option name, or value if not given
+	static bool int_option( const map<string,string>& options, const string& name, int& value, string& error ) {
+		map<string,string>::const_iterator it = options.find( name ) ;
+		if( it == options.end() ) return true ;
+		char* end = NULL ;
+		long v = strtol( it->second.c_str(), &end, 10 ) ;
+		if( it->second.empty() || *end != '\0' || v < -1000000000L || v > 1000000000L ) {
+			error = "the value of " + name + " is not a number: " + it->second ;
+			return false ;
+		}
+		value = (int) v ;
+		return true ;
+	}
+
+	static bool flag_option( const map<string,string>& options, const string& name ) {
+		map<string,string>::const_iterator it = options.find( name ) ;
+		return it != options.end() && it->second != "" && it->second != "false" && it->second != "0" ;
+	}
+
+	static string string_option( const map<string,string>& options, const string& name ) {
+		map<string,string>::const_iterator it = options.find( name ) ;
+		return it != options.end() ? it->second : "" ;
+	}
+
+	//
+	//
+	// Server
+	//
+	//
+
+	Server::Server( int workers, unsigned int batchsize ) {
+		_nworkers    = workers > 0 ? workers : 1 ;
+		_batchsize   = batchsize > 0 ? batchsize : 1 ;
+		_queue       = new RingBuffer<_Task>( LIMIT / _batchsize + 1 ) ;
+		_designs     = map<string, IndexFile*>() ;
+		_jobs        = map<unsigned int, _Job*>() ;
+		_next        = 1 ;
+		_connections = 0 ;
+	}
+
+	Server::~Server() {
+		for( map<string, IndexFile*>::iterator it=_designs.begin(); it!=_designs.end(); ++it ) delete it->second ;
+		delete _queue ;
+	}
+
+	void Server::addDesign( string name, string fname ) {
+		if( _designs.find( name ) != _designs.end() ) {
+			cerr << "[Server] design " << name << " is given twice" << endl ;
+			exit( EXIT_FAILURE ) ;
+		}
+		IndexFile* file = new IndexFile( fname ) ;
+		_designs[ name ] = file ;
+		cerr << "[Server] Mapped design " << name << ": " << file->index()->n_amplicons() << " amplicons, key size " << file->keysize() << endl ;
+	}
+
+	void Server::run( string path ) {
+
+		struct sockaddr_un address ;
+		memset( &address, 0, sizeof( address ) ) ;
+		address.sun_family = AF_UNIX ;
+		if( path.size() >= sizeof( address.sun_path ) ) {
+			cerr << "[Server] the socket path " << path << " is too long" << endl ;
+			exit( EXIT_FAILURE ) ;
+		}
+		strncpy( address.sun_path, path.c_str(), sizeof( address.sun_path ) - 1 ) ;
+
+		// a socket left by a server that is no longer running is replaced
+		int fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ;
+		if( fd >= 0 && bind( fd, (struct sockaddr*) &address, sizeof( address ) ) != 0 && errno == EADDRINUSE ) {
+			int probe = socket( AF_UNIX, SOCK_STREAM, 0 ) ;
+			bool running = probe >= 0 && connect( probe, (struct sockaddr*) &address, sizeof( address ) ) == 0 ;
+			if( probe >= 0 ) close( probe ) ;
+			if( running ) {
+				cerr << "[Server] a server is already running on " << path << endl ;
+				exit( EXIT_FAILURE ) ;
+			}
+			unlink( path.c_str() ) ;
+			close( fd ) ;
+			fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ;
+			if( fd >= 0 && bind( fd, (struct sockaddr*) &address, sizeof( address ) ) != 0 ) {
+				close( fd ) ;
+				fd = -1 ;
+			}
+		}
+		if( fd < 0 || listen( fd, 16 ) != 0 ) {
+			cerr << "[Server] could not listen on " << path << ": " << strerror( errno ) << endl ;
+			exit( EXIT_FAILURE ) ;
+		}
+
+		signal( SIGINT, stop_serving ) ;
+		signal( SIGTERM, stop_serving ) ;
+
+		for( int i=0; i<_nworkers; i++ ) {
+			_workers.push_back( thread( &Server::_work, this ) ) ;
+		}
+		cerr << "[Server] Serving " << _designs.size() << " designs with " << _nworkers << " workers on " << path << endl ;
+
+		// each connection is handled by a thread of its own
+		while( ! stopping ) {
+			struct pollfd p ;
+			p.fd     = fd ;
+			p.events = POLLIN ;
+			if( poll( &p, 1, 1000 ) <= 0 ) continue ;
+			int client = accept( fd, NULL, NULL ) ;
+			if( client < 0 ) continue ;
+
+			// a client has a few seconds to send its request
+			struct timeval timeout ;
+			timeout.tv_sec  = 5 ;
+			timeout.tv_usec = 0 ;
+			setsockopt( client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) ) ;
+			{
+				lock_guard<mutex> guard( _m ) ;
+				_connections++ ;
+			}
+			thread( &Server::_connection, this, client ).detach() ;
+		}
+		close( fd ) ;
+		unlink( path.c_str() ) ;
+
+		// the cancelled jobs finish without aligning their remaining read pairs
+		{
+			unique_lock<mutex> lock( _m ) ;
+			cerr << "[Server] Stopping, cancelling " << _jobs.size() << " running jobs" << endl ;
+			for( map<unsigned int, _Job*>::iterator it=_jobs.begin(); it!=_jobs.end(); ++it ) it->second->cancel->set( true ) ;
+			while( _connections > 0 ) _closed.wait( lock ) ;
+		}
+		_queue->close() ;
+		for( vector<thread>::iterator it=_workers.begin(); it!=_workers.end(); ++it ) it->join() ;
+		_workers.clear() ;
+		cerr << "[Server] Stopped" << endl ;
+	}
+
+	void Server::_work() {
+
+		// the alignment matrices of this thread are reused for all jobs
+		AlignmentWorkspace workspace ;
+
+		_Task t ;
+		while( _queue->shift( t ) ) {
+			_Job* job = t.job ;
+			OutputBatch* o = NULL ;
+			if( job->cancel->get() ) {
+
+				// the read pairs of a cancelled job are only counted
+				o = job->opool->get() ;
+				o->records.clear() ;
+				o->keys.clear() ;
+				o->n      = t.batch->n ;
+				o->sample = t.batch->sample ;
+			} else {
+				o = job->worker->process( t.batch, &workspace ) ;
+			}
+			job->oqueue->push( o ) ;
+			job->rpool->put( t.batch ) ;
+			_count( job, true ) ;
+		}
+	}
+
+	void Server::_count( _Job* job, bool aligned ) {
+		lock_guard<mutex> guard( job->m ) ;
+		if( aligned ) {
+			job->aligned++ ;
+		} else {
+			job->read = true ;
+		}
+		if( job->read && job->aligned == job->batches ) job->oqueue->close() ;
+	}
+
+	void Server::_connection( int fd ) {
+		string buffer ;
+		string line ;
+		if( receive_line( fd, buffer, line ) ) {
+			string command = line.substr( 0, line.find( '\t' ) ) ;
+			string argument = line.size() > command.size() ? line.substr( command.size() + 1 ) : "" ;
+			if( command == "align" ) {
+
+				// the options of the job, up to an empty line
+				map<string,string> options = map<string,string>() ;
+				bool complete = false ;
+				while( ! complete && receive_line( fd, buffer, line ) ) {
+					if( line.empty() ) {
+						complete = true ;
+					} else {
+						size_t tab = line.find( '\t' ) ;
+						options[ line.substr( 0, tab ) ] = tab != string::npos ? line.substr( tab + 1 ) : "true" ;
+					}
+				}
+				if( complete ) _align( fd, options ) ;
+			} else if( command == "status" ) {
+				_status( fd ) ;
+			} else if( command == "cancel" ) {
+				_cancel( fd, argument ) ;
+			} else {
+				send_all( fd, "error\tunknown command " + command + "\n" ) ;
+			}
+		}
+		close( fd ) ;
+
+		lock_guard<mutex> guard( _m ) ;
+		_connections-- ;
+		_closed.notify_all() ;
+	}
+
+	void Server::_status( int fd ) {
+		stringstream s ;
+		{
+			lock_guard<mutex> guard( _m ) ;
+			for( map<unsigned int, _Job*>::iterator it=_jobs.begin(); it!=_jobs.end(); ++it ) {
+				_Job* job = it->second ;
+				s << "job\t" << job->id << "\t" << ( job->cancel->get() ? "cancelling" : "running" ) << "\t" << job->design ;
+				s << "\t" << job->pairs.load() << "\t" << job->writer->getCounter()->get() << "\t" << job->output << "\n" ;
+			}
+		}
+		send_all( fd, s.str() ) ;
+	}
+
+	void Server::_cancel( int fd, const string& id ) {
+		bool found = false ;
+		{
+			lock_guard<mutex> guard( _m ) ;
+			map<unsigned int, _Job*>::iterator it = _jobs.find( (unsigned int) atoi( id.c_str() ) ) ;
+			if( it != _jobs.end() ) {
+				it->second->cancel->set( true ) ;
+				found = true ;
+			}
+		}
+		send_all( fd, found ? "cancelled\t" + id + "\n" : "error\tno running job " + id + "\n" ) ;
+	}
+
+	void Server::_align( int fd, const map<string,string>& options ) {
+		string error ;
+		_Job* job = _create( options, error ) ;
+		if( job == NULL ) {
+			send_all( fd, "error\t" + error + "\n" ) ;
+			return ;
+		}
+		{
+			lock_guard<mutex> guard( _m ) ;
+			job->id = _next++ ;
+			_jobs[ job->id ] = job ;
+		}
+		cerr << "[Server] Job " << job->id << ": aligning " << job->fna << " and " << job->fnb << " to design " << job->design << " into " << job->output << endl ;
+
+		stringstream s ;
+		s << "job\t" << job->id << "\n" ;
+		bool connected = send_all( fd, s.str() ) ;
+
+		thread writer = thread( &Server::_write, this, job ) ;
+		thread reader = thread( &Server::_read, this, job ) ;
+
+		// report the progress every second; the job is cancelled when
+		// the connection is closed
+		int ticks = 0 ;
+		while( ! job->written->get() ) {
+			struct pollfd p ;
+			p.fd     = fd ;
+			p.events = POLLIN ;
+			if( connected && poll( &p, 1, 100 ) > 0 ) {
+				char data[256] ;
+				if( recv( fd, data, sizeof( data ), 0 ) <= 0 ) connected = false ;
+			} else if( ! connected ) {
+				this_thread::sleep_for( chrono::milliseconds( 100 ) ) ;
+			}
+			if( connected && ++ticks % 10 == 0 && ! job->written->get() ) {
+				stringstream progress ;
+				progress << "progress\t" << job->pairs.load() << "\t" << job->writer->getCounter()->get() << "\n" ;
+				connected = send_all( fd, progress.str() ) ;
+			}
+			if( ! connected ) job->cancel->set( true ) ;
+		}
+		reader.join() ;
+		writer.join() ;
+
+		// only the output of a completed job is kept
+		stringstream result ;
+		if( job->cancel->get() ) {
+			remove( job->output.c_str() ) ;
+			result << "cancelled\n" ;
+			cerr << "[Server] Job " << job->id << ": cancelled" << endl ;
+		} else if( ! job->pfo->good() ) {
+			remove( job->output.c_str() ) ;
+			result << "error\tcould not write " << job->output << "\n" ;
+			cerr << "[Server] Job " << job->id << ": could not write " << job->output << endl ;
+		} else {
+			result << "done\t" << job->pairs.load() << "\n" ;
+			cerr << "[Server] Job " << job->id << ": aligned " << job->pairs.load() << " read pairs" << endl ;
+		}
+		{
+			lock_guard<mutex> guard( _m ) ;
+			_jobs.erase( job->id ) ;
+		}
+		_delete( job ) ;
+		if( connected ) send_all( fd, result.str() ) ;
+	}
+
+	void Server::_read( _Job* job ) {
+		ifstream* fa = NULL ;
+		ifstream* fb = NULL ;
+		GzipInput* ga = NULL ;
+		GzipInput* gb = NULL ;
+		istream* ha = Reader::open( job->fna, fa, ga ) ;
+		istream* hb = Reader::open( job->fnb, fb, gb ) ;
+		{
+			Reader reader = Reader( ha, hb, LIMIT, _batchsize ) ;
+			bool proceed = true ;
+			while( proceed && ! job->cancel->get() ) {
+				ReadBatch* batch = job->rpool->get() ;
+				batch->sample = 0 ;
+				proceed = reader.fill( batch ) ;
+				if( batch->n == 0 ) {
+					job->rpool->put( batch ) ;
+					continue ;
+				}
+				job->pairs += (long) batch->n ;
+				{
+					lock_guard<mutex> guard( job->m ) ;
+					job->batches++ ;
+				}
+
+				// waits while the workers are busy
+				_Task t ;
+				t.job   = job ;
+				t.batch = batch ;
+				_queue->push( t ) ;
+			}
+			delete reader.getQueue() ;
+			delete reader.getCounter() ;
+			delete reader.getStopSignal() ;
+		}
+		_count( job, false ) ;
+
+		// stop the decompression before closing the files
+		if( ga != NULL ) delete ga ;
+		if( gb != NULL ) delete gb ;
+		if( fa != NULL ) delete fa ;
+		if( fb != NULL ) delete fb ;
+	}
+
+	void Server::_write( _Job* job ) {
+		job->writer->run() ;
+		job->written->set( true ) ;
+	}
+
+	Server::_Job* Server::_create( const map<string,string>& options, string& error ) {
+
+		// the design, which may be left out if the server has only one
+		string design = string_option( options, "design" ) ;
+		if( design == "" && _designs.size() == 1 ) design = _designs.begin()->first ;
+		map<string, IndexFile*>::iterator d = _designs.find( design ) ;
+		if( design == "" ) {
+			error = "the server has several designs, select one with --design" ;
+			return NULL ;
+		}
+		if( d == _designs.end() ) {
+			error = "unknown design " + design ;
+			return NULL ;
+		}
+
+		string fna    = string_option( options, "forward" ) ;
+		string fnb    = string_option( options, "reverse" ) ;
+		string output = string_option( options, "sam" ) ;
+		if( fna == "" || fnb == "" || output == "" ) {
+			error = "the forward, reverse and sam options are required" ;
+			return NULL ;
+		}
+		if( ! commandline::FileExists( fna ) ) {
+			error = "forward FastQ file " + fna + " not found" ;
+			return NULL ;
+		}
+		if( ! commandline::FileExists( fnb ) ) {
+			error = "reverse FastQ file " + fnb + " not found" ;
+			return NULL ;
+		}
+
+		// the parameters, with the defaults of align
+		int match = 2, mismatch = -1, gapextend = -1, gapopen = -1, seedmargin = 5, maxamplicons = 6000 ;
+		int bandwidth = 0, ungapped = 2, compressionthreads = 2, sortmemory = 768, cachesize = 100000 ;
+		if( ! int_option( options, "match", match, error ) ||
+			! int_option( options, "mismatch", mismatch, error ) ||
+			! int_option( options, "gap-extend", gapextend, error ) ||
+			! int_option( options, "gap-open", gapopen, error ) ||
+			! int_option( options, "seed-margin", seedmargin, error ) ||
+			! int_option( options, "maximum-amplicons", maxamplicons, error ) ||
+			! int_option( options, "band-width", bandwidth, error ) ||
+			! int_option( options, "ungapped-mismatches", ungapped, error ) ||
+			! int_option( options, "compression-threads", compressionthreads, error ) ||
+			! int_option( options, "sort-memory", sortmemory, error ) ||
+			! int_option( options, "cache-size", cachesize, error ) ) return NULL ;
+		if( bandwidth < 0 || ungapped < -1 || compressionthreads < 0 || sortmemory < 0 || cachesize < 0 ) {
+			error = "band-width, compression-threads, sort-memory and cache-size should not be negative, ungapped-mismatches should be -1 or more" ;
+			return NULL ;
+		}
+		kernel_t kernel = k_AUTO ;
+		if( string_option( options, "aligner-kernel" ) != "" && ! kernelFromString( string_option( options, "aligner-kernel" ), kernel ) ) {
+			error = "aligner kernel " + string_option( options, "aligner-kernel" ) + " not recognized" ;
+			return NULL ;
+		}
+		string readgroup = ReadGroupLine( string_option( options, "read-group" ) ) ;
+		if( readgroup != "" && ReadGroupID( readgroup ) == "" ) {
+			error = "the read group " + readgroup + " has no ID field" ;
+			return NULL ;
+		}
+		bool bam    = flag_option( options, "bam" ) ;
+		bool sorted = flag_option( options, "sorted" ) ;
+
+		ofstream* pfo = new ofstream( output.c_str(), fstream::out | fstream::binary ) ;
+		if( ! pfo->good() ) {
+			delete pfo ;
+			error = "could not open " + output ;
+			return NULL ;
+		}
+
+		_Job* job    = new _Job() ;
+		job->id      = 0 ;
+		job->design  = design ;
+		job->fna     = fna ;
+		job->fnb     = fnb ;
+		job->output  = output ;
+		job->pfo     = pfo ;
+		job->batches = 0 ;
+		job->aligned = 0 ;
+		job->read    = false ;
+		job->pairs.store( 0 ) ;
+		job->cancel  = new Signal<bool>( false ) ;
+		job->written = new Signal<bool>( false ) ;
+
+		// the alignment shares the mapped index
+		Nimbus::seed::AmpliconIndex* ai = d->second->index() ;
+		job->scores = new AlignmentScore( match, mismatch, gapextend, maxamplicons, kernel, bandwidth, ungapped ) ;
+		job->aa     = new AmpliconAlignment( ai, job->scores, seedmargin, gapopen ) ;
+		job->cache  = NULL ;
+		if( cachesize > 0 ) {
+			job->cache = new AlignmentCache( cachesize ) ;
+			job->aa->setCache( job->cache ) ;
+		}
+
+		// the header, as written by align
+		SAMHeader header = d->second->header() ;
+		job->sorter = NULL ;
+		if( sorted ) {
+			job->sorter = new RecordSorter( ai->amplicons(), header.names(), (size_t) sortmemory << 20 ) ;
+			header.sorted( true ) ;
+		}
+		string text = header.str() ;
+		if( readgroup != "" ) text += "@RG\t" + readgroup + "\n" ;
+		text += "@PG\tID:nimbus\tPN:nimbus\tVN:beta\n@CO\t\n" ;
+		job->encoder = NULL ;
+		job->bgzf    = NULL ;
+		if( bam ) {
+			job->encoder = new BAMEncoder( text ) ;
+			job->bgzf    = new BGZFWriter( pfo, compressionthreads ) ;
+			string h ;
+			job->encoder->header( h ) ;
+			job->bgzf->write( h ) ;
+		} else {
+			(*pfo) << text ;
+		}
+
+		// the batches in the queues and those being processed
+		size_t capacity = 2 * ( LIMIT / _batchsize + 1 ) + _nworkers + 2 ;
+		job->rpool  = new BatchPool<ReadBatch>( capacity ) ;
+		job->opool  = new BatchPool<OutputBatch>( capacity ) ;
+		job->oqueue = new RingBuffer<OutputBatch*>( LIMIT / _batchsize + 1 ) ;
+
+		job->worker = new Worker( job->aa, job->cancel, NULL, job->oqueue ) ;
+		job->worker->setOutputFormat( job->encoder, ReadGroupID( readgroup ) ) ;
+		job->worker->setSorter( job->sorter ) ;
+		job->worker->setPools( job->rpool, job->opool ) ;
+
+		job->writer = new Writer( job->oqueue, job->cancel ) ;
+		job->writer->setOutput( 0, pfo, job->bgzf ) ;
+		job->writer->setSorter( 0, job->sorter ) ;
+		job->writer->setPool( job->opool ) ;
+		return job ;
+	}
+
+	void Server::_delete( _Job* job ) {
+
+		// the last worker may still hold the lock of the job
+		{
+			lock_guard<mutex> guard( job->m ) ;
+		}
+		delete job->writer->getCounter() ;
+		delete job->writer ;
+		delete job->worker ;
+		if( job->bgzf != NULL ) delete job->bgzf ;
+		if( job->encoder != NULL ) delete job->encoder ;
+		if( job->sorter != NULL ) delete job->sorter ;
+		if( job->pfo->is_open() ) job->pfo->close() ;
+		delete job->pfo ;
+		delete job->oqueue ;
+		delete job->rpool ;
+		delete job->opool ;
+		delete job->aa ;
+		delete job->scores ;
+		if( job->cache != NULL ) delete job->cache ;
+		delete job->cancel ;
+		delete job->written ;
+		delete job ;
+	}
+
+}
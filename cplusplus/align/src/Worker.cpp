@@ -7,29 +7,29 @@ namespace NimApp {
 	using namespace threadutils ;
 	using namespace Nimbus ;
 	using namespace Nimbus::basic ;
+	using namespace Nimbus::alignment ;
 
-	Worker::Worker( AmpliconAlignment* a, Signal<bool>* s, TQueue< pair<Read*, Read*> >* i, TQueue< AlignmentBuilder* >* o, unsigned int l )  {
-		_aa    = a ;
-		_stop  = s ;
-		_in    = i ;
-		_out   = o ;
-		_limit = l ;
+	Worker::Worker( AmpliconAlignment* a, Signal<bool>* s, WorkStealingQueue<ReadBatch*>* i, RingBuffer<OutputBatch*>* o ) {
+		_init( a, s, i, o ) ;
 	}
 
-	Worker::Worker( AmpliconAlignment* a, Signal<bool>* s, TQueue< pair<Read*, Read*> >* i, TQueue< AlignmentBuilder* >* o ) {
-		_aa    = a ;
-		_stop  = s ;
-		_in    = i ;
-		_out   = o ;
-		_limit = LIMIT ;
+	Worker::Worker( AmpliconAlignment* a, WorkStealingQueue<ReadBatch*>* i, RingBuffer<OutputBatch*>* o ) {
+		_init( a, new Signal<bool>( false ), i, o ) ;
 	}
 
-	Worker::Worker( AmpliconAlignment* a, TQueue< pair<Read*, Read*> >* i, TQueue< AlignmentBuilder* >* o ) {
+	void Worker::_init( AmpliconAlignment* a, Signal<bool>* s, WorkStealingQueue<ReadBatch*>* i, RingBuffer<OutputBatch*>* o ) {
 		_aa    = a ;
-		_stop  = new Signal<bool>( false ) ;
+		_stop  = s ;
 		_in    = i ;
 		_out   = o ;
-		_limit = LIMIT ;				
+		_id    = _in != NULL ? _in->addWorker() : 0 ;
+		_minsplit = max( (size_t) MINSPLIT, (size_t) BATCHSIZE / 8 ) ;
+		_rpool  = NULL ;
+		_opool  = NULL ;
+
+		// SAM records of a single sample
+		_formats = vector<_Format>() ;
+		_format( 0 ) ;
 	}
 
 	Worker::~Worker() {
@@ -39,52 +39,204 @@ namespace NimApp {
 		return _stop ;
 	}
 
+	void Worker::setOutputFormat( BAMEncoder* bam, string readgroup ) {
+		setOutputFormat( 0, bam, readgroup ) ;
+	}
+
+	void Worker::setOutputFormat( unsigned int sample, BAMEncoder* bam, string readgroup ) {
+		_Format& f  = _format( sample ) ;
+		f.bam       = bam ;
+		f.readgroup = readgroup ;
+	}
+
+	void Worker::setSorter( RecordSorter* sorter ) {
+		setSorter( 0, sorter ) ;
+	}
+
+	void Worker::setSorter( unsigned int sample, RecordSorter* sorter ) {
+		_format( sample ).sorter = sorter ;
+	}
+
+	Worker::_Format& Worker::_format( unsigned int sample ) {
+		while( _formats.size() <= sample ) {
+			_Format f ;
+			f.bam    = NULL ;
+			f.sorter = NULL ;
+			_formats.push_back( f ) ;
+		}
+		return _formats[ sample ] ;
+	}
+
+	void Worker::setPools( BatchPool<ReadBatch>* rpool, BatchPool<OutputBatch>* opool ) {
+		_rpool = rpool ;
+		_opool = opool ;
+	}
+
+	void Worker::setBatchSize( size_t batchsize ) {
+		_minsplit = max( (size_t) MINSPLIT, batchsize / 8 ) ;
+	}
+
 	/*
-	 	* process the alignments in a paired end manner
+	 	* aligns a batch of read pairs and formats their SAM records
 		*/ 
-	AlignmentBuilder* Worker::process( pair<Read*,Read*> p ) {				
-		AlignmentBuilder t = _aa->align( p ) ;
-		return new AlignmentBuilder( t ) ;
+	OutputBatch* Worker::process( ReadBatch* b, alignment::AlignmentWorkspace* ws ) {
+		// a reused batch keeps the memory of its records
+		OutputBatch* rval = _opool != NULL ? _opool->get() : new OutputBatch() ;
+		rval->records.clear() ;
+		rval->keys.clear() ;
+		rval->sample = b->sample ;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now() ;
+		for( size_t i=0; i<b->n; i++ ) {
+
+			// the cost of a read pair varies widely, so hand half of the
+			// rest of an expensive batch to the idle workers instead of 
+			// keeping them waiting; the clock is only read when they wait
+			if( _in != NULL && b->n - i >= _minsplit && _in->hungry() && chrono::steady_clock::now() - start >= chrono::milliseconds( SPLITTIME ) ) {
+				_split( b, i + ( b->n - i + 1 ) / 2 ) ;
+			}
+
+			AlignmentBuilder t = _aa->align( b->pairs[i], ws ) ;
+			serialize( t, *rval ) ;
+		}
+		rval->n = b->n ;
+		return rval ;
 	}
 
+	void Worker::_split( ReadBatch* b, size_t first ) {
+		// the reads are swapped, the new batch keeps its own reads for reuse
+		ReadBatch* s = _rpool != NULL ? _rpool->get() : new ReadBatch() ;
+		s->n      = 0 ;
+		s->sample = b->sample ;
+		for( size_t i=first; i<b->n; i++ ) {
+			if( s->n == s->pairs.size() ) s->pairs.push_back( pair<Read*,Read*>( NULL, NULL ) ) ;
+			swap( s->pairs[ s->n ], b->pairs[i] ) ;
+			s->n++ ;
+		}
+		b->n = first ;
+		_in->split( _id, s ) ;
+	}
+
+	/*
+	 	* appends the SAM records of value to batch, and cleans up the alignments
+		*/ 
+	void Worker::serialize( AlignmentBuilder& value, OutputBatch& batch ) {
+
+		// write all the generated SAM records
+		for( vector<AlnSet>::iterator it=value.entries.begin();  it!=value.entries.end(); ++it ) {
+			if( it->f_record != NULL ) _append( *(it->f_record), it->amplicon, batch ) ;
+			if( it->r_record != NULL ) _append( *(it->r_record), it->amplicon, batch ) ;
+		}
+		
+		// if we did not have any SAM entries, write 
+		// empty samrecords
+		if( ! value.samrecordspresent()  ) {
+
+			// create an empty samrecord
+			SAMRecord* f = NULL ;
+			SAMRecord* r = NULL ;
+
+			// 
+			if( value.forward != NULL ) {
+				f = new SAMRecord( *(value.forward) ) ;
+				f->setPaired() ;
+				f->setFirstSegmentInTemplate() ;
+			}				
+			if( value.reverse != NULL ) {
+				r = new SAMRecord( *(value.reverse) ) ;
+				r->setPaired() ;
+				r->setLastSegmentInTemplate() ;
+			}
+
+			// write and delete samrecords
+			if( f != NULL && r != NULL ) {
+				f->mate( *r ) ;
+				r->mate( *f ) ;
+				_append( *f, NULL, batch ) ;
+				_append( *r, NULL, batch ) ;
+			} else if( f != NULL ) {
+				_append( *f, NULL, batch ) ;
+			} else if( r != NULL ) {
+				_append( *r, NULL, batch ) ;
+			}
+			// cleanup 
+			if( f != NULL ) delete f ;
+			if( r != NULL ) delete r ;
+		}
+
+		// clean up the alignments and records
+		for(vector<AlnSet>::iterator it=value.entries.begin();  it!=value.entries.end(); ++it) {
+			it->delete_content() ;
+		}
+	}
+
+	void Worker::_append( const SAMRecord& record, const Amplicon* amplicon, OutputBatch& batch ) {
+		// the records are formatted for the sample of the batch
+		const _Format& f = _formats[ batch.sample < _formats.size() ? batch.sample : 0 ] ;
+		string& buffer   = batch.records ;
+		size_t start     = buffer.size() ;
+		if( f.bam != NULL ) {
+			f.bam->append( record, f.readgroup, buffer ) ;
+		} else {
+			record.append( buffer ) ;
+			if( ! f.readgroup.empty() ) {
+				buffer += "\tRG:Z:" ;
+				buffer += f.readgroup ;
+			}
+			buffer += '\n' ;
+		}
+
+		// the sorter needs to know where the record belongs
+		if( f.sorter != NULL ) {
+			RecordKey k ;
+			k.bucket = f.sorter->bucket( amplicon, record ) ;
+			k.pos    = record.pos() ;
+			k.length = (unsigned int) ( buffer.size() - start ) ;
+			k.flag   = (unsigned short) record.flag() ;
+			if( f.bam != NULL ) {
+				// the name follows the fixed fields, its length includes the NUL
+				k.nameoffset = 36 ;
+				k.namelength = (unsigned char) ( (unsigned char) buffer[start + 12] - 1 ) ;
+			} else {
+				size_t tab   = buffer.find( '\t', start ) ;
+				k.nameoffset = 0 ;
+				k.namelength = (unsigned char) min( (size_t) 255, ( tab == string::npos ? buffer.size() : tab ) - start ) ;
+			}
+			batch.keys.push_back( k ) ;
+		}
+	}
 
 	/*
 		* Runs the processing loop 
 		*/
 	void Worker::run() {
 
-		// keep running untill the stop signal
-		bool proceed = true ;
-		while( proceed ) {
+		// the alignment matrices of this thread are reused for each read pair
+		alignment::AlignmentWorkspace workspace ;
 
-			// check whether we should stop processing
-			if( _stop->get() ) break ;
-
-			// wait with processing while the output is full			
-			while( _out->size() > _limit ) {				
-#if __cplusplus >= 201103L				
-				this_thread::sleep_for( chrono::milliseconds(THREADSLEEPTIME) ) ;
-#elif _POSIX_VERSION >= 200112L
-				usleep( THREADSLEEPTIME * 1000 ) ;
-#endif
-				if( _stop->get() ) {
-					proceed = false ;
-					break ; 
-				}				
-			}			
-
-			// sleep if there is no input
-			//while( _in->empty() && ! _stop->get() ) {				
-				// this_thread::sleep_for( chrono::milliseconds(1) ) ;
-			//}
-
-			// get a new read from the stack
-			pair<Read*,Read*> p ;
-			bool ok = _in->shift( p ) ;
-			if( ok ) {
+		// keep running untill the input is closed and drained, or the stop signal
+		ReadBatch* batch = NULL ;
+		while( _in->shift( _id, batch ) ) {
 						
-				// add the result to the output queue
-				_out->push( process( p ) ) ;
+			// add the result to the output queue, waits while the output is full;
+			// the output is dropped if the queue was closed
+			OutputBatch* output = process( batch, &workspace ) ;
+			if( ! _out->push( output ) ) {
+				if( _opool != NULL ) {
+					_opool->put( output ) ;
+				} else {
+					delete output ;
+				}
+			}
+			if( _rpool != NULL ) {
+				_rpool->put( batch ) ;
+			} else {
+				delete batch ;
+			}
+
+			// check whether we should stop processing
+			if( _stop->get() ) {
+				_in->leave( _id ) ;
+				break ;
 			}
 		}
 	}
@@ -10,31 +10,40 @@ namespace NimApp {
 		using namespace Nimbus::alignment ;
 
 		Writer::Writer( ) {
-			_in     = NULL ;
-			_out    = NULL ;
-			_sigcnt = new Signal<long>( 0 ) ;
-			_stop   = new Signal<bool>( false ) ;		
+			_init( NULL, NULL, NULL, new Signal<long>( 0 ), new Signal<bool>( false ) ) ;
 		}
 
 		Writer::Writer( ostream* o ) {
-			_in     = NULL ;
-			_out    = o ;
-			_sigcnt = new Signal<long>( 0 ) ;
-			_stop   = new Signal<bool>( false ) ;
+			_init( o, NULL, NULL, new Signal<long>( 0 ), new Signal<bool>( false ) ) ;
 		}
 
-		Writer::Writer( ostream* o, TQueue<AlignmentBuilder*>* q, Signal<bool>* b ) {
-			_in     = q ;
-			_out    = o ;
-			_sigcnt = new Signal<long>( 0 ) ;
-			_stop   = b ;
+		Writer::Writer( ostream* o, RingBuffer<OutputBatch*>* q, Signal<bool>* b ) {
+			_init( o, NULL, q, new Signal<long>( 0 ), b ) ;
 		}
 
-		Writer::Writer( ostream* o, TQueue<AlignmentBuilder*>* q, Signal<long>* s, Signal<bool>* b ) {
+		Writer::Writer( ostream* o, RingBuffer<OutputBatch*>* q, Signal<long>* s, Signal<bool>* b ) {
+			_init( o, NULL, q, s, b ) ;
+		}
+
+		Writer::Writer( ostream* o, BGZFWriter* z, RingBuffer<OutputBatch*>* q, Signal<bool>* b ) {
+			_init( o, z, q, new Signal<long>( 0 ), b ) ;
+		}
+
+		Writer::Writer( RingBuffer<OutputBatch*>* q, Signal<bool>* b ) {
+			_init( NULL, NULL, q, new Signal<long>( 0 ), b ) ;
+			_outputs.clear() ;
+		}
+
+		void Writer::_init( ostream* o, BGZFWriter* z, RingBuffer<OutputBatch*>* q, Signal<long>* s, Signal<bool>* b ) {
 			_in     = q ;
-			_out    = o ;
+			_pool   = NULL ;
 			_sigcnt = s ;
 			_stop   = b ;
+
+			// a single output
+			_outputs = vector<_Output>() ;
+			_first   = 0 ;
+			setOutput( 0, o, z ) ;
 		}
 
 		Writer::~Writer() {			
@@ -49,112 +58,129 @@ namespace NimApp {
 			return _sigcnt ;
 		}
 
-		bool Writer::process( AlignmentBuilder* value ) { 
+		void Writer::setSorter( RecordSorter* sorter ) {
+			setSorter( 0, sorter ) ;
+		}
 
-			// if there is no opened output stream: stop the iteration
-			if( _out == NULL ) return false ;
+		void Writer::setSorter( unsigned int sample, RecordSorter* sorter ) {
+			_output( sample ).sorter = sorter ;
+		}
+
+		void Writer::setOutput( unsigned int sample, ostream* o, BGZFWriter* z ) {
+			_Output& x = _output( sample ) ;
+			x.out  = o ;
+			x.bgzf = z ;
+		}
+
+		void Writer::setTotal( unsigned int sample, Signal<long>* total ) {
+			_output( sample ).total = total ;
+		}
+
+		Writer::_Output& Writer::_output( unsigned int sample ) {
+			while( _outputs.size() <= sample ) {
+				_Output x ;
+				x.out     = NULL ;
+				x.bgzf    = NULL ;
+				x.sorter  = NULL ;
+				x.total   = NULL ;
+				x.written = 0 ;
+				x.good    = true ;
+				x.done    = false ;
+				_outputs.push_back( x ) ;
+			}
+			return _outputs[ sample ] ;
+		}
+
+		void Writer::setPool( BatchPool<OutputBatch>* pool ) {
+			_pool = pool ;
+		}
+
+		bool Writer::process( OutputBatch* value ) { 
 
 			// should never happen, but if it does don't kill writer
 			if( value == NULL ) return true ;
 
-			// write all the generated SAM records
-			for( vector<AlnSet>::iterator it=value->entries.begin();  it!=value->entries.end(); ++it ) {
-				if( it->f_record != NULL ) (*_out) << it->f_record->str() << endl ; 
-				if( it->r_record != NULL ) (*_out) << it->r_record->str() << endl ; 
+			// if there is no opened output stream: stop the iteration
+			if( value->sample >= _outputs.size() || _outputs[ value->sample ].out == NULL ) return false ;
+			_Output& o = _outputs[ value->sample ] ;
+
+			// the records were formatted by the workers, sorted 
+			// records are written when all have been added
+			if( o.sorter != NULL ) {
+				o.sorter->add( value ) ;
+				return true ;
 			}
-			
-			// if we did not have any SAM entries, write 
-			// empty samrecords
-			if( ! value->samrecordspresent()  ) {
-
-				// create an empty samrecord
-				SAMRecord* f = NULL ;
-				SAMRecord* r = NULL ;
-
-				// 
-				if( value->forward != NULL ) {
-					f = new SAMRecord( *(value->forward) ) ;
-					f->setPaired() ;
-					f->setFirstSegmentInTemplate() ;
-				}				
-				if( value->reverse != NULL ) {
-					r = new SAMRecord( *(value->reverse) ) ;
-					r->setPaired() ;
-					r->setLastSegmentInTemplate() ;
-				}
+			return _write( o, value->records ) ;
+		}
 
-				// write and delete samrecords
-				if( f != NULL && r != NULL ) {
-					f->mate( *r ) ;
-					r->mate( *f ) ;
-					(*_out) << f->str() << endl ; 
-					(*_out) << r->str() << endl ; 
-					
-				} else if( f != NULL ) {
-					(*_out) << f->str() << endl ; 					
-				} else if( r != NULL ) {
-					(*_out) << r->str() << endl ; 					
-				}
-				// cleanup 
-				if( f != NULL ) delete f ;
-				if( r != NULL ) delete r ;
+		bool Writer::_write( _Output& o, const string& records ) {
+			if( o.bgzf != NULL ) {
+				o.bgzf->write( records ) ;
+			} else {
+				o.out->write( records.data(), records.size() ) ;
 			}
 
+			// returns that we should proceed if the stream is still good
+			return o.out->good() ;
+		}
 
-			// clean up the reads			
-			if( value->forward != NULL ) delete value->forward ;
-			if( value->reverse != NULL ) delete value->reverse ;
+		void Writer::_complete( _Output& o ) {
 
-			// the alnsets will go out of scope in the run 
-			// function and will be cleaned automatically
-			for(vector<AlnSet>::iterator it=value->entries.begin();  it!=value->entries.end(); ++it) {
-				it->delete_content() ;
+			// write the sorted records
+			if( o.sorter != NULL ) {
+				string records ;
+				while( o.good && o.out != NULL && o.sorter->next( records ) ) {
+					o.good = _write( o, records ) ;
+				}
 			}
-			delete value ;
 
-			// returns that we should proceed if we made it this far
-			return true ;		
+			// write the last block and the end of file marker
+			if( o.bgzf != NULL ) {
+				o.bgzf->close() ;
+			} else if( o.out != NULL ) {
+				o.out->flush() ;
+			}
+			o.done = true ;
 		}
 
 		// run the processor
 		void Writer::run( ) {
 
-			// check if we should be active
-			bool proceed = true ;
-
-			if( _in == NULL ) proceed = false ;
-
-			// while we need to be active
-			while( proceed ) {
-		
-				// wait for input 
-#if __cplusplus >= 201103L
-				while( _in->empty() ) {
-					this_thread::sleep_for( chrono::milliseconds(1) ) ;
-					if( _stop->get() ) {
-						proceed = false ;
-						break ; 
-					}
-				}
-#endif
-				// get a new value from the queue
-				AlignmentBuilder* value = NULL ;
-				bool ok = _in->shift( value ) ;
-				if( ok ) {
-
-					// process the value
-					proceed = process( value ) ; 
+			// write the values untill the queue is closed and drained;
+			// after a failure the values of the sample are still taken 
+			// from the queue so the workers are never blocked
+			OutputBatch* batch = NULL ;
+			while( _in != NULL && _in->shift( batch ) ) {
+
+				// write the records
+				_Output& o = _output( batch->sample ) ;
+				if( o.good && ! o.done ) o.good = process( batch ) ; 
+				o.written += batch->n ;
 					
-					// update the counter signal
-					long c = _sigcnt->get() ;
-					c += 1 ;
-					_sigcnt->set( c ) ;
+				// update the counter signal
+				long c = _sigcnt->get() ;
+				c += batch->n ;
+				_sigcnt->set( c ) ;
+				if( _pool != NULL ) {
+					_pool->put( batch ) ;
+				} else {
+					delete batch ;
 				}
 
-				// stop if the we get the signal
-				if( _stop->get() ) proceed = false ;
+				// complete the samples of which all read pairs have been written,
+				// the total of a sample can be set after its last batch was written
+				for( size_t i=_first; i<_outputs.size(); i++ ) {
+					_Output& x = _outputs[i] ;
+					if( ! x.done && x.total != NULL && x.total->get() == x.written ) _complete( x ) ;
+					if( x.done && i == _first ) _first++ ;
+				}
 				
 			} // end of while loop
+
+			// complete the other outputs
+			for( size_t i=_first; i<_outputs.size(); i++ ) {
+				if( ! _outputs[i].done ) _complete( _outputs[i] ) ;
+			}
 		}
 
 
@@ -20,6 +20,9 @@ void main_usage( string message, bool terminate ) {
 	printf( "Functions:\n" ) ;
 	printf( "  trim\ttrims adapter sequences from the reads in a FastQ file\n" ) ;
 	printf( "  align\taligns the provided reads to the amplicons\n" ) ;
+	printf( "  index\twrites the amplicon index of a design for align --index\n" ) ;
+	printf( "  serve\taligns the jobs submitted on a local socket\n" ) ;
+	printf( "  submit\tsubmits a job to the alignment server and waits for it\n" ) ;
 //	printf( "  count\tcounts the aligned reads per amplicon\n" ) ;
 	printf( "\n" ) ;
 
@@ -43,6 +46,9 @@ int main(int argc, char* argv[]) {
 	vector<string> func = vector<string>() ;
 	func.push_back( "trim" ) ;
 	func.push_back( "align" ) ;
+	func.push_back( "index" ) ;
+	func.push_back( "serve" ) ;
+	func.push_back( "submit" ) ;
 	// func.push_back( "count" ) ;
 	int fnum = -1 ;
 	for( unsigned int i=0; i<func.size(); i++ ) {
@@ -58,6 +64,12 @@ int main(int argc, char* argv[]) {
 		preprocess_main( argc, argv ) ;
 	} else if( fnum == 1 )  {
 		nimbus_main( argc, argv ) ;
+	} else if( fnum == 2 )  {
+		index_main( argc, argv ) ;
+	} else if( fnum == 3 )  {
+		serve_main( argc, argv ) ;
+	} else if( fnum == 4 )  {
+		submit_main( argc, argv ) ;
 	} else {
 		main_usage( "function out of bounds", true ) ;
 	}
@@ -9,12 +9,15 @@
 
 //
 #include "AmpliconIndex.h"
+#include "IndexFile.h"
 #include "io.h"
 #include "SAMrecord.h"
 #include "Amplicon.h" 
 #include "Alignment.h"
 #include "AmpliconAlignment.h"
 #include "Manager.h"
+#include "AllocationCounter.h"
+#include <set>
 
 //
 using namespace std ;
@@ -26,30 +29,119 @@ using namespace Nimbus::IO ;
 using namespace NimApp ;
 
 /**
- * The alignment procedure
- *
+ * The ID field of a read group header line
  **/
-void NimbusAlignment( 
-	string fastq_f, 
-	string fastq_r, 
-	string design, 
-	string fasta, 
-	string samfile,
-	int maxamplicons,
-	int keysize, int match, int mismatch, int gapextend, int gapopen, int seedmargin, int threads ) {
-	
-	cerr << "[Main] Loading index" << endl ;
-	
+string ReadGroupID( string readgroup ) {
+	string rval = "" ;
+	size_t start = 0 ;
+	while( start <= readgroup.size() ) {
+		size_t end = readgroup.find( '\t', start ) ;
+		if( end == string::npos ) end = readgroup.size() ;
+		if( readgroup.compare( start, 3, "ID:" ) == 0 ) {
+			rval = readgroup.substr( start + 3, end - start - 3 ) ;
+			break ;
+		}
+		start = end + 1 ;
+	}
+	return rval ;
+}
+
+/**
+ * The read group header line with escaped tabs, as given on the command 
+ * line, without @RG
+ **/
+string ReadGroupLine( string readgroup ) {
+	if( readgroup.compare( 0, 4, "@RG\t" ) == 0 ) readgroup = readgroup.substr( 4 ) ;
+	for( size_t p=readgroup.find( "\\t" ); p!=string::npos; p=readgroup.find( "\\t", p ) ) {
+		readgroup.replace( p, 2, "\t" ) ;
+	}
+	return readgroup ;
+}
+
+/**
+ * A sample to align: its FastQ files, output file and read group
+ **/
+struct AlignmentSample {
+	string name ;
+	string forward ;
+	string reverse ;
+	string output ;
+	string readgroup ;
+} ;
+
+/**
+ * Reads the samples of a sample sheet, with a line per sample holding the
+ * tab separated name, forward and reverse FastQ files and output file of
+ * the sample. The read group fields may follow in the next columns, by 
+ * default the read group is ID:name SM:name. Empty lines and lines 
+ * starting with # are skipped. Returns an error message, or an empty 
+ * string if the sheet is valid
+ **/
+string SampleSheetReader( vector<AlignmentSample>& samples, string fname ) {
+	ifstream in( fname.c_str() ) ;
+	if( ! in ) return "Sample sheet " + fname + " could not be read" ;
+
+	set<string> outputs = set<string>() ;
+	string line ;
+	int lineno = 0 ;
+	while( getline( in, line ) ) {
+		lineno++ ;
+		if( ! line.empty() && line[ line.size() - 1 ] == '\r' ) line.erase( line.size() - 1 ) ;
+		if( line.empty() || line[0] == '#' ) continue ;
+
+		vector<string> fields = vector<string>() ;
+		size_t start = 0 ;
+		while( start <= line.size() ) {
+			size_t end = line.find( '\t', start ) ;
+			if( end == string::npos ) end = line.size() ;
+			fields.push_back( line.substr( start, end - start ) ) ;
+			start = end + 1 ;
+		}
+
+		stringstream where ;
+		where << fname << " line " << lineno ;
+		if( fields.size() < 4 || fields[0] == "" || fields[1] == "" || fields[2] == "" || fields[3] == "" ) 
+			return "Sample sheet " + where.str() + " should have a name, forward and reverse FastQ file and output file" ;
+
+		AlignmentSample x ;
+		x.name    = fields[0] ;
+		x.forward = fields[1] ;
+		x.reverse = fields[2] ;
+		x.output  = fields[3] ;
+		x.readgroup = "ID:" + x.name + "\tSM:" + x.name ;
+		if( fields.size() > 4 ) {
+			x.readgroup = fields[4] ;
+			for( size_t i=5; i<fields.size(); i++ ) x.readgroup += "\t" + fields[i] ;
+			x.readgroup = ReadGroupLine( x.readgroup ) ;
+			if( ReadGroupID( x.readgroup ) == "" ) 
+				return "The read group of sample sheet " + where.str() + " has no ID field" ;
+		}
+
+		if( ! commandline::FileExists( x.forward ) ) 
+			return "Forward FastQ file " + x.forward + " of sample " + x.name + " not found" ;
+		if( ! commandline::FileExists( x.reverse ) ) 
+			return "Reverse FastQ file " + x.reverse + " of sample " + x.name + " not found" ;
+		if( ! outputs.insert( x.output ).second ) 
+			return "Output file " + x.output + " of sample " + x.name + " is used by another sample" ;
+		samples.push_back( x ) ;
+	}
+	if( samples.empty() ) return "Sample sheet " + fname + " has no samples" ;
+	return "" ;
+}
+
+/**
+ * Builds the index of the distinct amplicons in the design; amplicons
+ * receives all the amplicons read, which are owned by the caller
+ **/
+AmpliconIndex* BuildIndex( vector<Amplicon*>& amplicons, SAMHeader& header, string design, string fasta, int keysize ) {
+
 	// load the amplicons and the samheader
-	SAMHeader header ;
-	vector<Amplicon*> amplicons ;
 	AmpliconReader( amplicons, header, design, fasta ) ;
 
 	// make sure to remove duplicate amplicons
-	sort( amplicons.begin(), amplicons.end(), cmp_lt_amplicon_p ) ;
-	vector<Amplicon*> amp_toadd = vector<Amplicon*>( amplicons.size() );
-	vector<Amplicon*>::iterator it = unique_copy( amplicons.begin(), amplicons.end(), amp_toadd.begin(), cmp_eq_amplicon_p ) ;
-	amp_toadd.resize( distance( amp_toadd.begin(), it ) );
+	vector<Amplicon*> amp_toadd = amplicons ;
+	sort( amp_toadd.begin(), amp_toadd.end(), cmp_lt_amplicon_p ) ;
+	amp_toadd.erase( unique( amp_toadd.begin(), amp_toadd.end(), cmp_eq_amplicon_p ), amp_toadd.end() ) ;
 
 	// create an amplicon index
 	AmpliconIndex* ai = new AmpliconIndex() ;
@@ -57,23 +149,74 @@ void NimbusAlignment(
 		ai->add( *it ) ; 				
 	}
 	ai->build( keysize ) ;
+	return ai ;
+}
+
+/**
+ * The alignment procedure; the amplicons are read from the index file 
+ * if provided, otherwise from the design and fasta. The samples share
+ * the index and the workers.
+ *
+ **/
+void NimbusAlignment( 
+	const vector<AlignmentSample>& samples,
+	string design, 
+	string fasta, 
+	string index,
+	int maxamplicons,
+	int keysize, int match, int mismatch, int gapextend, int gapopen, int seedmargin, int threads,
+	kernel_t kernel, int bandwidth, int ungapped, int batchsize,
+	bool bam, int compressionthreads,
+	bool sorted, int sortmemory, int cachesize ) {
+	
+	cerr << "[Main] Loading index" << endl ;
+	
+	// map a prebuilt index, or load the amplicons and the samheader and build it
+	SAMHeader header ;
+	vector<Amplicon*> amplicons ;
+	IndexFile* file   = NULL ;
+	AmpliconIndex* ai = NULL ;
+	if( index != "" ) {
+		file   = new IndexFile( index ) ;
+		ai     = file->index() ;
+		header = file->header() ;
+		cerr << "[Main] Mapped the index with key size " << file->keysize() << endl ;
+	} else {
+		ai = BuildIndex( amplicons, header, design, fasta, keysize ) ;
+	}
 
 	cerr << "[Main] Loaded " << ai->dbsize() << " bases in " << ai->n_amplicons() << " amplicons" << endl ;
 	cerr << "[Main] Preparing alignment" << endl ;
 
 	// create a new score calculator
-	AlignmentScore* scores = new AlignmentScore( match, mismatch, gapextend, maxamplicons ) ;
+	AlignmentScore* scores = new AlignmentScore( match, mismatch, gapextend, maxamplicons, kernel, bandwidth, ungapped ) ;
 	AmpliconAlignment* aa  = new AmpliconAlignment( ai, scores, seedmargin, gapopen ) ;
 
+	// read pairs with the same sequences are only aligned once
+	AlignmentCache* cache = NULL ;
+	if( cachesize > 0 ) {
+		cache = new AlignmentCache( cachesize ) ;
+		aa->setCache( cache ) ;
+	}
+
 	// create the thread manager
-	Manager mng = Manager() ;
-
-	// open the input and output
-	mng.addForwardInput( fastq_f ) ;
-	mng.addReverseInput( fastq_r ) ;
-	mng.addOutput( samfile ) ;
-	mng.writeToOutput( header.str() ) ;
-	mng.writeToOutput( "@PG\tID:nimbus\tPN:nimbus\tVN:beta\n@CO\t\n" ) ;
+	Manager mng = Manager( batchsize ) ;
+
+	// open the input and output of each sample
+	if( sorted ) header.sorted( true ) ;
+	for( vector<AlignmentSample>::const_iterator it=samples.begin(); it!=samples.end(); ++it ) {
+		if( it != samples.begin() ) mng.addSample() ;
+		mng.addForwardInput( it->forward ) ;
+		mng.addReverseInput( it->reverse ) ;
+		mng.addOutput( it->output, bam, compressionthreads ) ;
+		if( sorted ) mng.sortOutput( ai->amplicons(), header.names(), (size_t) sortmemory << 20 ) ;
+		mng.writeToOutput( header.str() ) ;
+		if( it->readgroup != "" ) {
+			mng.writeToOutput( "@RG\t" + it->readgroup + "\n" ) ;
+			mng.setReadGroup( ReadGroupID( it->readgroup ) ) ;
+		}
+		mng.writeToOutput( "@PG\tID:nimbus\tPN:nimbus\tVN:beta\n@CO\t\n" ) ;
+	}
 	mng.finalizeStreams() ;
 
 	// initialize the workers
@@ -81,13 +224,32 @@ void NimbusAlignment(
 	cerr << "[Main] Performing alignment" << endl ;
 	
 	// run the tool
+	size_t allocations = AllocationCounter::allocations() ;
+	size_t bytes       = AllocationCounter::bytes() ;
 	mng.run() ;
 	cerr << "[Main] Finished alignment" << endl ;
-
-	// cleanup
-	delete ai ;
+	if( AllocationCounter::enabled() ) {
+		cerr << "[Main] Allocations during alignment: " << AllocationCounter::allocations() - allocations ;
+		cerr << " (" << ( AllocationCounter::bytes() - bytes ) << " bytes)" << endl ;
+	}
+	if( cache != NULL ) {
+		cerr << "[Main] Alignment cache: " << cache->hits() << " of " << cache->lookups() << " read pairs found" ;
+		if( cache->lookups() > 0 ) cerr << " (" << ( 100.0 * cache->hits() ) / cache->lookups() << "%)" ;
+		cerr << endl ;
+	}
+	cerr << "[Main] Ungapped alignment: " << aa->ungapped() << " of " << aa->aligned() << " reads aligned without Smith-Waterman" ;
+	if( aa->aligned() > 0 ) cerr << " (" << ( 100.0 * aa->ungapped() ) / aa->aligned() << "%)" ;
+	cerr << endl ;
+
+	// cleanup, the index file owns its index and amplicons
+	if( file != NULL ) {
+		delete file ;
+	} else {
+		delete ai ;
+	}
 	delete aa ;
 	delete scores ;
+	if( cache != NULL ) delete cache ;
 	for( vector<Amplicon*>::iterator it=amplicons.begin(); it!=amplicons.end(); ++it ) delete *it ;	
 } ;
 
@@ -99,11 +261,13 @@ int nimbus_main( int argc, char* argv[] ) {
 	OptParser* op = new OptParser( "nimbus align" ) ;
 
 	// add the required options
-	op->add( '1', "forward", true, true, "the forward read from the sequencing" ) ;
-	op->add( '2', "reverse", true, true, "the reverse read from the sequencing" ) ;
-	op->add( 'd', "design", true, true, "the BED file with the design" ) ;
-	op->add( 'f', "fasta", true, true, "the FastA file with the genome sequence" ) ;
-	op->add( 'o', "sam", true, true, "the SAM output file" ) ;
+	op->add( '1', "forward", false, true, "the forward read from the sequencing, may be gzip or BGZF compressed; required without --samples" ) ;
+	op->add( '2', "reverse", false, true, "the reverse read from the sequencing, may be gzip or BGZF compressed; required without --samples" ) ;
+	op->add( 'd', "design", false, true, "the BED file with the design, required without --index" ) ;
+	op->add( 'f', "fasta", false, true, "the FastA file with the genome sequence, required without --index" ) ;
+	op->add( 'o', "sam", false, true, "the SAM output file, required without --samples" ) ;
+	op->add( 'i', "index", false, true, "the index file written by nimbus index, used instead of --design and --fasta" ) ;
+	op->add( 'l', "samples", false, true, "a sample sheet to align several samples with the same index and workers, instead of --forward, --reverse and --sam; each line holds the tab separated sample name, forward and reverse FastQ file and output file, optionally followed by the read group fields (default: ID:name\\tSM:name)" ) ;
 
 	// add the optionals 
 	op->add( 'x', "maximum-amplicons", false, true, "reads that generate more than this number of candidate amplicons are not considered in the alignment (default: 6000)" ) ;
@@ -114,6 +278,16 @@ int nimbus_main( int argc, char* argv[] ) {
 	op->add( 'g', "gap-open", false, true, "the gap open score (default: -1)" ) ;
 	op->add( 's', "seed-margin", false, true, "the seed margin (default: 5)" ) ;
 	op->add( 'w', "workers", false, true, "the number of workers (default: 5)" ) ;
+	op->add( 'a', "aligner-kernel", false, true, "the Smith-Waterman kernel: auto, scalar, sse41 or avx2 (default: auto)" ) ;
+	op->add( 'b', "band-width", false, true, "only align within this distance of the seed diagonal, 0 aligns to the full amplicon (default: 0)" ) ;
+	op->add( 'u', "ungapped-mismatches", false, true, "align reads with at most this number of mismatches on their seed diagonal without gaps, when the gap scores rule out a better gapped alignment; -1 always uses Smith-Waterman (default: 2)" ) ;
+	op->add( 'c', "batch-size", false, true, "the number of read pairs passed between the threads at once (default: 1024)" ) ;
+	op->add( 'z', "bam", false, false, "write the output file in the BAM format" ) ;
+	op->add( 't', "compression-threads", false, true, "the number of threads compressing the BAM output (default: 2)" ) ;
+	op->add( 'S', "sorted", false, false, "write the records sorted by coordinate" ) ;
+	op->add( 'M', "sort-memory", false, true, "the megabytes of records kept in memory by --sorted before using temporary files (default: 768)" ) ;
+	op->add( 'C', "cache-size", false, true, "the number of distinct read pairs of which the alignment is kept for read pairs with the same sequences, 0 disables the cache (default: 100000)" ) ;
+	op->add( 'r', "read-group", false, true, "the read group header line without @RG, with the fields separated by \\t, e.g. ID:sample\\tSM:sample; the ID is added to each record as RG tag" ) ;
 
 	// parse the provided options
 	op->interpret( argc, argv ) ;
@@ -133,21 +307,48 @@ int nimbus_main( int argc, char* argv[] ) {
 	}
 
 	// check file presence
-	if( ! FileExists(op->getValue( "forward")) ) 
-		op->usageInformation( "Forward FastQ file " +  op->getValue( "forward") + " not found", true ) ;
-	
-	if( ! FileExists(op->getValue( "reverse")) ) 
-		op->usageInformation( "Reverse FastQ file " +  op->getValue( "reverse") + " not found", true ) ;
+	vector<AlignmentSample> samples = vector<AlignmentSample>() ;
+	if( op->getValue( "samples" ) != "" ) {
+		if( op->getValue( "forward" ) != "" || op->getValue( "reverse" ) != "" || op->getValue( "sam" ) != "" ) 
+			op->usageInformation( "The FastQ and output files are part of the sample sheet", true ) ;
+
+		if( op->getValue( "read-group" ) != "" ) 
+			op->usageInformation( "The read groups are part of the sample sheet", true ) ;
+
+		string error = SampleSheetReader( samples, op->getValue( "samples" ) ) ;
+		if( error != "" ) 
+			op->usageInformation( error, true ) ;
+	} else {
+		if( op->getValue( "forward" ) == "" || op->getValue( "reverse" ) == "" ) 
+			op->usageInformation( "FastQ files not provided", true ) ;
+
+		if( ! FileExists(op->getValue( "forward")) ) 
+			op->usageInformation( "Forward FastQ file " +  op->getValue( "forward") + " not found", true ) ;
+		
+		if( ! FileExists(op->getValue( "reverse")) ) 
+			op->usageInformation( "Reverse FastQ file " +  op->getValue( "reverse") + " not found", true ) ;
+
+		if( op->getValue("sam") == "" ) 
+			op->usageInformation( "SAM output file not provided", true ) ;
+	}
 
-	if( ! FileExists(op->getValue( "design")) ) 
-		op->usageInformation( "Design file " +  op->getValue( "design") + " not found", true ) ;
+	if( op->getValue( "index" ) != "" ) {
+		if( ! FileExists(op->getValue( "index")) ) 
+			op->usageInformation( "Index file " +  op->getValue( "index") + " not found", true ) ;
 
-	if( ! FileExists(op->getValue( "fasta")) ) 
-		op->usageInformation( "FastA file " +  op->getValue( "fasta") + " not found", true ) ;
+		if( op->getValue( "design" ) != "" || op->getValue( "fasta" ) != "" ) 
+			op->usageInformation( "The design and fasta are part of the index", true ) ;
+
+		if( op->getValue( "key-size" ) != "" ) 
+			op->usageInformation( "The key size is set by the index", true ) ;
+	} else {
+		if( ! FileExists(op->getValue( "design")) ) 
+			op->usageInformation( "Design file " +  op->getValue( "design") + " not found", true ) ;
+
+		if( ! FileExists(op->getValue( "fasta")) ) 
+			op->usageInformation( "FastA file " +  op->getValue( "fasta") + " not found", true ) ;
+	}
 
-	if( op->getValue("sam") == "" ) 
-		op->usageInformation( "SAM output file not provided", true ) ;
-	
 
 	// set the optional paramters
 	int keysize   = 7 ;
@@ -158,6 +359,16 @@ int nimbus_main( int argc, char* argv[] ) {
 	int seedmargin = 5 ;
 	int threads   = 5 ;
 	int maxamplicons = 6000 ;
+	kernel_t kernel  = k_AUTO ;
+	int bandwidth    = 0 ;
+	int ungapped     = 2 ;
+	int batchsize    = BATCHSIZE ;
+	bool bam         = false ;
+	int compressionthreads = 2 ;
+	string readgroup = "" ;
+	bool sorted      = false ;
+	int sortmemory   = 768 ;
+	int cachesize    = 100000 ;
 
 	// set the optional data
 	if( op->getValue("maximum-amplicons") != "" )
@@ -184,14 +395,81 @@ int nimbus_main( int argc, char* argv[] ) {
 	if( op->getValue("workers") != "" )
 		threads = atoi( op->getValue("workers").c_str() )  ;
 
+	if( threads < 1 )
+		op->usageInformation( "The number of workers should be at least 1", true ) ;
+
+	if( op->getValue("aligner-kernel") != "" && ! kernelFromString( op->getValue("aligner-kernel"), kernel ) )
+		op->usageInformation( "Aligner kernel " + op->getValue("aligner-kernel") + " not recognized", true ) ;
+
+	if( op->getValue("band-width") != "" )
+		bandwidth = atoi( op->getValue("band-width").c_str() )  ;
+
+	if( bandwidth < 0 ) 
+		op->usageInformation( "The band width should not be negative", true ) ;
+
+	if( op->getValue("ungapped-mismatches") != "" )
+		ungapped = atoi( op->getValue("ungapped-mismatches").c_str() )  ;
+
+	if( ungapped < -1 ) 
+		op->usageInformation( "The number of ungapped mismatches should be -1 or more", true ) ;
+
+	if( op->getValue("batch-size") != "" )
+		batchsize = atoi( op->getValue("batch-size").c_str() )  ;
+
+	if( batchsize < 1 ) 
+		op->usageInformation( "The batch size should be at least 1", true ) ;
+
+	if( op->getValue("bam") != "" )
+		bam = true ;
+
+	if( op->getValue("compression-threads") != "" )
+		compressionthreads = atoi( op->getValue("compression-threads").c_str() )  ;
+
+	if( compressionthreads < 0 ) 
+		op->usageInformation( "The number of compression threads should not be negative", true ) ;
+
+	if( op->getValue("sorted") != "" )
+		sorted = true ;
+
+	if( op->getValue("sort-memory") != "" )
+		sortmemory = atoi( op->getValue("sort-memory").c_str() )  ;
+
+	if( sortmemory < 0 ) 
+		op->usageInformation( "The sort memory should not be negative", true ) ;
+
+	if( op->getValue("cache-size") != "" )
+		cachesize = atoi( op->getValue("cache-size").c_str() )  ;
+
+	if( cachesize < 0 ) 
+		op->usageInformation( "The cache size should not be negative", true ) ;
+
+	if( op->getValue("read-group") != "" ) {
+		// accept the escaped tabs of the command line
+		readgroup = ReadGroupLine( op->getValue("read-group") ) ;
+		if( ReadGroupID( readgroup ) == "" ) 
+			op->usageInformation( "The read group " + readgroup + " has no ID field", true ) ;
+	}
+
+	if( ! kernelSupported( kernel ) )
+		cerr << "[Align] aligner kernel " << kernelName( kernel ) << " is not supported by this CPU" << endl ;
+	kernel = resolveKernel( kernel ) ;
+
 	// report the options
 	cerr << "[Align] calling alignment with the following options:" << endl ;
-	cerr << "[Align] -1 " << op->getValue( "forward") << endl ;
-	cerr << "[Align] -2 " << op->getValue( "reverse" ) << endl ;
-	cerr << "[Align] --design " << op->getValue( "design" ) << endl ; 
-	cerr << "[Align] --fasta " << op->getValue( "fasta" ) << endl ; 
-	cerr << "[Align] --sam " << op->getValue( "sam" ) << endl ;
-	cerr << "[Align] --key-size " << keysize << endl ;
+	if( op->getValue( "samples" ) != "" ) {
+		cerr << "[Align] --samples " << op->getValue( "samples" ) << " (" << samples.size() << " samples)" << endl ;
+	} else {
+		cerr << "[Align] -1 " << op->getValue( "forward") << endl ;
+		cerr << "[Align] -2 " << op->getValue( "reverse" ) << endl ;
+	}
+	if( op->getValue( "index" ) != "" ) {
+		cerr << "[Align] --index " << op->getValue( "index" ) << endl ; 
+	} else {
+		cerr << "[Align] --design " << op->getValue( "design" ) << endl ; 
+		cerr << "[Align] --fasta " << op->getValue( "fasta" ) << endl ; 
+		cerr << "[Align] --key-size " << keysize << endl ;
+	}
+	if( op->getValue( "samples" ) == "" ) cerr << "[Align] --sam " << op->getValue( "sam" ) << endl ;
 	cerr << "[Align] --match " << match << endl ; 
 	cerr << "[Align] --mismatch " << mismatch << endl ; 
 	cerr << "[Align] --gap-extend " << gapextend << endl ; 
@@ -199,19 +477,111 @@ int nimbus_main( int argc, char* argv[] ) {
 	cerr << "[Align] --seed-margin " << seedmargin << endl ; 
 	cerr << "[Align] --workers " << threads << endl ;
 	cerr << "[Align] --maximum-amplicons " << maxamplicons << endl ;
+	cerr << "[Align] --aligner-kernel " << kernelName( kernel ) << endl ;
+	cerr << "[Align] --band-width " << bandwidth << endl ;
+	cerr << "[Align] --ungapped-mismatches " << ungapped << endl ;
+	cerr << "[Align] --batch-size " << batchsize << endl ;
+	if( bam ) {
+		cerr << "[Align] --bam" << endl ;
+		cerr << "[Align] --compression-threads " << compressionthreads << endl ;
+	}
+	cerr << "[Align] --cache-size " << cachesize << endl ;
+	if( readgroup != "" ) cerr << "[Align] --read-group " << readgroup << endl ;
+	if( sorted ) {
+		cerr << "[Align] --sorted" << endl ;
+		cerr << "[Align] --sort-memory " << sortmemory << endl ;
+	}
 
 
+	// a single sample from the command line
+	if( samples.empty() ) {
+		AlignmentSample x ;
+		x.forward   = op->getValue( "forward" ) ;
+		x.reverse   = op->getValue( "reverse" ) ;
+		x.output    = op->getValue( "sam" ) ;
+		x.readgroup = readgroup ;
+		samples.push_back( x ) ;
+	}
+
 	// call the nimbus function
 	NimbusAlignment( 
-		op->getValue( "forward"), 
-		op->getValue( "reverse" ),
+		samples,
 		op->getValue( "design" ), 
 		op->getValue( "fasta" ), 
-		op->getValue( "sam" ),
-		maxamplicons, keysize, match, mismatch, gapextend, gapopen, seedmargin, threads ) ;
+		op->getValue( "index" ), 
+		maxamplicons, keysize, match, mismatch, gapextend, gapopen, seedmargin, threads,
+		kernel, bandwidth, ungapped, batchsize,
+		bam, compressionthreads,
+		sorted, sortmemory, cachesize ) ;
 
 	//
 	delete op ;
 
 	return 0 ;
 }
+
+int index_main( int argc, char* argv[] ) {
+
+	// define a new option parser
+	OptParser* op = new OptParser( "nimbus index" ) ;
+
+	// add the required options
+	op->add( 'd', "design", true, true, "the BED file with the design" ) ;
+	op->add( 'f', "fasta", true, true, "the FastA file with the genome sequence" ) ;
+	op->add( 'o', "index", true, true, "the index file to write" ) ;
+
+	// add the optionals 
+	op->add( 'k', "key-size", false, true, "the key size to use (default: 7)" ) ;
+
+	// parse the provided options
+	op->interpret( argc, argv ) ;
+
+	// check whether all required options are set
+	vector<string> miss = op->missingOptions() ;
+	if( miss.size() > 0 ) {
+		string mess = "Missing options:" ;
+		for( unsigned int i=0; i<miss.size(); ++i ) {
+			if( i > 0 ) 
+				mess += ", " ;
+			mess += miss[i] ;
+		}
+
+		// quit due to missing arguments
+		op->usageInformation( mess, true ) ;
+	}
+
+	// check file presence
+	if( ! FileExists(op->getValue( "design")) ) 
+		op->usageInformation( "Design file " +  op->getValue( "design") + " not found", true ) ;
+
+	if( ! FileExists(op->getValue( "fasta")) ) 
+		op->usageInformation( "FastA file " +  op->getValue( "fasta") + " not found", true ) ;
+
+	int keysize = 7 ;
+	if( op->getValue("key-size") != "" )
+		keysize = atoi( op->getValue("key-size").c_str() )  ;
+
+	if( keysize < 1 || keysize > KmerIndex<unsigned int>::MAXKEYSIZE ) 
+		op->usageInformation( "The key size should be between 1 and 32", true ) ;
+
+	// report the options
+	cerr << "[Index] building the index with the following options:" << endl ;
+	cerr << "[Index] --design " << op->getValue( "design" ) << endl ; 
+	cerr << "[Index] --fasta " << op->getValue( "fasta" ) << endl ; 
+	cerr << "[Index] --index " << op->getValue( "index" ) << endl ; 
+	cerr << "[Index] --key-size " << keysize << endl ;
+
+	// build and write the index
+	SAMHeader header ;
+	vector<Amplicon*> amplicons ;
+	AmpliconIndex* ai = BuildIndex( amplicons, header, op->getValue( "design" ), op->getValue( "fasta" ), keysize ) ;
+	IndexFile::write( op->getValue( "index" ), *ai, header ) ;
+	cerr << "[Index] Wrote " << ai->dbsize() << " bases in " << ai->n_amplicons() << " amplicons" << endl ;
+
+	// cleanup
+	delete ai ;
+	for( vector<Amplicon*>::iterator it=amplicons.begin(); it!=amplicons.end(); ++it ) delete *it ;	
+	delete op ;
+
+	return 0 ;
+}
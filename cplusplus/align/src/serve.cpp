@@ -0,0 +1,270 @@
+// serve.cpp : the alignment server and the client submitting its jobs
+
+//
+#include "nimbusheader.h"
+
+//
+#include "nimbus.h"
+#include "opt.h"
+#include "Server.h"
+
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//
+using namespace std ;
+using namespace NimApp ;
+using namespace commandline ;
+
+/**
+ * The options of a job, sent by submit as given on its command line
+ **/
+static const char* JOB_OPTIONS[] = {
+	"design", "read-group", "maximum-amplicons", "match", "mismatch", "gap-extend", "gap-open", "seed-margin",
+	"aligner-kernel", "band-width", "ungapped-mismatches", "bam", "compression-threads", "sorted", "sort-memory", "cache-size", NULL } ;
+
+/**
+ * The absolute path of fn, relative to the working directory
+ **/
+string AbsolutePath( string fn ) {
+	if( fn == "" || fn[0] == '/' ) return fn ;
+	char dir[4096] ;
+	if( getcwd( dir, sizeof( dir ) ) == NULL ) return fn ;
+	return string( dir ) + "/" + fn ;
+}
+
+int serve_main( int argc, char* argv[] ) {
+
+	// define a new option parser
+	OptParser* op = new OptParser( "nimbus serve" ) ;
+
+	// add the required options
+	op->add( 'U', "socket", true, true, "the path of the UNIX domain socket on which the jobs are submitted" ) ;
+	op->add( 'i', "index", true, true, "the comma separated index files written by nimbus index, as name=file or file; a job selects its design by name, which is by default the file name without .nix" ) ;
+
+	// add the optionals
+	op->add( 'w', "workers", false, true, "the number of workers shared by the jobs (default: 5)" ) ;
+	op->add( 'c', "batch-size", false, true, "the number of read pairs passed between the threads at once (default: 1024)" ) ;
+
+	// parse the provided options
+	op->interpret( argc, argv ) ;
+
+	// check whether all required options are set
+	vector<string> miss = op->missingOptions() ;
+	if( miss.size() > 0 ) {
+		string mess = "Missing options:" ;
+		for( unsigned int i=0; i<miss.size(); ++i ) {
+			if( i > 0 )
+				mess += ", " ;
+			mess += miss[i] ;
+		}
+
+		// quit due to missing arguments
+		op->usageInformation( mess, true ) ;
+	}
+
+	int threads   = 5 ;
+	int batchsize = BATCHSIZE ;
+	if( op->getValue("workers") != "" )
+		threads = atoi( op->getValue("workers").c_str() )  ;
+
+	if( threads < 1 )
+		op->usageInformation( "The number of workers should be at least 1", true ) ;
+
+	if( op->getValue("batch-size") != "" )
+		batchsize = atoi( op->getValue("batch-size").c_str() )  ;
+
+	if( batchsize < 1 )
+		op->usageInformation( "The batch size should be at least 1", true ) ;
+
+	// the designs, as name=file or file
+	vector< pair<string,string> > designs = vector< pair<string,string> >() ;
+	string indexes = op->getValue( "index" ) ;
+	size_t start = 0 ;
+	while( start <= indexes.size() ) {
+		size_t end = indexes.find( ',', start ) ;
+		if( end == string::npos ) end = indexes.size() ;
+		string entry = indexes.substr( start, end - start ) ;
+		start = end + 1 ;
+		if( entry == "" ) continue ;
+
+		string name  = "" ;
+		string fname = entry ;
+		size_t eq = entry.find( '=' ) ;
+		if( eq != string::npos ) {
+			name  = entry.substr( 0, eq ) ;
+			fname = entry.substr( eq + 1 ) ;
+		} else {
+			name = fname.substr( fname.rfind( '/' ) == string::npos ? 0 : fname.rfind( '/' ) + 1 ) ;
+			if( name.size() > 4 && name.compare( name.size() - 4, 4, ".nix" ) == 0 ) name.erase( name.size() - 4 ) ;
+		}
+		if( ! FileExists( fname ) )
+			op->usageInformation( "Index file " + fname + " not found", true ) ;
+		designs.push_back( pair<string,string>( name, fname ) ) ;
+	}
+	if( designs.empty() )
+		op->usageInformation( "No index files provided", true ) ;
+
+	// report the options
+	cerr << "[Serve] serving alignments with the following options:" << endl ;
+	cerr << "[Serve] --socket " << op->getValue( "socket" ) << endl ;
+	for( vector< pair<string,string> >::iterator it=designs.begin(); it!=designs.end(); ++it ) {
+		cerr << "[Serve] --index " << it->first << "=" << it->second << endl ;
+	}
+	cerr << "[Serve] --workers " << threads << endl ;
+	cerr << "[Serve] --batch-size " << batchsize << endl ;
+
+	// map the designs once and serve the jobs
+	Server* server = new Server( threads, batchsize ) ;
+	for( vector< pair<string,string> >::iterator it=designs.begin(); it!=designs.end(); ++it ) {
+		server->addDesign( it->first, it->second ) ;
+	}
+	server->run( op->getValue( "socket" ) ) ;
+
+	//
+	delete server ;
+	delete op ;
+
+	return 0 ;
+}
+
+int submit_main( int argc, char* argv[] ) {
+
+	// define a new option parser
+	OptParser* op = new OptParser( "nimbus submit" ) ;
+
+	// add the required options
+	op->add( 'U', "socket", true, true, "the socket of the alignment server started by nimbus serve; the server has mapped the index and runs the workers, so unlike align there are no --index, --fasta, --key-size, --workers, --batch-size and --samples options" ) ;
+	op->add( '1', "forward", false, true, "the forward read from the sequencing, may be gzip or BGZF compressed" ) ;
+	op->add( '2', "reverse", false, true, "the reverse read from the sequencing, may be gzip or BGZF compressed" ) ;
+	op->add( 'o', "sam", false, true, "the SAM output file" ) ;
+	op->add( 'd', "design", false, true, "unlike align not a BED file but the name of a design of the server, required if the server has several" ) ;
+
+	// the other requests, with options that align does not use
+	op->add( 'L', "status", false, false, "lists the running jobs of the server instead of submitting a job" ) ;
+	op->add( 'K', "cancel", false, true, "cancels the job with this id instead of submitting a job" ) ;
+
+	// add the optionals of align, with the same short options
+	op->add( 'x', "maximum-amplicons", false, true, "reads that generate more than this number of candidate amplicons are not considered in the alignment (default: 6000)" ) ;
+	op->add( 'm', "match", false, true, "the match score (default: 2)" ) ;
+	op->add( 'n', "mismatch", false, true, "the mismatch score (default: -1)" ) ;
+	op->add( 'e', "gap-extend", false, true, "the gap extend score (default: -1)" ) ;
+	op->add( 'g', "gap-open", false, true, "the gap open score (default: -1)" ) ;
+	op->add( 's', "seed-margin", false, true, "the seed margin (default: 5)" ) ;
+	op->add( 'a', "aligner-kernel", false, true, "the Smith-Waterman kernel: auto, scalar, sse41 or avx2 (default: auto)" ) ;
+	op->add( 'b', "band-width", false, true, "only align within this distance of the seed diagonal, 0 aligns to the full amplicon (default: 0)" ) ;
+	op->add( 'u', "ungapped-mismatches", false, true, "align reads with at most this number of mismatches on their seed diagonal without gaps, -1 always uses Smith-Waterman (default: 2)" ) ;
+	op->add( 'z', "bam", false, false, "write the output file in the BAM format" ) ;
+	op->add( 't', "compression-threads", false, true, "the number of threads compressing the BAM output (default: 2)" ) ;
+	op->add( 'S', "sorted", false, false, "write the records sorted by coordinate" ) ;
+	op->add( 'M', "sort-memory", false, true, "the megabytes of records kept in memory by --sorted before using temporary files (default: 768)" ) ;
+	op->add( 'C', "cache-size", false, true, "the number of distinct read pairs of which the alignment is kept, 0 disables the cache (default: 100000)" ) ;
+	op->add( 'r', "read-group", false, true, "the read group header line without @RG, with the fields separated by \\t, e.g. ID:sample\\tSM:sample" ) ;
+
+	// parse the provided options
+	op->interpret( argc, argv ) ;
+
+	// check whether all required options are set
+	vector<string> miss = op->missingOptions() ;
+	if( miss.size() > 0 ) {
+		string mess = "Missing options:" ;
+		for( unsigned int i=0; i<miss.size(); ++i ) {
+			if( i > 0 )
+				mess += ", " ;
+			mess += miss[i] ;
+		}
+
+		// quit due to missing arguments
+		op->usageInformation( mess, true ) ;
+	}
+
+	// the request: the status, a cancellation or a job
+	string request = "" ;
+	if( op->getValue( "status" ) != "" ) {
+		request = "status\n" ;
+	} else if( op->getValue( "cancel" ) != "" ) {
+		request = "cancel\t" + op->getValue( "cancel" ) + "\n" ;
+	} else {
+		if( op->getValue( "forward" ) == "" || op->getValue( "reverse" ) == "" || op->getValue( "sam" ) == "" )
+			op->usageInformation( "The FastQ files and SAM output file are required for a job", true ) ;
+
+		// the server has another working directory
+		request  = "align\n" ;
+		request += "forward\t" + AbsolutePath( op->getValue( "forward" ) ) + "\n" ;
+		request += "reverse\t" + AbsolutePath( op->getValue( "reverse" ) ) + "\n" ;
+		request += "sam\t" + AbsolutePath( op->getValue( "sam" ) ) + "\n" ;
+		for( int i=0; JOB_OPTIONS[i] != NULL; i++ ) {
+			if( op->getValue( JOB_OPTIONS[i] ) != "" ) request += string( JOB_OPTIONS[i] ) + "\t" + op->getValue( JOB_OPTIONS[i] ) + "\n" ;
+		}
+		request += "\n" ;
+	}
+
+	// connect to the server
+	string path = op->getValue( "socket" ) ;
+	struct sockaddr_un address ;
+	memset( &address, 0, sizeof( address ) ) ;
+	address.sun_family = AF_UNIX ;
+	strncpy( address.sun_path, path.c_str(), sizeof( address.sun_path ) - 1 ) ;
+	int fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ;
+	if( fd < 0 || path.size() >= sizeof( address.sun_path ) || connect( fd, (struct sockaddr*) &address, sizeof( address ) ) != 0 ) {
+		cerr << "[Submit] could not connect to the server on " << path << ": " << strerror( errno ) << endl ;
+		exit( EXIT_FAILURE ) ;
+	}
+	if( send( fd, request.data(), request.size(), MSG_NOSIGNAL ) != (ssize_t) request.size() ) {
+		cerr << "[Submit] could not send the request to the server" << endl ;
+		exit( EXIT_FAILURE ) ;
+	}
+
+	// print the answer of the server until it closes the connection; the
+	// job reports its progress and ends with done, cancelled or error
+	bool success = true ;
+	bool ended   = request == "status\n" ;
+	string job   = "" ;
+	string buffer ;
+	char data[4096] ;
+	ssize_t n = 0 ;
+	while( ( n = recv( fd, data, sizeof( data ), 0 ) ) > 0 || ( n < 0 && errno == EINTR ) ) {
+		if( n < 0 ) continue ;
+		buffer.append( data, (size_t) n ) ;
+		size_t end = string::npos ;
+		while( ( end = buffer.find( '\n' ) ) != string::npos ) {
+			string line = buffer.substr( 0, end ) ;
+			buffer.erase( 0, end + 1 ) ;
+			string kind = line.substr( 0, line.find( '\t' ) ) ;
+			string rest = line.size() > kind.size() ? line.substr( kind.size() + 1 ) : "" ;
+			if( kind == "job" && job == "" && request != "status\n" ) {
+				job = rest ;
+				cerr << "[Submit] Submitted job " << job << endl ;
+			} else if( kind == "progress" ) {
+				size_t tab = rest.find( '\t' ) ;
+				cerr << "[Submit] Job " << job << ": read " << rest.substr( 0, tab ) << " read pairs, wrote " << rest.substr( tab + 1 ) << endl ;
+			} else if( kind == "done" ) {
+				cerr << "[Submit] Job " << job << " finished: aligned " << rest << " read pairs" << endl ;
+				ended = true ;
+			} else if( kind == "cancelled" ) {
+				cerr << "[Submit] " << ( job != "" ? "Job " + job : "Job " + rest ) << " cancelled" << endl ;
+				success = job == "" ;
+				ended   = true ;
+			} else if( kind == "error" ) {
+				cerr << "[Submit] " << rest << endl ;
+				success = false ;
+				ended   = true ;
+			} else {
+				cout << line << endl ;
+			}
+		}
+	}
+	close( fd ) ;
+	if( ! ended ) {
+		cerr << "[Submit] the server closed the connection" << endl ;
+		success = false ;
+	}
+
+	//
+	delete op ;
+
+	if( ! success ) exit( EXIT_FAILURE ) ;
+	return 0 ;
+}
@@ -14,6 +14,7 @@
 #include <rwwb/sequtils/types.hpp>
 #include <rwwb/sequtils/fastq.hpp>
 #include <rwwb/sequtils/fasta.hpp>
+#include <GzipInput.h>
 
 //
 // Processes the reads in the input stream and writes them to the output stream
@@ -205,8 +206,16 @@ int main(int argc, char** argv) {
     std::istream& hin = fin.is_open() ? fin : std::cin ;
     std::ostream& hout = fout.is_open() ? fout : std::cout ;
         
-    // process the reads from standard in 
-    return_code = process_reads(hin, hout, adapters, buffer_size, minimum_bases_remaining) ;
+    // process the reads from standard in, gzip compressed input is decompressed on the fly
+    if(Nimbus::IO::GzipInput::gzipped(hin)){
+        Nimbus::IO::GzipInput gzin(hin) ;
+        if(verbose){
+            std::cerr << "Reading " << (gzin.bgzf() ? "BGZF" : "gzip") << " compressed input" << std::endl ;
+        }
+        return_code = process_reads(gzin, hout, adapters, buffer_size, minimum_bases_remaining) ;
+    } else {
+        return_code = process_reads(hin, hout, adapters, buffer_size, minimum_bases_remaining) ;
+    }
           
     // cleanup the opened files
     if(file_input != "-"){
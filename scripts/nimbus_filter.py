@@ -39,7 +39,9 @@ class MismatchCalculator(object):
     def mismatches(self, nmscore=0, cigar=None):
         """
         Get the number of mismatches based on the NM
-        score (Levenstein distance) and the alignment CIGAR.
+        score (the mismatches and the inserted and deleted
+        bases, without the soft clipped bases) and the
+        alignment CIGAR.
 
         Args:
             nmscore: the NM score
@@ -51,7 +53,7 @@ class MismatchCalculator(object):
         """
         count, bases = self.bases_in_indels(cigar)
         return (
-            nmscore - sum(bases),
+            nmscore - bases[0] - bases[1],
             count,
             bases
             )
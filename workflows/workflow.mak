@@ -22,9 +22,9 @@ minimum_readlength   = 50
 adapter_trim_options = --maximum-mismatches $(maximum_mismatches) --minimum-matches $(minimum_matches) --minimum-bases-remaining $(minimum_readlength)
 adapters             = -a AGATCGGAAGAG -a CTGTCTCTTATA
 
-# Alignment
+# Alignment, the workers are shared by all samples
 keysize = 6
-workers = 4
+workers = 12
 
 # SAMtools
 sort_options   := --threads 4
@@ -57,6 +57,10 @@ operation := g,r,f,f
 fileinput     := $(wildcard *_R1.fastq) $(wildcard *_R1.fastq.gz) $(wildcard *_R1_001.fastq) $(wildcard *_R1_001.fastq.gz) $(wildcard *.srt.bam) 
 filebase      := $(sort $(foreach entry, $(fileinput), $(shell echo $(entry) | sed 's/_R1_001.fastq.*$$//'| sed 's/_R1.fastq.*$$//' | sed 's/.srt.bam.*$$//')))
 bamfiles      := $(patsubst %, %.srt.bam, $(filebase))
+fastqinput    := $(filter-out %.srt.bam, $(fileinput))
+fastqbase     := $(sort $(foreach entry, $(fastqinput), $(shell echo $(entry) | sed 's/_R1_001.fastq.*$$//'| sed 's/_R1.fastq.*$$//')))
+fastqbams     := $(patsubst %, %.srt.bam, $(fastqbase))
+fastqtrimmed  := $(foreach entry, $(fastqbase), $(entry)_R1.tr.fastq.gz $(entry)_R2.tr.fastq.gz)
 bamflags      := $(patsubst %, %.flagstat.txt, $(filebase))
 bampassed     := $(patsubst %, %.passed.bam, $(filebase))
 bamdiscarded  := $(patsubst %, %.discarded.bam, $(filebase))
@@ -64,6 +68,15 @@ blckfiles     := $(patsubst %, %.srt.blck, $(filebase))
 blckpassed    := $(patsubst %, %.passed.blck, $(filebase))
 blckdiscarded := $(patsubst %, %.discarded.blck, $(filebase))
 
+# Shell
+# =====
+#
+# The recipes pipe the output of nimbus into gzip; with pipefail a failing
+# step fails the recipe, and the incomplete target is deleted
+SHELL       := /bin/bash
+.SHELLFLAGS := -o pipefail -c
+.DELETE_ON_ERROR:
+
 # Control flow
 # ============
 #
@@ -90,70 +103,81 @@ table: combined.hg19.anno.txt
 
 # Trim files
 # ----------
-%.tr.fastq: %_001.fastq.gz
+# nimbus_trim and nimbus_align read gzip compressed FastQ files themselves,
+# the trimmed reads are kept compressed
+%.tr.fastq.gz: %_001.fastq.gz
 	mkdir -p logs
-	$(path_zcat)/zcat $*_001.fastq.gz | $(path_nimbus)/bin/nimbus_trim \
-		-i - \
+	$(path_nimbus)/bin/nimbus_trim \
+		-i $*_001.fastq.gz \
 		$(adapter_trim_options) \
 		$(adapters) \
-		-o $*.tr.fastq 2>> logs/$*.trim.errors.log >> logs/$*.messages.errors.log
+		-o - 2>> logs/$*.trim.errors.log | \
+		$(path_gzip)/gzip -1 -c > $*.tr.fastq.gz 2>> logs/$*.messages.errors.log
 
-%.tr.fastq: %.fastq.gz
+%.tr.fastq.gz: %.fastq.gz
 	mkdir -p logs
-	$(path_zcat)/zcat $*.fastq.gz | $(path_nimbus)/bin/nimbus_trim \
-		-i - \
+	$(path_nimbus)/bin/nimbus_trim \
+		-i $*.fastq.gz \
 		$(adapter_trim_options) \
 		$(adapters) \
-		-o $*.tr.fastq 2>> logs/$*.trim.errors.log >> logs/$*.messages.errors.log
+		-o - 2>> logs/$*.trim.errors.log | \
+		$(path_gzip)/gzip -1 -c > $*.tr.fastq.gz 2>> logs/$*.messages.errors.log
 
-%.tr.fastq: %_001.fastq
+%.tr.fastq.gz: %_001.fastq
 	mkdir -p logs
 	$(path_nimbus)/bin/nimbus_trim \
 		-i $*_001.fastq \
 		$(adapter_trim_options) \
 		$(adapters) \
-		-o $*.tr.fastq 2>> logs/$*.trim.errors.log >> logs/$*.messages.errors.log
+		-o - 2>> logs/$*.trim.errors.log | \
+		$(path_gzip)/gzip -1 -c > $*.tr.fastq.gz 2>> logs/$*.messages.errors.log
 
-%.tr.fastq: %.fastq
+%.tr.fastq.gz: %.fastq
 	mkdir -p logs
 	$(path_nimbus)/bin/nimbus_trim \
 		-i $*.fastq \
 		$(adapter_trim_options) \
 		$(adapters) \
-		-o $*.tr.fastq 2>> logs/$*.trim.errors.log >> logs/$*.messages.errors.log
+		-o - 2>> logs/$*.trim.errors.log | \
+		$(path_gzip)/gzip -1 -c > $*.tr.fastq.gz 2>> logs/$*.messages.errors.log
 
 # Nimbus alignment
 # ----------------
-%.sam: $(amplicon_design) $(genome_reference) %_R1.tr.fastq %_R2.tr.fastq
+# the amplicon index is built once and mapped by the alignment of each sample
+amplicons.nix: $(amplicon_design) $(genome_reference)
 	mkdir -p logs
-	$(path_nimbus)/bin/nimbus_align align \
-		--forward $*_R1.tr.fastq \
-		--reverse $*_R2.tr.fastq \
+	$(path_nimbus)/bin/nimbus_align index \
 		--design $(amplicon_design) \
 		--fasta $(genome_reference) \
 		--key-size $(keysize) \
+		--index amplicons.nix 2>> logs/index.errors.log
+
+# the samples are aligned by a single run sharing the index and the workers,
+# with a line per sample in the sample sheet
+samples.tsv: $(fastqtrimmed)
+	rm -f samples.tsv
+	for entry in $(fastqbase) ; do \
+		sample=$$(echo $${entry} | sed 's/_.*$$//') ; \
+		path=$$(readlink -f $${entry}.srt.bam) ; \
+		printf '%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n' $${entry} $${entry}_R1.tr.fastq.gz $${entry}_R2.tr.fastq.gz $${entry}.srt.bam \
+			"ID:$${sample}" "CN:$(center_label)" "LB:$(library_label)" "SM:$${sample}" "PL:$(platform_label)" "DS:$${path}" >> samples.tsv ; \
+	done
+
+alignment.done: amplicons.nix samples.tsv
+	mkdir -p logs
+	$(path_nimbus)/bin/nimbus_align align \
+		--samples samples.tsv \
+		--index amplicons.nix \
 		--workers $(workers) \
 		--maximum-amplicons 1000 \
-		--sam $*.sam 2>> logs/$*.nimbus.errors.log >> logs/$*.nimbus.messages.log
+		--bam \
+		--sorted 2>> logs/alignment.nimbus.errors.log >> logs/alignment.nimbus.messages.log
+	touch alignment.done
+
+$(fastqbams): alignment.done ;
 
 # SAMtools processing
 # -------------------
-%.srt.bam: %.sam
-	sample=$$(echo $* | sed 's/_.*$$//') ; \
-	path=$$(readlink -f $*.srt.bam) ; \
-	$(path_samtools)/samtools addreplacerg \
-		-r "ID:$${sample}" \
-		-r "CN:$(center_label)" \
-		-r "LB:$(library_label)" \
-		-r "SM:$${sample}" \
-		-r "PL:$(platform_label)" \
-		-r "DS:$${path}" \
-		$*.sam | $(path_samtools)/samtools sort \
-			$(sort_options) \
-			-T $*_tmp_sort \
-			-o $*.srt.bam \
-			- ;
-
 %.flagstat.txt: %.srt.bam
 	$(path_samtools)/samtools flagstat $*.srt.bam > $*.flagstat.txt
 